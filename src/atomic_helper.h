@@ -0,0 +1,40 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: atomic_helper.h  Created: 261016
+ *
+ * Description: Minimal atomic load/store helpers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef ATOMIC_HELPER_H
+#define ATOMIC_HELPER_H
+
+/*
+ * Gmu has to build with rather old cross compilers for some of the
+ * supported handhelds, so instead of depending on C11 <stdatomic.h> we
+ * use the GCC __atomic builtins where available (GCC >= 4.7, clang) and
+ * fall back to the older __sync builtins with full memory barriers
+ * otherwise.
+ */
+#if defined(__ATOMIC_ACQUIRE)
+#define ATOMIC_LOAD_ACQUIRE(ptr)       __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ATOMIC_LOAD_RELAXED(ptr)       __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define ATOMIC_STORE_RELEASE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define ATOMIC_ADD(ptr, val)           __atomic_add_fetch((ptr), (val), __ATOMIC_ACQ_REL)
+#else
+#define ATOMIC_LOAD_ACQUIRE(ptr)       __sync_add_and_fetch((ptr), 0)
+#define ATOMIC_LOAD_RELAXED(ptr)       (*(volatile __typeof__(*(ptr)) *)(ptr))
+#define ATOMIC_STORE_RELEASE(ptr, val) do { __sync_synchronize(); *(volatile __typeof__(*(ptr)) *)(ptr) = (val); } while (0)
+#define ATOMIC_ADD(ptr, val)           __sync_add_and_fetch((ptr), (val))
+#endif
+
+/* Typical L1 cache line size of the supported platforms */
+#define CACHE_LINE_SIZE 64
+#endif
@@ -14,21 +14,87 @@
  * for details.
  */
 #include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include "SDL.h"
-#include "ringbuffer.h"
+#include "lfringbuffer.h"
+#include "audiotap.h"
+#include "atomic_helper.h"
 #include "audio.h"
-#include "fmath.h"
+#include "fft.h"
+#include "mixer.h"
 #include "debug.h"
 #include "eventqueue.h"
 #include "gmuerror.h"
 #include "core.h"
+#include "pthread_helper.h"
 #include FILE_HW_H
-#define RINGBUFFER_SIZE 131072
+#define VOLUME_MAX      128
 
-static RingBuffer    audio_rb;
+/* Buffer sizes are given in milliseconds, the ring buffer is allocated
+ * large enough for that amount of 48 kHz stereo audio. The actual
+ * fill level to aim for (buffer_target) depends on the audio format. */
+#define RINGBUFFER_BYTES_PER_MS (48 * 2 * 2)
+/* Adaptive mode: After an underrun the target is increased by half, after
+ * ADAPT_STABLE_SECONDS of playback without underruns it is reduced by 20%
+ * again, but never below the profile's target. */
+#define ADAPT_STABLE_SECONDS    60
+/* The analysis thread runs this often while somebody needs its results */
+#define ANALYSIS_INTERVAL_MS    20
+#define TAP_SIZE                65536
+
+static const struct {
+	const char *name;
+	int         target_ms, max_ms; /* max_ms is the limit for adaptive mode */
+	int         period_frames;     /* Device buffer size */
+	int         burst;             /* Let the buffer drain before refilling it */
+} profiles[] = {
+	{ "low-latency",  150, 1000, SAMPLE_BUFFER_SIZE / 4, 0 },
+	{ "default",      750, 2000, SAMPLE_BUFFER_SIZE,     0 },
+	{ "power-save",  4000, 8000, SAMPLE_BUFFER_SIZE * 2, 1 }
+};
+
+/* The decoder thread is the only producer and the output's fill callback
+ * is the only consumer, so the PCM buffer can be accessed without locking. */
+static LockFreeRingBuffer audio_rb;
 static unsigned int  volume_fade_percent = 100;
 
+/* The buffer is filled up to buffer_target bytes only. It is derived from
+ * target_ms, which the adaptive mode adjusts on the producer side. In
+ * burst mode the decoder stops once the buffer is full (burst_wait) and
+ * does not continue before it has been drained to a quarter of the
+ * target, so the CPU can sleep for several seconds at a time. */
+static AudioBufferProfile profile;
+static int           adaptive;
+static int           target_ms;
+static size_t        buffer_target;
+static int           burst_wait;
+static unsigned long adapt_glitches;
+static size_t        adapt_read_pos;
+
+/* Statistics, updated by the fill callback only */
+static unsigned long stat_callbacks, stat_underruns, stat_partial_fills, stat_late_callbacks;
+static unsigned int  stat_max_gap_us;
+static int           stat_timing_reset;
+static struct timespec stat_last_callback;
+
 static unsigned long buf_read_counter;
+/* Track boundaries, i.e. buffer write positions at which the play
+ * position restarts at the given offset (in bytes). That is the start of
+ * a track appended during gapless playback, or the first data after
+ * seeking. Several boundaries can be buffered when tracks are short. The
+ * decoder thread adds boundaries (boundary_head), the audio callback (or
+ * whoever holds the output lock) counts the ones that have been played
+ * (boundary_tail). Both counters only ever increase. */
+typedef struct _TrackBoundary {
+	size_t        pos;
+	unsigned long offset;
+} TrackBoundary;
+
+static TrackBoundary boundaries[AUDIO_MAX_TRACK_BOUNDARIES];
+static unsigned long boundary_head, boundary_tail;
+static unsigned long boundary_tail_woken; /* Audio callback only */
 static int           done;
 static int           have_samplerate, have_channels;
 static SDL_mutex    *audio_mutex2;
@@ -36,62 +102,230 @@ static SDL_mutex    *audio_mutex2;
 static int           paused;
 static SDL_mutex    *pause_mutex;
 
-static size_t        spectrum_reg = 0;
-static int16_t       amplitudes[16];
-static SDL_mutex    *spectrum_mutex;
+/* The audio callback only publishes the played data into the tap. While
+ * somebody has registered for the results (spectrum_reg), the analysis
+ * thread reads the data from there and computes the spectrum and the
+ * levels into the back snapshot, which then becomes the front snapshot
+ * frontends read from. analysis_mutex protects the analyzer settings,
+ * spectrum_mutex the front snapshot while it is being read. */
+typedef struct _AudioAnalysis {
+	int16_t     amplitudes[FFT_MAX_BANDS];
+	AudioLevels levels;
+} AudioAnalysis;
+
+static int             spectrum_reg = 0;
+static AudioTap        tap;
+static FFTSpectrum     spectrum;
+static AudioAnalysis   snapshots[2], *snapshot_front = snapshots;
+static int16_t         spectrum_samples[FFT_MAX_SIZE];
+static size_t          spectrum_sample_pos;
+static int             spectrum_clear;
+static SDL_mutex      *spectrum_mutex;
+static pthread_t       analysis_thread;
+static pthread_mutex_t analysis_mutex;
+static pthread_cond_t  analysis_cond;
+static int             analysis_quit, analysis_running;
 
 static int           device_open;
+static GmuOutput    *output;
+
+/* The decoder thread sleeps on space_cond while the buffer is full.
+ * space_wanted is the amount of free space it is waiting for (0 when
+ * nobody waits), so the fill callback only has to signal once that
+ * watermark has been reached. Incrementing space_wakeups makes the
+ * waiting thread return early, e.g. when playback is stopped. */
+static pthread_mutex_t space_mutex;
+static pthread_cond_t  space_cond;
+static size_t          space_wanted;
+static unsigned int    space_wakeups;
+
+/* Playback clock. buf_read_counter counts the bytes handed to the output.
+ * To get the position that is actually audible, the output's latency is
+ * subtracted, and between two fill callbacks the position is advanced
+ * according to the time passed since the last one (at most by the
+ * amount of data it returned, clock_add). */
+static pthread_mutex_t clock_mutex;
+static size_t          clock_add;
+static struct timespec clock_time;
 
 static unsigned int  volume, volume_internal;
 
 
-int audio_fill_buffer(char *data, size_t size)
+/* Free space up to the target fill level, without regard to burst mode */
+static size_t buffer_get_target_free(void)
 {
-	int result = 0;
-	SDL_LockAudio();
-	result = ringbuffer_write(&audio_rb, data, size);
-	SDL_UnlockAudio();
-	return result;
+	size_t fill   = lfringbuffer_get_fill(&audio_rb);
+	size_t target = ATOMIC_LOAD_ACQUIRE(&buffer_target);
+
+	return fill < target ? target - fill : 0;
 }
 
-static void calculate_dft(int16_t *input_signal, int input_signal_size, int *rex, int *imx)
+/**
+ * Converts target_ms into the buffer fill level for the current audio
+ * format. The buffer always holds at least three device buffers.
+ */
+static void buffer_target_update(void)
 {
-	int res_size = input_signal_size / 2 + 1;
+	size_t frame_size = 2 * have_channels;
+	size_t bytes = (size_t)((long long)target_ms * have_samplerate / 1000) * frame_size;
+	size_t min   = (size_t)profiles[profile].period_frames * 3 * frame_size;
+	size_t max   = lfringbuffer_get_size(&audio_rb);
 
-	if (rex && imx) {
-		int i, j, rs = res_size * sizeof(int);
-		memset(rex, 0, rs);
-		memset(imx, 0, rs);
-		for (j = 0; j < res_size; j++) {
-			for (i = 0; i < input_signal_size; i++) {
-				/*if (rex) rex[j] = rex[j] + input_signal[i] * cos(2*M_PI*j*i/input_signal_size);
-				if (imx) imx[j] = imx[j] + input_signal[i] * sin(2*M_PI*j*i/input_signal_size);*/
-				if (rex) rex[j] = rex[j] + input_signal[i] * fcos(F_PI2*j*i/input_signal_size);
-				if (imx) imx[j] = imx[j] + input_signal[i] * fsin(F_PI2*j*i/input_signal_size);
-			}
-		}
-		for (j = 0; j < res_size; j++) {
-			if (rex) rex[j] /= 10000;
-			if (imx) imx[j] /= 10000;
-		}
+	if (bytes < min) bytes = min;
+	if (bytes > max) bytes = max - max % frame_size;
+	ATOMIC_STORE_RELEASE(&buffer_target, bytes);
+}
+
+/**
+ * Adaptive buffering. Called by the producer, i.e. the decoder thread,
+ * which is the only one changing target_ms after the device has been
+ * opened. Stable periods are measured in played data, so time spent in
+ * pause does not count.
+ */
+static void buffer_adapt(void)
+{
+	unsigned long glitches;
+	size_t        rp;
+	int           new_target = target_ms;
+
+	if (!adaptive) return;
+	glitches = ATOMIC_LOAD_ACQUIRE(&stat_underruns) + ATOMIC_LOAD_ACQUIRE(&stat_partial_fills);
+	rp = lfringbuffer_get_read_position(&audio_rb);
+	if (glitches != adapt_glitches) {
+		adapt_glitches = glitches;
+		adapt_read_pos = rp;
+		new_target = target_ms * 3 / 2;
+		if (new_target > profiles[profile].max_ms) new_target = profiles[profile].max_ms;
+	} else if (rp - adapt_read_pos >= (size_t)ADAPT_STABLE_SECONDS * have_samplerate * 2 * have_channels) {
+		adapt_read_pos = rp;
+		new_target = target_ms * 4 / 5;
+		if (new_target < profiles[profile].target_ms) new_target = profiles[profile].target_ms;
+	}
+	if (new_target != target_ms) {
+		wdprintf(V_INFO, "audio", "Buffer target: %d ms -> %d ms (%lu underruns)\n",
+		         target_ms, new_target, glitches);
+		ATOMIC_STORE_RELEASE(&target_ms, new_target);
+		buffer_target_update();
 	}
 }
 
+/**
+ * Writes size bytes to the buffer. Returns 1 on success and 0 when there
+ * is not enough free space (see audio_buffer_get_free()). To be called
+ * from the decoder thread only.
+ */
+int audio_fill_buffer(char *data, size_t size)
+{
+	int res = 0;
+
+	buffer_adapt();
+	if (size <= audio_buffer_get_free())
+		res = lfringbuffer_write(&audio_rb, data, size);
+	else if (profiles[profile].burst)
+		burst_wait = 1;
+	return res;
+}
+
+/**
+ * Returns a pointer to free buffer memory the decoder can write to
+ * directly and stores the (contiguous) size of it in size. That is at
+ * least min(free space, AUDIO_BUFFER_MAX_RESERVE) bytes. The data has to
+ * be passed on with audio_buffer_commit() afterwards.
+ */
+char *audio_buffer_reserve(size_t *size)
+{
+	size_t space = audio_buffer_get_free();
+	char  *res   = lfringbuffer_write_reserve(&audio_rb, size);
+
+	if (*size > space) *size = space;
+	return res;
+}
+
+void audio_buffer_commit(size_t size)
+{
+	lfringbuffer_write_commit(&audio_rb, size);
+	buffer_adapt();
+}
+
+/**
+ * Waits until at least size bytes are free in the buffer, at most
+ * timeout_ms milliseconds, or until audio_wake_waiters() is called.
+ * Returns 1 when there is enough free space, 0 otherwise.
+ */
+int audio_wait_for_space(size_t size, int timeout_ms)
+{
+	int          res, timed_out = 0;
+	unsigned int wakeups;
+	size_t       target = ATOMIC_LOAD_ACQUIRE(&buffer_target);
+
+	if (size > target) size = target;
+	if (burst_wait && size < target - target / 4) size = target - target / 4;
+	pthread_mutex_lock(&space_mutex);
+	wakeups = space_wakeups;
+	ATOMIC_STORE_RELEASE(&space_wanted, size);
+	/* The fill callback checks space_wanted without holding the mutex, so
+	 * a wake-up can in rare cases be missed; the timeout covers that. */
+	while (!timed_out && wakeups == space_wakeups && buffer_get_target_free() < size)
+		timed_out = pthread_cond_timedwait_ms(&space_cond, &space_mutex, timeout_ms) == ETIMEDOUT;
+	ATOMIC_STORE_RELEASE(&space_wanted, 0);
+	res = buffer_get_target_free() >= size;
+	pthread_mutex_unlock(&space_mutex);
+	return res;
+}
+
+/* Makes audio_wait_for_space() return immediately */
+void audio_wake_waiters(void)
+{
+	pthread_mutex_lock(&space_mutex);
+	space_wakeups++;
+	pthread_cond_broadcast(&space_cond);
+	pthread_mutex_unlock(&space_mutex);
+}
+
+/* Returns the amplitudes; to be called between audio_spectrum_read_lock() and audio_spectrum_read_unlock() */
 int16_t *audio_spectrum_get_current_amplitudes(void)
 {
-	return amplitudes;
+	return snapshot_front->amplitudes;
 }
 
 void audio_spectrum_register_for_access(void)
 {
-	spectrum_reg++;
+	ATOMIC_ADD(&spectrum_reg, 1);
+	pthread_mutex_lock(&analysis_mutex);
+	pthread_cond_signal(&analysis_cond);
+	pthread_mutex_unlock(&analysis_mutex);
 }
 
 void audio_spectrum_unregister(void)
 {
-	if (spectrum_reg > 0) spectrum_reg--;
+	if (ATOMIC_LOAD_ACQUIRE(&spectrum_reg) > 0) ATOMIC_ADD(&spectrum_reg, -1);
+}
+
+int audio_spectrum_get_number_of_bands(void)
+{
+	return fft_spectrum_get_number_of_bands(&spectrum);
 }
 
+/**
+ * Sets the FFT size (256, 512 or 1024) and number of bands (up to 64)
+ * of the spectrum analyzer. Returns 1 on success, 0 otherwise.
+ */
+int audio_spectrum_configure(int fft_size, int bands)
+{
+	int res;
+
+	pthread_mutex_lock(&analysis_mutex);
+	res = fft_spectrum_init(&spectrum, fft_size, bands);
+	if (SDL_LockMutex(spectrum_mutex) != -1) {
+		memset(snapshots, 0, sizeof(snapshots));
+		SDL_UnlockMutex(spectrum_mutex);
+	}
+	pthread_mutex_unlock(&analysis_mutex);
+	if (!res) wdprintf(V_WARNING, "audio", "Invalid spectrum analyzer settings: %d/%d\n", fft_size, bands);
+	return res;
+}
+
+/* Locks the most recent analysis results for reading. Returns 1 on success, 0 otherwise. */
 int audio_spectrum_read_lock(void)
 {
 	return !SDL_LockMutex(spectrum_mutex);
@@ -102,60 +336,281 @@ void audio_spectrum_read_unlock(void)
 	SDL_UnlockMutex(spectrum_mutex);
 }
 
-static void fill_audio(void *udata, Uint8 *stream, int len)
+/**
+ * Stores the peak and RMS levels (0..32767) of the most recently played
+ * data in levels. Like the spectrum, they are only updated while
+ * somebody has registered with audio_spectrum_register_for_access().
+ */
+void audio_get_levels(AudioLevels *levels)
 {
-	static Uint8 buf[65536];
-	size_t       add = 0;
-
-	if (ringbuffer_read(&audio_rb, (char *)buf, len)) {
-		add = len;
-	} else {
-		size_t avail = ringbuffer_get_fill(&audio_rb);
-		memset(buf, 0, 65536);
-		if (avail > 0 && ringbuffer_read(&audio_rb, (char *)buf, avail))
-			add = avail;
+	if (audio_spectrum_read_lock()) {
+		*levels = snapshot_front->levels;
+		audio_spectrum_read_unlock();
 	}
+}
 
-	if (SDL_LockMutex(audio_mutex2) == 0) {
-		buf_read_counter += add;
-		SDL_UnlockMutex(audio_mutex2);
+/**
+ * Reads the tapped data, keeps the most recent samples (downmixed to mono)
+ * for the spectrum analyzer and determines the levels of each channel
+ * (the first two channels, to be precise; mono data is duplicated).
+ * Returns 1 when there is new data, 0 otherwise.
+ */
+static int analysis_read_tap(AudioLevels *levels)
+{
+	int16_t   buf[2048];
+	size_t    n, frames = 0;
+	long long sum_sq[2] = { 0, 0 };
+	int       c, channels = audio_tap_get_channels(&tap);
+
+	memset(levels, 0, sizeof(AudioLevels));
+	while ((n = audio_tap_read(&tap, (char *)buf, sizeof(buf))) > 0) {
+		const int16_t *p = buf;
+		size_t         i, k = n / (2 * channels);
+
+		for (i = 0; i < k; i++) {
+			int sum = 0;
+			for (c = 0; c < channels; c++, p++) {
+				int s = *p, a = s < 0 ? -s : s, lc = c < 2 ? c : 1;
+
+				if (a > 32767) a = 32767;
+				if (a > levels->peak[lc]) levels->peak[lc] = (int16_t)a;
+				sum_sq[lc] += s * s;
+				sum += s;
+			}
+			spectrum_samples[spectrum_sample_pos] = (int16_t)(sum / channels);
+			spectrum_sample_pos = (spectrum_sample_pos + 1) & (FFT_MAX_SIZE - 1);
+		}
+		frames += k;
 	}
-	SDL_memset(stream, 0, len);
-	SDL_MixAudio(stream, buf, len, volume * volume_fade_percent / 100);
-
-	/* When requested, run DFT on a few samples of each block of data for visualization purposes */
-	if (spectrum_reg > 0) {
-		int     rex[9], imx[9];
-		size_t  i, j;
-		int16_t samples_l[16];
-		int     channels = 0;
-
-		if (SDL_LockMutex(audio_mutex2) != -1) {
-			channels = have_channels;
-			SDL_UnlockMutex(audio_mutex2);
+	if (frames > 0) {
+		for (c = 0; c < 2 && c < channels; c++) {
+			double rms = sqrt((double)sum_sq[c] / frames);
+			levels->rms[c] = (int16_t)(rms < 32767.0 ? rms : 32767.0);
+		}
+		if (channels == 1) {
+			levels->peak[1] = levels->peak[0];
+			levels->rms[1]  = levels->rms[0];
+		}
+	}
+	return frames > 0;
+}
+
+/**
+ * The analysis thread. It sleeps while nobody needs its results, and
+ * while it is not running the tap is disabled, so the audio callback
+ * does not even copy the data. Runs with analysis_mutex being held,
+ * except while waiting.
+ */
+static void *analysis_run(void *udata)
+{
+	pthread_mutex_lock(&analysis_mutex);
+	while (!analysis_quit) {
+		AudioAnalysis *back;
+		AudioLevels    levels;
+		int            update;
+
+		if (ATOMIC_LOAD_ACQUIRE(&spectrum_reg) == 0) {
+			audio_tap_set_enabled(&tap, 0);
+			pthread_cond_wait(&analysis_cond, &analysis_mutex);
+			continue;
 		}
+		audio_tap_set_enabled(&tap, 1);
+		pthread_cond_timedwait_ms(&analysis_cond, &analysis_mutex, ANALYSIS_INTERVAL_MS);
+		update = analysis_read_tap(&levels);
+		if (ATOMIC_LOAD_ACQUIRE(&spectrum_clear)) { /* Paused */
+			ATOMIC_STORE_RELEASE(&spectrum_clear, 0);
+			memset(spectrum_samples, 0, sizeof(spectrum_samples));
+			memset(&levels, 0, sizeof(levels));
+			update = 1;
+		}
+		if (update) {
+			int16_t samples[FFT_MAX_SIZE];
+			int     i, n = fft_spectrum_get_size(&spectrum);
+			size_t  pos = spectrum_sample_pos + FFT_MAX_SIZE - n;
 
-		if (channels > 0) {
-			for (i = 0, j = 0; j < 16; i += (2 * channels), j++) {
-				samples_l[j] = (buf[i+1] << 8) + buf[i];
+			/* Nobody reads the back snapshot, so no locking is needed for updating it */
+			back = snapshot_front == snapshots ? snapshots + 1 : snapshots;
+			for (i = 0; i < n; i++)
+				samples[i] = spectrum_samples[(pos + i) & (FFT_MAX_SIZE - 1)];
+			fft_spectrum_analyze(&spectrum, samples, back->amplitudes);
+			back->levels = levels;
+			if (SDL_LockMutex(spectrum_mutex) != -1) {
+				snapshot_front = back;
+				SDL_UnlockMutex(spectrum_mutex);
 			}
-			calculate_dft(samples_l, 16, rex, imx);
 		}
-		SDL_LockMutex(spectrum_mutex);
-		if (channels > 0)
-			for (i = 1; i < 9; i++) amplitudes[i-1] = (imx[i] < 0 ? -imx[i] : imx[i]);
-		SDL_UnlockMutex(spectrum_mutex);
 	}
+	audio_tap_set_enabled(&tap, 0);
+	pthread_mutex_unlock(&analysis_mutex);
+	return NULL;
+}
+
+static void output_lock(void)
+{
+	if (output) (*output->lock)();
+}
+
+static void output_unlock(void)
+{
+	if (output) (*output->unlock)();
+}
+
+void audio_set_output(GmuOutput *out)
+{
+	output = out;
+}
+
+/**
+ * Counts fill callbacks that could not be served (completely) from the
+ * buffer and callbacks that came later than expected, i.e. more than
+ * 1.5 times the duration of the previous callback's data plus 2 ms after
+ * it. Running out of data after the decoder reached the end of the
+ * stream (done) does not count as underrun.
+ */
+static void stats_update(size_t add, int len)
+{
+	struct timespec now;
+	long long       gap_us, expected_us;
+	int             bytes_per_sec = have_samplerate * 2 * have_channels;
+
+	ATOMIC_ADD(&stat_callbacks, 1);
+	if (add < (size_t)len && !ATOMIC_LOAD_RELAXED(&done)) {
+		if (add == 0)
+			ATOMIC_ADD(&stat_underruns, 1);
+		else
+			ATOMIC_ADD(&stat_partial_fills, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ATOMIC_LOAD_ACQUIRE(&stat_timing_reset)) {
+		ATOMIC_STORE_RELEASE(&stat_timing_reset, 0);
+	} else if (stat_last_callback.tv_sec != 0 && bytes_per_sec > 0) {
+		gap_us = (long long)(now.tv_sec - stat_last_callback.tv_sec) * 1000000LL +
+		         (now.tv_nsec - stat_last_callback.tv_nsec) / 1000;
+		expected_us = (long long)len * 1000000LL / bytes_per_sec;
+		if (gap_us > expected_us * 3 / 2 + 2000) ATOMIC_ADD(&stat_late_callbacks, 1);
+		if (gap_us > (long long)ATOMIC_LOAD_RELAXED(&stat_max_gap_us))
+			ATOMIC_STORE_RELEASE(&stat_max_gap_us, (unsigned int)gap_us);
+	}
+	stat_last_callback = now;
+}
+
+/**
+ * The output's fill callback. It runs in the audio thread and must never
+ * block, so it takes no locks it would have to wait for; everything else
+ * (e.g. analyzing the data) is left to other threads.
+ */
+static int fill_audio(char *stream, int len)
+{
+	size_t       add = 0, wanted;
+	unsigned int vol = volume * volume_fade_percent / 100;
+
+	/* Copy the data straight from the buffer memory (in up to two parts
+	 * when it wraps around), applying the software volume on the way */
+	while (add < (size_t)len) {
+		size_t      n;
+		const char *src = lfringbuffer_read_peek(&audio_rb, &n);
+
+		if (n == 0) break;
+		if (n > len - add) n = len - add;
+		audio_tap_publish(&tap, src, n);
+		if (vol < VOLUME_MAX)
+			mixer_scale_s16((int16_t *)(stream + add), (const int16_t *)src, n / 2,
+			                (int32_t)vol * (MIXER_GAIN_UNITY / VOLUME_MAX));
+		else
+			memcpy(stream + add, src, n);
+		lfringbuffer_read_consume(&audio_rb, n);
+		add += n;
+	}
+	memset(stream + add, 0, len - add);
+	stats_update(add, len);
+
+	if (add > 0) {
+		unsigned long head = ATOMIC_LOAD_ACQUIRE(&boundary_head), tail = boundary_tail;
+		size_t        rp   = lfringbuffer_get_read_position(&audio_rb);
+
+		/* When the clock is being read or set right now, only count the
+		 * data; a track boundary is then handled on the next call */
+		if (pthread_mutex_trylock(&clock_mutex) == 0) {
+			/* Restart the play time as soon as the first sample of the next track has been played */
+			if (tail != head && (long)(rp - boundaries[tail % AUDIO_MAX_TRACK_BOUNDARIES].pos) >= 0) {
+				do {
+					TrackBoundary *b = boundaries + tail % AUDIO_MAX_TRACK_BOUNDARIES;
+
+					ATOMIC_STORE_RELEASE(&buf_read_counter, rp - b->pos + b->offset);
+					tail++;
+				} while (tail != head && (long)(rp - boundaries[tail % AUDIO_MAX_TRACK_BOUNDARIES].pos) >= 0);
+				ATOMIC_STORE_RELEASE(&boundary_tail, tail);
+			} else {
+				ATOMIC_ADD(&buf_read_counter, add);
+			}
+			clock_add = add;
+			clock_gettime(CLOCK_MONOTONIC, &clock_time);
+			pthread_mutex_unlock(&clock_mutex);
+		} else {
+			ATOMIC_ADD(&buf_read_counter, add);
+		}
+		/* Wake up the decoder thread once the free space it waits for is
+		 * available, or when a track boundary has been passed, so it can
+		 * publish the new track's info. If the mutex is busy, try again
+		 * on the next call. */
+		wanted = ATOMIC_LOAD_ACQUIRE(&space_wanted);
+		if ((tail != boundary_tail_woken || (wanted > 0 && buffer_get_target_free() >= wanted)) &&
+		    pthread_mutex_trylock(&space_mutex) == 0) {
+			ATOMIC_STORE_RELEASE(&space_wanted, 0);
+			if (tail != boundary_tail_woken) {
+				boundary_tail_woken = tail;
+				space_wakeups++;
+			}
+			pthread_cond_signal(&space_cond);
+			pthread_mutex_unlock(&space_mutex);
+		}
+	}
+	return add;
+}
+
+/* Sets the play position (in bytes) right away */
+static void clock_set(unsigned long pos)
+{
+	pthread_mutex_lock(&clock_mutex);
+	ATOMIC_STORE_RELEASE(&buf_read_counter, pos);
+	clock_add = 0;
+	pthread_mutex_unlock(&clock_mutex);
+}
+
+/**
+ * Returns the audible play position of the current track in bytes.
+ * To be called with audio_mutex2 being locked.
+ */
+static long long clock_get_position(void)
+{
+	long long       pos, add, elapsed;
+	struct timespec now, t;
+	int             frame_size = 2 * have_channels;
+
+	pthread_mutex_lock(&clock_mutex);
+	pos = ATOMIC_LOAD_ACQUIRE(&buf_read_counter);
+	add = clock_add;
+	t   = clock_time;
+	pthread_mutex_unlock(&clock_mutex);
+	if (add > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (long long)(now.tv_sec - t.tv_sec) * 1000000000LL + (now.tv_nsec - t.tv_nsec);
+		if (elapsed > 1000000000LL) elapsed = 1000000000LL;
+		elapsed = elapsed * have_samplerate / 1000000000LL * frame_size;
+		pos = pos - add + (elapsed < add ? elapsed : add);
+	}
+	if (device_open && output->get_latency)
+		pos -= (long long)(*output->get_latency)() * frame_size;
+	return pos > 0 ? pos : 0;
 }
 
 int audio_device_open(int samplerate, int channels)
 {
-	static SDL_AudioSpec wanted, obtained;
-	int                  result = -1;
+	int result = -1;
 
 	/* Keep audio device open unless sampling rate or number of channels change */
 	if (SDL_LockMutex(audio_mutex2) != -1) {
-		buf_read_counter = 0;
+		clock_set(0);
 		wdprintf(V_DEBUG, "audio", "Device already open: %s\n", device_open ? "yes" : "no");
 		if (device_open)
 			wdprintf(V_DEBUG, "audio", "Samplerate: have=%d want=%d Channels: have=%d want=%d\n",
@@ -167,15 +622,8 @@ int audio_device_open(int samplerate, int channels)
 				SDL_LockMutex(audio_mutex2);
 			}
 			wdprintf(V_INFO, "audio", "Opening audio device...\n");
-			wanted.freq     = samplerate;
-			wanted.format   = AUDIO_S16;
-			wanted.channels = channels; /* 1 = mono, 2 = stereo */
-			wanted.samples  = SAMPLE_BUFFER_SIZE;
-			wanted.callback = fill_audio;
-			wanted.userdata = NULL;
-			SDL_ClearError();
-			if (SDL_OpenAudio(&wanted, &obtained) < 0) {
-				wdprintf(V_ERROR, "audio", "Could not open audio: %s\n", SDL_GetError());
+			if (!output || !(*output->open)(samplerate, channels, profiles[profile].period_frames, fill_audio)) {
+				wdprintf(V_ERROR, "audio", "Could not open audio output.\n");
 				event_queue_push_with_parameter(gmu_core_get_event_queue(),
 				                                GMU_ERROR,
 				                                GMU_ERROR_CANNOT_OPEN_AUDIO_DEVICE);
@@ -185,13 +633,15 @@ int audio_device_open(int samplerate, int channels)
 				device_open = 1;
 				have_samplerate = samplerate;
 				have_channels   = channels;
-				wdprintf(V_INFO, "audio", "Device opened with %d Hz, %d channels and sample buffer w/ %d samples.\n",
-						 obtained.freq, obtained.channels, obtained.samples);
+				audio_tap_set_format(&tap, channels);
+				buffer_target_update();
+				wdprintf(V_INFO, "audio", "Device opened with %d Hz and %d channels.\n", samplerate, channels);
 			}
 			if (SDL_UnlockMutex(audio_mutex2) != -1) {
-				SDL_LockAudio();
-				ringbuffer_clear(&audio_rb);
-				SDL_UnlockAudio();
+				output_lock();
+				lfringbuffer_clear(&audio_rb);
+				ATOMIC_STORE_RELEASE(&boundary_tail, boundary_head);
+				output_unlock();
 				SDL_LockMutex(audio_mutex2);
 			}
 		} else {
@@ -207,11 +657,69 @@ int audio_device_open(int samplerate, int channels)
 	return result;
 }
 
-int audio_get_status(void)
+/**
+ * Adds a track boundary at the current buffer write position. Returns 1
+ * on success, 0 when too many boundaries are waiting to be played.
+ * To be called from the decoder thread only.
+ */
+static int boundary_add(unsigned long offset)
+{
+	unsigned long head = boundary_head;
+	int           res = 0;
+
+	if (head - ATOMIC_LOAD_ACQUIRE(&boundary_tail) < AUDIO_MAX_TRACK_BOUNDARIES) {
+		boundaries[head % AUDIO_MAX_TRACK_BOUNDARIES].pos    = lfringbuffer_get_write_position(&audio_rb);
+		boundaries[head % AUDIO_MAX_TRACK_BOUNDARIES].offset = offset;
+		ATOMIC_STORE_RELEASE(&boundary_head, head + 1);
+		res = 1;
+	}
+	return res;
+}
+
+/**
+ * Used for gapless playback. When the device is open with the requested
+ * settings, the current buffer write position is marked as the start of
+ * a new track, so the new track's data can be appended to the buffer while
+ * the previous track is still playing, and 1 is returned. The play time is
+ * reset once playback reaches the marked position, which can be checked
+ * with audio_get_track_boundaries_passed(). Returns 0 when the device
+ * would have to be (re)opened with audio_device_open(), or when the
+ * boundaries of AUDIO_MAX_TRACK_BOUNDARIES tracks are still buffered.
+ */
+int audio_device_continue(int samplerate, int channels)
+{
+	int result = 0;
+
+	if (SDL_LockMutex(audio_mutex2) != -1) {
+		if (device_open && samplerate == have_samplerate && channels == have_channels && boundary_add(0)) {
+			done = 0;
+			result = 1;
+		}
+		SDL_UnlockMutex(audio_mutex2);
+	}
+	return result;
+}
+
+/* Returns the number of track boundaries added so far, i.e. the number of the latest one */
+unsigned long audio_get_track_boundaries_added(void)
+{
+	return ATOMIC_LOAD_ACQUIRE(&boundary_head);
+}
+
+/**
+ * Returns the number of track boundaries that have been played so far.
+ * Clearing the buffer counts as passing all boundaries added until then.
+ */
+unsigned long audio_get_track_boundaries_passed(void)
+{
+	return ATOMIC_LOAD_ACQUIRE(&boundary_tail);
+}
+
+int audio_is_playing(void)
 {
 	int res = 0;
 	if (SDL_LockMutex(pause_mutex) != -1) {
-		res = SDL_GetAudioStatus();
+		res = device_open && (*output->is_playing)();
 		SDL_UnlockMutex(pause_mutex);
 	}
 	return res;
@@ -219,10 +727,12 @@ int audio_get_status(void)
 
 void audio_force_pause(int pause)
 {
+	ATOMIC_STORE_RELEASE(&stat_timing_reset, 1);
 	if (SDL_LockMutex(pause_mutex) != -1) {
-		SDL_PauseAudio(pause);
+		if (device_open) (*output->pause)(pause);
 		SDL_UnlockMutex(pause_mutex);
 	}
+	audio_wake_waiters();
 }
 
 int audio_set_pause(int pause_state)
@@ -233,12 +743,14 @@ int audio_set_pause(int pause_state)
 		if (SDL_LockMutex(pause_mutex) != -1) {
 			if (paused != pause_state) {
 				paused = pause_state;
-				if (paused) memset(amplitudes, 0, sizeof(int16_t) * 16);
+				ATOMIC_STORE_RELEASE(&stat_timing_reset, 1);
+				if (paused) ATOMIC_STORE_RELEASE(&spectrum_clear, 1);
 				res = paused;
-				SDL_PauseAudio(paused);
+				(*output->pause)(paused);
 			}
 			SDL_UnlockMutex(pause_mutex);
 		}
+		audio_wake_waiters();
 	} else {
 		wdprintf(V_WARNING, "audio", "Device not opened. Cannot set pause state!\n");
 	}
@@ -263,11 +775,12 @@ int audio_get_pause(void)
 	return res;
 }
 
+/* Returns the audible play position of the current track in milliseconds */
 int audio_get_playtime(void)
 {
 	int res = 0;
 	if (SDL_LockMutex(audio_mutex2) != -1) {
-		res = buf_read_counter / (have_samplerate * 2 * have_channels) * 1000;
+		res = (int)(clock_get_position() * 1000 / (have_samplerate * 2 * have_channels));
 		SDL_UnlockMutex(audio_mutex2);
 	}
 	return res;
@@ -275,48 +788,122 @@ int audio_get_playtime(void)
 
 size_t audio_buffer_get_fill(void)
 {
-	size_t res = 0;
-	SDL_LockAudio();
-	res = ringbuffer_get_fill(&audio_rb);
-	SDL_UnlockAudio();
-	return res;
+	return lfringbuffer_get_fill(&audio_rb);
+}
+
+/**
+ * Returns the free space up to the target fill level. In burst mode it
+ * is 0 until a full buffer has been drained to a quarter of the target.
+ * To be called from the decoder thread only.
+ */
+size_t audio_buffer_get_free(void)
+{
+	size_t target = ATOMIC_LOAD_ACQUIRE(&buffer_target);
+
+	if (burst_wait) {
+		if (lfringbuffer_get_fill(&audio_rb) > target / 4) return 0;
+		burst_wait = 0;
+	}
+	return buffer_get_target_free();
 }
 
+/* Returns the target fill level of the buffer in bytes */
 size_t audio_buffer_get_size(void)
 {
-	size_t res = 0;
-	SDL_LockAudio();
-	res = ringbuffer_get_size(&audio_rb);
-	SDL_UnlockAudio();
-	return res;
+	return ATOMIC_LOAD_ACQUIRE(&buffer_target);
+}
+
+const char *audio_buffer_profile_get_name(AudioBufferProfile p)
+{
+	return profiles[p].name;
+}
+
+void audio_get_stats(AudioStats *stats)
+{
+	int bytes_per_ms = 1;
+
+	if (SDL_LockMutex(audio_mutex2) != -1) {
+		bytes_per_ms = have_samplerate * 2 * have_channels / 1000;
+		SDL_UnlockMutex(audio_mutex2);
+	}
+	if (bytes_per_ms <= 0) bytes_per_ms = 1;
+	stats->callbacks           = ATOMIC_LOAD_ACQUIRE(&stat_callbacks);
+	stats->underruns           = ATOMIC_LOAD_ACQUIRE(&stat_underruns);
+	stats->partial_fills       = ATOMIC_LOAD_ACQUIRE(&stat_partial_fills);
+	stats->late_callbacks      = ATOMIC_LOAD_ACQUIRE(&stat_late_callbacks);
+	stats->max_callback_gap_ms = (int)(ATOMIC_LOAD_ACQUIRE(&stat_max_gap_us) / 1000);
+	stats->buffer_fill_ms      = (int)(lfringbuffer_get_fill(&audio_rb) / bytes_per_ms);
+	stats->buffer_target_ms    = ATOMIC_LOAD_ACQUIRE(&target_ms);
+	stats->profile             = profile;
+	stats->adaptive            = adaptive;
 }
 
-void audio_buffer_init(void)
+void audio_buffer_init(AudioBufferProfile buffer_profile, int adaptive_buffer)
 {
-	volume = SDL_MIX_MAXVOLUME;
+	int ms;
+
+	volume = VOLUME_MAX;
 	volume_internal = 15;
 	paused = 1;
 	done = 0;
 	device_open = 0;
 	have_samplerate = 1;
 	have_channels = 1;
-	ringbuffer_init(&audio_rb, RINGBUFFER_SIZE);
+	profile   = buffer_profile;
+	adaptive  = adaptive_buffer;
+	target_ms = profiles[profile].target_ms;
+	ms = adaptive ? profiles[profile].max_ms : target_ms;
+	if (!lfringbuffer_init_with_slack(&audio_rb, (size_t)ms * RINGBUFFER_BYTES_PER_MS, AUDIO_BUFFER_MAX_RESERVE))
+		wdprintf(V_ERROR, "audio", "Unable to allocate audio buffer.\n");
+	buffer_target_update();
+	wdprintf(V_INFO, "audio", "Buffer profile: %s (%d ms, %s)\n", profiles[profile].name,
+	         target_ms, adaptive ? "adaptive" : "fixed");
 	spectrum_mutex = SDL_CreateMutex();
+	fft_spectrum_init(&spectrum, 512, 8);
+	audio_tap_init(&tap, TAP_SIZE);
+	pthread_mutex_init(&analysis_mutex, NULL);
+	pthread_cond_init_monotonic(&analysis_cond);
+	analysis_quit = 0;
+	analysis_running = pthread_create_with_stack_size(&analysis_thread, DEFAULT_THREAD_STACK_SIZE, analysis_run, NULL) == 0;
+	if (!analysis_running) wdprintf(V_WARNING, "audio", "Could not create analysis thread.\n");
 	audio_mutex2 = SDL_CreateMutex();
 	pause_mutex = SDL_CreateMutex();
+	pthread_mutex_init(&space_mutex, NULL);
+	pthread_cond_init_monotonic(&space_cond);
+	pthread_mutex_init(&clock_mutex, NULL);
 }
 
 void audio_buffer_clear(void)
 {
 	audio_set_pause(1);
-	SDL_LockAudio();
-	ringbuffer_clear(&audio_rb);
-	SDL_UnlockAudio();
+	/* Clearing moves the read position, which is owned by the consumer,
+	 * so make sure the fill callback is not running meanwhile */
+	output_lock();
+	lfringbuffer_clear(&audio_rb);
+	ATOMIC_STORE_RELEASE(&boundary_tail, boundary_head);
+	clock_add = 0;
+	output_unlock();
+	burst_wait = 0;
+	audio_wake_waiters();
 }
 
 void audio_buffer_free(void)
 {
-	ringbuffer_free(&audio_rb);
+	if (analysis_running) {
+		pthread_mutex_lock(&analysis_mutex);
+		analysis_quit = 1;
+		pthread_cond_signal(&analysis_cond);
+		pthread_mutex_unlock(&analysis_mutex);
+		pthread_join(analysis_thread, NULL);
+		analysis_running = 0;
+	}
+	pthread_cond_destroy(&analysis_cond);
+	pthread_mutex_destroy(&analysis_mutex);
+	audio_tap_free(&tap);
+	lfringbuffer_free(&audio_rb);
+	pthread_cond_destroy(&space_cond);
+	pthread_mutex_destroy(&space_mutex);
+	pthread_mutex_destroy(&clock_mutex);
 	SDL_DestroyMutex(pause_mutex);
 	SDL_DestroyMutex(spectrum_mutex);
 	if (audio_mutex2) SDL_DestroyMutex(audio_mutex2);
@@ -328,8 +915,10 @@ void audio_device_close(void)
 		wdprintf(V_DEBUG, "audio", "Closing device.\n");
 		audio_set_pause(1);
 		device_open = 0;
-		SDL_CloseAudio();
-		wdprintf(V_INFO, "audio", "Device closed.\n");
+		(*output->close)();
+		wdprintf(V_INFO, "audio", "Device closed. Callbacks: %lu, underruns: %lu, partial fills: %lu, late callbacks: %lu\n",
+		         ATOMIC_LOAD_ACQUIRE(&stat_callbacks), ATOMIC_LOAD_ACQUIRE(&stat_underruns),
+		         ATOMIC_LOAD_ACQUIRE(&stat_partial_fills), ATOMIC_LOAD_ACQUIRE(&stat_late_callbacks));
 	}
 }
 
@@ -339,8 +928,8 @@ void audio_set_volume(int vol) /* 0..AUDIO_MAX_SW_VOLUME */
 {
 	volume_internal = (vol < AUDIO_MAX_SW_VOLUME ? vol : AUDIO_MAX_SW_VOLUME-1);
 	volume_internal = (volume_internal > 0 ? volume_internal : 0);
-	volume = volume_array[volume_internal]; /*(SDL_MIX_MAXVOLUME / AUDIO_MAX_SW_VOLUME) * volume_internal;*/
-	wdprintf(V_DEBUG, "audio", "volume=%d (%d/%d)\n", volume, SDL_MIX_MAXVOLUME, AUDIO_MAX_SW_VOLUME);
+	volume = volume_array[volume_internal];
+	wdprintf(V_DEBUG, "audio", "volume=%d (%d/%d)\n", volume, VOLUME_MAX, AUDIO_MAX_SW_VOLUME);
 }
 
 int audio_get_volume(void)
@@ -352,28 +941,51 @@ long audio_set_sample_counter(long sample)
 {
 	long res = 0;
 	if (SDL_LockMutex(audio_mutex2) != -1) {
-		res = buf_read_counter = (sample * 2 * have_channels);
+		res = sample * 2 * have_channels;
+		clock_set((unsigned long)res);
 		SDL_UnlockMutex(audio_mutex2);
 	}
 	return res;
 }
 
+/**
+ * Sets the play position to the given sample once playback reaches the
+ * data that is written to the buffer next, e.g. after seeking. The data
+ * that is still in the buffer keeps counting from the current position.
+ */
+void audio_set_sample_counter_at_write_position(long sample)
+{
+	unsigned long offset = 0;
+
+	if (SDL_LockMutex(audio_mutex2) != -1) {
+		offset = (unsigned long)sample * 2 * have_channels;
+		done = 0;
+		SDL_UnlockMutex(audio_mutex2);
+	}
+	/* With nothing left to play there might be no boundary to pass, so
+	 * set the position right away, like when no boundary can be added */
+	if (lfringbuffer_get_fill(&audio_rb) == 0 || !boundary_add(offset)) clock_set(offset);
+}
+
 long audio_increase_sample_counter(long sample_offset)
 {
 	long res = 0;
 	if (SDL_LockMutex(audio_mutex2) != -1) {
-		buf_read_counter += (sample_offset * 2 * have_channels);
-		res = buf_read_counter;
+		pthread_mutex_lock(&clock_mutex);
+		res = ATOMIC_ADD(&buf_read_counter, sample_offset * 2 * have_channels);
+		clock_add = 0;
+		pthread_mutex_unlock(&clock_mutex);
 		SDL_UnlockMutex(audio_mutex2);
 	}
 	return res;
 }
 
+/* Returns the audible play position of the current track in samples (frames) */
 long audio_get_sample_count(void)
 {
 	long res = 0;
 	if (SDL_LockMutex(audio_mutex2) != -1) {
-		res = buf_read_counter / (2 * have_channels);
+		res = (long)(clock_get_position() / (2 * have_channels));
 		SDL_UnlockMutex(audio_mutex2);
 	}
 	return res;
@@ -381,10 +993,10 @@ long audio_get_sample_count(void)
 
 void audio_set_fade_volume(int percent)
 {
-	SDL_LockAudio();
+	output_lock();
 	if (percent >= 0 && percent <= 100)
 		volume_fade_percent = percent;
-	SDL_UnlockAudio();
+	output_unlock();
 }
 
 /**
@@ -394,29 +1006,29 @@ void audio_set_fade_volume(int percent)
 int audio_fade_out_step(unsigned int step_size)
 {
 	int res;
-	SDL_LockAudio();
+	output_lock();
 	if (volume_fade_percent > 0 && volume_fade_percent >= step_size)
 		volume_fade_percent -= step_size;
 	else
 		volume_fade_percent = 0;
 	wdprintf(V_DEBUG, "audio", "fadeout: %d\n", volume_fade_percent);
 	res = (volume_fade_percent == 0 ? 1 : 0);
-	SDL_UnlockAudio();
+	output_unlock();
 	return res;
 }
 
 void audio_reset_fade_volume(void)
 {
-	SDL_LockAudio();
+	output_lock();
 	volume_fade_percent = 100;
-	SDL_UnlockAudio();
+	output_unlock();
 }
 
 int audio_fade_out_in_progress(void)
 {
 	int res;
-	SDL_LockAudio();
+	output_lock();
 	res = (volume_fade_percent < 100 && volume_fade_percent > 0) ? 1 : 0;
-	SDL_UnlockAudio();
+	output_unlock();
 	return res;
 }
@@ -15,26 +15,62 @@
  */
 #define MIN_BUFFER_FILL 32768
 #define AUDIO_MAX_SW_VOLUME 16
+#define AUDIO_BUFFER_MAX_RESERVE 65536
+#define AUDIO_MAX_TRACK_BOUNDARIES 8 /* Track starts that can be buffered at a time */
 #ifndef _AUDIO_H
 #define _AUDIO_H
 #include <sys/types.h>
+#include "gmuoutput.h"
 
+typedef enum {
+	AUDIO_BUFFER_PROFILE_LOW_LATENCY,
+	AUDIO_BUFFER_PROFILE_DEFAULT,
+	AUDIO_BUFFER_PROFILE_POWER_SAVE
+} AudioBufferProfile;
+
+typedef struct _AudioStats {
+	unsigned long      callbacks;      /* Number of fill callbacks */
+	unsigned long      underruns;      /* Callbacks that got no data at all */
+	unsigned long      partial_fills;  /* Callbacks that got less data than requested */
+	unsigned long      late_callbacks; /* Callbacks that came late, e.g. due to high CPU load */
+	int                max_callback_gap_ms;
+	int                buffer_fill_ms, buffer_target_ms;
+	AudioBufferProfile profile;
+	int                adaptive;
+} AudioStats;
+
+typedef struct _AudioLevels {
+	int16_t peak[2], rms[2]; /* Left and right channel, 0..32767 */
+} AudioLevels;
+
+void     audio_set_output(GmuOutput *out);
 int      audio_device_open(int samplerate, int channels);
+int      audio_device_continue(int samplerate, int channels);
+unsigned long audio_get_track_boundaries_added(void);
+unsigned long audio_get_track_boundaries_passed(void);
 int      audio_fill_buffer(char *data, size_t size);
+int      audio_wait_for_space(size_t size, int timeout_ms);
+char    *audio_buffer_reserve(size_t *size);
+void     audio_buffer_commit(size_t size);
+void     audio_wake_waiters(void);
 int      audio_get_playtime(void);
-void     audio_buffer_init(void);
+void     audio_buffer_init(AudioBufferProfile buffer_profile, int adaptive_buffer);
 void     audio_buffer_clear(void);
 void     audio_buffer_free(void);
 void     audio_device_close(void);
 size_t   audio_buffer_get_fill(void);
+size_t   audio_buffer_get_free(void);
 size_t   audio_buffer_get_size(void);
-int      audio_get_status(void);
+const char *audio_buffer_profile_get_name(AudioBufferProfile p);
+void     audio_get_stats(AudioStats *stats);
+int      audio_is_playing(void);
 void     audio_force_pause(int pause);
 int      audio_set_pause(int pause_state);
 int      audio_get_pause(void);
 void     audio_set_volume(int vol); /* 0..15 */
 int      audio_get_volume(void);
 long     audio_set_sample_counter(long sample);
+void     audio_set_sample_counter_at_write_position(long sample);
 long     audio_increase_sample_counter(long sample_offset);
 long     audio_get_sample_count(void);
 void     audio_wait_until_more_data_is_needed(void);
@@ -48,4 +84,7 @@ void     audio_spectrum_register_for_access(void);
 void     audio_spectrum_unregister(void);
 int      audio_spectrum_read_lock(void);
 void     audio_spectrum_read_unlock(void);
+int      audio_spectrum_get_number_of_bands(void);
+int      audio_spectrum_configure(int fft_size, int bands);
+void     audio_get_levels(AudioLevels *levels);
 #endif
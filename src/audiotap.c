@@ -0,0 +1,74 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: audiotap.c  Created: 261016
+ *
+ * Description: Lock-free tap for the PCM data being played
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include "audiotap.h"
+#include "atomic_helper.h"
+
+int audio_tap_init(AudioTap *tap, size_t size)
+{
+	tap->enabled  = 0;
+	tap->channels = 2;
+	tap->reset    = 0;
+	tap->dropped  = 0;
+	return lfringbuffer_init(&(tap->rb), size);
+}
+
+void audio_tap_free(AudioTap *tap)
+{
+	lfringbuffer_free(&(tap->rb));
+}
+
+void audio_tap_set_enabled(AudioTap *tap, int enabled)
+{
+	ATOMIC_STORE_RELEASE(&(tap->enabled), enabled);
+}
+
+void audio_tap_set_format(AudioTap *tap, int channels)
+{
+	ATOMIC_STORE_RELEASE(&(tap->channels), channels);
+	ATOMIC_STORE_RELEASE(&(tap->reset), 1);
+}
+
+int audio_tap_get_channels(AudioTap *tap)
+{
+	return ATOMIC_LOAD_ACQUIRE(&(tap->channels));
+}
+
+void audio_tap_publish(AudioTap *tap, const char *data, size_t size)
+{
+	if (ATOMIC_LOAD_RELAXED(&(tap->enabled)) && !lfringbuffer_write(&(tap->rb), data, size))
+		ATOMIC_ADD(&(tap->dropped), size);
+}
+
+size_t audio_tap_read(AudioTap *tap, char *target, size_t size)
+{
+	size_t frame_size, fill;
+
+	if (ATOMIC_LOAD_ACQUIRE(&(tap->reset))) {
+		ATOMIC_STORE_RELEASE(&(tap->reset), 0);
+		lfringbuffer_clear(&(tap->rb));
+	}
+	frame_size = 2 * audio_tap_get_channels(tap);
+	fill = lfringbuffer_get_fill(&(tap->rb));
+	if (size > fill) size = fill;
+	size -= size % frame_size;
+	if (size > 0 && !lfringbuffer_read(&(tap->rb), target, size)) size = 0;
+	return size;
+}
+
+void audio_tap_clear(AudioTap *tap)
+{
+	lfringbuffer_clear(&(tap->rb));
+}
@@ -0,0 +1,52 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: audiotap.h  Created: 261016
+ *
+ * Description: Lock-free tap for the PCM data being played
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _AUDIOTAP_H
+#define _AUDIOTAP_H
+#include <sys/types.h>
+#include "lfringbuffer.h"
+
+/*
+ * The audio output's fill callback publishes the data it plays into the
+ * tap with a single copy and without ever blocking. A consumer thread
+ * (e.g. the spectrum analyzer) reads it at its own pace. When the
+ * consumer falls behind, new data is dropped rather than waiting for it.
+ * The tap transports interleaved signed 16 bit samples; the number of
+ * channels is passed along with audio_tap_set_format().
+ */
+typedef struct _AudioTap {
+	LockFreeRingBuffer rb;
+	int                enabled;  /* Set by the consumer */
+	int                channels;
+	int                reset;    /* Set when the format changes */
+	unsigned long      dropped;  /* Bytes dropped because the tap was full */
+} AudioTap;
+
+int    audio_tap_init(AudioTap *tap, size_t size);
+void   audio_tap_free(AudioTap *tap);
+/* Consumer side; publishing is skipped while the tap is disabled */
+void   audio_tap_set_enabled(AudioTap *tap, int enabled);
+/* To be called while the producer is not running, e.g. before the audio
+ * device is opened. Pending data is discarded by the consumer. */
+void   audio_tap_set_format(AudioTap *tap, int channels);
+int    audio_tap_get_channels(AudioTap *tap);
+/* Producer side; never blocks */
+void   audio_tap_publish(AudioTap *tap, const char *data, size_t size);
+/* Consumer side; reads up to size bytes (whole sample frames only) and
+ * returns the number of bytes read */
+size_t audio_tap_read(AudioTap *tap, char *target, size_t size);
+/* Consumer side; discards all pending data */
+void   audio_tap_clear(AudioTap *tap);
+#endif
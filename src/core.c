@@ -19,13 +19,17 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <signal.h>
-#include "SDL.h" /* For audio output */
+#include "SDL.h"
 #include "playlist.h"
 #include "pbstatus.h"
 #include "fileplayer.h"
 #include "decloader.h"
 #include "feloader.h"
+#include "outloader.h"
 #include "audio.h"
+#include "pcmcache.h"
+#include "diskcache.h"
+#include "prefetch.h"
 #include "m3u.h"
 #include "pls.h"
 #include "trackinfo.h"
@@ -41,10 +45,10 @@
 #define MAX_FILE_EXTENSIONS 255
 
 typedef enum GlobalCommand { NO_CMD, PLAY, PAUSE, STOP, NEXT, 
-                             PREVIOUS, PLAY_ITEM, PLAY_FILE } GlobalCommand;
+                             PREVIOUS, PLAY_CURRENT, PLAY_FILE } GlobalCommand;
 
 static GlobalCommand   global_command = NO_CMD;
-static int             global_param = 0;
+static int             global_param = 0; /* PLAY_CURRENT: skip the currently playing track */
 static char            global_filename[256];
 static int             gmu_running = 0;
 static pthread_mutex_t gmu_running_mutex;
@@ -69,9 +73,9 @@ static void init_sdl(void)
 {
 	setenv("SDL_VIDEO_ALLOW_SCREENSAVER", "1", 0);
 #ifndef CORE_WITH_SDL_VIDEO
-	if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_TIMER) < 0) {
+	if (SDL_Init(SDL_INIT_TIMER) < 0) {
 #else
-	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) < 0) {
+	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
 #endif
 		wdprintf(V_ERROR, "gmu", "ERROR: Could not initialize SDL: %s\n", SDL_GetError());
 		exit(1);
@@ -152,19 +156,29 @@ static int check_fade_out_on_skip(void)
 	return res;
 }
 
+/**
+ * Lets the main loop open the playlist's current entry. Requests that
+ * come in before the main loop gets to them replace each other, so when
+ * skipping several tracks in a row, only the last one gets opened. To be
+ * called with the playlist being locked.
+ */
+static void request_current_track(int skip_current)
+{
+	if (global_command == PLAY_CURRENT)
+		global_param = global_param || skip_current;
+	else
+		global_param = skip_current;
+	global_command = PLAY_CURRENT;
+}
+
 static int play_next(Playlist *pl, int skip_current)
 {
 	int result = 0;
-	int fade_out_on_skip = check_fade_out_on_skip();
 	playlist_get_lock(pl);
 	if (playlist_next(pl)) {
 		int ppos = playlist_get_current_position(pl);
 		if (ppos >= 0) ppos++;
-		file_player_play_file(
-			playlist_get_entry_filename(pl, playlist_get_current(pl)),
-			skip_current,
-			fade_out_on_skip
-		);
+		request_current_track(skip_current);
 		result = 1;
 		event_queue_push_with_parameter(
 			&event_queue,
@@ -180,18 +194,13 @@ static int play_next(Playlist *pl, int skip_current)
 static int play_previous(Playlist *pl)
 {
 	int result = 0;
-	int fade_out_on_skip = check_fade_out_on_skip();
 	playlist_get_lock(pl);
 	if (playlist_prev(pl)) {
 		Entry *entry = playlist_get_current(pl);
 		int    ppos = playlist_get_current_position(pl);
 		if (ppos >= 0) ppos++;
 		if (entry != NULL) {
-			file_player_play_file(
-				playlist_get_entry_filename(pl, entry),
-				1,
-				fade_out_on_skip
-			);
+			request_current_track(1);
 			result = 1;
 			event_queue_push_with_parameter(
 				&event_queue,
@@ -205,6 +214,48 @@ static int play_previous(Playlist *pl)
 	return result;
 }
 
+/* Lets the pre-decoder know which tracks are most likely played next */
+static void pcm_cache_update(Playlist *pl, int tracks)
+{
+	Entry      *entries[PL_LOOKAHEAD_MAX];
+	const char *filenames[PL_LOOKAHEAD_MAX];
+	size_t      i, num;
+
+	if (tracks > PL_LOOKAHEAD_MAX) tracks = PL_LOOKAHEAD_MAX;
+	if (tracks <= 0) return;
+	playlist_get_lock(pl);
+	num = playlist_peek_next(pl, entries, tracks);
+	for (i = 0; i < num; i++)
+		filenames[i] = playlist_get_entry_filename(pl, entries[i]);
+	pcm_cache_set_upcoming(filenames, (int)num);
+	playlist_release_lock(pl);
+}
+
+/**
+ * Prefetches the track that is going to be played next, once the current
+ * one is about to end, so the transition does not wait for the storage
+ * device. Returns 1 when that has been done.
+ */
+static int prefetch_update(Playlist *pl, int time_played, int seconds)
+{
+	Entry *entry;
+	int    length = 0, res = 0;
+
+	if (trackinfo_acquire_lock(&current_track_ti)) {
+		length = trackinfo_get_length_minutes(&current_track_ti) * 60 +
+		         trackinfo_get_length_seconds(&current_track_ti);
+		trackinfo_release_lock(&current_track_ti);
+	}
+	if (length > 0 && length - time_played <= seconds) {
+		playlist_get_lock(pl);
+		if (playlist_peek_next(pl, &entry, 1) == 1)
+			prefetch_file(playlist_get_entry_filename(pl, entry));
+		playlist_release_lock(pl);
+		res = 1;
+	}
+	return res;
+}
+
 static void add_default_cfg_settings(ConfigFile *config)
 {
 	cfg_add_key(config, "Gmu.DefaultPlayMode", "continue");
@@ -232,11 +283,41 @@ static void add_default_cfg_settings(ConfigFile *config)
 	cfg_key_add_presets(config, "Gmu.ReaderCache", "256", "512", "1024", NULL);
 	cfg_add_key(config, "Gmu.ReaderCachePrebufferSize", "256");
 	cfg_key_add_presets(config, "Gmu.ReaderCachePrebufferSize", "128", "256", "512", "768", NULL);
+	cfg_add_key(config, "Gmu.DiskCacheSize", "0");
+	cfg_key_add_presets(config, "Gmu.DiskCacheSize", "0", "64", "256", "1024", NULL);
+	cfg_add_key(config, "Gmu.PrefetchSeconds", "10");
+	cfg_key_add_presets(config, "Gmu.PrefetchSeconds", "0", "5", "10", "30", NULL);
 	cfg_add_key(config, "Gmu.LyricsFilePattern", "*.txt");
 	cfg_add_key(config, "Gmu.FadeOutOnSkip", "no");
 	cfg_key_add_presets(config, "Gmu.FadeOutOnSkip", "yes", "no", NULL);
 	cfg_add_key(config, "Gmu.DeviceCloseASAP", "no");
 	cfg_key_add_presets(config, "Gmu.DeviceCloseASAP", "yes", "no", NULL);
+	cfg_add_key(config, "Gmu.GaplessPlayback", "yes");
+	cfg_key_add_presets(config, "Gmu.GaplessPlayback", "yes", "no", NULL);
+	cfg_add_key(config, "Gmu.Crossfade", "0"); /* Crossfade length in seconds, requires gapless playback */
+	cfg_key_add_presets(config, "Gmu.Crossfade", "0", "1", "2", "3", "4", "5", "6", "8", "10", "12", NULL);
+	cfg_add_key(config, "Gmu.AudioOutput", "sdl");
+	cfg_key_add_presets(config, "Gmu.AudioOutput", "sdl", "alsa", "null", "wav", NULL);
+	cfg_add_key(config, "Gmu.OutputSampleRate", "44100"); /* "auto" = use each track's sample rate */
+	cfg_key_add_presets(config, "Gmu.OutputSampleRate", "auto", "22050", "32000", "44100", "48000", NULL);
+	cfg_add_key(config, "Gmu.OutputChannels", "2"); /* "auto" = use each track's channel count */
+	cfg_key_add_presets(config, "Gmu.OutputChannels", "auto", "1", "2", NULL);
+	cfg_add_key(config, "Gmu.AudioBufferProfile", "default");
+	cfg_key_add_presets(config, "Gmu.AudioBufferProfile", "low-latency", "default", "power-save", NULL);
+	cfg_add_key(config, "Gmu.AudioBufferAdaptive", "yes");
+	cfg_key_add_presets(config, "Gmu.AudioBufferAdaptive", "yes", "no", NULL);
+	cfg_add_key(config, "Gmu.PreDecodeCache", "2048"); /* Memory for pre-decoded track beginnings in KB, 0 = off */
+	cfg_key_add_presets(config, "Gmu.PreDecodeCache", "0", "1024", "2048", "4096", "8192", NULL);
+	cfg_add_key(config, "Gmu.PreDecodeTracks", "2");
+	cfg_key_add_presets(config, "Gmu.PreDecodeTracks", "1", "2", "3", "4", NULL);
+	cfg_add_key(config, "Gmu.PreDecodeSeconds", "3");
+	cfg_key_add_presets(config, "Gmu.PreDecodeSeconds", "2", "3", "5", NULL);
+	cfg_add_key(config, "Gmu.ResamplerQuality", "medium");
+	cfg_key_add_presets(config, "Gmu.ResamplerQuality", "low", "medium", "high", NULL);
+	cfg_add_key(config, "Gmu.SpectrumFFTSize", "512");
+	cfg_key_add_presets(config, "Gmu.SpectrumFFTSize", "256", "512", "1024", NULL);
+	cfg_add_key(config, "Gmu.SpectrumBands", "16");
+	cfg_key_add_presets(config, "Gmu.SpectrumBands", "8", "16", "32", "64", NULL);
 }
 
 int gmu_core_export_playlist(const char *file)
@@ -376,8 +457,15 @@ int gmu_core_stop(void)
 
 int gmu_core_play_pl_item(int item)
 {
-	global_command = PLAY_ITEM;
-	global_param = item;
+	Entry *entry;
+
+	playlist_get_lock(&pl);
+	if (item >= 0 && (entry = playlist_get_entry(&pl, item)) != NULL) {
+		wdprintf(V_DEBUG, "gmu", "Playing item %d from current playlist!\n", item);
+		playlist_set_current(&pl, entry);
+		request_current_track(1);
+	}
+	playlist_release_lock(&pl);
 	player_status = PLAYING;
 	file_player_request_playback_state_change(PBRQ_PLAY);
 	event_queue_push_with_parameter(
@@ -653,6 +741,12 @@ int gmu_core_get_length_current_track(void)
 	return len;
 }
 
+int gmu_core_seek_ms(long position_ms, int relative)
+{
+	if (relative) position_ms += file_player_playback_get_time();
+	return file_player_seek_ms(position_ms);
+}
+
 EventQueue *gmu_core_get_event_queue(void)
 {
 	return &event_queue;
@@ -930,6 +1024,8 @@ static void file_extensions_free(void)
 }
 
 #define MAX_FRONTEND_PLUGIN_BY_CMD_ARG 16
+/* Compared to time() differences, so at least one full second passes */
+#define UNDERRUN_QUIET_SECONDS 2
 
 int main(int argc, char **argv)
 {
@@ -945,6 +1041,11 @@ int main(int argc, char **argv)
 	char        *frontend_plugin_by_cmd_arg[MAX_FRONTEND_PLUGIN_BY_CMD_ARG];
 	size_t       frontend_plugin_by_cmd_arg_counter = 0;
 	int          pb_time = -1;
+	AudioStats   audio_stats;
+	unsigned long underruns = 0;
+	time_t        last_underrun = 0;
+	int           predecode_tracks;
+	int           prefetch_seconds, prefetched = 0;
 	char        *alt_playlist = NULL;
 
 	for (i = 0; i < MAX_FRONTEND_PLUGIN_BY_CMD_ARG; i++)
@@ -1100,6 +1201,19 @@ int main(int argc, char **argv)
 		reader_set_cache_size_kb(size, prebuffer_size);
 	}
 
+	/* Disk cache for remote files */
+	{
+		int size = cfg_get_int_value(config, "Gmu.DiskCacheSize");
+
+		if (size > 0) {
+			char *cache_dir = get_data_dir_with_name_alloc("gmu", 1, "cache");
+
+			if (!cache_dir || !disk_cache_init(cache_dir, size))
+				wdprintf(V_WARNING, "gmu", "Disk cache unavailable.\n");
+			free(cache_dir);
+		}
+	}
+
 	{
 		const char *vc = cfg_get_key_value(config, "Gmu.VolumeControl");
 		if (strncmp(vc, "Software+Hardware", 17) == 0)
@@ -1125,9 +1239,18 @@ int main(int argc, char **argv)
 	/* Put available file extensions in an array */
 	file_extensions_load();
 
+	audio_buffer_init(
+		cfg_compare_value(config, "Gmu.AudioBufferProfile", "low-latency", 1) ? AUDIO_BUFFER_PROFILE_LOW_LATENCY :
+		cfg_compare_value(config, "Gmu.AudioBufferProfile", "power-save", 1) ? AUDIO_BUFFER_PROFILE_POWER_SAVE :
+		AUDIO_BUFFER_PROFILE_DEFAULT,
+		cfg_get_boolean_value(config, "Gmu.AudioBufferAdaptive")
+	);
 	gmu_core_config_release_lock();
 
-	audio_buffer_init();
+	audio_spectrum_configure(
+		cfg_get_int_value(config, "Gmu.SpectrumFFTSize"),
+		cfg_get_int_value(config, "Gmu.SpectrumBands")
+	);
 	trackinfo_init(&current_track_ti, 1);
 	playlist_init(&pl);
 	if (alt_playlist) { /* Load user playlist if it has been specified with the -l cmd option */
@@ -1149,7 +1272,21 @@ int main(int argc, char **argv)
 #ifdef GMU_MEDIALIB
 	medialib_open(&gm);
 #endif
-	init_sdl(); /* Initialize SDL audio */
+	init_sdl();
+
+	/* Load audio outputs */
+#if STATIC
+	outloader_load_builtin_outputs();
+#else
+	snprintf(temp, 511, "%s/outputs", base_dir);
+	wdprintf(V_DEBUG, "gmu", "Searching for audio outputs in %s.\n", temp);
+	wdprintf(V_DEBUG, "gmu", "%d audio outputs loaded successfully.\n", outloader_load_all(temp));
+#endif
+	gmu_core_config_acquire_lock();
+	strncpy(temp, cfg_get_key_value(config, "Gmu.AudioOutput"), 511);
+	temp[511] = '\0';
+	gmu_core_config_release_lock();
+	audio_set_output(outloader_select_output(temp));
 
 	/* Load frontends */
 	snprintf(temp, 511, "%s/frontends", base_dir);
@@ -1167,13 +1304,35 @@ int main(int argc, char **argv)
 	}
 #endif
 
-	file_player_init(&current_track_ti, cfg_get_boolean_value(config, "Gmu.DeviceCloseASAP"));
+	file_player_init(
+		&current_track_ti,
+		cfg_get_boolean_value(config, "Gmu.DeviceCloseASAP"),
+		cfg_get_boolean_value(config, "Gmu.GaplessPlayback")
+	);
 	set_default_play_mode(config, &pl);
 
+	gmu_core_config_acquire_lock();
+	predecode_tracks = cfg_get_int_value(config, "Gmu.PreDecodeTracks");
+	if (!pcm_cache_init(
+		cfg_get_int_value(config, "Gmu.PreDecodeCache"),
+		predecode_tracks,
+		cfg_get_int_value(config, "Gmu.PreDecodeSeconds")
+	)) predecode_tracks = 0;
+	prefetch_seconds = cfg_get_int_value(config, "Gmu.PrefetchSeconds");
+	if (prefetch_seconds > 0 && !prefetch_init()) prefetch_seconds = 0;
+	gmu_core_config_release_lock();
+
 	gmu_core_set_volume(-1); /* Load from config */
 
 	gmu_core_config_acquire_lock();
 	file_player_set_lyrics_file_pattern(cfg_get_key_value(config, "Gmu.LyricsFilePattern"));
+	file_player_set_crossfade(cfg_get_int_value(config, "Gmu.Crossfade"));
+	file_player_set_output_format(
+		cfg_get_int_value(config, "Gmu.OutputSampleRate"),
+		cfg_get_int_value(config, "Gmu.OutputChannels"),
+		cfg_compare_value(config, "Gmu.ResamplerQuality", "low", 1) ? 0 :
+		cfg_compare_value(config, "Gmu.ResamplerQuality", "high", 1) ? 2 : 1
+	);
 
 	if (cfg_get_boolean_value(config, "Gmu.AutoPlayOnProgramStart")) {
 		global_command = NEXT;
@@ -1200,20 +1359,17 @@ int main(int argc, char **argv)
 
 		if (global_command == NO_CMD)
 			event_queue_wait_for_event(&event_queue, 500);
-		if (global_command == PLAY_ITEM && global_param >= 0) {
-			Entry *tmp_item;
+		if (global_command == PLAY_CURRENT) {
+			Entry *entry;
 			int    fade_out_on_skip = check_fade_out_on_skip();
 
 			playlist_get_lock(&pl);
-			tmp_item = playlist_get_entry(&pl, global_param);
-			wdprintf(V_DEBUG, "gmu", "Playing item %d from current playlist!\n", global_param);
-			if (tmp_item != NULL) {
-				playlist_set_current(&pl, tmp_item);
-				file_player_play_file(playlist_get_entry_filename(&pl, tmp_item), 1, fade_out_on_skip);
-			}
-			playlist_release_lock(&pl);
+			entry = playlist_get_current(&pl);
+			if (entry != NULL)
+				file_player_play_file(playlist_get_entry_filename(&pl, entry), global_param, fade_out_on_skip);
 			global_command = NO_CMD;
 			global_param = 0;
+			playlist_release_lock(&pl);
 		} else if (global_command == PLAY_FILE && global_filename[0] != '\0') {
 			wdprintf(V_DEBUG, "gmu", "Direct file playback: %s\n", global_filename);
 			playlist_get_lock(&pl);
@@ -1225,6 +1381,8 @@ int main(int argc, char **argv)
 		} else if ((file_player_get_item_status() == FINISHED || 
 		           global_command == NEXT) && player_status == PLAYING) {
 			wdprintf(V_DEBUG, "gmu", "Trying to play next track in playlist...\n");
+			global_command = NO_CMD; /* play_next() requests the track to be opened */
+			global_param = 0;
 			if (global_filename[0] != '\0' || !play_next(&pl, 0)) {
 				wdprintf(V_DEBUG, "gmu", "No more tracks to play. Stopping playback.\n");
 				stop_playback();
@@ -1234,8 +1392,6 @@ int main(int argc, char **argv)
 				}
 			}
 			global_filename[0] = '\0';
-			global_command = NO_CMD;
-			global_param = 0;
 		}
 
 		if (trackinfo_acquire_lock(&current_track_ti)) {
@@ -1288,9 +1444,24 @@ int main(int argc, char **argv)
 			gmu_core_quit();
 		}
 
-		if (pb_time != file_player_playback_get_time()) {
+		/* The play time is millisecond accurate, notify frontends once per second */
+		if (pb_time / 1000 != file_player_playback_get_time() / 1000) {
 			pb_time = file_player_playback_get_time();
 			event_queue_push_with_parameter(&event_queue, GMU_PLAYBACK_TIME_CHANGE, pb_time);
+			if (prefetch_seconds > 0 && !prefetched)
+				prefetched = prefetch_update(&pl, pb_time / 1000, prefetch_seconds);
+		}
+
+		/* Let frontends know when the audio output runs out of data. A stall
+		 * is reported once; it is over after a second without underruns. */
+		audio_get_stats(&audio_stats);
+		if (audio_stats.underruns + audio_stats.partial_fills != underruns) {
+			time_t now = time(NULL);
+
+			underruns = audio_stats.underruns + audio_stats.partial_fills;
+			if (now - last_underrun >= UNDERRUN_QUIET_SECONDS)
+				event_queue_push_with_parameter(&event_queue, GMU_BUFFER_EMPTY, (int)underruns);
+			last_underrun = now;
 		}
 
 		while (event_queue_is_event_waiting(&event_queue)) {
@@ -1298,6 +1469,18 @@ int main(int argc, char **argv)
 			GmuEvent event = event_queue_pop(&event_queue);
 
 			/*wdprintf(V_DEBUG, "gmu", "Got event %d with param %d\n", event, event_param);*/
+			switch (event) {
+				case GMU_TRACK_CHANGE:
+				case GMU_PLAYLIST_CHANGE:
+				case GMU_PLAYLIST_CLEAR:
+				case GMU_QUEUE_CHANGE:
+				case GMU_PLAYMODE_CHANGE:
+					pcm_cache_update(&pl, predecode_tracks);
+					prefetched = 0; /* The next track might have changed */
+					break;
+				default:
+					break;
+			}
 			/*wdprintf(V_DEBUG, "gmu", "Pushing event to frontends:\n");*/
 			fe = feloader_frontend_list_get_next_frontend(1);
 			while (fe) {
@@ -1338,8 +1521,12 @@ int main(int argc, char **argv)
 	wdprintf(V_INFO, "gmu", "Unloading frontends done.\n");
 
 	file_player_shutdown();
+	pcm_cache_free();
+	prefetch_free();
+	disk_cache_free();
 	audio_device_close();
 	audio_buffer_free();
+	outloader_free();
 
 	gmu_core_config_acquire_lock();
 	if (strncmp(cfg_get_key_value(config, "Gmu.VolumeControl"), "Hardware", 8) == 0 ||
@@ -49,6 +49,9 @@ int              gmu_core_play_file(const char *filename);
 int              gmu_core_play_medialib_item(size_t id);
 int              gmu_core_playback_is_paused(void);
 int              gmu_core_get_length_current_track(void);
+/* Seeks to position_ms milliseconds, or by position_ms milliseconds if
+ * relative is non-zero */
+int              gmu_core_seek_ms(long position_ms, int relative);
 void             gmu_core_quit(void);
 TrackInfo       *gmu_core_get_current_trackinfo_ref(void);
 void             gmu_core_set_volume(int volume);
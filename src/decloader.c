@@ -17,11 +17,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include "dir.h"
 #include "decloader.h"
 #include "gmudecoder.h"
 #include "util.h"
 #include "debug.h"
+
+typedef struct _DecoderLoadFuncs {
+	GmuDecoder   *(*v1)(void);
+	GmuDecoderV2 *(*v2)(void);
+} DecoderLoadFuncs;
+
 #if STATIC
 #include "../tmp-declist.h"
 #endif
@@ -31,6 +38,11 @@ static union {
 	GmuDecoder * (*fptr) (void);
 } dlsymunion;
 
+static union {
+	void *ptr;
+	GmuDecoderV2 * (*fptr) (void);
+} dlsymunion_v2;
+
 static char         *dir_extensions[] = { ".so", NULL };
 static DecoderChain *dc_root;
 static char          extensions[1024];
@@ -46,6 +58,241 @@ static DecoderChain *dc_init_element(void)
 	return dc;
 }
 
+/*
+ * Compatibility layer for v1 decoders. A v1 decoder keeps its state in
+ * global variables, so the wrapper allows only one instance at a time to
+ * have a file opened for decoding and one to have meta data loaded,
+ * which matches what the v1 interface has always been able to do.
+ */
+typedef struct _LegacyDecoder {
+	GmuDecoderV2 gd2; /* Must be the first member */
+	GmuDecoder  *gd;
+	int          file_in_use, meta_in_use;
+} LegacyDecoder;
+
+struct _GmuDecoderInstance {
+	LegacyDecoder *ld;
+	int            file_open, meta_loaded, reader_set;
+};
+
+static pthread_mutex_t legacy_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int legacy_claim(int *in_use)
+{
+	int res = 0;
+	pthread_mutex_lock(&legacy_mutex);
+	if (!*in_use) {
+		*in_use = 1;
+		res = 1;
+	}
+	pthread_mutex_unlock(&legacy_mutex);
+	return res;
+}
+
+static void legacy_release(int *in_use)
+{
+	pthread_mutex_lock(&legacy_mutex);
+	*in_use = 0;
+	pthread_mutex_unlock(&legacy_mutex);
+}
+
+static int legacy_close_file(GmuDecoderInstance *inst)
+{
+	GmuDecoder *gd = inst->ld->gd;
+
+	if (inst->file_open) {
+		(*gd->close_file)();
+		inst->file_open = 0;
+		legacy_release(&inst->ld->file_in_use);
+	}
+	if (inst->meta_loaded) {
+		if (gd->meta_data_close) (*gd->meta_data_close)();
+		inst->meta_loaded = 0;
+		legacy_release(&inst->ld->meta_in_use);
+	}
+	return 0;
+}
+
+static void legacy_destroy_instance(GmuDecoderInstance *inst)
+{
+	if (inst) {
+		legacy_close_file(inst);
+		if (inst->reader_set) (*inst->ld->gd->set_reader_handle)(NULL);
+		free(inst);
+	}
+}
+
+static void legacy_set_reader_handle(GmuDecoderInstance *inst, Reader *r)
+{
+	(*inst->ld->gd->set_reader_handle)(r);
+	inst->reader_set = 1;
+}
+
+static int legacy_open_file(GmuDecoderInstance *inst, const char *filename)
+{
+	int res = 0;
+
+	if (!inst->file_open && legacy_claim(&inst->ld->file_in_use)) {
+		res = (*inst->ld->gd->open_file)(filename);
+		if (res)
+			inst->file_open = 1;
+		else
+			legacy_release(&inst->ld->file_in_use);
+	} else {
+		wdprintf(V_WARNING, "decloader", "%s: v1 decoder is busy.\n", inst->ld->gd->identifier);
+	}
+	return res;
+}
+
+static int legacy_decode_data(GmuDecoderInstance *inst, char *target, size_t max_size)
+{
+	return (*inst->ld->gd->decode_data)(target, max_size);
+}
+
+static int legacy_seek(GmuDecoderInstance *inst, int second)
+{
+	return (*inst->ld->gd->seek)(second);
+}
+
+static int legacy_get_current_bitrate(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->get_current_bitrate)();
+}
+
+static const char *legacy_get_meta_data(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
+{
+	return (*inst->ld->gd->get_meta_data)(gmdt, inst->file_open);
+}
+
+static int legacy_get_meta_data_int(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
+{
+	return (*inst->ld->gd->get_meta_data_int)(gmdt, inst->file_open);
+}
+
+static int legacy_get_samplerate(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->get_samplerate)();
+}
+
+static int legacy_get_channels(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->get_channels)();
+}
+
+static int legacy_get_length(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->get_length)();
+}
+
+static int legacy_get_bitrate(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->get_bitrate)();
+}
+
+static const char *legacy_get_file_type(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->get_file_type)();
+}
+
+static int legacy_get_decoder_buffer_size(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->get_decoder_buffer_size)();
+}
+
+static int legacy_meta_data_load(GmuDecoderInstance *inst, const char *filename)
+{
+	int res = 0;
+
+	if (!inst->meta_loaded && legacy_claim(&inst->ld->meta_in_use)) {
+		res = (*inst->ld->gd->meta_data_load)(filename);
+		/* v1 decoders expect meta_data_close() even after a failed load */
+		inst->meta_loaded = 1;
+	} else {
+		wdprintf(V_WARNING, "decloader", "%s: v1 meta data loader is busy.\n", inst->ld->gd->identifier);
+	}
+	return res;
+}
+
+static GmuCharset legacy_meta_data_get_charset(GmuDecoderInstance *inst)
+{
+	return (*inst->ld->gd->meta_data_get_charset)();
+}
+
+static GmuDecoderV2 *legacy_wrap(GmuDecoder *gd)
+{
+	LegacyDecoder *ld = NULL;
+
+	if (gd && (ld = calloc(1, sizeof(LegacyDecoder)))) {
+		GmuDecoderV2 *gd2 = &ld->gd2;
+
+		ld->gd = gd;
+		gd2->api_version             = 1;
+		gd2->identifier              = gd->identifier;
+		gd2->init_decoder            = gd->init_decoder;
+		gd2->close_decoder           = gd->close_decoder;
+		gd2->get_name                = gd->get_name;
+		gd2->get_info                = gd->get_info;
+		gd2->get_file_extensions     = gd->get_file_extensions;
+		gd2->get_mime_types          = gd->get_mime_types;
+		gd2->data_check_magic_bytes  = gd->data_check_magic_bytes;
+		gd2->destroy_instance        = legacy_destroy_instance;
+		gd2->open_file               = legacy_open_file;
+		gd2->close_file              = legacy_close_file;
+		gd2->decode_data             = legacy_decode_data;
+		if (gd->set_reader_handle)       gd2->set_reader_handle       = legacy_set_reader_handle;
+		if (gd->seek)                    gd2->seek                    = legacy_seek;
+		if (gd->get_current_bitrate)     gd2->get_current_bitrate     = legacy_get_current_bitrate;
+		if (gd->get_meta_data)           gd2->get_meta_data           = legacy_get_meta_data;
+		if (gd->get_meta_data_int)       gd2->get_meta_data_int       = legacy_get_meta_data_int;
+		if (gd->get_samplerate)          gd2->get_samplerate          = legacy_get_samplerate;
+		if (gd->get_channels)            gd2->get_channels            = legacy_get_channels;
+		if (gd->get_length)              gd2->get_length              = legacy_get_length;
+		if (gd->get_bitrate)             gd2->get_bitrate             = legacy_get_bitrate;
+		if (gd->get_file_type)           gd2->get_file_type           = legacy_get_file_type;
+		if (gd->get_decoder_buffer_size) gd2->get_decoder_buffer_size = legacy_get_decoder_buffer_size;
+		if (gd->meta_data_load)          gd2->meta_data_load          = legacy_meta_data_load;
+		if (gd->meta_data_get_charset)   gd2->meta_data_get_charset   = legacy_meta_data_get_charset;
+		gd2->handle                  = gd->handle;
+		gd2->legacy                  = ld;
+	}
+	return ld ? &ld->gd2 : NULL;
+}
+
+GmuDecoderInstance *decloader_instance_create(GmuDecoderV2 *gd)
+{
+	GmuDecoderInstance *inst = NULL;
+
+	if (gd && gd->legacy) {
+		if ((inst = malloc(sizeof(GmuDecoderInstance)))) {
+			inst->ld          = (LegacyDecoder *)gd->legacy;
+			inst->file_open   = 0;
+			inst->meta_loaded = 0;
+			inst->reader_set  = 0;
+		}
+	} else if (gd && gd->create_instance) {
+		inst = (*gd->create_instance)();
+	}
+	return inst;
+}
+
+void decloader_instance_destroy(GmuDecoderV2 *gd, GmuDecoderInstance *inst)
+{
+	if (gd && inst && gd->destroy_instance) (*gd->destroy_instance)(inst);
+}
+
+/* Checks the API version of a v2 decoder and calls its init function */
+static GmuDecoderV2 *decoder_setup(GmuDecoderV2 *gd)
+{
+	if (gd && !gd->legacy && gd->api_version != GMU_DECODER_API_VERSION) {
+		wdprintf(V_ERROR, "decloader", "%s: Unsupported decoder API version %d.\n",
+		         gd->identifier, gd->api_version);
+		gd = NULL;
+	} else if (gd && gd->init_decoder) {
+		(*gd->init_decoder)();
+	}
+	return gd;
+}
+
 static void dc_free(DecoderChain *dc)
 {
 	DecoderChain *tmp = dc;
@@ -54,10 +301,12 @@ static void dc_free(DecoderChain *dc)
 		dc = tmp;
 		tmp = tmp->next;
 		if (dc) {
-			if (dc->gd && dc->gd->handle) {
+			if (dc->gd) {
+				void *handle = dc->gd->handle;
 				wdprintf(V_DEBUG, "decloader", "Unloading decoder: %s\n", dc->gd->identifier);
 				if (dc->gd->close_decoder) (*dc->gd->close_decoder)();
-				dlclose(dc->gd->handle);
+				if (dc->gd->legacy) free(dc->gd->legacy);
+				if (handle) dlclose(handle);
 			}
 			free(dc);
 		}
@@ -84,27 +333,37 @@ void decloader_free(void)
 #define DLOPEN_FLAGS RTLD_LAZY
 #endif
 
-GmuDecoder *decloader_load_decoder(const char *so_file)
+GmuDecoderV2 *decloader_load_decoder(const char *so_file)
 {
-	GmuDecoder *result = NULL;
-	void       *handle;
-	GmuDecoder *(*dec_load_func)(void);
+	GmuDecoderV2 *result = NULL;
+	void         *handle;
 
 	handle = dlopen(so_file, DLOPEN_FLAGS);
 	if (!handle) {
 		wdprintf(V_ERROR, "decloader", "%s\n", dlerror());
 		result = 0;
 	} else {
-		char *error;
-		dlsymunion.ptr = dlsym(handle, "gmu_register_decoder");
-		dec_load_func  = dlsymunion.fptr;
-		error = dlerror();
-		if (error) {
-			wdprintf(V_ERROR, "decloader", "%s\n", error);
+		dlsymunion_v2.ptr = dlsym(handle, "gmu_register_decoder_v2");
+		if (dlsymunion_v2.ptr) {
+			result = (*dlsymunion_v2.fptr)();
+			if (result) result->handle = handle;
 		} else {
-			result = (*dec_load_func)();
-			result->handle = handle;
+			char *error;
+			dlerror();
+			dlsymunion.ptr = dlsym(handle, "gmu_register_decoder");
+			error = dlerror();
+			if (error) {
+				wdprintf(V_ERROR, "decloader", "%s\n", error);
+			} else {
+				GmuDecoder *gd = (*dlsymunion.fptr)();
+				if (gd) {
+					gd->handle = handle;
+					result = legacy_wrap(gd);
+				}
+			}
 		}
+		result = decoder_setup(result);
+		if (!result) dlclose(handle);
 	}
 	dlerror(); /* Clear any possibly existing error */
 
@@ -132,8 +391,8 @@ int decloader_load_all(const char *directory)
 
 			wdprintf(V_INFO, "decloader", "%d decoders found.\n", num-2);
 			for (i = 0; i < num; i++) {
-				GmuDecoder *gd;
-				char        fpath[256];
+				GmuDecoderV2 *gd;
+				char          fpath[256];
 
 				if (dir_get_flag(dir, i) == REG_FILE) {
 					snprintf(fpath, 255, "%s/%s", dir_get_path(dir), dir_get_filename(dir, i));
@@ -160,10 +419,10 @@ int decloader_load_all(const char *directory)
 	return res;
 }
 
-GmuDecoder *decloader_get_decoder_for_extension(const char *file_extension)
+GmuDecoderV2 *decloader_get_decoder_for_extension(const char *file_extension)
 {
 	DecoderChain *dc = dc_root;
-	GmuDecoder   *gd = NULL;
+	GmuDecoderV2 *gd = NULL;
 
 	if (file_extension) {
 		while (dc && dc->next) {
@@ -186,10 +445,10 @@ GmuDecoder *decloader_get_decoder_for_extension(const char *file_extension)
 	return gd;
 }
 
-GmuDecoder *decloader_get_decoder_for_mime_type(const char *mime_type)
+GmuDecoderV2 *decloader_get_decoder_for_mime_type(const char *mime_type)
 {
 	DecoderChain *dc = dc_root;
-	GmuDecoder   *gd = NULL;
+	GmuDecoderV2 *gd = NULL;
 
 	if (mime_type) {
 		while (dc->next) {
@@ -210,10 +469,10 @@ GmuDecoder *decloader_get_decoder_for_mime_type(const char *mime_type)
 }
 
 
-GmuDecoder *decloader_get_decoder_for_data_chunk(const char *data, int size)
+GmuDecoderV2 *decloader_get_decoder_for_data_chunk(const char *data, int size)
 {
 	DecoderChain *dc = dc_root;
-	GmuDecoder   *gd = NULL;
+	GmuDecoderV2 *gd = NULL;
 
 	if (data && size > 0) {
 		while (dc->next) {
@@ -240,10 +499,10 @@ char *decloader_get_all_extensions(void)
 	return extensions;
 }
 
-GmuDecoder *decloader_decoder_list_get_next_decoder(int getfirst)
+GmuDecoderV2 *decloader_decoder_list_get_next_decoder(int getfirst)
 {
 	static DecoderChain *dc = NULL;
-	GmuDecoder          *gd = NULL;
+	GmuDecoderV2        *gd = NULL;
 
 	if (getfirst) {
 		dc = dc_root;
@@ -263,9 +522,16 @@ int decloader_load_builtin_decoders(void)
 
 	dc = dc_init_element();
 	dc_root = dc;
-	for (i = 0; decload_funcs[i]; i++) {
+	for (i = 0; decload_funcs[i].v1 || decload_funcs[i].v2; i++) {
 		wdprintf(V_INFO, "decloader", "Loading internal decoder %d...\n", i);
-		dc->gd = (*decload_funcs[i])();
+		if (decload_funcs[i].v2)
+			dc->gd = decoder_setup((*decload_funcs[i].v2)());
+		else
+			dc->gd = decoder_setup(legacy_wrap((*decload_funcs[i].v1)()));
+		if (!dc->gd) {
+			wdprintf(V_WARNING, "decloader", "Loading decoder %d was unsuccessful.\n", i);
+			continue;
+		}
 		wdprintf(V_INFO, "decloader", "Loading decoder %d was successful.\n", i);
 		wdprintf(V_INFO, "decloader", "%s: Name: %s\n", dc->gd->identifier, (*dc->gd->get_name)());
 		if (dc->gd->get_file_extensions) {
@@ -21,16 +21,23 @@ typedef struct _DecoderChain DecoderChain;
 
 struct _DecoderChain {
 	DecoderChain *next;
-	GmuDecoder   *gd;
+	GmuDecoderV2 *gd;
 };
 
-GmuDecoder *decloader_load_decoder(const char *so_file);
-int         decloader_load_all(const char *directory);
-GmuDecoder *decloader_get_decoder_for_extension(const char *file_extension);
-GmuDecoder *decloader_get_decoder_for_mime_type(const char *mime_type);
-GmuDecoder *decloader_get_decoder_for_data_chunk(const char *data, int size);
-char       *decloader_get_all_extensions(void);
-GmuDecoder *decloader_decoder_list_get_next_decoder(int getfirst);
-void        decloader_free(void);
-int         decloader_load_builtin_decoders(void);
+/* All decoders are handled through the v2 interface. Decoders only
+ * implementing the v1 interface are wrapped transparently. */
+GmuDecoderV2       *decloader_load_decoder(const char *so_file);
+int                 decloader_load_all(const char *directory);
+GmuDecoderV2       *decloader_get_decoder_for_extension(const char *file_extension);
+GmuDecoderV2       *decloader_get_decoder_for_mime_type(const char *mime_type);
+GmuDecoderV2       *decloader_get_decoder_for_data_chunk(const char *data, int size);
+char               *decloader_get_all_extensions(void);
+GmuDecoderV2       *decloader_decoder_list_get_next_decoder(int getfirst);
+void                decloader_free(void);
+int                 decloader_load_builtin_decoders(void);
+/* Creates a new decoder instance. For wrapped v1 decoders only one
+ * instance can have a file opened (and one can have meta data loaded)
+ * at a time; open_file()/meta_data_load() fail on other instances. */
+GmuDecoderInstance *decloader_instance_create(GmuDecoderV2 *gd);
+void                decloader_instance_destroy(GmuDecoderV2 *gd, GmuDecoderInstance *inst);
 #endif
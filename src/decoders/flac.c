@@ -25,13 +25,15 @@
 #include "../debug.h"
 #define BUF_SIZE 65536
 
-static FLAC__StreamDecoder *fsd;
-static long                 total_samples, seek_to_sample;
-static int                  sample_rate, channels, track_length, bitrate, file_size;
-static unsigned int         size = 1; /* size of decoded data */
-static char                 buf[BUF_SIZE];
-static TrackInfo            ti, ti_metaonly;
-static Reader              *r;
+struct _GmuDecoderInstance {
+	FLAC__StreamDecoder *fsd;
+	long                 total_samples, seek_to_sample;
+	int                  sample_rate, channels, track_length, bitrate, file_size;
+	unsigned int         size; /* size of decoded data */
+	char                 buf[BUF_SIZE];
+	TrackInfo            ti;
+	Reader              *r;
+};
 
 static const char *get_name(void)
 {
@@ -43,6 +45,7 @@ static FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *
                                                      const FLAC__int32 *const   buffer[],
                                                      void                      *client_data)
 {
+	GmuDecoderInstance *inst = (GmuDecoderInstance *)client_data;
 	unsigned int length = frame->header.blocksize * frame->header.channels
 	                                              * frame->header.bits_per_sample / 8;
 	unsigned int sample, channel, pos = 0, byte_count = 0;
@@ -70,8 +73,8 @@ static FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *
 	}
 
 	if (byte_count <= BUF_SIZE) {
-		memcpy(buf, (char *)packed, byte_count);
-		size = byte_count;
+		memcpy(inst->buf, (char *)packed, byte_count);
+		inst->size = byte_count;
 	} else {
 		wdprintf(V_DEBUG, "flac", "Sample size > buffer size: %d bytes\n", byte_count);
 	}
@@ -87,7 +90,8 @@ static FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *de
 	 * in the buffer already, otherwise we initiate a read operation with
 	 * the desired size.
 	 */
-	size_t bs = reader_get_number_of_bytes_in_buffer(r);
+	Reader *r  = ((GmuDecoderInstance *)client_data)->r;
+	size_t  bs = reader_get_number_of_bytes_in_buffer(r);
 
 	if (bs <= 0) {
 		if (reader_read_bytes(r, *bytes)) {
@@ -116,15 +120,16 @@ static void metadata_callback(const FLAC__StreamDecoder  *decoder,
                               const FLAC__StreamMetadata *metadata,
                               void                       *client_data)
 {
-	TrackInfo   *ti = (TrackInfo *)client_data;
-	unsigned int i;
+	GmuDecoderInstance *inst = (GmuDecoderInstance *)client_data;
+	TrackInfo          *ti = &(inst->ti);
+	unsigned int        i;
 
 	switch (metadata->type) {
 		case FLAC__METADATA_TYPE_STREAMINFO:
-			sample_rate        = metadata->data.stream_info.sample_rate;
-			channels           = metadata->data.stream_info.channels;
-			track_length       = metadata->data.stream_info.total_samples / sample_rate;
-			bitrate            = (int)((FLAC__int64)file_size * 8 * sample_rate / metadata->data.stream_info.total_samples);
+			inst->sample_rate  = metadata->data.stream_info.sample_rate;
+			inst->channels     = metadata->data.stream_info.channels;
+			inst->track_length = metadata->data.stream_info.total_samples / inst->sample_rate;
+			inst->bitrate      = (int)((FLAC__int64)inst->file_size * 8 * inst->sample_rate / metadata->data.stream_info.total_samples);
 
 			ti->samplerate     = metadata->data.stream_info.sample_rate;
 			ti->channels       = metadata->data.stream_info.channels;
@@ -138,7 +143,7 @@ static void metadata_callback(const FLAC__StreamDecoder  *decoder,
 				"Bitstream is %d channel(s), %d bits per sample, %ld kbps, %d Hz\n",
 				ti->channels,
 				metadata->data.stream_info.bits_per_sample,
-				bitrate / 1000,
+				inst->bitrate / 1000,
 				ti->samplerate
 			);
 			break;
@@ -175,24 +180,26 @@ static void error_callback(const FLAC__StreamDecoder      *decoder,
 
 static FLAC__StreamDecoderTellStatus tell_callback(const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset, void *client_data)
 {
-	*absolute_byte_offset = reader_get_stream_position(r);
+	*absolute_byte_offset = reader_get_stream_position(((GmuDecoderInstance *)client_data)->r);
 	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
 }
 
 static FLAC__StreamDecoderLengthStatus length_callback(const FLAC__StreamDecoder *decoder, FLAC__uint64 *stream_length, void *client_data)
 {
-	*stream_length = reader_get_file_size(r);
+	*stream_length = reader_get_file_size(((GmuDecoderInstance *)client_data)->r);
 	return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
 }
 
 static FLAC__bool eof_callback(const FLAC__StreamDecoder *decoder, void *client_data)
 {
-	return reader_is_eof(r);
+	return reader_is_eof(((GmuDecoderInstance *)client_data)->r);
 }
 
 static FLAC__StreamDecoderSeekStatus seek_callback(const FLAC__StreamDecoder *decoder, FLAC__uint64 absolute_byte_offset, void *client_data)
 {
 	FLAC__StreamDecoderSeekStatus res;
+	Reader                       *r = ((GmuDecoderInstance *)client_data)->r;
+
 	if (reader_is_seekable(r)) {
 		res = reader_seek(r, absolute_byte_offset) ? FLAC__STREAM_DECODER_SEEK_STATUS_OK : FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
 	} else {
@@ -201,26 +208,55 @@ static FLAC__StreamDecoderSeekStatus seek_callback(const FLAC__StreamDecoder *de
 	return res;
 }
 
-static int open_file(const char *filename)
+static GmuDecoderInstance *create_instance(void)
+{
+	GmuDecoderInstance *inst = malloc(sizeof(GmuDecoderInstance));
+	if (inst) {
+		inst->fsd = NULL;
+		inst->total_samples = 0;
+		inst->seek_to_sample = 0;
+		inst->sample_rate = 0;
+		inst->channels = 0;
+		inst->track_length = 0;
+		inst->bitrate = 0;
+		inst->file_size = 0;
+		inst->size = 1;
+		trackinfo_init(&(inst->ti), 0);
+		inst->r = NULL;
+	}
+	return inst;
+}
+
+static int close_file(GmuDecoderInstance *inst);
+
+static void destroy_instance(GmuDecoderInstance *inst)
+{
+	if (inst) {
+		close_file(inst);
+		free(inst);
+	}
+}
+
+static int open_file(GmuDecoderInstance *inst, const char *filename)
 {
 	int result = 1;
 
-	total_samples = 0;
-	seek_to_sample = 0;
-	sample_rate = 0;
-	fsd = FLAC__stream_decoder_new();
-	FLAC__stream_decoder_set_metadata_respond(fsd, FLAC__METADATA_TYPE_VORBIS_COMMENT);
+	inst->total_samples = 0;
+	inst->seek_to_sample = 0;
+	inst->sample_rate = 0;
 
-	trackinfo_clear(&ti);
+	trackinfo_clear(&(inst->ti));
 
-	if (!r) {
+	if (!inst->r) {
 		wdprintf(V_WARNING, "flac", "Unable to open stream: %s\n", filename);
 		return 0;
 	}
 
-	file_size = reader_get_file_size(r);
+	inst->fsd = FLAC__stream_decoder_new();
+	FLAC__stream_decoder_set_metadata_respond(inst->fsd, FLAC__METADATA_TYPE_VORBIS_COMMENT);
+	inst->file_size = reader_get_file_size(inst->r);
 
-	if (FLAC__stream_decoder_init_stream(fsd,
+	if (FLAC__stream_decoder_init_stream(inst->fsd,
 		&read_callback,
 		&seek_callback,
 		&tell_callback,
@@ -229,11 +265,11 @@ static int open_file(const char *filename)
 		&write_callback,
 		&metadata_callback,
 		&error_callback,
-		&ti) != FLAC__STREAM_DECODER_INIT_STATUS_OK)  {
+		inst) != FLAC__STREAM_DECODER_INIT_STATUS_OK)  {
 		wdprintf(V_ERROR, "flac", "Could not initialize decoder.\n");
 		result = 0;
 	} else {
-		if (FLAC__stream_decoder_process_until_end_of_metadata(fsd) == false) {
+		if (FLAC__stream_decoder_process_until_end_of_metadata(inst->fsd) == false) {
 			wdprintf(V_ERROR, "flac", "Stream error.\n");
 			result = 0;
 		} else {
@@ -243,42 +279,50 @@ static int open_file(const char *filename)
 	return result;
 }
 
-static int close_file(void)
+static int close_file(GmuDecoderInstance *inst)
 {
-	FLAC__stream_decoder_finish(fsd);
-	FLAC__stream_decoder_delete(fsd);
+	if (inst->fsd) {
+		FLAC__stream_decoder_finish(inst->fsd);
+		FLAC__stream_decoder_delete(inst->fsd);
+		inst->fsd = NULL;
+	}
+	trackinfo_clear(&(inst->ti));
 	return 0;
 }
 
-static int decode_data(char *target, size_t max_size)
+static int decode_data(GmuDecoderInstance *inst, char *target, size_t max_size)
 {
-	if (seek_to_sample) {
-		if (seek_to_sample < 0) seek_to_sample = 0;
-		FLAC__stream_decoder_seek_absolute(fsd, seek_to_sample);
-		seek_to_sample = 0;
+	if (inst->seek_to_sample) {
+		if (inst->seek_to_sample < 0) inst->seek_to_sample = 0;
+		FLAC__stream_decoder_seek_absolute(inst->fsd, inst->seek_to_sample);
+		inst->seek_to_sample = 0;
 	}
-	if (FLAC__stream_decoder_process_single(fsd) == false)
-		size = 0;
-	if (FLAC__stream_decoder_get_state(fsd) >= FLAC__STREAM_DECODER_END_OF_STREAM)
-		size = 0;
-	if (size <= max_size) {
-		memcpy(target, buf, size);
-		/*total_samples++;
-		size += ret;*/
+	if (FLAC__stream_decoder_process_single(inst->fsd) == false)
+		inst->size = 0;
+	if (FLAC__stream_decoder_get_state(inst->fsd) >= FLAC__STREAM_DECODER_END_OF_STREAM)
+		inst->size = 0;
+	if (inst->size <= max_size) {
+		memcpy(target, inst->buf, inst->size);
 	} else {
-		wdprintf(V_ERROR, "flac", "FATAL: Target buffer too small: %d < %d\n", max_size, size);
-		size = max_size;
+		wdprintf(V_ERROR, "flac", "FATAL: Target buffer too small: %d < %d\n", max_size, inst->size);
+		inst->size = max_size;
 	}
-	return size;
+	return inst->size;
 }
 
-static int seek(int seconds)
+static int seek_sample(GmuDecoderInstance *inst, long sample)
 {
-	seek_to_sample = seconds * sample_rate;
+	/* 0 means no seek request, negative values seek to the beginning */
+	inst->seek_to_sample = sample > 0 ? sample : -1;
 	return 1;
 }
 
-static int get_decoder_buffer_size(void)
+static int seek(GmuDecoderInstance *inst, int seconds)
+{
+	return seek_sample(inst, (long)seconds * inst->sample_rate);
+}
+
+static int get_decoder_buffer_size(GmuDecoderInstance *inst)
 {
 	return 65536;
 }
@@ -288,35 +332,35 @@ static const char* get_file_extensions(void)
 	return ".flac";
 }
 
-static int get_current_bitrate(void)
+static int get_current_bitrate(GmuDecoderInstance *inst)
 {
-	return bitrate;
+	return inst->bitrate;
 }
 
-static int get_length(void)
+static int get_length(GmuDecoderInstance *inst)
 {
-	return track_length;
+	return inst->track_length;
 }
 
-static int get_samplerate(void)
+static int get_samplerate(GmuDecoderInstance *inst)
 {
-	return sample_rate;
+	return inst->sample_rate;
 }
 
-static int get_channels(void)
+static int get_channels(GmuDecoderInstance *inst)
 {
-	return channels;
+	return inst->channels;
 }
 
-static int get_bitrate(void)
+static int get_bitrate(GmuDecoderInstance *inst)
 {
-	return bitrate;
+	return inst->bitrate;
 }
 
-static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
+static const char *get_meta_data(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
 {
-	char *result = NULL;
-	TrackInfo *ti_res = (for_current_file ? &ti : &ti_metaonly);
+	char      *result = NULL;
+	TrackInfo *ti_res = &(inst->ti);
 
 	switch (gmdt) {
 		case GMU_META_ARTIST:
@@ -340,7 +384,7 @@ static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
 	return result;
 }
 
-static const char *get_file_type(void)
+static const char *get_file_type(GmuDecoderInstance *inst)
 {
 	return "FLAC";
 }
@@ -353,7 +397,7 @@ static FLAC__StreamDecoderWriteStatus dummy_write_callback(const FLAC__StreamDec
 	return 0;
 }
 
-static int meta_data_load(const char *filename)
+static int meta_data_load(GmuDecoderInstance *inst, const char *filename)
 {
 	int                  result = 0;
 	FILE                *file;
@@ -363,22 +407,22 @@ static int meta_data_load(const char *filename)
 	decoder = FLAC__stream_decoder_new(); 
 	FLAC__stream_decoder_set_metadata_respond(decoder, FLAC__METADATA_TYPE_VORBIS_COMMENT);
 
-	trackinfo_clear(&ti_metaonly);
+	trackinfo_clear(&(inst->ti));
 
 	file = fopen(filename, "rb");
 	if (file) {
 		fseek(file, SEEK_END, 0);
-		ti_metaonly.file_size = ftell(file);
+		inst->ti.file_size = ftell(file);
 		fseek(file, SEEK_SET, 0);
 	}
 	if (!file) {
 		wdprintf(V_WARNING, "flac", "Could not open file.\n");
 	} else if (FLAC__stream_decoder_init_FILE(decoder, file, &dummy_write_callback,
-	                                          &metadata_callback, &error_callback, &ti_metaonly)
+	                                          &metadata_callback, &error_callback, inst)
 	                                         != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
 		wdprintf(V_ERROR, "flac", "Could not initialize decoder.\n");
 	} else {
-		strncpy(ti_metaonly.file_name, filename, SIZE_FILE_NAME-1);
+		strncpy(inst->ti.file_name, filename, SIZE_FILE_NAME-1);
 		filename_without_path = strrchr(filename, '/');
 		if (filename_without_path != NULL)
 			filename_without_path++;
@@ -386,10 +430,10 @@ static int meta_data_load(const char *filename)
 		filename_without_path = charset_filename_convert_alloc(
 			filename_without_path ? filename_without_path : filename
 		);
-		strncpy(ti_metaonly.title, filename_without_path, SIZE_TITLE-1);
+		strncpy(inst->ti.title, filename_without_path, SIZE_TITLE-1);
 		free(filename_without_path);
 
-		strncpy(ti_metaonly.file_type, "FLAC", SIZE_FILE_TYPE-1);
+		strncpy(inst->ti.file_type, "FLAC", SIZE_FILE_TYPE-1);
 
 		if (FLAC__stream_decoder_process_until_end_of_metadata(decoder) == false) {
 			wdprintf(V_ERROR, "flac", "Stream error.\n");
@@ -402,23 +446,18 @@ static int meta_data_load(const char *filename)
 	return result;
 }
 
-
-static int meta_data_close(void)
-{
-	return 1;
-}
-
-static GmuCharset meta_data_get_charset(void)
+static GmuCharset meta_data_get_charset(GmuDecoderInstance *inst)
 {
 	return M_CHARSET_UTF_8;
 }
 
-static void set_reader_handle(Reader *reader)
+static void set_reader_handle(GmuDecoderInstance *inst, Reader *reader)
 {
-	r = reader;
+	inst->r = reader;
 }
 
-static GmuDecoder gd = {
+static GmuDecoderV2 gd = {
+	GMU_DECODER_API_VERSION,
 	"FLAC_decoder",
 	NULL,
 	NULL,
@@ -426,6 +465,10 @@ static GmuDecoder gd = {
 	NULL,
 	get_file_extensions,
 	NULL,
+	NULL,
+	create_instance,
+	destroy_instance,
+	set_reader_handle,
 	open_file,
 	close_file,
 	decode_data,
@@ -440,14 +483,13 @@ static GmuDecoder gd = {
 	get_file_type,
 	get_decoder_buffer_size,
 	meta_data_load,
-	meta_data_close,
 	meta_data_get_charset,
+	seek_sample,
 	NULL,
-	set_reader_handle,
 	NULL
 };
 
-GmuDecoder *GMU_REGISTER_DECODER(void)
+GmuDecoderV2 *GMU_REGISTER_DECODER_V2(void)
 {
 	return &gd;
 }
@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <mpg123.h>
 #include "../gmudecoder.h"
 #include "../trackinfo.h"
@@ -26,44 +27,103 @@
 #include "../debug.h"
 #include "../charset.h"
 
-static mpg123_handle *player;
-static int            init = 0;
-static long           seek_to_sample_offset;
-static int            sample_rate, channels = 0, bitrate = 0;
-static TrackInfo      ti, ti_metaonly;
-static Reader        *r;
-static int            metaint = -1, metacount = 0;
-static int            seek_request = 0;
+struct _GmuDecoderInstance {
+	mpg123_handle *player;
+	long           seek_to_sample_offset;
+	int            sample_rate, channels, bitrate;
+	TrackInfo      ti;
+	Reader        *r;
+	int            metaint, metacount;
+	int            seek_request;
+	/* PCM data decoded while probing the stream format on open; handed out
+	 * by the first decode_data() call, so no samples get lost */
+	unsigned char  pending[1024];
+	size_t         pending_size;
+};
+
+static int init = 0;
 
 static const char *get_name(void)
 {
 	return "mpg123 MPEG decoder v1.0";
 }
 
-static int decode_data(char *target, size_t max_size)
+static void init_decoder(void)
+{
+	wdprintf(V_DEBUG, "mpg123", "Initializing.\n");
+	if (mpg123_init() != MPG123_OK)
+		wdprintf(V_ERROR, "mpg123", "Init failed.\n");
+	else
+		init = 1;
+}
+
+static void close_decoder(void)
+{
+	if (init) mpg123_exit();
+	init = 0;
+}
+
+static GmuDecoderInstance *create_instance(void)
+{
+	GmuDecoderInstance *inst = malloc(sizeof(GmuDecoderInstance));
+	if (inst) {
+		inst->player = NULL;
+		inst->seek_to_sample_offset = 0;
+		inst->sample_rate = 0;
+		inst->channels = 0;
+		inst->bitrate = 0;
+		trackinfo_init(&(inst->ti), 0);
+		inst->r = NULL;
+		inst->metaint = -1;
+		inst->metacount = 0;
+		inst->seek_request = 0;
+		inst->pending_size = 0;
+	}
+	return inst;
+}
+
+static int close_file(GmuDecoderInstance *inst);
+
+static void destroy_instance(GmuDecoderInstance *inst)
+{
+	if (inst) {
+		close_file(inst);
+		free(inst);
+	}
+}
+
+static int decode_data(GmuDecoderInstance *inst, char *target, size_t max_size)
 {
 	int                     ret = 1;
 	struct mpg123_frameinfo mi;
 	size_t                  decsize = 0;
 	int                     readsize;
 
-	if (r) {
-		if (metaint > 0 && metacount == 0) { /* Shoutcast stream meta data handling */
-			int metasize = reader_read_byte(r) * 16;
+	if (inst->pending_size > 0 && inst->pending_size <= max_size && !inst->seek_request) {
+		memcpy(target, inst->pending, inst->pending_size);
+		decsize = inst->pending_size;
+		inst->pending_size = 0;
+		return decsize;
+	}
+	inst->pending_size = 0;
+
+	if (inst->r) {
+		if (inst->metaint > 0 && inst->metacount == 0) { /* Shoutcast stream meta data handling */
+			int metasize = reader_read_byte(inst->r) * 16;
 			if (metasize > 0) {
 				char *metastr;
 				int   s;
 				
 				wdprintf(V_DEBUG, "mpg123", "metadata size = %d bytes\n", metasize);
-				reader_read_bytes(r, metasize);
-				s = reader_get_number_of_bytes_in_buffer(r);
+				reader_read_bytes(inst->r, metasize);
+				s = reader_get_number_of_bytes_in_buffer(inst->r);
 				wdprintf(V_DEBUG, "mpg123", "got %d bytes\n", s);
 				if (s > 0) {
 					metastr = malloc(s+1);
 					if (metastr) {
 						char *stream_title;
 
-						memcpy(metastr, reader_get_buffer(r), s);
+						memcpy(metastr, reader_get_buffer(inst->r), s);
 						metastr[s] = '\0';
 						wdprintf(V_DEBUG, "mpg123", "metadata: [%s]\n", metastr);
 						stream_title = strstr(metastr, "StreamTitle='");
@@ -77,61 +137,61 @@ static int decode_data(char *target, size_t max_size)
 							else
 								charset_iso8859_1_to_utf8(stitle_utf8, stream_title, 255);
 							wdprintf(V_DEBUG, "mpg123", "stream_title=[%s]\n", stitle_utf8);
-							trackinfo_set_title(&ti, stitle_utf8);
-							trackinfo_set_updated(&ti);
+							trackinfo_set_title(&(inst->ti), stitle_utf8);
+							trackinfo_set_updated(&(inst->ti));
 						}
 						free(metastr);
 					}
 				}
 			}
-			metacount = metaint;
+			inst->metacount = inst->metaint;
 		}
 
-		if (seek_request && reader_is_seekable(r) && seek_to_sample_offset >= 0) {
+		if (inst->seek_request && reader_is_seekable(inst->r) && inst->seek_to_sample_offset >= 0) {
 			off_t offset;
-			wdprintf(V_DEBUG, "mpg123", "Seeking requested to sample %d.\n", seek_to_sample_offset);
-			if (mpg123_feedseek(player, seek_to_sample_offset, SEEK_SET, &offset) >= 0) {
+			wdprintf(V_DEBUG, "mpg123", "Seeking requested to sample %d.\n", inst->seek_to_sample_offset);
+			if (mpg123_feedseek(inst->player, inst->seek_to_sample_offset, SEEK_SET, &offset) >= 0) {
 				wdprintf(V_DEBUG, "mpg123", "Seeking stream to file offset at %d bytes.\n", offset);
-				reader_seek(r, offset);
+				reader_seek(inst->r, offset);
 			} else {
 				wdprintf(V_WARNING, "mpg123", "Seek error.\n");
 			}
-			seek_to_sample_offset = 0;
-			seek_request = 0;
+			inst->seek_to_sample_offset = 0;
+			inst->seek_request = 0;
 		}
 
 		readsize = 4096;
-		if (metacount > 0) {
-			if (metacount < readsize) readsize = metacount;
-			metacount -= readsize;
+		if (inst->metacount > 0) {
+			if (inst->metacount < readsize) readsize = inst->metacount;
+			inst->metacount -= readsize;
 		}
-		if (reader_read_bytes(r, readsize)) {
-			int size = reader_get_number_of_bytes_in_buffer(r);
+		if (reader_read_bytes(inst->r, readsize)) {
+			int size = reader_get_number_of_bytes_in_buffer(inst->r);
 			if (size > 0) {
-				mpg123_feed(player, (unsigned char *)reader_get_buffer(r), size);
+				mpg123_feed(inst->player, (unsigned char *)reader_get_buffer(inst->r), size);
 			}
 		} else {
 			wdprintf(V_WARNING, "mpg123", "Got no data from reader :(\n");
-			if (reader_get_number_of_bytes_in_buffer(r) == 0)
+			if (reader_get_number_of_bytes_in_buffer(inst->r) == 0)
 				ret = MPG123_DONE;
 		}
 	}
-	mpg123_info(player, &mi);
-	bitrate = 1000 * (mi.abr_rate ? mi.abr_rate : mi.bitrate);
+	mpg123_info(inst->player, &mi);
+	inst->bitrate = 1000 * (mi.abr_rate ? mi.abr_rate : mi.bitrate);
 	if (ret != MPG123_DONE) {
 		do {
-			ret = mpg123_read(player, (unsigned char*)target, max_size, &decsize);
+			ret = mpg123_read(inst->player, (unsigned char*)target, max_size, &decsize);
 			if (ret == MPG123_NEED_MORE && decsize == 0) {
 				readsize = 4096;
-				if (metaint > 0) { /* Do this only if there is Shoutcast meta data in the stream */
-					if (metacount < readsize) readsize = metacount;
-					metacount -= readsize;
+				if (inst->metaint > 0) { /* Do this only if there is Shoutcast meta data in the stream */
+					if (inst->metacount < readsize) readsize = inst->metacount;
+					inst->metacount -= readsize;
 				}
 				if (readsize > 0) {
-					if (reader_read_bytes(r, readsize)) {
-						int size = reader_get_number_of_bytes_in_buffer(r);
+					if (reader_read_bytes(inst->r, readsize)) {
+						int size = reader_get_number_of_bytes_in_buffer(inst->r);
 						if (size > 0) {
-							mpg123_feed(player, (unsigned char *)reader_get_buffer(r), size);
+							mpg123_feed(inst->player, (unsigned char *)reader_get_buffer(inst->r), size);
 						}
 					} else { /* Must have reached EOF */
 						break;
@@ -141,147 +201,157 @@ static int decode_data(char *target, size_t max_size)
 					break;
 				}
 			}
-		} while (ret == MPG123_NEED_MORE && decsize == 0 && !reader_is_eof(r));
+		} while (ret == MPG123_NEED_MORE && decsize == 0 && !reader_is_eof(inst->r));
 	}
 	if (ret == MPG123_DONE) decsize = 0;
 	return decsize;
 }
 
-static int mpg123_play_file(const char *mpeg_file)
+static int mpg123_play_file(GmuDecoderInstance *inst, const char *mpeg_file)
 {
-	int                     result = 1;
+	int                     result = 0;
 	struct mpg123_frameinfo mi;
 
-	seek_to_sample_offset = 0;
-	seek_request = 0;
+	inst->seek_to_sample_offset = 0;
+	inst->seek_request = 0;
 
-	if (!init) {
-		wdprintf(V_DEBUG, "mpg123", "Initializing.\n");
-		if (mpg123_init() != MPG123_OK)
-			wdprintf(V_ERROR, "mpg123", "Init failed.\n");
-		wdprintf(V_DEBUG, "mpg123", "Creating decoder.\n");	
-		player = mpg123_new(NULL, NULL);
-		init = 1;
+	if (init && !inst->player) {
+		wdprintf(V_DEBUG, "mpg123", "Creating decoder.\n");
+		inst->player = mpg123_new(NULL, NULL);
+		/* Let libmpg123 cut off encoder delay and padding as specified in the
+		 * LAME/Xing header, so consecutive tracks join without a gap */
+		if (inst->player && mpg123_param(inst->player, MPG123_ADD_FLAGS, MPG123_GAPLESS, 0) != MPG123_OK)
+			wdprintf(V_DEBUG, "mpg123", "Gapless decoding not supported by libmpg123.\n");
 	}
+	inst->pending_size = 0;
 
-	if (player) {
+	if (inst->player) {
 		int  encoding = 0;
 		long rate = 0;
 
+		result = 1;
 		wdprintf(V_INFO, "mpg123", "Opening %s...\n", mpeg_file);
-		trackinfo_clear(&ti);
-		id3_read_tag(mpeg_file, &ti, "MP3");
-		trackinfo_set_updated(&ti);
+		trackinfo_clear(&(inst->ti));
+		/* Parse the tags from the data the reader has (or can get) anyway */
+		if (inst->r)
+			id3_read_tag_from_reader(inst->r, mpeg_file, &(inst->ti), "MP3");
+		else
+			id3_read_tag(mpeg_file, &(inst->ti), "MP3");
+		trackinfo_set_updated(&(inst->ti));
 		/*strncpy(ti->file_name, mpeg_file, SIZE_FILE_NAME-1);*/
 
-		if (r) { /* Always use stream reader */
+		if (inst->r) { /* Always use stream reader */
 			wdprintf(V_INFO, "mpg123", "Opening stream...\n");
-			if (mpg123_open_feed(player) == MPG123_OK) {
+			if (mpg123_open_feed(inst->player) == MPG123_OK) {
 				int   status;
-				int   size = reader_get_number_of_bytes_in_buffer(r); /* There are some bytes in the buffer already, that should be used first */
-				char *metaint_str = cfg_get_key_value(r->streaminfo, "icy-metaint");
-				long  file_size = reader_get_file_size(r);
+				int   size = reader_get_number_of_bytes_in_buffer(inst->r); /* There are some bytes in the buffer already, that should be used first */
+				char *metaint_str = cfg_get_key_value(inst->r->streaminfo, "icy-metaint");
+				long  file_size = reader_get_file_size(inst->r);
 				int   need_more_debug = 0;
 				
-				if (file_size > 0) mpg123_set_filesize(player, file_size);
-				if (metaint_str) metaint = atoi(metaint_str); else metaint = -1;
-				if (metaint > 0) {
-					metacount = metaint - size;
-					wdprintf(V_DEBUG, "mpg123", "Metadata every %d bytes.\n", metaint);
+				if (file_size > 0) mpg123_set_filesize(inst->player, file_size);
+				if (metaint_str) inst->metaint = atoi(metaint_str); else inst->metaint = -1;
+				if (inst->metaint > 0) {
+					inst->metacount = inst->metaint - size;
+					wdprintf(V_DEBUG, "mpg123", "Metadata every %d bytes.\n", inst->metaint);
 				} else {
-					metacount = 0;
+					inst->metacount = 0;
 				}
 				do {
-					mpg123_feed(player, (unsigned char *)reader_get_buffer(r), size);
+					mpg123_feed(inst->player, (unsigned char *)reader_get_buffer(inst->r), size);
 
-					status = mpg123_getformat(player, &rate, &channels, &encoding);
+					status = mpg123_getformat(inst->player, &rate, &(inst->channels), &encoding);
 					if (status == MPG123_NEED_MORE) {
 						if (!need_more_debug) {
 							wdprintf(V_DEBUG, "mpg123", "Need more data to determine format.\n");
 							need_more_debug = 1;
 						}
-						reader_read_bytes(r, 1024);
-						size = reader_get_number_of_bytes_in_buffer(r);
-						metacount -= size;
+						reader_read_bytes(inst->r, 1024);
+						size = reader_get_number_of_bytes_in_buffer(inst->r);
+						inst->metacount -= size;
 					}
-				} while (status == MPG123_NEED_MORE && !reader_is_eof(r));
-				wdprintf(V_DEBUG, "mpg123", "Next metadata in %d bytes.\n", metacount);
+				} while (status == MPG123_NEED_MORE && !reader_is_eof(inst->r));
+				wdprintf(V_DEBUG, "mpg123", "Next metadata in %d bytes.\n", inst->metacount);
 
 				/* Set meta data */
 				{
-					char *name = cfg_get_key_value(r->streaminfo, "icy-name");
-					/*char *description = cfg_get_key_value(r->streaminfo, "icy-description");
+					char *name = cfg_get_key_value(inst->r->streaminfo, "icy-name");
+					/*char *description = cfg_get_key_value(inst->r->streaminfo, "icy-description");
 					if (!description) description = "";*/
-					if (name) trackinfo_set(&ti, "", name, name, "", 0, rate, channels);
+					if (name) trackinfo_set(&(inst->ti), "", name, name, "", 0, rate, inst->channels);
 				}
 
 				if (status != MPG123_OK) {
 					wdprintf(V_ERROR, "mpg123", "Error opening stream.\n");
-					channels = 0;
+					inst->channels = 0;
 				}
 			} else {
 				wdprintf(V_ERROR, "mpg123", "Failed opening feed.\n");
-				channels = 0;
+				inst->channels = 0;
 			}
 		} else {
 			wdprintf(V_ERROR, "mpg123", "ERROR: Could not open stream/file.\n");
-			channels = 0;
+			inst->channels = 0;
 		}
-		if (channels > 0) {
-			size_t        dummy;
-			unsigned char dumbuf[1024];
-
-			wdprintf(V_INFO, "mpg123", "Found stream with %d channels and %ld Hz.\n", channels, rate);
-			mpg123_format_none(player);
-			mpg123_format(player, rate, channels, encoding);
-			mpg123_info(player, &mi);
-			sample_rate = mi.rate;
-			bitrate = 1000 * (mi.abr_rate ? mi.abr_rate : mi.bitrate);
+		if (inst->channels > 0) {
+
+			wdprintf(V_INFO, "mpg123", "Found stream with %d channels and %ld Hz.\n", inst->channels, rate);
+			mpg123_format_none(inst->player);
+			mpg123_format(inst->player, rate, inst->channels, encoding);
+			mpg123_info(inst->player, &mi);
+			inst->sample_rate = mi.rate;
+			inst->bitrate = 1000 * (mi.abr_rate ? mi.abr_rate : mi.bitrate);
 			/*ti->samplerate = mi.rate;
 			ti->channels   = mi.mode == MPG123_M_MONO ? 1 : 2;
 			ti->bitrate    = 1000 * (mi.abr_rate ? mi.abr_rate : mi.bitrate);
-			ti->length     = mpg123_length(player) / ti->samplerate;
+			ti->length     = mpg123_length(inst->player) / ti->samplerate;
 			ti->vbr        = mi.vbr == MPG123_CBR ? 0 : 1;
 			wdprintf(V_DEBUG, "mpg123", "Bitstream is %ld kbps, %d channel(s), %d Hz\n", 
 			       ti->bitrate / 1000, ti->channels, ti->samplerate);*/
 
-			if (mpg123_read(player, dumbuf, 1024, &dummy) != MPG123_NEW_FORMAT) {
+			if (mpg123_read(inst->player, inst->pending, 1024, &(inst->pending_size)) != MPG123_NEW_FORMAT) {
 				wdprintf(V_DEBUG, "mpg123", "No new format.\n");
 			}
 		} else {
 			wdprintf(V_ERROR, "mpg123", "Problem with stream.\n");
-			mpg123_delete(player);
-			mpg123_exit();
-			player = NULL;
-			init = 0;
+			mpg123_delete(inst->player);
+			inst->player = NULL;
 			result = 0;
 		}
 	}
 	return result;
 }
 
-static int mpg123_seek_to(int offset_seconds)
+static int mpg123_seek_to_sample(GmuDecoderInstance *inst, long sample)
 {
 	int res = 0;
-	if (offset_seconds >= 0) {
-		seek_to_sample_offset = offset_seconds * sample_rate;
-		seek_request = 1;
+	if (sample >= 0) {
+		inst->seek_to_sample_offset = sample;
+		inst->seek_request = 1;
 		res = 1;
 	}
 	return res;
 }
 
-static int close_file(void)
+static int mpg123_seek_to(GmuDecoderInstance *inst, int offset_seconds)
 {
-	wdprintf(V_DEBUG, "mpg123", "Closing file.\n");
-	mpg123_close(player);
-	mpg123_delete(player);
-	mpg123_exit();
-	init = 0;
+	return mpg123_seek_to_sample(inst, (long)offset_seconds * inst->sample_rate);
+}
+
+static int close_file(GmuDecoderInstance *inst)
+{
+	if (inst->player) {
+		wdprintf(V_DEBUG, "mpg123", "Closing file.\n");
+		mpg123_close(inst->player);
+		mpg123_delete(inst->player);
+		inst->player = NULL;
+	}
+	trackinfo_clear(&(inst->ti));
+	inst->channels = 0;
 	return 0;
 }
 
-static int get_decoder_buffer_size(void)
+static int get_decoder_buffer_size(GmuDecoderInstance *inst)
 {
 	return 256;
 }
@@ -291,41 +361,47 @@ static const char* get_file_extensions(void)
 	return ".mp3;.mp2;.mp1";
 }
 
-static int get_current_bitrate(void)
+static int get_current_bitrate(GmuDecoderInstance *inst)
 {
-	return bitrate;
+	return inst->bitrate;
 }
 
-static int get_length(void)
+static int get_length(GmuDecoderInstance *inst)
 {
-	return mpg123_length(player) / sample_rate;
+	return inst->sample_rate > 0 ? mpg123_length(inst->player) / inst->sample_rate : 0;
 }
 
-static int get_samplerate(void)
+static int get_samplerate(GmuDecoderInstance *inst)
 {
-	return sample_rate;
+	return inst->sample_rate;
 }
 
-static int get_channels(void)
+static int get_channels(GmuDecoderInstance *inst)
 {
-	return channels;
+	return inst->channels;
 }
 
-static int get_bitrate(void)
+static int get_bitrate(GmuDecoderInstance *inst)
 {
-	return bitrate;
+	return inst->bitrate;
 }
 
-static int get_meta_data_int(GmuMetaDataType gmdt, int for_current_file)
+static int get_meta_data_int(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
 {
 	int        result = 0;
-	TrackInfo *t = &ti_metaonly;
+	TrackInfo *t = &(inst->ti);
 
-	if (for_current_file) t = &ti;
 	switch (gmdt) {
 		case GMU_META_IMAGE_DATA_SIZE:
 			result = trackinfo_get_image_data_size(t);
 			break;
+		case GMU_META_IMAGE_OFFSET:
+			/* Offsets not fitting into an int are not reported */
+			if (trackinfo_get_image_offset(t) <= INT_MAX)
+				result = (int)trackinfo_get_image_offset(t);
+			else
+				result = -1;
+			break;
 		case GMU_META_IS_UPDATED:
 			result = trackinfo_is_updated(t);
 			break;
@@ -335,12 +411,11 @@ static int get_meta_data_int(GmuMetaDataType gmdt, int for_current_file)
 	return result;
 }
 
-static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
+static const char *get_meta_data(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
 {
 	char      *result = NULL;
-	TrackInfo *t = &ti_metaonly;
+	TrackInfo *t = &(inst->ti);
 
-	if (for_current_file) t = &ti;
 	switch (gmdt) {
 		case GMU_META_ARTIST:
 			result = trackinfo_get_artist(t);
@@ -363,13 +438,18 @@ static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
 		case GMU_META_IMAGE_MIME_TYPE:
 			result = trackinfo_get_image_mime_type(t);
 			break;
+		case GMU_META_IMAGE_FILE:
+			/* Without a usable offset the image data has to be used instead */
+			if (trackinfo_get_image_offset(t) <= INT_MAX)
+				result = trackinfo_get_image_file(t);
+			break;
 		default:
 			break;
 	}
 	return result;
 }
 
-static const char *get_file_type(void)
+static const char *get_file_type(GmuDecoderInstance *inst)
 {
 	return "MPEG Audio";
 }
@@ -379,18 +459,13 @@ static const char *get_mime_types(void)
 	return "audio/mpeg";
 }
 
-static int meta_data_load(const char *filename)
+static int meta_data_load(GmuDecoderInstance *inst, const char *filename)
 {
-	return id3_read_tag(filename, &ti_metaonly, "MP3");
+	trackinfo_clear(&(inst->ti));
+	return id3_read_tag(filename, &(inst->ti), "MP3");
 }
 
-static int meta_data_close(void)
-{
-	trackinfo_clear(&ti_metaonly);
-	return 1;
-}
-
-static GmuCharset meta_data_get_charset(void)
+static GmuCharset meta_data_get_charset(GmuDecoderInstance *inst)
 {
 	return M_CHARSET_UTF_8;
 }
@@ -412,19 +487,24 @@ static int data_check_magic_bytes(const char *data, size_t size)
 	return id3 || sync;
 }
 
-static void set_reader_handle(Reader *reader)
+static void set_reader_handle(GmuDecoderInstance *inst, Reader *reader)
 {
-	r = reader;
+	inst->r = reader;
 }
 
-static GmuDecoder gd = {
+static GmuDecoderV2 gd = {
+	GMU_DECODER_API_VERSION,
 	"mpg123_decoder",
-	NULL,
-	NULL,
+	init_decoder,
+	close_decoder,
 	get_name,
 	NULL,
 	get_file_extensions,
 	get_mime_types,
+	data_check_magic_bytes,
+	create_instance,
+	destroy_instance,
+	set_reader_handle,
 	mpg123_play_file,
 	close_file,
 	decode_data,
@@ -439,14 +519,13 @@ static GmuDecoder gd = {
 	get_file_type,
 	get_decoder_buffer_size,
 	meta_data_load,
-	meta_data_close,
 	meta_data_get_charset,
-	data_check_magic_bytes,
-	set_reader_handle,
+	mpg123_seek_to_sample,
+	NULL,
 	NULL
 };
 
-GmuDecoder *GMU_REGISTER_DECODER(void)
+GmuDecoderV2 *GMU_REGISTER_DECODER_V2(void)
 {
 	return &gd;
 }
@@ -61,7 +61,8 @@ static int openmpt_play_file(const char *mod_file)
 			memcpy(module, buf, s);
 			offset = s;
 		}
-		if (module && size > 0 && reader_read_bytes(r, size-offset)) {
+		if (module && size > 0 && reader_read_bytes(r, size-offset) &&
+		    reader_get_number_of_bytes_in_buffer(r) == (size_t)(size-offset)) {
 			buf = reader_get_buffer(r);
 			memcpy(module+offset, buf, size-offset);
 			mod = openmpt_module_create_from_memory(
@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <opusfile.h>
 #include "../gmudecoder.h"
 #include "../trackinfo.h"
@@ -23,13 +24,14 @@
 #include "../reader.h"
 #include "../debug.h"
 
-static int          init = 0;
-static long         seek_to_sample_offset;
-static int          sample_rate, channels = 0, bitrate = 0;
-static TrackInfo    ti, ti_metaonly;
-static Reader      *r;
-static OggOpusFile *oof;
-static int          seek_request = 0;
+struct _GmuDecoderInstance {
+	long         seek_to_sample_offset;
+	int          sample_rate, channels, bitrate;
+	TrackInfo    ti;
+	Reader      *r;
+	OggOpusFile *oof;
+	int          seek_request, prev_li;
+};
 
 static const char *get_name(void)
 {
@@ -42,8 +44,9 @@ static int read_func(void *_stream, unsigned char *_ptr, int _nbytes)
 	int     res = -1;
 	Reader *r = (Reader *)_stream;
 	if (reader_read_bytes(r, _nbytes)) {
-		memcpy(_ptr, reader_get_buffer(r), _nbytes);
-		res = _nbytes;
+		/* Near the end of the file fewer bytes than requested are available */
+		res = reader_get_number_of_bytes_in_buffer(r);
+		memcpy(_ptr, reader_get_buffer(r), res);
 	}
 	return res;
 }
@@ -88,32 +91,22 @@ static int close_func(void *_stream)
 }
 
 struct _trackinfo_mapping {
-	char *key;
-	char *target;
-	int   maxlen;
+	char  *key;
+	size_t offset; /* of the target field in TrackInfo */
+	int    maxlen;
 };
 
 static struct _trackinfo_mapping tim[] = {
-	{ "artist=",      ti.artist,  SIZE_ARTIST },
-	{ "title=",       ti.title,   SIZE_TITLE },
-	{ "album=",       ti.album,   SIZE_ALBUM },
-	{ "tracknumber=", ti.tracknr, SIZE_TRACKNR },
-	{ "date=",        ti.date,    SIZE_DATE },
-	{ "comment=",     ti.comment, SIZE_COMMENT },
-	{ NULL,           NULL,       0 }
-};
-
-static struct _trackinfo_mapping tim_metaonly[] = {
-	{ "artist=",      ti_metaonly.artist,  SIZE_ARTIST },
-	{ "title=",       ti_metaonly.title,   SIZE_TITLE },
-	{ "album=",       ti_metaonly.album,   SIZE_ALBUM },
-	{ "tracknumber=", ti_metaonly.tracknr, SIZE_TRACKNR },
-	{ "date=",        ti_metaonly.date,    SIZE_DATE },
-	{ "comment=",     ti_metaonly.comment, SIZE_COMMENT },
-	{ NULL,           NULL,       0 }
+	{ "artist=",      offsetof(TrackInfo, artist),  SIZE_ARTIST },
+	{ "title=",       offsetof(TrackInfo, title),   SIZE_TITLE },
+	{ "album=",       offsetof(TrackInfo, album),   SIZE_ALBUM },
+	{ "tracknumber=", offsetof(TrackInfo, tracknr), SIZE_TRACKNR },
+	{ "date=",        offsetof(TrackInfo, date),    SIZE_DATE },
+	{ "comment=",     offsetof(TrackInfo, comment), SIZE_COMMENT },
+	{ NULL,           0,                            0 }
 };
 
-static int read_tags(OggOpusFile *oof, int li, struct _trackinfo_mapping *tim)
+static int read_tags(OggOpusFile *oof, int li, TrackInfo *ti)
 {
 	const OpusTags *tags = op_tags(oof, li);
 	int             ci, i;
@@ -124,9 +117,10 @@ static int read_tags(OggOpusFile *oof, int li, struct _trackinfo_mapping *tim)
 			for (i = 0; tim[i].key; i++) {
 				int len = strlen(tim[i].key);
 				if (strncasecmp(tags->user_comments[ci], tim[i].key, len) == 0) {
+					char *target = (char *)ti + tim[i].offset;
 					wdprintf(V_INFO, "opus", "%s> %s\n", tim[i].key, tags->user_comments[ci]+len);
-					strncpy(tim[i].target, tags->user_comments[ci]+len, tim[i].maxlen);
-					tim[i].target[tim[i].maxlen-1] = '\0';
+					strncpy(target, tags->user_comments[ci]+len, tim[i].maxlen);
+					target[tim[i].maxlen-1] = '\0';
 					res = 1;
 				}
 			}
@@ -135,65 +129,93 @@ static int read_tags(OggOpusFile *oof, int li, struct _trackinfo_mapping *tim)
 	return res;
 }
 
-static int decode_data(char *target, size_t max_size)
+static GmuDecoderInstance *create_instance(void)
 {
-	int        res = 0;
-	static int prev_li = -1;
-	int        samples = 0;
-	int        li = op_current_link(oof);
-
-	if (li != prev_li) {
-		prev_li = li;
-		if (read_tags(oof, li, tim)) trackinfo_set_updated(&ti);
+	GmuDecoderInstance *inst = malloc(sizeof(GmuDecoderInstance));
+	if (inst) {
+		inst->seek_to_sample_offset = 0;
+		inst->sample_rate = 0;
+		inst->channels = 0;
+		inst->bitrate = 0;
+		trackinfo_init(&(inst->ti), 0);
+		inst->r = NULL;
+		inst->oof = NULL;
+		inst->seek_request = 0;
+		inst->prev_li = -1;
+	}
+	return inst;
+}
+
+static int close_file(GmuDecoderInstance *inst);
+
+static void destroy_instance(GmuDecoderInstance *inst)
+{
+	if (inst) {
+		close_file(inst);
+		free(inst);
+	}
+}
+
+static int decode_data(GmuDecoderInstance *inst, char *target, size_t max_size)
+{
+	int res = 0;
+	int samples = 0;
+	int li = op_current_link(inst->oof);
+
+	if (li != inst->prev_li) {
+		inst->prev_li = li;
+		if (read_tags(inst->oof, li, &(inst->ti))) trackinfo_set_updated(&(inst->ti));
 	}
 
-	if (seek_request && reader_is_seekable(r) && seek_to_sample_offset >= 0) {
-		wdprintf(V_DEBUG, "opus", "Seeking requested to sample %d.\n", seek_to_sample_offset);
-		if (op_pcm_seek(oof, seek_to_sample_offset) != 0)
+	if (inst->seek_request && reader_is_seekable(inst->r) && inst->seek_to_sample_offset >= 0) {
+		wdprintf(V_DEBUG, "opus", "Seeking requested to sample %d.\n", inst->seek_to_sample_offset);
+		if (op_pcm_seek(inst->oof, inst->seek_to_sample_offset) != 0)
 			wdprintf(V_WARNING, "opus", "Seeking failed.\n");
-		seek_to_sample_offset = 0;
-		seek_request = 0;
+		inst->seek_to_sample_offset = 0;
+		inst->seek_request = 0;
 	}
 
-	if (channels > 1)
-		samples = op_read_stereo(oof, (opus_int16 *)target, max_size / 2);
-	else if (channels == 1)
-		samples = op_read(oof, (opus_int16 *)target, max_size / 2, NULL);
+	if (inst->channels > 1)
+		samples = op_read_stereo(inst->oof, (opus_int16 *)target, max_size / 2);
+	else if (inst->channels == 1)
+		samples = op_read(inst->oof, (opus_int16 *)target, max_size / 2, NULL);
 	if (samples > 0)
-		res = samples * 2 * channels;
+		res = samples * 2 * inst->channels;
 	return res;
 }
 
-static int opus_play_file(const char *opus_file)
+static int opus_play_file(GmuDecoderInstance *inst, const char *opus_file)
 {
 	int result = 1, error;
 	OpusFileCallbacks ofc;
 	int available_bytes;
 
 	wdprintf(V_DEBUG, "opus", "Initializing.\n");
-	trackinfo_init(&ti, 0);
+	trackinfo_clear(&(inst->ti));
+	inst->prev_li = -1;
 
 	ofc.read  = read_func;
 	ofc.seek  = seek_func;
 	ofc.tell  = tell_func;
 	ofc.close = close_func;
 
-	if (r) {
-		available_bytes = reader_get_number_of_bytes_in_buffer(r);
+	if (inst->r) {
+		available_bytes = reader_get_number_of_bytes_in_buffer(inst->r);
 
 		wdprintf(V_DEBUG, "opus", "Available bytes in buffer: %d\n", available_bytes);
-		oof = op_open_callbacks(r, &ofc, (unsigned char *)reader_get_buffer(r),
-								available_bytes, &error);
+		inst->oof = op_open_callbacks(inst->r, &ofc, (unsigned char *)reader_get_buffer(inst->r),
+		                              available_bytes, &error);
 
 		wdprintf(V_INFO, "opus", "Stream open result: %d\n", error);
 		if (error) {
+			inst->oof = NULL;
 			result = 0;
 		} else {
-			int li = op_current_link(oof);
-			read_tags(oof, li, tim);
-			channels = op_channel_count(oof, -1);
-			bitrate  = op_bitrate(oof, -1);
-			sample_rate = 48000;
+			int li = op_current_link(inst->oof);
+			read_tags(inst->oof, li, &(inst->ti));
+			inst->channels    = op_channel_count(inst->oof, -1);
+			inst->bitrate     = op_bitrate(inst->oof, -1);
+			inst->sample_rate = 48000;
 		}
 	} else {
 		wdprintf(V_WARNING, "opus", "Reader was unable to open stream/file.\n");
@@ -202,26 +224,34 @@ static int opus_play_file(const char *opus_file)
 	return result;
 }
 
-static int opus_seek_to(int offset_seconds)
+static int opus_seek_to_sample(GmuDecoderInstance *inst, long sample)
 {
 	int res = 0;
-	if (offset_seconds >= 0) {
-		seek_to_sample_offset = offset_seconds * sample_rate;
-		seek_request = 1;
+	if (sample >= 0) {
+		inst->seek_to_sample_offset = sample;
+		inst->seek_request = 1;
 		res = 1;
 	}
 	return res;
 }
 
-static int close_file(void)
+static int opus_seek_to(GmuDecoderInstance *inst, int offset_seconds)
+{
+	return opus_seek_to_sample(inst, (long)offset_seconds * inst->sample_rate);
+}
+
+static int close_file(GmuDecoderInstance *inst)
 {
-	wdprintf(V_DEBUG, "opus", "Closing file.\n");
-	op_free(oof);
-	init = 0;
+	if (inst->oof) {
+		wdprintf(V_DEBUG, "opus", "Closing file.\n");
+		op_free(inst->oof);
+		inst->oof = NULL;
+	}
+	trackinfo_clear(&(inst->ti));
 	return 0;
 }
 
-static int get_decoder_buffer_size(void)
+static int get_decoder_buffer_size(GmuDecoderInstance *inst)
 {
 	return 256;
 }
@@ -231,37 +261,36 @@ static const char* get_file_extensions(void)
 	return ".opus";
 }
 
-static int get_current_bitrate(void)
+static int get_current_bitrate(GmuDecoderInstance *inst)
 {
-	return op_bitrate_instant(oof);
+	return op_bitrate_instant(inst->oof);
 }
 
-static int get_length(void)
+static int get_length(GmuDecoderInstance *inst)
 {
-	ogg_int64_t samples = op_pcm_total(oof, -1);
+	ogg_int64_t samples = op_pcm_total(inst->oof, -1);
 	return samples == OP_EINVAL ? 0 : samples / 48000;
 }
 
-static int get_samplerate(void)
+static int get_samplerate(GmuDecoderInstance *inst)
 {
-	return sample_rate;
+	return inst->sample_rate;
 }
 
-static int get_channels(void)
+static int get_channels(GmuDecoderInstance *inst)
 {
-	return channels;
+	return inst->channels;
 }
 
-static int get_bitrate(void)
+static int get_bitrate(GmuDecoderInstance *inst)
 {
-	return bitrate;
+	return inst->bitrate;
 }
 
-static int get_meta_data_int(GmuMetaDataType gmdt, int for_current_file)
+static int get_meta_data_int(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
 {
-	int result = 0;
-	TrackInfo *t = &ti_metaonly;;
-	if (for_current_file) t = &ti;
+	int        result = 0;
+	TrackInfo *t = &(inst->ti);
 
 	switch (gmdt) {
 		case GMU_META_IMAGE_DATA_SIZE:
@@ -276,11 +305,10 @@ static int get_meta_data_int(GmuMetaDataType gmdt, int for_current_file)
 	return result;
 }
 
-static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
+static const char *get_meta_data(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
 {
-	char *result = NULL;
-	TrackInfo *t = &ti_metaonly;;
-	if (for_current_file) t = &ti;
+	char      *result = NULL;
+	TrackInfo *t = &(inst->ti);
 
 	switch (gmdt) {
 		case GMU_META_ARTIST:
@@ -310,7 +338,7 @@ static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
 	return result;
 }
 
-static const char *get_file_type(void)
+static const char *get_file_type(GmuDecoderInstance *inst)
 {
 	return "Ogg Opus Audio";
 }
@@ -320,7 +348,7 @@ static const char *get_mime_types(void)
 	return "audio/ogg";
 }
 
-static int meta_data_load(const char *filename)
+static int meta_data_load(GmuDecoderInstance *inst, const char *filename)
 {
 	int result = 0, error;
 	OpusFileCallbacks ofc;
@@ -328,7 +356,7 @@ static int meta_data_load(const char *filename)
 	OggOpusFile *oof_tmp;
 
 	wdprintf(V_DEBUG, "opus", "Initializing.\n");
-	trackinfo_init(&ti, 0);
+	trackinfo_clear(&(inst->ti));
 
 	ofc.read  = read_func;
 	ofc.seek  = seek_func;
@@ -344,22 +372,16 @@ static int meta_data_load(const char *filename)
 			result = 0;
 		} else {
 			int li = op_current_link(oof_tmp);
-			read_tags(oof_tmp, li, tim_metaonly);
+			read_tags(oof_tmp, li, &(inst->ti));
 			result = 1;
 		}
-		op_free(oof_tmp);
+		if (oof_tmp) op_free(oof_tmp);
 		reader_close(re);
 	}
 	return result;
 }
 
-static int meta_data_close(void)
-{
-	trackinfo_clear(&ti_metaonly);
-	return 1;
-}
-
-static GmuCharset meta_data_get_charset(void)
+static GmuCharset meta_data_get_charset(GmuDecoderInstance *inst)
 {
 	return M_CHARSET_UTF_8;
 }
@@ -367,7 +389,7 @@ static GmuCharset meta_data_get_charset(void)
 static int data_check_magic_bytes(const char *data, size_t size)
 {
 	int res = 0;
-	if (strncmp(data, "OggS", 4) == 0) { /* Ok, we've got an Ogg container */
+	if (size >= 36 && strncmp(data, "OggS", 4) == 0) { /* Ok, we've got an Ogg container */
 		if (strncmp(data+28, "OpusHead", 8) == 0) {
 			res = 1;
 			wdprintf(V_DEBUG, "opus", "Magic check: Ogg Opus data detected!\n");
@@ -376,12 +398,13 @@ static int data_check_magic_bytes(const char *data, size_t size)
 	return res;
 }
 
-static void set_reader_handle(Reader *reader)
+static void set_reader_handle(GmuDecoderInstance *inst, Reader *reader)
 {
-	r = reader;
+	inst->r = reader;
 }
 
-static GmuDecoder gd = {
+static GmuDecoderV2 gd = {
+	GMU_DECODER_API_VERSION,
 	"opus_decoder",
 	NULL,
 	NULL,
@@ -389,6 +412,10 @@ static GmuDecoder gd = {
 	NULL,
 	get_file_extensions,
 	get_mime_types,
+	data_check_magic_bytes,
+	create_instance,
+	destroy_instance,
+	set_reader_handle,
 	opus_play_file,
 	close_file,
 	decode_data,
@@ -403,14 +430,13 @@ static GmuDecoder gd = {
 	get_file_type,
 	get_decoder_buffer_size,
 	meta_data_load,
-	meta_data_close,
 	meta_data_get_charset,
-	data_check_magic_bytes,
-	set_reader_handle,
+	opus_seek_to_sample,
+	NULL,
 	NULL
 };
 
-GmuDecoder *GMU_REGISTER_DECODER(void)
+GmuDecoderV2 *GMU_REGISTER_DECODER_V2(void)
 {
 	return &gd;
 }
@@ -23,9 +23,12 @@
 #include "tremor/ivorbisfile.h"
 #include "../debug.h"
 
-static OggVorbis_File  vf, vf_metaonly;
-static vorbis_info    *vi;
-static Reader         *r;
+struct _GmuDecoderInstance {
+	OggVorbis_File  vf;
+	vorbis_info    *vi;
+	Reader         *r;
+	int             vf_open, current_section;
+};
 
 static const char *get_name(void)
 {
@@ -40,7 +43,8 @@ static size_t read_callback(void *buffer, size_t size, size_t nmemb, void *datas
 	 * in the buffer already, otherwise we initiate a read operation with
 	 * the desired size.
 	 */
-	size_t bs = reader_get_number_of_bytes_in_buffer(r);
+	Reader *r  = (Reader *)datasource;
+	size_t  bs = reader_get_number_of_bytes_in_buffer(r);
 
 	if (bs <= 0) {
 		if (reader_read_bytes(r, size * nmemb)) {
@@ -63,7 +67,7 @@ static size_t read_callback(void *buffer, size_t size, size_t nmemb, void *datas
 
 static long tell_callback(void *datasource)
 {
-	return reader_get_stream_position(r);
+	return reader_get_stream_position((Reader *)datasource);
 }
 
 /* Returns 0 on success or -1 if seeking is unsupported or an error occured */
@@ -78,17 +82,39 @@ static int seek_callback(void *datasource, ogg_int64_t offset, int whence)
 	return res;
 }
 
-static ov_callbacks callbacks;
+static GmuDecoderInstance *create_instance(void)
+{
+	GmuDecoderInstance *inst = malloc(sizeof(GmuDecoderInstance));
+	if (inst) {
+		inst->vi = NULL;
+		inst->r = NULL;
+		inst->vf_open = 0;
+		inst->current_section = 0;
+	}
+	return inst;
+}
+
+static int close_file(GmuDecoderInstance *inst);
 
-static int open_file(const char *filename)
+static void destroy_instance(GmuDecoderInstance *inst)
 {
-	int res = 0;
+	if (inst) {
+		close_file(inst);
+		free(inst);
+	}
+}
+
+static int open_file(GmuDecoderInstance *inst, const char *filename)
+{
+	int          res = 0;
+	ov_callbacks callbacks;
 
-	callbacks.read_func = read_callback;
-	callbacks.tell_func = tell_callback;
-	callbacks.seek_func = seek_callback;
+	callbacks.read_func  = read_callback;
+	callbacks.tell_func  = tell_callback;
+	callbacks.seek_func  = seek_callback;
+	callbacks.close_func = NULL;
 
-	if (!r) {
+	if (!inst->r) {
 		wdprintf(V_WARNING, "flac", "Unable to open stream: %s\n", filename);
 		return 0;
 	}
@@ -96,33 +122,34 @@ static int open_file(const char *filename)
 	 * read some bytes from the file/stream to determine mime type, which
 	 * upsets the Vorbis decoder, when it tries to do a relative seek at
 	 * the beginning and expects to be at absolute position 0: */
-	reader_seek(r, 0);
+	reader_seek(inst->r, 0);
 
-	if (ov_open_callbacks(r, &vf, NULL, 0, callbacks) < 0) {
+	if (ov_open_callbacks(inst->r, &(inst->vf), NULL, 0, callbacks) < 0) {
 		wdprintf(V_WARNING, "vorbis", "Input does not appear to be an Ogg bitstream.\n");
 	} else {
-		vi  = ov_info(&vf, -1);
+		inst->vi      = ov_info(&(inst->vf), -1);
+		inst->vf_open = 1;
 		res = 1;
 	}
 	return res;
 }
 
-static int close_file(void)
+static int close_file(GmuDecoderInstance *inst)
 {
-	ov_clear(&vf);
+	if (inst->vf_open) ov_clear(&(inst->vf));
+	inst->vf_open = 0;
 	return 0;
 }
 
-static int decode_data(char *target, size_t max_size)
+static int decode_data(GmuDecoderInstance *inst, char *target, size_t max_size)
 {
-	int        size = -1;
-	static int current_section;
+	int size = -1;
 
 	if (4096 <= max_size) {
 		int i;
 		/* In case of a (temporary) error (e.g. OV_HOLE), we retry a few times before giving up */
 		for (i = 0; i < 10 && size < 0; i++) {
-			size = ov_read(&vf, target, 4096, &current_section);
+			size = ov_read(&(inst->vf), target, 4096, &(inst->current_section));
 			if (size > 0) break;
 		}
 	} else {
@@ -131,17 +158,22 @@ static int decode_data(char *target, size_t max_size)
 	return size;
 }
 
-static int seek(int seconds)
+static int seek(GmuDecoderInstance *inst, int seconds)
 {
 	int  unsuccessful = 1;
 	long pos = seconds * 1000;
 
 	if (pos <= 0) pos = 0;
-	unsuccessful = ov_time_seek_page(&vf, pos);
+	unsuccessful = ov_time_seek_page(&(inst->vf), pos);
 	return !unsuccessful;
 }
 
-static int get_decoder_buffer_size(void)
+static int seek_sample(GmuDecoderInstance *inst, long sample)
+{
+	return ov_pcm_seek(&(inst->vf), sample > 0 ? sample : 0) == 0;
+}
+
+static int get_decoder_buffer_size(GmuDecoderInstance *inst)
 {
 	return 4096;
 }
@@ -151,43 +183,39 @@ static const char* get_file_extensions(void)
 	return ".ogg;.oga";
 }
 
-static int get_current_bitrate(void)
+static int get_current_bitrate(GmuDecoderInstance *inst)
 {
-	return ov_bitrate_instant(&vf);
+	return ov_bitrate_instant(&(inst->vf));
 }
 
-static int get_length(void)
+static int get_length(GmuDecoderInstance *inst)
 {
-	return ov_time_total(&vf, -1) / 1000;
+	return ov_time_total(&(inst->vf), -1) / 1000;
 }
 
-static int get_samplerate(void)
+static int get_samplerate(GmuDecoderInstance *inst)
 {
-	return vi->rate;
+	return inst->vi->rate;
 }
 
-static int get_channels(void)
+static int get_channels(GmuDecoderInstance *inst)
 {
-	return vi->channels;
+	return inst->vi->channels;
 }
 
-static int get_bitrate(void)
+static int get_bitrate(GmuDecoderInstance *inst)
 {
-	return ov_bitrate(&vf, -1);
+	return ov_bitrate(&(inst->vf), -1);
 }
 
-static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
+static const char *get_meta_data(GmuDecoderInstance *inst, GmuMetaDataType gmdt)
 {
 	char *result = NULL;
 	char **ptr   = NULL;
 
-	if (for_current_file) {
-		ptr = ov_comment(&vf, -1)->user_comments;
-	} else {
-		ptr = ov_comment(&vf_metaonly, -1)->user_comments;
-	}
+	if (inst->vf_open) ptr = ov_comment(&(inst->vf), -1)->user_comments;
 
-	while (*ptr) {
+	while (ptr && *ptr) {
 		char buf[80];
 		strtoupper(buf, *ptr, 79);
 		switch (gmdt) {
@@ -219,20 +247,23 @@ static const char *get_meta_data(GmuMetaDataType gmdt, int for_current_file)
 	return result;
 }
 
-static const char *get_file_type(void)
+static const char *get_file_type(GmuDecoderInstance *inst)
 {
 	return "Ogg Vorbis";
 }
 
-static int meta_data_load(const char *filename)
+static int meta_data_load(GmuDecoderInstance *inst, const char *filename)
 {
 	FILE *file;
 	int   result = 1;
 
 	if ((file = fopen(filename, "r"))) {
-		if (ov_open(file, &vf_metaonly, NULL, 0) < 0) {
+		if (ov_open(file, &(inst->vf), NULL, 0) < 0) {
 			wdprintf(V_WARNING, "vorbis", "Input does not appear to be an Ogg bitstream.\n");
+			fclose(file);
 			result = 0;
+		} else {
+			inst->vf_open = 1;
 		}
 	} else {
 		result = 0;
@@ -240,23 +271,18 @@ static int meta_data_load(const char *filename)
 	return result;
 }
 
-static int meta_data_close(void)
-{
-	ov_clear(&vf_metaonly);
-	return 1;
-}
-
-static GmuCharset meta_data_get_charset(void)
+static GmuCharset meta_data_get_charset(GmuDecoderInstance *inst)
 {
 	return M_CHARSET_UTF_8;
 }
 
-static void set_reader_handle(Reader *reader)
+static void set_reader_handle(GmuDecoderInstance *inst, Reader *reader)
 {
-	r = reader;
+	inst->r = reader;
 }
 
-static GmuDecoder gd = {
+static GmuDecoderV2 gd = {
+	GMU_DECODER_API_VERSION,
 	"vorbis_decoder",
 	NULL,
 	NULL,
@@ -264,6 +290,10 @@ static GmuDecoder gd = {
 	NULL,
 	get_file_extensions,
 	NULL,
+	NULL,
+	create_instance,
+	destroy_instance,
+	set_reader_handle,
 	open_file,
 	close_file,
 	decode_data,
@@ -278,14 +308,13 @@ static GmuDecoder gd = {
 	get_file_type,
 	get_decoder_buffer_size,
 	meta_data_load,
-	meta_data_close,
 	meta_data_get_charset,
+	seek_sample,
 	NULL,
-	set_reader_handle,
 	NULL
 };
 
-GmuDecoder *GMU_REGISTER_DECODER(void)
+GmuDecoderV2 *GMU_REGISTER_DECODER_V2(void)
 {
 	return &gd;
 }
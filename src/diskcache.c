@@ -0,0 +1,378 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: diskcache.c  Created: 261016
+ *
+ * Description: Persistent disk cache for remote audio files
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "diskcache.h"
+#include "util.h"
+#include "debug.h"
+
+#define INDEX_FILE      "index"
+#define INDEX_LINE_MAX  8192
+#define PART_SUFFIX     ".part"
+
+/* The cache directory contains one file per entry, named after a hash of
+ * the entry's key, and an index file with one line per entry:
+ * name, size, time of last use, ETag, Last-Modified and URL, separated by
+ * tabs. Unknown validators are stored as empty strings. */
+typedef struct _DiskCacheEntry {
+	char                    name[17];
+	char                   *url, *etag, *last_modified;
+	unsigned long           size;
+	long                    last_used;
+	struct _DiskCacheEntry *next;
+} DiskCacheEntry;
+
+struct _DiskCacheWriter {
+	FILE          *file;
+	char          *tmp_path, *url, *etag, *last_modified;
+	unsigned long  size, written;
+	int            failed;
+};
+
+static pthread_mutex_t     mutex = PTHREAD_MUTEX_INITIALIZER;
+static int                 enabled;
+static char               *cache_dir;
+static unsigned long long  max_size, total_size;
+static DiskCacheEntry     *entries;
+static unsigned int        writer_counter;
+
+static char *str_copy_alloc(const char *str)
+{
+	char *res = malloc(str ? strlen(str) + 1 : 1);
+
+	if (res) strcpy(res, str ? str : "");
+	return res;
+}
+
+static char *path_alloc(const char *name, const char *suffix)
+{
+	size_t len = strlen(cache_dir) + 1 + strlen(name) + (suffix ? strlen(suffix) : 0) + 1;
+	char  *path = malloc(len);
+
+	if (path) snprintf(path, len, "%s/%s%s", cache_dir, name, suffix ? suffix : "");
+	return path;
+}
+
+/* FNV-1a hash of the entry key, used as file name */
+static void key_to_name(const char *url, const char *etag, const char *last_modified, char name[17])
+{
+	const char         *parts[3];
+	unsigned long long  hash = 14695981039346656037ULL;
+	int                 i;
+
+	parts[0] = url;
+	parts[1] = etag ? etag : "";
+	parts[2] = last_modified ? last_modified : "";
+	for (i = 0; i < 3; i++) {
+		const unsigned char *c;
+
+		for (c = (const unsigned char *)parts[i]; *c; c++) {
+			hash ^= *c;
+			hash *= 1099511628211ULL;
+		}
+		hash ^= '\n';
+		hash *= 1099511628211ULL;
+	}
+	snprintf(name, 17, "%016llx", hash);
+}
+
+static void entry_free(DiskCacheEntry *entry)
+{
+	free(entry->url);
+	free(entry->etag);
+	free(entry->last_modified);
+	free(entry);
+}
+
+/* Removes the entry from the list and deletes its file */
+static void entry_remove(DiskCacheEntry *entry)
+{
+	DiskCacheEntry **e;
+	char            *path = path_alloc(entry->name, NULL);
+
+	for (e = &entries; *e; e = &((*e)->next)) {
+		if (*e == entry) {
+			*e = entry->next;
+			break;
+		}
+	}
+	if (path) {
+		remove(path);
+		free(path);
+	}
+	total_size -= entry->size;
+	entry_free(entry);
+}
+
+static void index_save(void)
+{
+	char *path = path_alloc(INDEX_FILE, NULL), *tmp_path = path_alloc(INDEX_FILE, PART_SUFFIX);
+	FILE *f = tmp_path ? fopen(tmp_path, "w") : NULL;
+
+	if (f) {
+		DiskCacheEntry *e;
+		int             ok = 1;
+
+		for (e = entries; e && ok; e = e->next)
+			ok = fprintf(f, "%s\t%lu\t%ld\t%s\t%s\t%s\n",
+			             e->name, e->size, e->last_used, e->etag, e->last_modified, e->url) > 0;
+		if (fclose(f) == 0 && ok && path) rename(tmp_path, path);
+	} else {
+		wdprintf(V_WARNING, "diskcache", "Unable to write the cache index.\n");
+	}
+	free(tmp_path);
+	free(path);
+}
+
+/* Splits off the next tab separated field of line, returns the rest */
+static char *next_field(char *line)
+{
+	char *tab = line ? strchr(line, '\t') : NULL;
+
+	if (tab) *tab = '\0';
+	return tab ? tab + 1 : NULL;
+}
+
+/* Loads the index, dropping entries whose files are gone or incomplete */
+static void index_load(void)
+{
+	char *path = path_alloc(INDEX_FILE, NULL);
+	FILE *f = path ? fopen(path, "r") : NULL;
+	char *line = malloc(INDEX_LINE_MAX);
+
+	while (f && line && fgets(line, INDEX_LINE_MAX, f)) {
+		char           *size = next_field(line), *used = next_field(size), *etag = next_field(used);
+		char           *last_modified = next_field(etag), *url = next_field(last_modified);
+		DiskCacheEntry *entry;
+		char           *file;
+		struct stat     st;
+		size_t          len;
+
+		if (!url || strlen(line) != 16) continue;
+		len = strlen(url);
+		if (len > 0 && url[len-1] == '\n') url[len-1] = '\0';
+		if (!(entry = calloc(1, sizeof(DiskCacheEntry)))) break;
+		strcpy(entry->name, line);
+		entry->size = strtoul(size, NULL, 10);
+		entry->last_used = atol(used);
+		entry->url = str_copy_alloc(url);
+		entry->etag = str_copy_alloc(etag);
+		entry->last_modified = str_copy_alloc(last_modified);
+		file = path_alloc(entry->name, NULL);
+		if (entry->url && entry->etag && entry->last_modified && file &&
+		    stat(file, &st) == 0 && (unsigned long)st.st_size == entry->size) {
+			entry->next = entries;
+			entries = entry;
+			total_size += entry->size;
+		} else {
+			if (file) remove(file);
+			entry_free(entry);
+		}
+		free(file);
+	}
+	if (f) fclose(f);
+	free(line);
+	free(path);
+}
+
+/* Deletes files left behind by interrupted downloads */
+static void remove_partial_files(void)
+{
+	DIR           *dir = opendir(cache_dir);
+	struct dirent *de;
+	size_t         suffix_len = strlen(PART_SUFFIX);
+
+	while (dir && (de = readdir(dir))) {
+		size_t len = strlen(de->d_name);
+
+		if (len > suffix_len && strcmp(de->d_name + len - suffix_len, PART_SUFFIX) == 0) {
+			char *path = path_alloc(de->d_name, NULL);
+
+			if (path) {
+				remove(path);
+				free(path);
+			}
+		}
+	}
+	if (dir) closedir(dir);
+}
+
+/* Removes the least recently used entries until size more bytes fit */
+static void evict(unsigned long long size)
+{
+	while (entries && total_size + size > max_size) {
+		DiskCacheEntry *e, *lru = entries;
+
+		for (e = entries; e; e = e->next)
+			if (e->last_used < lru->last_used) lru = e;
+		wdprintf(V_DEBUG, "diskcache", "Removing %s from the cache.\n", lru->url);
+		entry_remove(lru);
+	}
+}
+
+int disk_cache_init(const char *dir, size_t max_mb)
+{
+	pthread_mutex_lock(&mutex);
+	if (!enabled && dir && max_mb > 0 && (cache_dir = str_copy_alloc(dir))) {
+		rmkdir(cache_dir, S_IRWXU);
+		max_size = (unsigned long long)max_mb * 1024 * 1024;
+		total_size = 0;
+		remove_partial_files();
+		index_load();
+		evict(0);
+		index_save();
+		enabled = 1;
+		wdprintf(V_INFO, "diskcache", "Cache in %s: %llu of %lu MB used.\n",
+		         cache_dir, total_size / (1024 * 1024), (unsigned long)max_mb);
+	}
+	pthread_mutex_unlock(&mutex);
+	return enabled;
+}
+
+void disk_cache_free(void)
+{
+	pthread_mutex_lock(&mutex);
+	if (enabled) {
+		index_save();
+		while (entries) {
+			DiskCacheEntry *next = entries->next;
+			entry_free(entries);
+			entries = next;
+		}
+		free(cache_dir);
+		cache_dir = NULL;
+		enabled = 0;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+char *disk_cache_get_file_alloc(const char *url, const char *etag, const char *last_modified, unsigned long size)
+{
+	DiskCacheEntry *e;
+	char           *path = NULL;
+
+	pthread_mutex_lock(&mutex);
+	for (e = enabled ? entries : NULL; e; e = e->next)
+		if (strcmp(e->url, url) == 0) break;
+	if (e && size > 0 && (e->size != size || strcmp(e->etag, etag ? etag : "") != 0 ||
+	                      strcmp(e->last_modified, last_modified ? last_modified : "") != 0)) {
+		wdprintf(V_DEBUG, "diskcache", "Cached copy of %s is outdated.\n", url);
+		entry_remove(e);
+		index_save();
+		e = NULL;
+	}
+	if (e && (path = path_alloc(e->name, NULL))) {
+		e->last_used = (long)time(NULL);
+		index_save();
+	}
+	pthread_mutex_unlock(&mutex);
+	return path;
+}
+
+DiskCacheWriter *disk_cache_writer_open(const char *url, const char *etag, const char *last_modified, unsigned long size)
+{
+	DiskCacheWriter *w = NULL;
+
+	pthread_mutex_lock(&mutex);
+	if (enabled && size > 0 && size <= max_size && (w = calloc(1, sizeof(DiskCacheWriter)))) {
+		char name[17], suffix[32];
+
+		key_to_name(url, etag, last_modified, name);
+		snprintf(suffix, sizeof(suffix), ".%u%s", writer_counter++, PART_SUFFIX);
+		w->url = str_copy_alloc(url);
+		w->etag = str_copy_alloc(etag);
+		w->last_modified = str_copy_alloc(last_modified);
+		w->tmp_path = path_alloc(name, suffix);
+		w->size = size;
+		if (!w->url || !w->etag || !w->last_modified || !w->tmp_path || !(w->file = fopen(w->tmp_path, "wb"))) {
+			free(w->url);
+			free(w->etag);
+			free(w->last_modified);
+			free(w->tmp_path);
+			free(w);
+			w = NULL;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return w;
+}
+
+void disk_cache_writer_write(DiskCacheWriter *w, const char *data, size_t len, unsigned long offset)
+{
+	if (w && !w->failed && offset <= w->written && offset + len > w->written) {
+		size_t skip = w->written - offset;
+
+		if (fwrite(data + skip, 1, len - skip, w->file) == len - skip)
+			w->written += len - skip;
+		else
+			w->failed = 1;
+	}
+}
+
+void disk_cache_writer_close(DiskCacheWriter *w)
+{
+	if (w) {
+		int ok = fclose(w->file) == 0 && !w->failed && w->written == w->size;
+
+		pthread_mutex_lock(&mutex);
+		if (ok && enabled) {
+			DiskCacheEntry *e, *entry = calloc(1, sizeof(DiskCacheEntry));
+			char           *path = NULL;
+
+			if (entry) {
+				key_to_name(w->url, w->etag, w->last_modified, entry->name);
+				path = path_alloc(entry->name, NULL);
+			}
+			if (path) {
+				/* Replace older copies of the file */
+				for (e = entries; e; ) {
+					DiskCacheEntry *next = e->next;
+					if (strcmp(e->url, w->url) == 0 || strcmp(e->name, entry->name) == 0) entry_remove(e);
+					e = next;
+				}
+				evict(w->size);
+				if (rename(w->tmp_path, path) == 0) {
+					entry->url = w->url;
+					entry->etag = w->etag;
+					entry->last_modified = w->last_modified;
+					w->url = w->etag = w->last_modified = NULL;
+					entry->size = w->size;
+					entry->last_used = (long)time(NULL);
+					entry->next = entries;
+					entries = entry;
+					entry = NULL;
+					total_size += w->size;
+					index_save();
+					wdprintf(V_DEBUG, "diskcache", "Cached %s (%lu bytes).\n", entries->url, entries->size);
+				}
+				free(path);
+			}
+			if (entry) free(entry);
+		}
+		pthread_mutex_unlock(&mutex);
+		remove(w->tmp_path); /* Fails when it has been added to the cache */
+		free(w->url);
+		free(w->etag);
+		free(w->last_modified);
+		free(w->tmp_path);
+		free(w);
+	}
+}
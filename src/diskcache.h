@@ -0,0 +1,50 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: diskcache.h  Created: 261016
+ *
+ * Description: Persistent disk cache for remote audio files
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _DISKCACHE_H
+#define _DISKCACHE_H
+#include <sys/types.h>
+
+/*
+ * Files fetched over HTTP are written through to the cache while they
+ * are being read. Once a file has been received completely, it replaces
+ * any older copy of the same URL. Entries are identified by their URL
+ * and the server's ETag and Last-Modified headers, so a changed file is
+ * fetched again. The least recently used entries are removed when the
+ * cache grows beyond its size limit.
+ */
+typedef struct _DiskCacheWriter DiskCacheWriter;
+
+/* Enables the cache in the given directory, limited to max_mb MB.
+ * Returns 1 on success, 0 if the cache is disabled or unavailable. */
+int              disk_cache_init(const char *dir, size_t max_mb);
+void             disk_cache_free(void);
+/* Returns the path of the cached copy of url (to be freed by the caller)
+ * or NULL. When size is non-zero, the copy has to match the given size
+ * and validators (etag/last_modified, NULL if unknown). With size 0, any
+ * copy of url is returned, e.g. when the server cannot be reached. */
+char            *disk_cache_get_file_alloc(const char *url, const char *etag,
+                                           const char *last_modified, unsigned long size);
+/* Starts caching a file of the given size. Returns NULL when the file
+ * cannot be cached, e.g. because it is too large. */
+DiskCacheWriter *disk_cache_writer_open(const char *url, const char *etag,
+                                        const char *last_modified, unsigned long size);
+/* Passes on data received from the given offset on. Data that does not
+ * continue what has been written so far is ignored. */
+void             disk_cache_writer_write(DiskCacheWriter *w, const char *data, size_t len, unsigned long offset);
+/* Adds the file to the cache, if it has been written completely, and
+ * frees the writer */
+void             disk_cache_writer_close(DiskCacheWriter *w);
+#endif
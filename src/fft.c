@@ -0,0 +1,134 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: fft.c  Created: 261016
+ *
+ * Description: Fixed-point FFT for the spectrum analyzer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <math.h>
+#include "fft.h"
+#include "fmath.h"
+
+/* Angle 2*PI*k/n in units as expected by fsin()/fcos() */
+static int fft_angle(int k, int n)
+{
+	return (int)((long)F_PI2 * k / n);
+}
+
+int fft_spectrum_init(FFTSpectrum *fs, int size, int bands)
+{
+	int res = 0;
+
+	if ((size == 256 || size == 512 || size == 1024) && bands > 0 && bands <= FFT_MAX_BANDS) {
+		int    i, bins = size / 2;
+		double ratio;
+
+		fs->size = size;
+		for (fs->log2_size = 0; (1 << fs->log2_size) < size; fs->log2_size++);
+		if (bands > bins - 1) bands = bins - 1;
+		fs->bands = bands;
+
+		for (i = 0; i < size; i++) /* w(i) = 0.5 * (1 - cos(2*PI*i/(size-1))) */
+			fs->window[i] = (int16_t)((10000 - fcos(fft_angle(i, size - 1))) * 32767 / 20000);
+		for (i = 0; i < bins; i++) {
+			fs->tw_cos[i] = (int16_t)(fcos(fft_angle(i, size)) * 16384 / 10000);
+			fs->tw_sin[i] = (int16_t)(fsin(fft_angle(i, size)) * 16384 / 10000);
+		}
+
+		/* Logarithmic band edges between bin 1 and the Nyquist bin; every
+		 * band gets at least one bin. This is only done on (re)configuration,
+		 * so using floating point here is fine. */
+		ratio = pow((double)bins, 1.0 / bands);
+		fs->band_start[0] = 1;
+		for (i = 1; i <= bands; i++) {
+			int edge = (int)(pow(ratio, i) + 0.5);
+			if (edge <= fs->band_start[i-1]) edge = fs->band_start[i-1] + 1;
+			if (edge > bins - (bands - i)) edge = bins - (bands - i);
+			fs->band_start[i] = (int16_t)edge;
+		}
+		res = 1;
+	}
+	return res;
+}
+
+int fft_spectrum_get_size(FFTSpectrum *fs)
+{
+	return fs->size;
+}
+
+int fft_spectrum_get_number_of_bands(FFTSpectrum *fs)
+{
+	return fs->bands;
+}
+
+void fft_transform(FFTSpectrum *fs, int32_t *re, int32_t *im)
+{
+	int n = fs->size, i, j, len;
+
+	/* Bit reversal permutation */
+	for (i = 1, j = 0; i < n; i++) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			int32_t t;
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	/* Butterflies; every stage is scaled by 1/2 to keep values in range */
+	for (len = 2; len <= n; len <<= 1) {
+		int half = len >> 1, step = n / len;
+
+		for (i = 0; i < n; i += len) {
+			int k;
+			for (k = 0; k < half; k++) {
+				int     a = i + k, b = a + half;
+				int32_t wr = fs->tw_cos[k * step], wi = -fs->tw_sin[k * step];
+				int32_t tr = (re[b] * wr - im[b] * wi) >> 14;
+				int32_t ti = (re[b] * wi + im[b] * wr) >> 14;
+
+				re[b] = (re[a] - tr) >> 1;
+				im[b] = (im[a] - ti) >> 1;
+				re[a] = (re[a] + tr) >> 1;
+				im[a] = (im[a] + ti) >> 1;
+			}
+		}
+	}
+}
+
+void fft_spectrum_analyze(FFTSpectrum *fs, const int16_t *samples, int16_t *amplitudes)
+{
+	int i, b;
+
+	for (i = 0; i < fs->size; i++) {
+		fs->re[i] = (samples[i] * fs->window[i]) >> 15;
+		fs->im[i] = 0;
+	}
+	fft_transform(fs, fs->re, fs->im);
+
+	for (b = 0; b < fs->bands; b++) {
+		int32_t peak = 0;
+
+		for (i = fs->band_start[b]; i < fs->band_start[b+1]; i++) {
+			int32_t x = fs->re[i] < 0 ? -fs->re[i] : fs->re[i];
+			int32_t y = fs->im[i] < 0 ? -fs->im[i] : fs->im[i];
+			/* Alpha max plus beta min approximation of sqrt(x^2 + y^2) */
+			int32_t mag = x > y ? x + (y * 3 >> 3) : y + (x * 3 >> 3);
+			if (mag > peak) peak = mag;
+		}
+		/* A full-scale sine ends up at 1/4: 1/2 for the one-sided spectrum
+		 * and 1/2 for the coherent gain of the Hann window */
+		peak *= 4;
+		amplitudes[b] = (int16_t)(peak > 32767 ? 32767 : peak);
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: fft.h  Created: 261016
+ *
+ * Description: Fixed-point FFT for the spectrum analyzer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _FFT_H
+#define _FFT_H
+#include <stdint.h>
+
+#define FFT_MIN_SIZE  256
+#define FFT_MAX_SIZE  1024
+#define FFT_MAX_BANDS 64
+
+struct _FFTSpectrum
+{
+	int     size, log2_size, bands;
+	int16_t window[FFT_MAX_SIZE];          /* Hann window, Q15 */
+	int16_t tw_cos[FFT_MAX_SIZE / 2];      /* Twiddle factors, Q14 */
+	int16_t tw_sin[FFT_MAX_SIZE / 2];
+	int16_t band_start[FFT_MAX_BANDS + 1]; /* First FFT bin of each band */
+	int32_t re[FFT_MAX_SIZE], im[FFT_MAX_SIZE];
+};
+
+typedef struct _FFTSpectrum FFTSpectrum;
+
+/* In-place radix-2 FFT on 2^log2_size values. The result is scaled by
+ * 1/size to avoid overflows. Twiddle factors have to be taken from an
+ * FFTSpectrum object initialized with the same size. */
+void fft_transform(FFTSpectrum *fs, int32_t *re, int32_t *im);
+/* Initializes the analyzer for size points (256, 512 or 1024) and the
+ * given number of logarithmically spaced bands (1..FFT_MAX_BANDS).
+ * Returns 1 on success, 0 on invalid parameters. */
+int  fft_spectrum_init(FFTSpectrum *fs, int size, int bands);
+int  fft_spectrum_get_size(FFTSpectrum *fs);
+int  fft_spectrum_get_number_of_bands(FFTSpectrum *fs);
+/* Analyzes fs->size mono samples (oldest first) and stores the peak
+ * magnitude (0..32767, full-scale sine ~ 32767) of each band in amplitudes */
+void fft_spectrum_analyze(FFTSpectrum *fs, const int16_t *samples, int16_t *amplitudes);
+#endif
@@ -13,11 +13,11 @@
  * the License. See the file COPYING in the Gmu's main directory
  * for details.
  */
-#include "SDL/SDL.h"
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 #include "fileplayer.h"
 #include "audio.h"
 #include "trackinfo.h"
@@ -33,11 +33,18 @@
 #include "eventqueue.h"
 #include "gmuerror.h"
 #include "pthread_helper.h"
+#include "ringbuffer.h"
+#include "mixer.h"
+#include "resampler.h"
+#include "pcmcache.h"
 
 #define BUF_SIZE 65536
+/* Track requests that follow each other more closely than this are
+ * coalesced, so only the last requested track gets opened */
+#define OPEN_DEBOUNCE_MS 250
 
 static char            lyrics_file_pattern[256];
-static long            seek_second;
+static long            seek_ms; /* Requested seek position in milliseconds, -1 if none */
 
 static int             file_player_shut_down = 0;
 static pthread_mutex_t shut_down_mutex;
@@ -64,12 +71,61 @@ static PB_Status_Request user_pb_request = PBRQ_NONE;
 
 static char             *file = NULL;
 static pthread_mutex_t   file_mutex;
+static pthread_cond_t    file_cond;         /* Signalled when a track is requested or playback is stopped */
+static long              file_request_ms;   /* Time of the latest track request */
+static int               file_rapid;        /* Set when the latest request quickly followed the previous one */
+static int               file_stopped;      /* Set when playback has been stopped after the latest request */
 
 static TrackInfo        *ti;
 
 static pthread_mutex_t   mutex;
 
+/* Reader the decoder thread is waiting on while prebuffering, so that
+ * it can be woken up when playback is stopped */
+static Reader           *wait_reader;
+static pthread_mutex_t   wait_reader_mutex;
+
 static int               dev_close_asap; /* When true, the device isn't kept open, but closed ASAP */
+static int               gapless;        /* When true, the next track's data is appended to the audio buffer while the current track drains */
+
+/**
+ * Crossfading (only in gapless mode). The last crossfade_seconds of decoded
+ * data are held back in xfade_tail before passing them on to the audio
+ * buffer. When the next track starts, its data is mixed with the held back
+ * data. xfade_len and xfade_pos are the length of the current crossfade
+ * and the position within it, in bytes.
+ */
+static int               crossfade_seconds;
+static RingBuffer        xfade_tail;
+static size_t            xfade_len, xfade_pos, xfade_frame_size = 4;
+static char              xfade_buf[BUF_SIZE];
+
+/**
+ * Gapless playback: The info of a track appended to the audio buffer is
+ * published (copied to ti, followed by GMU_TRACKINFO_CHANGE) only once
+ * playback reaches the track, i.e. passes its boundary in the audio
+ * buffer. Until then the decoder writes it to one of the pending track
+ * infos, which are queued with the number of that boundary (see
+ * audio_get_track_boundaries_added()). decoder_ti points to the track
+ * info of the track being decoded. Only used by the decoder thread.
+ */
+static TrackInfo         pending_ti[AUDIO_MAX_TRACK_BOUNDARIES];
+static unsigned long     pending_boundary[AUDIO_MAX_TRACK_BOUNDARIES];
+static int               pending_first, pending_count;
+static TrackInfo        *decoder_ti;
+
+/**
+ * Conversion of the decoded data to the output format. When an output
+ * sample rate and/or channel count has been configured (non-zero), all
+ * tracks are converted to that format, so the audio device never has to
+ * be reopened. Otherwise the device uses each track's own format.
+ */
+static int               output_samplerate, output_channels;
+static ResamplerQuality  resampler_quality = RESAMPLER_QUALITY_MEDIUM;
+static Resampler         resampler;
+static int               conv_in_rate, conv_in_channels, conv_out_rate, conv_out_channels;
+static char             *conv_buf, *conv_map_buf;
+static size_t            conv_buf_size, conv_map_buf_size;
 
 static void set_item_status(PB_Status status)
 {
@@ -108,6 +164,33 @@ static PB_Status_Request get_pb_request(void)
 	return status;
 }
 
+/* Wakes up the decoder thread when it is waiting for buffer space or data */
+static void wake_decoder_thread(void)
+{
+	audio_wake_waiters();
+	pthread_mutex_lock(&wait_reader_mutex);
+	if (wait_reader) reader_wake(wait_reader);
+	pthread_mutex_unlock(&wait_reader_mutex);
+}
+
+static long get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Returns 1 when a track has been requested that has not been picked up yet */
+static int file_requested(void)
+{
+	int res;
+	pthread_mutex_lock(&file_mutex);
+	res = (file != NULL);
+	pthread_mutex_unlock(&file_mutex);
+	return res;
+}
+
 int file_player_check_shutdown(void)
 {
 	int res;
@@ -122,6 +205,19 @@ void file_player_set_lyrics_file_pattern(const char *pattern)
 	strncpy(lyrics_file_pattern, pattern ? pattern : "", 255);
 }
 
+void file_player_set_crossfade(int seconds)
+{
+	crossfade_seconds = seconds > 0 ? (seconds <= 12 ? seconds : 12) : 0;
+}
+
+void file_player_set_output_format(int samplerate, int channels, int quality)
+{
+	output_samplerate = samplerate > 0 ? samplerate : 0;
+	output_channels   = channels > 0 ? (channels > 2 ? 2 : channels) : 0;
+	resampler_quality = quality == 0 ? RESAMPLER_QUALITY_LOW :
+	                    quality == 2 ? RESAMPLER_QUALITY_HIGH : RESAMPLER_QUALITY_MEDIUM;
+}
+
 int file_player_playback_get_time(void)
 {
  	return audio_get_playtime();
@@ -146,19 +242,30 @@ static pthread_t thread;
 
 void file_player_shutdown(void)
 {
+	int i;
+
 	wdprintf(V_DEBUG, "fileplayer", "Initiating shutdown.\n");
 	set_item_status(STOPPED);
 	pthread_mutex_lock(&shut_down_mutex);
 	file_player_shut_down = 1;
 	pthread_mutex_unlock(&shut_down_mutex);
 	file_player_set_filename(NULL);
+	wake_decoder_thread();
 	file_player_start_playback(); /* Release waiting lock in thread */
 	pthread_join(thread, NULL);
 	if (file) free(file);
+	pthread_mutex_destroy(&wait_reader_mutex);
 	pthread_mutex_destroy(&item_status_mutex);
 	pthread_mutex_destroy(&shut_down_mutex);
+	pthread_cond_destroy(&file_cond);
 	pthread_mutex_destroy(&file_mutex);
 	pthread_mutex_destroy(&mutex);
+	for (i = 0; i < AUDIO_MAX_TRACK_BOUNDARIES; i++)
+		trackinfo_destroy(&pending_ti[i]);
+	ringbuffer_free(&xfade_tail);
+	resampler_free(&resampler);
+	if (conv_buf) free(conv_buf);
+	if (conv_map_buf) free(conv_map_buf);
 	wdprintf(V_DEBUG, "fileplayer", "Shutdown complete.\n");
 }
 
@@ -174,11 +281,19 @@ void file_player_set_filename(char *filename)
 		if (len > 0) {
 			file = realloc(file, len+1);
 			if (file) {
+				long now = get_time_ms();
+
 				memcpy(file, filename, len+1);
 				wdprintf(V_DEBUG, "fileplayer", "Filename set: %s\n", file);
+				file_rapid = now - file_request_ms < OPEN_DEBOUNCE_MS;
+				file_request_ms = now;
+				file_stopped = 0;
 			}
 		}
+	} else {
+		file_stopped = 1;
 	}
+	pthread_cond_broadcast(&file_cond);
 	pthread_mutex_unlock(&file_mutex);
 }
 
@@ -188,16 +303,24 @@ void file_player_start_playback(void)
 	locked = 0;
 }
 
-int file_player_init(TrackInfo *ti_ref, int device_close_asap)
+int file_player_init(TrackInfo *ti_ref, int device_close_asap, int gapless_playback)
 {
+	int i;
+
 	pthread_mutex_init(&mutex, NULL);
 	pthread_mutex_init(&file_mutex, NULL);
+	pthread_cond_init_monotonic(&file_cond);
 	pthread_mutex_init(&shut_down_mutex, NULL);
 	pthread_mutex_init(&item_status_mutex, NULL);
+	pthread_mutex_init(&wait_reader_mutex, NULL);
 	file_player_set_filename(NULL);
 	ti = ti_ref;
+	decoder_ti = ti;
+	for (i = 0; i < AUDIO_MAX_TRACK_BOUNDARIES; i++)
+		trackinfo_init(&pending_ti[i], 1);
 	pthread_create_with_stack_size(&thread, DEFAULT_THREAD_STACK_SIZE, decode_audio_thread, NULL);
 	dev_close_asap = device_close_asap;
+	gapless = gapless_playback;
 	return 0;
 }
 
@@ -206,30 +329,31 @@ void file_player_stop_playback(void)
 	set_item_status(STOPPED);
 	wdprintf(V_INFO, "fileplayer", "Stop playback!\n");
 	file_player_set_filename(NULL);
+	wake_decoder_thread();
 }
 
 
 /* Return 1 when new meta data differs from previous data, 0 otherwise */
-static int update_metadata(GmuDecoder *gd, TrackInfo *ti, GmuCharset charset)
+static int update_metadata(GmuDecoderV2 *gd, GmuDecoderInstance *di, TrackInfo *ti, GmuCharset charset)
 {
 	TrackInfo ti_tmp;
 	int       differ = 0;
 
 	if (*gd->get_meta_data) {
-		trackinfo_copy(&ti_tmp, ti);
+		trackinfo_copy_text(&ti_tmp, ti);
 		trackinfo_set_artist(&ti_tmp, "");
 		trackinfo_set_title(&ti_tmp, "");
 		trackinfo_set_album(&ti_tmp, "");
-		if ((*gd->get_meta_data)(GMU_META_ARTIST, 1))
-			strncpy_charset_conv(ti_tmp.artist,  (*gd->get_meta_data)(GMU_META_ARTIST, 1), SIZE_ARTIST-1, 0, charset);
-		if ((*gd->get_meta_data)(GMU_META_TITLE, 1))
-			strncpy_charset_conv(ti_tmp.title,   (*gd->get_meta_data)(GMU_META_TITLE, 1), SIZE_TITLE-1, 0, charset);
-		if ((*gd->get_meta_data)(GMU_META_ALBUM, 1))
-			strncpy_charset_conv(ti_tmp.album,   (*gd->get_meta_data)(GMU_META_ALBUM, 1), SIZE_ALBUM-1, 0, charset);
-		if ((*gd->get_meta_data)(GMU_META_TRACKNR, 1))
-			strncpy_charset_conv(ti_tmp.tracknr, (*gd->get_meta_data)(GMU_META_TRACKNR, 1), SIZE_TRACKNR-1, 0, charset);
-		if ((*gd->get_meta_data)(GMU_META_DATE, 1))
-			strncpy_charset_conv(ti_tmp.date,    (*gd->get_meta_data)(GMU_META_DATE, 1), SIZE_DATE-1, 0, charset);
+		if ((*gd->get_meta_data)(di, GMU_META_ARTIST))
+			strncpy_charset_conv(ti_tmp.artist,  (*gd->get_meta_data)(di, GMU_META_ARTIST), SIZE_ARTIST-1, 0, charset);
+		if ((*gd->get_meta_data)(di, GMU_META_TITLE))
+			strncpy_charset_conv(ti_tmp.title,   (*gd->get_meta_data)(di, GMU_META_TITLE), SIZE_TITLE-1, 0, charset);
+		if ((*gd->get_meta_data)(di, GMU_META_ALBUM))
+			strncpy_charset_conv(ti_tmp.album,   (*gd->get_meta_data)(di, GMU_META_ALBUM), SIZE_ALBUM-1, 0, charset);
+		if ((*gd->get_meta_data)(di, GMU_META_TRACKNR))
+			strncpy_charset_conv(ti_tmp.tracknr, (*gd->get_meta_data)(di, GMU_META_TRACKNR), SIZE_TRACKNR-1, 0, charset);
+		if ((*gd->get_meta_data)(di, GMU_META_DATE))
+			strncpy_charset_conv(ti_tmp.date,    (*gd->get_meta_data)(di, GMU_META_DATE), SIZE_DATE-1, 0, charset);
 
 		if (ti_tmp.title[0] == '\0') {
 			char *filename_without_path = strrchr(ti_tmp.file_name, '/');
@@ -251,17 +375,19 @@ static int update_metadata(GmuDecoder *gd, TrackInfo *ti, GmuCharset charset)
 			differ = 1;
 
 		if (differ) {
-			trackinfo_copy(ti, &ti_tmp);
-			if (*gd->get_meta_data_int) {
-				if ((*gd->get_meta_data_int)(GMU_META_IMAGE_DATA_SIZE, 1) &&
-				   ((*gd->get_meta_data)(GMU_META_IMAGE_DATA, 1)) &&
-				   (*gd->get_meta_data)(GMU_META_IMAGE_MIME_TYPE, 1)) {
-					trackinfo_set_image(
-						ti,
-						((*gd->get_meta_data)(GMU_META_IMAGE_DATA, 1)),
-						(*gd->get_meta_data_int)(GMU_META_IMAGE_DATA_SIZE, 1),
-						((*gd->get_meta_data)(GMU_META_IMAGE_MIME_TYPE, 1))
-					);
+			trackinfo_copy_text(ti, &ti_tmp);
+			if (*gd->get_meta_data_int && (*gd->get_meta_data_int)(di, GMU_META_IMAGE_DATA_SIZE) &&
+			    (*gd->get_meta_data)(di, GMU_META_IMAGE_MIME_TYPE)) {
+				const char *image_file = (*gd->get_meta_data)(di, GMU_META_IMAGE_FILE);
+				const char *mime_type = (*gd->get_meta_data)(di, GMU_META_IMAGE_MIME_TYPE);
+				int         size = (*gd->get_meta_data_int)(di, GMU_META_IMAGE_DATA_SIZE);
+				int         offset = image_file ? (*gd->get_meta_data_int)(di, GMU_META_IMAGE_OFFSET) : -1;
+
+				/* Prefer a reference to the image, so it is only loaded when needed */
+				if (offset < 0 || !trackinfo_set_image_reference(ti, image_file, offset, size, mime_type)) {
+					const char *data = (*gd->get_meta_data)(di, GMU_META_IMAGE_DATA);
+
+					if (data) trackinfo_set_image(ti, data, size, mime_type);
 				}
 			}
 			trackinfo_set_updated(ti);
@@ -270,18 +396,503 @@ static int update_metadata(GmuDecoder *gd, TrackInfo *ti, GmuCharset charset)
 	return differ;
 }
 
+/* Makes sure *buf can hold at least size bytes. Returns 1 on success, 0 otherwise. */
+static int conversion_buffer_reserve(char **buf, size_t *buf_size, size_t size)
+{
+	if (*buf_size < size) {
+		char *tmp = realloc(*buf, size);
+		if (tmp) {
+			*buf      = tmp;
+			*buf_size = size;
+		}
+	}
+	return *buf_size >= size;
+}
+
+/* Sets up the conversion from a track's format to the output format */
+static void conversion_setup(int samplerate, int channels)
+{
+	conv_in_rate      = samplerate;
+	conv_in_channels  = channels;
+	conv_out_rate     = output_samplerate > 0 ? output_samplerate : samplerate;
+	conv_out_channels = output_channels > 0 ? output_channels : channels;
+	if (conv_out_rate != conv_in_rate) {
+		if (conv_out_channels > RESAMPLER_MAX_CHANNELS) conv_out_channels = RESAMPLER_MAX_CHANNELS;
+		if (!resampler_init(&resampler, conv_in_rate, conv_out_rate, conv_out_channels, resampler_quality)) {
+			wdprintf(V_WARNING, "fileplayer", "Unable to set up resampler. Using the track's sample rate.\n");
+			conv_out_rate = conv_in_rate;
+		}
+	}
+	if (conv_out_rate != conv_in_rate || conv_out_channels != conv_in_channels)
+		wdprintf(V_INFO, "fileplayer", "Converting %d Hz/%d ch to %d Hz/%d ch.\n",
+		         conv_in_rate, conv_in_channels, conv_out_rate, conv_out_channels);
+}
+
+/**
+ * Converts size bytes of decoded data to the output format. Returns a
+ * pointer to the converted data and stores its size in out_size. At the
+ * end of a track (eof) the data still held back by the resampler is
+ * appended.
+ */
+static char *conversion_run(char *data, size_t size, int eof, size_t *out_size)
+{
+	char  *res = data;
+	size_t frames = size / (2 * conv_in_channels);
+
+	*out_size = size;
+	if (conv_in_channels != conv_out_channels && frames > 0) {
+		if (conversion_buffer_reserve(&conv_map_buf, &conv_map_buf_size, frames * 2 * conv_out_channels)) {
+			mixer_channel_map_s16(
+				(int16_t *)conv_map_buf, conv_out_channels,
+				(const int16_t *)data, conv_in_channels, frames
+			);
+			res = conv_map_buf;
+			*out_size = frames * 2 * conv_out_channels;
+		} else {
+			*out_size = 0;
+		}
+	}
+	if (conv_in_rate != conv_out_rate) {
+		size_t max = resampler_get_max_output_frames(&resampler, frames) + resampler.taps;
+
+		if (conversion_buffer_reserve(&conv_buf, &conv_buf_size, max * 2 * conv_out_channels)) {
+			int16_t *target = (int16_t *)conv_buf;
+			size_t   n = resampler_process(&resampler, (const int16_t *)res, *out_size / (2 * conv_out_channels), target);
+
+			if (eof) n += resampler_flush(&resampler, target + n * conv_out_channels);
+			res = conv_buf;
+			*out_size = n * 2 * conv_out_channels;
+		} else {
+			*out_size = 0;
+		}
+	}
+	return res;
+}
+
+/* Publishes the info of the pending tracks whose boundary has been played meanwhile */
+static void pending_trackinfo_publish(void)
+{
+	unsigned long passed = audio_get_track_boundaries_passed();
+
+	while (pending_count > 0 && (long)(passed - pending_boundary[pending_first]) >= 0) {
+		TrackInfo *pti = &pending_ti[pending_first];
+
+		if (trackinfo_acquire_lock(ti)) {
+			trackinfo_copy(ti, pti);
+			trackinfo_release_lock(ti);
+		}
+		event_queue_push(gmu_core_get_event_queue(), GMU_TRACKINFO_CHANGE);
+		wdprintf(V_DEBUG, "fileplayer", "Playback reached %s.\n", pti->file_name);
+		if (decoder_ti == pti) decoder_ti = ti;
+		if (trackinfo_acquire_lock(pti)) {
+			trackinfo_clear(pti);
+			trackinfo_release_lock(pti);
+		}
+		pending_first = (pending_first + 1) % AUDIO_MAX_TRACK_BOUNDARIES;
+		pending_count--;
+	}
+}
+
+/* Drops the pending track infos, e.g. when playback has been stopped */
+static void pending_trackinfo_discard(void)
+{
+	while (pending_count > 0) {
+		if (trackinfo_acquire_lock(&pending_ti[pending_first])) {
+			trackinfo_clear(&pending_ti[pending_first]);
+			trackinfo_release_lock(&pending_ti[pending_first]);
+		}
+		pending_first = (pending_first + 1) % AUDIO_MAX_TRACK_BOUNDARIES;
+		pending_count--;
+	}
+	decoder_ti = ti;
+}
+
+/**
+ * Like audio_wait_for_space(), but also publishes the info of tracks
+ * whose playback has started meanwhile. The decoder thread uses this
+ * for all its waiting.
+ */
+static int wait_for_space(size_t size, int timeout_ms)
+{
+	int res = audio_wait_for_space(size, timeout_ms);
+
+	pending_trackinfo_publish();
+	return res;
+}
+
+/**
+ * Returns the pending track info the next track's info is to be written
+ * to while the current track is still playing. Waits for one to become
+ * free if necessary. Returns ti when playback has been stopped meanwhile.
+ */
+static TrackInfo *pending_trackinfo_get(void)
+{
+	while (pending_count == AUDIO_MAX_TRACK_BOUNDARIES && get_item_status() == PLAYING && !file_player_check_shutdown())
+		wait_for_space(audio_buffer_get_size(), 100);
+	if (pending_count == AUDIO_MAX_TRACK_BOUNDARIES) return ti;
+	return &pending_ti[(pending_first + pending_count) % AUDIO_MAX_TRACK_BOUNDARIES];
+}
+
+/**
+ * Queues the track info returned by pending_trackinfo_get(), so it is
+ * published as soon as the given track boundary has been played.
+ */
+static void pending_trackinfo_queue(unsigned long boundary)
+{
+	pending_boundary[(pending_first + pending_count) % AUDIO_MAX_TRACK_BOUNDARIES] = boundary;
+	pending_count++;
+}
+
+/**
+ * Writes data to the audio buffer, waiting for free space if necessary.
+ * Returns 1 on success and 0 if the track has been stopped meanwhile.
+ */
+static int audio_write_chunk(char *data, size_t size)
+{
+	int ret = 0;
+
+	while (!ret && get_item_status() == PLAYING) {
+		ret = audio_fill_buffer(data, size);
+		if (!ret) wait_for_space(size, 100);
+		if (get_item_status() == PLAYING && get_pb_request() == PBRQ_PLAY && audio_get_pause()) {
+			wdprintf(V_DEBUG, "fileplayer", "Unpause audio due to user request...\n");
+			audio_set_pause(0);
+		}
+	}
+	return ret;
+}
+
+/**
+ * Writes data to the audio buffer, waiting for free space if necessary.
+ * The data is written in chunks of at most half the buffer size, so it
+ * fits even into small (low-latency) buffers. Returns 1 on success and
+ * 0 if the track has been stopped meanwhile.
+ */
+static int audio_write(char *data, size_t size)
+{
+	int ret = 1;
+
+	while (ret && size > 0) {
+		size_t chunk = audio_buffer_get_size() / 2;
+
+		chunk -= chunk % xfade_frame_size; /* Never split a sample frame */
+		if (chunk == 0 || chunk > size) chunk = size;
+		ret = audio_write_chunk(data, chunk);
+		data += chunk;
+		size -= chunk;
+	}
+	return ret;
+}
+
+/**
+ * Seeks to the position 'ms' (in milliseconds). Decoders without sample
+ * accurate seeking can only seek to whole seconds. The sample the decoder
+ * continues with is stored in sample. Returns 1 on success, 0 otherwise.
+ */
+static int decoder_seek(GmuDecoderV2 *gd, GmuDecoderInstance *di, long ms, long *sample)
+{
+	int res = 0;
+
+	if (gd->seek_sample) {
+		*sample = (long)((long long)ms * conv_in_rate / 1000);
+		res = (*gd->seek_sample)(di, *sample);
+	} else if (gd->seek) {
+		*sample = ms / 1000 * conv_in_rate;
+		res = (*gd->seek)(di, (int)(ms / 1000));
+	}
+	return res;
+}
+
+/**
+ * Decodes straight into the audio buffer's memory, which saves copying
+ * the data through pcmout. That is only possible when the data neither
+ * has to be converted nor held back for crossfading. ret and size are
+ * updated like in the regular decoding loop. Returns 1 when the data has
+ * been decoded this way, 0 when it has to be decoded into pcmout instead.
+ */
+static int decode_direct(GmuDecoderV2 *gd, GmuDecoderInstance *di, int *ret, int *size)
+{
+	char  *target;
+	size_t avail = 0;
+
+	if (conv_in_rate != conv_out_rate || conv_in_channels != conv_out_channels) return 0;
+	if (ringbuffer_get_size(&xfade_tail) > 0 && xfade_tail.buffer) return 0;
+	if (audio_buffer_get_size() < 2 * BUF_SIZE) return 0; /* Small (low-latency) buffer */
+	/* Decoders are used to getting at least BUF_SIZE/2 bytes of space
+	 * on each call, so wait until there is room for BUF_SIZE bytes */
+	if (!wait_for_space(BUF_SIZE, 100)) return 0;
+	target = audio_buffer_reserve(&avail);
+	if (avail < BUF_SIZE) return 0;
+	while (*ret > 0 && *size < BUF_SIZE / 2 && get_item_status() != STOPPED) {
+		*ret = (*gd->decode_data)(di, target + *size, BUF_SIZE - *size);
+		if (*ret > 0) *size += *ret;
+	}
+	if (*size > 0) audio_buffer_commit(*size);
+	return 1;
+}
+
+/**
+ * (Re)allocates the crossfade tail buffer for the given audio format.
+ * Crossfading is disabled when it fails or crossfading is turned off.
+ */
+static void crossfade_setup(int samplerate, int channels)
+{
+	size_t size = gapless ? (size_t)crossfade_seconds * samplerate * channels * 2 : 0;
+
+	if (size != ringbuffer_get_size(&xfade_tail) || !xfade_tail.buffer) {
+		ringbuffer_free(&xfade_tail);
+		xfade_tail.size = 0;
+		if (size > 0 && !ringbuffer_init(&xfade_tail, size)) {
+			wdprintf(V_ERROR, "fileplayer", "Unable to allocate crossfade buffer.\n");
+			xfade_tail.size = 0;
+		}
+	}
+	ringbuffer_clear(&xfade_tail);
+	xfade_len = 0;
+	xfade_pos = 0;
+	xfade_frame_size = 2 * channels;
+}
+
+/**
+ * Moves held back data on to the audio buffer when the audio buffer is
+ * running low. This way the tail buffer fills up over time (decoding is
+ * faster than playback) without ever starving the audio output.
+ */
+static void crossfade_tail_top_up(void)
+{
+	size_t fill  = ringbuffer_get_fill(&xfade_tail);
+	size_t space = audio_buffer_get_free();
+
+	if (fill > 0 && space > audio_buffer_get_size() / 2) {
+		size_t n = space - audio_buffer_get_size() / 4;
+
+		if (n > fill) n = fill;
+		if (n > BUF_SIZE) n = BUF_SIZE;
+		n -= n % xfade_frame_size; /* Never split a sample frame */
+		if (n > 0 && ringbuffer_read(&xfade_tail, xfade_buf, n))
+			audio_fill_buffer(xfade_buf, n);
+	}
+}
+
+/* Passes all held back data on to the audio buffer without crossfading */
+static void crossfade_tail_flush(void)
+{
+	size_t fill;
+
+	while ((fill = ringbuffer_get_fill(&xfade_tail)) > 0) {
+		size_t n = fill < BUF_SIZE ? fill : BUF_SIZE;
+		if (!ringbuffer_read(&xfade_tail, xfade_buf, n) || !audio_write(xfade_buf, n)) break;
+	}
+	ringbuffer_clear(&xfade_tail);
+	xfade_len = 0;
+}
+
+/**
+ * Passes decoded data on to the audio buffer. While a crossfade is in
+ * progress the data is mixed with the held back data of the previous
+ * track first. When crossfading is enabled the most recent data is held
+ * back in the tail buffer.
+ */
+static int write_pcm(char *data, size_t size)
+{
+	int res = 1;
+
+	if (xfade_len > 0 && ringbuffer_get_fill(&xfade_tail) > 0) {
+		size_t n = ringbuffer_get_fill(&xfade_tail);
+
+		if (n > size) n = size;
+		if (ringbuffer_read(&xfade_tail, xfade_buf, n)) {
+			mixer_crossfade_s16(
+				(int16_t *)data, (const int16_t *)xfade_buf, (const int16_t *)data,
+				n / 2, xfade_pos / 2, xfade_len / 2
+			);
+			xfade_pos += n;
+			res = audio_write(data, n);
+		}
+		data += n;
+		size -= n;
+		if (ringbuffer_get_fill(&xfade_tail) == 0) {
+			wdprintf(V_DEBUG, "fileplayer", "Crossfade done.\n");
+			xfade_len = 0;
+		}
+	}
+	if (res && size > 0) {
+		if (ringbuffer_get_size(&xfade_tail) > 0 && xfade_tail.buffer) {
+			/* Make room by passing on the oldest data */
+			while (res && ringbuffer_get_free(&xfade_tail) < size) {
+				size_t n = size - ringbuffer_get_free(&xfade_tail);
+				if (n > BUF_SIZE) n = BUF_SIZE;
+				res = ringbuffer_read(&xfade_tail, xfade_buf, n) && audio_write(xfade_buf, n);
+			}
+			if (res) {
+				ringbuffer_write(&xfade_tail, data, size);
+				crossfade_tail_top_up();
+			}
+		} else {
+			res = audio_write(data, size);
+		}
+	}
+	return res;
+}
+
+/**
+ * Starts playback with the pre-decoded beginning of a track. As much of
+ * it as fits into the audio buffer is written right away, so playback
+ * starts before the decoder has even opened the file. Returns the number
+ * of bytes of the cached data that have been used.
+ */
+static size_t cache_playback_start(PCMCacheEntry *ce)
+{
+	size_t pos = 0, frame_size = 2 * ce->channels, max;
+
+	conversion_setup(ce->samplerate, ce->channels);
+	crossfade_setup(conv_out_rate, conv_out_channels);
+	audio_reset_fade_volume();
+	if (audio_device_open(conv_out_rate, conv_out_channels) < 0) return 0;
+	/* Fill up to 3/4 of the buffer, taking a format conversion into account */
+	max = (size_t)((long long)audio_buffer_get_size() * 3 / 4 * conv_in_rate / conv_out_rate
+	               * conv_in_channels / conv_out_channels);
+	max -= max % frame_size;
+	if (max > ce->size) max = ce->size;
+	while (pos < max && get_item_status() == PLAYING) {
+		size_t n = max - pos < BUF_SIZE / 2 ? max - pos : BUF_SIZE / 2, out_size;
+		char  *data = conversion_run(ce->data + pos, n, 0, &out_size);
+
+		if (!write_pcm(data, out_size)) break;
+		pos += n;
+	}
+	if (get_pb_request() == PBRQ_PLAY) audio_set_pause(0);
+	return pos;
+}
+
+/**
+ * Writes the rest of the pre-decoded data once the decoder is ready and
+ * moves the decoder to where that data ends. Decoders that cannot seek
+ * there exactly decode the data once more and drop it. Returns 1 on
+ * success, 0 otherwise.
+ */
+static int cache_playback_handover(GmuDecoderV2 *gd, GmuDecoderInstance *di, PCMCacheEntry *ce, size_t pos, char *buf)
+{
+	size_t skip = ce->size, out_size;
+	int    ret = 1;
+
+	while (pos < ce->size && get_item_status() == PLAYING) {
+		size_t n = ce->size - pos < BUF_SIZE / 2 ? ce->size - pos : BUF_SIZE / 2;
+		char  *data = conversion_run(ce->data + pos, n, 0, &out_size);
+
+		if (!write_pcm(data, out_size)) break;
+		pos += n;
+	}
+	if (gd->seek_sample && (*gd->seek_sample)(di, ce->frames)) return 1;
+	if (gd->seek && ce->frames % ce->samplerate == 0 && (*gd->seek)(di, (int)(ce->frames / ce->samplerate)))
+		return 1;
+	while (skip > 0 && get_item_status() == PLAYING && (ret = (*gd->decode_data)(di, buf, BUF_SIZE)) > 0) {
+		if ((size_t)ret > skip) { /* Pass on what follows the cached data */
+			char *data = conversion_run(buf + skip, ret - skip, 0, &out_size);
+			write_pcm(data, out_size);
+			skip = 0;
+		} else {
+			skip -= ret;
+		}
+	}
+	return ret >= 0;
+}
+
+/**
+ * Used in gapless mode after the decoder has reached the end of a track.
+ * Wakes up Gmu's main loop, so it notices the FINISHED item status and
+ * passes on the next track, and waits for that while the remaining audio
+ * data is being played. Returns 1 when the next track directly follows
+ * the current one, so its data can be appended to the audio buffer without
+ * a gap, 0 otherwise.
+ */
+static int gapless_wait_for_next_track(void)
+{
+	int next_file = 0, res = 0;
+
+	event_queue_push(gmu_core_get_event_queue(), GMU_NO_EVENT);
+	while (!file_player_check_shutdown()) {
+		pthread_mutex_lock(&file_mutex);
+		next_file = (file != NULL);
+		pthread_mutex_unlock(&file_mutex);
+		if (next_file || get_pb_request() == PBRQ_STOP) break;
+		if (audio_buffer_get_fill() == 0 && ringbuffer_get_fill(&xfade_tail) == 0) break;
+		crossfade_tail_top_up();
+		/* Sleep until held back data can be passed on or everything has been played */
+		if (ringbuffer_get_fill(&xfade_tail) > 0)
+			wait_for_space(audio_buffer_get_size() / 2 + 1, 100);
+		else
+			wait_for_space(audio_buffer_get_size(), 100);
+	}
+	/* file_player_play_file() sets the item status to PLAYING only when
+	 * the current track has not been skipped by the user */
+	if (next_file && get_item_status() == PLAYING) {
+		res = 1;
+	} else if (next_file || get_pb_request() == PBRQ_STOP) {
+		ringbuffer_clear(&xfade_tail);
+		audio_buffer_clear();
+	}
+	wdprintf(V_DEBUG, "fileplayer", "Gapless transition: %s\n", res ? "yes" : "no");
+	return res;
+}
+
+/**
+ * When tracks are requested in quick succession (e.g. by skipping several
+ * tracks), waits until no further request came in for OPEN_DEBOUNCE_MS,
+ * so only the last requested track gets opened. Returns the file to be
+ * played, which is either filename or a newer request (filename is freed
+ * then), or NULL if playback has been stopped meanwhile.
+ */
+static char *wait_for_last_request(char *filename)
+{
+	pthread_mutex_lock(&file_mutex);
+	while (filename && file_rapid && !file_player_check_shutdown()) {
+		long remaining = OPEN_DEBOUNCE_MS - (get_time_ms() - file_request_ms);
+
+		if (file_stopped) {
+			free(filename);
+			filename = NULL;
+		} else if (file) {
+			wdprintf(V_DEBUG, "fileplayer", "Skipping %s in favor of %s.\n", filename, file);
+			free(filename);
+			filename = file;
+			file = NULL;
+		} else if (remaining <= 0) {
+			break;
+		} else {
+			pthread_cond_timedwait_ms(&file_cond, &file_mutex, (int)remaining);
+		}
+	}
+	file_rapid = 0;
+	pthread_mutex_unlock(&file_mutex);
+	return filename;
+}
+
+/**
+ * Reader cancel callback: Opening a track is given up when playback has
+ * been stopped or another track has been requested meanwhile.
+ */
+static int open_cancelled(void *udata)
+{
+	return get_item_status() != PLAYING || file_requested() || file_player_check_shutdown();
+}
+
 static void *decode_audio_thread(void *udata)
 {
-	GmuDecoder *gd = NULL;
-	Reader     *r;
-	static char pcmout[BUF_SIZE];
-	GmuCharset  charset = M_CHARSET_AUTODETECT;
+	GmuDecoderV2       *gd = NULL;
+	GmuDecoderInstance *di = NULL;
+	Reader             *r;
+	static char         pcmout[BUF_SIZE];
+	GmuCharset          charset = M_CHARSET_AUTODETECT;
+	int                 gapless_continue = 0;
+	PCMCacheEntry      *cached = NULL;
+	size_t              cached_pos = 0;
 
 	wdprintf(V_INFO, "fileplayer", "File player thread initialized.\n");
-	seek_second = -1;
+	seek_ms = -1;
 	while (!file_player_check_shutdown()) {
 		char *filename = NULL;
-		int   len = 0, set_playing = 0;
+		int   len = 0, set_playing = 0, gapless_eof = 0;
 
 		pthread_mutex_lock(&mutex);  /* Wait for playback to be started */
 		pthread_mutex_unlock(&mutex);
@@ -304,18 +915,28 @@ static void *decode_audio_thread(void *udata)
 			wdprintf(V_WARNING, "fileplayer", "WARNING: Zero length filename detected!\n");
 		}
 		pthread_mutex_unlock(&file_mutex);
+		if (set_playing && !gapless_continue && !(filename = wait_for_last_request(filename))) {
+			wdprintf(V_DEBUG, "fileplayer", "Playback has been stopped before the track could be opened.\n");
+			set_playing = 0;
+		}
 		if (set_playing)
 			set_item_status(PLAYING);
 		else
 			wdprintf(V_WARNING, "fileplayer", "Uh, no proper filename set. Not starting playback!\n");
 		r = NULL;
+		/* Start playing right away, when the beginning of the track has been pre-decoded */
+		if (!gapless_continue && filename && get_item_status() == PLAYING && !file_player_check_shutdown() &&
+		    (cached = pcm_cache_take(filename))) {
+			wdprintf(V_DEBUG, "fileplayer", "Starting with %ld pre-decoded frames.\n", cached->frames);
+			cached_pos = cache_playback_start(cached);
+		}
 		if (!file_player_check_shutdown() && filename && get_item_status() == PLAYING) {
 			const char *tmp = get_file_extension(filename);
 			wdprintf(V_INFO, "fileplayer", "Playing %s...\n", filename);
 			if (tmp) gd = decloader_get_decoder_for_extension(tmp);
 			if (!(gd && gd->identifier)) { /* No decoder found by extension, try mime-type check by data chunk */
 				wdprintf(V_WARNING, "fileplayer", "No suitable decoder available for extension %s. Trying mime type check.\n", tmp);
-				r = reader_open(filename);
+				r = reader_open_cancellable(filename, open_cancelled, NULL);
 				if (r && reader_read_bytes(r, 4096)) {
 					char *mime_type = cfg_get_key_value_ignore_case(r->streaminfo, "content-type");
 					if (mime_type)
@@ -324,11 +945,13 @@ static void *decode_audio_thread(void *udata)
 						gd = decloader_get_decoder_for_data_chunk(reader_get_buffer(r), reader_get_number_of_bytes_in_buffer(r));
 				}
 			}
-			if (gd && gd->identifier && !file_player_check_shutdown()) {
+			if (gd && gd->identifier && !file_player_check_shutdown())
+				di = decloader_instance_create(gd);
+			if (di) {
 				wdprintf(V_INFO, "fileplayer", "Selected decoder: %s\n", gd->identifier);
 				if (gd->set_reader_handle) {
 					if (!r) {
-						r = reader_open(filename);
+						r = reader_open_cancellable(filename, open_cancelled, NULL);
 						if (r) reader_read_bytes(r, 4096);
 					}
 				} else {
@@ -338,50 +961,80 @@ static void *decode_audio_thread(void *udata)
 					}
 				}
 
-				if (*gd->meta_data_get_charset) charset = (*gd->meta_data_get_charset)();
-				if (gd->set_reader_handle) (*gd->set_reader_handle)(r);
+				if (*gd->meta_data_get_charset) charset = (*gd->meta_data_get_charset)(di);
+				if (gd->set_reader_handle) (*gd->set_reader_handle)(di, r);
 
-				audio_reset_fade_volume();
-				if (get_item_status() == PLAYING && !file_player_check_shutdown() && (*gd->open_file)(filename)) {
-					int channels = 0;
-					if (trackinfo_acquire_lock(ti)) {
-						trackinfo_clear(ti);
+				if (!cached) audio_reset_fade_volume();
+				if (!open_cancelled(NULL) && (*gd->open_file)(di, filename)) {
+					int channels = 0, samplerate = 0;
+					/* While the previous track is still playing, its info must remain */
+					decoder_ti = gapless_continue ? pending_trackinfo_get() : ti;
+					if (trackinfo_acquire_lock(decoder_ti)) {
+						trackinfo_clear(decoder_ti);
 						if (charset_is_valid_utf8_string(filename))
-							strncpy(ti->file_name, filename, SIZE_FILE_NAME-1);
+							strncpy(decoder_ti->file_name, filename, SIZE_FILE_NAME-1);
 						else
-							charset_iso8859_1_to_utf8(ti->file_name, filename, SIZE_FILE_NAME-1);
+							charset_iso8859_1_to_utf8(decoder_ti->file_name, filename, SIZE_FILE_NAME-1);
 
 						/* Assume 44.1 kHz stereo as default */
-						ti->samplerate = 44100;
-						ti->channels   = 2;
-						ti->bitrate    = 0;
+						decoder_ti->samplerate = 44100;
+						decoder_ti->channels   = 2;
+						decoder_ti->bitrate    = 0;
 
 						if (*gd->get_samplerate)
-							ti->samplerate = (*gd->get_samplerate)();
+							decoder_ti->samplerate = (*gd->get_samplerate)(di);
 						if (*gd->get_channels)
-							ti->channels   = (*gd->get_channels)();
+							decoder_ti->channels   = (*gd->get_channels)(di);
 						if (*gd->get_bitrate)
-							ti->bitrate    = (*gd->get_bitrate)();
+							decoder_ti->bitrate    = (*gd->get_bitrate)(di);
 						if (*gd->get_length)
-							ti->length     = (*gd->get_length)();
+							decoder_ti->length     = (*gd->get_length)(di);
 						if (*gd->get_file_type)
-							strncpy_charset_conv(ti->file_type, (*gd->get_file_type)(),
+							strncpy_charset_conv(decoder_ti->file_type, (*gd->get_file_type)(di),
 												 SIZE_FILE_TYPE-1, 0, charset);
-						channels = ti->channels;
-						trackinfo_release_lock(ti);
+						channels   = decoder_ti->channels;
+						samplerate = decoder_ti->samplerate;
+						trackinfo_release_lock(decoder_ti);
 					}
 
-					if (channels > 0 && trackinfo_acquire_lock(ti)) {
+					if (cached && (samplerate != cached->samplerate || channels != cached->channels)) {
+						wdprintf(V_WARNING, "fileplayer", "Pre-decoded data does not match the file. Discarding it.\n");
+						audio_buffer_clear();
+						pcm_cache_entry_free(cached);
+						cached = NULL;
+					}
+					if (channels > 0 && !cached) conversion_setup(samplerate, channels);
+					if (gapless_continue && channels > 0 && !audio_device_continue(conv_out_rate, conv_out_channels)) {
+						/* The audio format changes, so the previous track has to finish before reopening the device */
+						wdprintf(V_DEBUG, "fileplayer", "Audio format changed. Gapless transition not possible.\n");
+						crossfade_tail_flush();
+						while (audio_buffer_get_fill() > 0 && get_item_status() == PLAYING && !file_player_check_shutdown())
+							wait_for_space(audio_buffer_get_size(), 100);
+						gapless_continue = 0;
+					}
+					/* Without a new boundary the info is published once the previous data has been played */
+					if (decoder_ti != ti) pending_trackinfo_queue(audio_get_track_boundaries_added());
+					if (gapless_continue && ringbuffer_get_fill(&xfade_tail) > 0) {
+						xfade_len = ringbuffer_get_fill(&xfade_tail);
+						xfade_pos = 0;
+						wdprintf(V_DEBUG, "fileplayer", "Crossfading %d bytes (%s mixer).\n",
+						         (int)xfade_len, mixer_get_kernel_name());
+					} else if (channels > 0 && !cached) {
+						crossfade_setup(conv_out_rate, conv_out_channels);
+					}
+
+					if (channels > 0 && trackinfo_acquire_lock(decoder_ti)) {
 						int ret;
 
 						wdprintf(V_INFO, "fileplayer", "Found %s stream w/ %d channel(s), %d Hz, %ld bps, %d seconds\n",
-								 ti->file_type, ti->channels, ti->samplerate, ti->bitrate, ti->length);
+								 decoder_ti->file_type, decoder_ti->channels, decoder_ti->samplerate,
+								 decoder_ti->bitrate, decoder_ti->length);
 
-						if (!trackinfo_has_lyrics(ti)) {
+						if (!trackinfo_has_lyrics(decoder_ti)) {
 							char *lyrics_file = get_file_matching_given_pattern_alloc(filename, lyrics_file_pattern);
 							if (lyrics_file) {
 								wdprintf(V_DEBUG, "fileplayer", "Trying to load lyrics from file %s...\n", lyrics_file);
-								if (trackinfo_load_lyrics_from_file(ti, lyrics_file))
+								if (trackinfo_load_lyrics_from_file(decoder_ti, lyrics_file))
 									wdprintf(V_DEBUG, "fileplayer", "Loading lyrics was successful.\n");
 								else
 									wdprintf(V_WARNING, "fileplayer", "Loading lyrics from file failed.\n");
@@ -390,24 +1043,33 @@ static void *decode_audio_thread(void *udata)
 							/*wdprintf(V_DEBUG, "fileplayer", "LYRICS:%s\n",ti->lyrics);*/
 						}
 
-						if (audio_device_open(ti->samplerate, ti->channels) < 0) {
-							wdprintf(V_ERROR, "fileplayer", "Couldn't open audio: %s\n", SDL_GetError());
+						if (gapless_continue) {
+							wdprintf(V_DEBUG, "fileplayer", "Appending to the audio buffer of the previous track.\n");
+						} else if (cached) {
+							wdprintf(V_DEBUG, "fileplayer", "Continuing with the pre-decoded data.\n");
+						} else if (audio_device_open(conv_out_rate, conv_out_channels) < 0) {
+							wdprintf(V_ERROR, "fileplayer", "Couldn't open audio.\n");
 						} else {
 							wdprintf(V_DEBUG, "fileplayer", "Audio device ready!\n");
 						}
 
 						/* read meta data */
-						if (update_metadata(gd, ti, charset))
+						if (update_metadata(gd, di, decoder_ti, charset) && decoder_ti == ti)
 							event_queue_push(gmu_core_get_event_queue(), GMU_TRACKINFO_CHANGE);
-						trackinfo_release_lock(ti);
+						trackinfo_release_lock(decoder_ti);
 
 						if (get_pb_request() == PBRQ_PLAY) audio_set_pause(0);
 
+						/* The prebuffer needed depends on the stream's bitrate */
+						if (r && decoder_ti->bitrate > 0) reader_set_bitrate(r, decoder_ti->bitrate);
 						if (r && !reader_is_ready(r)) {
 							int check_count = 20, prev_buf_fill = 0;
 							/* Wait for the reader to pre-buffer the requested amount of data (if necessary) */
 							wdprintf(V_DEBUG, "fileplayer", "Prebuffering...\n");
 							event_queue_push(gmu_core_get_event_queue(), GMU_BUFFERING);
+							pthread_mutex_lock(&wait_reader_mutex);
+							wait_reader = r;
+							pthread_mutex_unlock(&wait_reader_mutex);
 							while (r && !reader_is_ready(r) && !reader_is_eof(r) && get_item_status() == PLAYING && check_count > 0) {
 								int buf_fill = reader_get_cache_fill(r);
 								if (prev_buf_fill != buf_fill) {
@@ -416,8 +1078,11 @@ static void *decode_audio_thread(void *udata)
 								} else {
 									check_count--;
 								}
-								SDL_Delay(200);
+								reader_wait_prebuffer(r, 200);
 							}
+							pthread_mutex_lock(&wait_reader_mutex);
+							wait_reader = NULL;
+							pthread_mutex_unlock(&wait_reader_mutex);
 							if (check_count <= 0) {
 								set_item_status(FINISHED);
 								wdprintf(V_DEBUG, "fileplayer", "Prebuffering failed.\n");
@@ -427,53 +1092,76 @@ static void *decode_audio_thread(void *udata)
 							}
 						}
 
+						if (cached) {
+							if (!cache_playback_handover(gd, di, cached, cached_pos, pcmout))
+								wdprintf(V_WARNING, "fileplayer", "Could not continue after the pre-decoded data.\n");
+							pcm_cache_entry_free(cached);
+							cached = NULL;
+						}
+
 						ret = 1;
 						while (
 							( get_item_status() == PLAYING || audio_fade_out_in_progress()
 							|| (item_status != STOPPED && audio_buffer_get_fill() > 0) )
 							&& !file_player_check_shutdown()
 						) {
-							int size = 0, br = 0;
+							int    size = 0, br = 0, direct = 0;
+							size_t out_size = 0;
+							char  *data = pcmout;
+
+							pending_trackinfo_publish();
+							if (seek_ms >= 0) {
+								long sample;
 
-							if (seek_second >= 0) {
 								if (get_item_status() == PLAYING && (!gd->set_reader_handle || reader_is_seekable(r))) {
-									if (*gd->seek && (*gd->seek)(seek_second))
-										audio_set_sample_counter(seek_second * ti->samplerate);
+									if (decoder_seek(gd, di, seek_ms, &sample)) {
+										/* Buffered and held back data is from before the seek position */
+										ringbuffer_clear(&xfade_tail);
+										xfade_len = 0;
+										audio_buffer_clear();
+										if (conv_in_rate != conv_out_rate) resampler_reset(&resampler);
+										audio_set_sample_counter_at_write_position(
+											(long)((long long)sample * conv_out_rate / conv_in_rate)
+										);
+										if (get_pb_request() == PBRQ_PLAY) audio_set_pause(0);
+									}
 								}
-								seek_second = -1;
+								seek_ms = -1;
 							}
 							if (audio_fade_out_in_progress()) {
 								if (audio_fade_out_step(15)) set_item_status(STOPPED);
 							}
-							while (ret > 0 && size < BUF_SIZE / 2 && item_status != STOPPED) {
-								ret = (*gd->decode_data)(pcmout+size, BUF_SIZE-size);
+							if (ret > 0 && item_status != STOPPED) direct = decode_direct(gd, di, &ret, &size);
+							while (!direct && ret > 0 && size < BUF_SIZE / 2 && item_status != STOPPED) {
+								ret = (*gd->decode_data)(di, pcmout+size, BUF_SIZE-size);
 								if (ret > 0) size += ret;
 							}
-							if (ret <= 0) SDL_Delay(50);
-							if (gd->get_current_bitrate) br = (*gd->get_current_bitrate)();
+							if (direct)
+								out_size = size; /* Already in the audio buffer */
+							else if (ret >= 0)
+								data = conversion_run(pcmout, size, ret == 0, &out_size);
+							if (gd->get_current_bitrate) br = (*gd->get_current_bitrate)(di);
 							if (br > 0) {
-								if (trackinfo_acquire_lock(ti)) {
-									ti->recent_bitrate = br;
-									trackinfo_release_lock(ti);
+								if (trackinfo_acquire_lock(decoder_ti)) {
+									decoder_ti->recent_bitrate = br;
+									trackinfo_release_lock(decoder_ti);
 								}
 							}
-							if (ret == 0 && audio_buffer_get_fill() == 0) { /* EOF while decoding data and no data lef in buffer */
+							if (ret == 0 && out_size == 0) audio_set_done(); /* Running out of data is no underrun now */
+							if (ret == 0 && out_size == 0 && gapless) { /* EOF, all data written; let the next track take over while the buffer drains */
+								gapless_eof = 1;
+								break;
+							} else if (ret == 0 && out_size == 0 && audio_buffer_get_fill() == 0) { /* EOF while decoding data and no data lef in buffer */
 								break;
 							} else if (ret < 0) { /* Decoder error */
 								wdprintf(V_ERROR, "fileplayer", "Error. Code: %d\n", ret);
 								audio_set_pause(1);
 								break;
 							} else {
-								int ret = 0;
-								while (!ret && get_item_status() == PLAYING) {
-									ret = audio_fill_buffer(pcmout, size);
-									if (!ret) SDL_Delay(10);
-									if (get_item_status() == PLAYING && get_pb_request() == PBRQ_PLAY && audio_get_pause()) {
-										wdprintf(V_DEBUG, "fileplayer", "Unpause audio due to user request...\n");
-										audio_set_pause(0);
-									}
-								}
-								if (audio_get_status() != SDL_AUDIO_PLAYING &&
+								if (out_size > 0 && !direct) write_pcm(data, out_size);
+								else if (out_size == 0 && ret == 0) /* EOF, wait for the remaining data to be played */
+									wait_for_space(audio_buffer_get_size(), 100);
+								if (!audio_is_playing() &&
 									!audio_get_pause() &&
 									audio_buffer_get_fill() > audio_buffer_get_size() / 2 &&
 									get_pb_request() == PBRQ_PLAY) {
@@ -482,24 +1170,27 @@ static void *decode_audio_thread(void *udata)
 								}
 							}
 							if (*gd->get_meta_data_int) {
-								if ((*gd->get_meta_data_int)(GMU_META_IS_UPDATED, 1)) {
-									if (trackinfo_acquire_lock(ti)) {
-										if (update_metadata(gd, ti, charset)) {
-											event_queue_push(gmu_core_get_event_queue(), GMU_TRACKINFO_CHANGE);
+								if ((*gd->get_meta_data_int)(di, GMU_META_IS_UPDATED)) {
+									if (trackinfo_acquire_lock(decoder_ti)) {
+										if (update_metadata(gd, di, decoder_ti, charset)) {
+											if (decoder_ti == ti)
+												event_queue_push(gmu_core_get_event_queue(), GMU_TRACKINFO_CHANGE);
 											wdprintf(V_DEBUG, "fileplayer", "Meta data change detected!\n");
 										}
-										trackinfo_release_lock(ti);
+										trackinfo_release_lock(decoder_ti);
 									}
 								}
 							}
 						}
 						wdprintf(V_INFO, "fileplayer", "Playback stopped: %d\n", item_status);
 						wdprintf(V_DEBUG, "fileplayer", "Buffer: %d\n", audio_buffer_get_fill());
-						seek_second = -1;
+						seek_ms = -1;
 					} else {
 						wdprintf(V_WARNING, "fileplayer", "Broken audio stream.\n");
 					}
-					(*gd->close_file)();
+					(*gd->close_file)(di);
+				} else if (open_cancelled(NULL)) {
+					wdprintf(V_DEBUG, "fileplayer", "Opening the file has been cancelled.\n");
 				} else {
 					wdprintf(V_DEBUG, "fileplayer", "Unable to open file.\n");
 					event_queue_push_with_parameter(
@@ -509,15 +1200,27 @@ static void *decode_audio_thread(void *udata)
 					);
 				}
 			}
+			if (cached) { /* The decoder could not be used */
+				pcm_cache_entry_free(cached);
+				cached = NULL;
+			}
+			/* Superseded by a newer request, so the main loop must not skip ahead */
+			if (get_item_status() == PLAYING && !gapless_eof && file_requested()) set_item_status(STOPPED);
 			if (get_item_status() == STOPPED) audio_buffer_clear();
 			audio_set_done();
 			if (item_status != STOPPED) set_item_status(FINISHED);
 			wdprintf(V_DEBUG, "fileplayer", "Decoder thread: Playback done.\n");
-			if (trackinfo_acquire_lock(ti)) {
-				trackinfo_clear(ti);
-				trackinfo_release_lock(ti);
+			gapless_continue = 0;
+			if (gapless_eof && item_status == FINISHED)
+				gapless_continue = gapless_wait_for_next_track();
+			if (!gapless_continue) {
+				pending_trackinfo_discard();
+				if (trackinfo_acquire_lock(ti)) {
+					trackinfo_clear(ti);
+					trackinfo_release_lock(ti);
+				}
+				event_queue_push(gmu_core_get_event_queue(), GMU_TRACKINFO_CHANGE);
 			}
-			event_queue_push(gmu_core_get_event_queue(), GMU_TRACKINFO_CHANGE);
 		} else {
 			wdprintf(V_DEBUG, "fileplayer", "wrong item status? %d\n", item_status);
 		}
@@ -525,14 +1228,15 @@ static void *decode_audio_thread(void *udata)
 			free(filename);
 			filename = NULL;
 		}
-		if (r) reader_close(r);
-		if (gd && gd->set_reader_handle) {
-			(*gd->set_reader_handle)(NULL);
+		if (di) {
+			decloader_instance_destroy(gd, di);
+			di = NULL;
 		}
+		if (r) reader_close(r);
 		pthread_mutex_lock(&file_mutex);
 		if (dev_close_asap && !file) audio_device_close();
 		pthread_mutex_unlock(&file_mutex);
-		usleep(100000);
+		if (!gapless_continue) usleep(100000);
 	}
 	wdprintf(V_DEBUG, "fileplayer", "Decoder thread finished.\n");
 	return NULL;
@@ -553,19 +1257,25 @@ int file_player_play_file(char *filename, int skip_current, int fade_out_on_skip
 
 	wdprintf(V_INFO, "fileplayer", "Trying to play %s... (skip current: %d)\n", filename, skip_current);
 	file_player_set_filename(filename);
+	wake_decoder_thread();
 	file_player_start_playback();
 	return 0;
 }
 
 /**
  * Initiates a seek request in the current stream to the relative
- * offset 'offset'. If the specified offset lies before the beginning
- * of the stream, the file player will try to seek to the beginning.
+ * offset 'offset' (in seconds). If the specified offset lies before the
+ * beginning of the stream, the file player will try to seek to the beginning.
  */
 int file_player_seek(long offset)
 {
-	seek_second = audio_get_playtime() / 1000 + offset;
-	if (seek_second < 0) seek_second = 0;
+	return file_player_seek_ms(audio_get_playtime() + offset * 1000);
+}
+
+/* Initiates a seek request to the absolute position 'position_ms' */
+int file_player_seek_ms(long position_ms)
+{
+	seek_ms = position_ms > 0 ? position_ms : 0;
 	return 0;
 }
 
@@ -595,6 +1305,8 @@ int file_player_request_playback_state_change(PB_Status_Request request)
 			audio_set_pause(1);
 			break;
 		case PBRQ_PLAY:
+			wake_decoder_thread(); /* Let it unpause the audio device */
+			break;
 		default:
 			break;
 	}
@@ -20,17 +20,22 @@
 
 int       file_player_check_shutdown(void);
 void      file_player_set_lyrics_file_pattern(const char *pattern);
+void      file_player_set_crossfade(int seconds);
+/* samplerate/channels: output format, 0 = use each track's own format;
+ * quality: resampler quality (0 = low, 1 = medium, 2 = high) */
+void      file_player_set_output_format(int samplerate, int channels, int quality);
 int       file_player_playback_get_time(void);
 PB_Status file_player_get_item_status(void);
 void      file_player_stop_playback(void);
 int       file_player_play_file(char *file, int skip_current, int fade_out_on_skip);
 int       file_player_read_tags(char *file, char *file_type, TrackInfo *ti);
 int       file_player_seek(long offset);
+int       file_player_seek_ms(long position_ms);
 int       file_player_is_thread_running(void);
 void      file_player_shutdown(void);
 void      file_player_set_filename(char *filename);
 void      file_player_start_playback(void);
-int       file_player_init(TrackInfo *ti_ref, int device_close_asap);
+int       file_player_init(TrackInfo *ti_ref, int device_close_asap, int gapless_playback);
 TrackInfo *file_player_get_trackinfo_ref(void);
 int       file_player_request_playback_state_change(PB_Status_Request request);
 #endif
@@ -66,9 +66,9 @@ void cover_viewer_load_artwork(
 
 	/* Try to load image embedded in tag: */
 	if (trackinfo_acquire_lock(ti)) {
-		if (cv->try_to_load_embedded_cover == EMBEDDED_COVER_FIRST && ti->image.data != NULL) {
-			cover_image_load_image_from_memory(&cv->ci, ti->image.data, ti->image.data_size, 
-											 ti->image.mime_type, ready_flag);
+		if (cv->try_to_load_embedded_cover == EMBEDDED_COVER_FIRST && trackinfo_get_image_data(ti) != NULL) {
+			cover_image_load_image_from_memory(&cv->ci, trackinfo_get_image_data(ti), trackinfo_get_image_data_size(ti),
+											 trackinfo_get_image_mime_type(ti), ready_flag);
 			last_cover_path[0] = '\0';
 			ti->has_cover_artwork = 1;
 		} else if (audio_file != NULL && strlen(audio_file) < 256) {
@@ -90,9 +90,9 @@ void cover_viewer_load_artwork(
 				if (cover_image_free_image(&cv->ci))
 					last_cover_path[0] = '\0';
 			}
-		} else if (cv->try_to_load_embedded_cover == EMBEDDED_COVER_LAST && ti->image.data != NULL) {
-			cover_image_load_image_from_memory(&cv->ci, ti->image.data, ti->image.data_size, 
-											   ti->image.mime_type, ready_flag);
+		} else if (cv->try_to_load_embedded_cover == EMBEDDED_COVER_LAST && trackinfo_get_image_data(ti) != NULL) {
+			cover_image_load_image_from_memory(&cv->ci, trackinfo_get_image_data(ti), trackinfo_get_image_data_size(ti),
+											   trackinfo_get_image_mime_type(ti), ready_flag);
 			last_cover_path[0] = '\0';	
 		}
 		trackinfo_release_lock(ti);
@@ -213,17 +213,20 @@ void cover_viewer_show(CoverViewer *cv, SDL_Surface *target, int with_image)
 	/* Draw spectrum analyzer */
 	if (cv->spectrum_analyzer) {
 		Uint32   color = SDL_MapRGB(target->format, 0, 70, 255);
-		int      i, barwidth = aw / 20;
+		int      i, bands = audio_spectrum_get_number_of_bands();
+		int      barwidth = aw * 2 / 5 / bands - 1;
 		int16_t *amplitudes;
-		static int16_t amplitudes_smoothed[8];
+		static int16_t amplitudes_smoothed[64];
 		SDL_Rect dstrect;
 
+		if (barwidth < 1) barwidth = 1;
+		if (bands > 64) bands = 64;
 		dstrect.w = barwidth;
 		dstrect.h = 20;
 		dstrect.x = cv->hide_text ? ax + aw / 2 - aw / 4 : ax + aw / 2;
 		if (audio_spectrum_read_lock()) {
 			amplitudes = audio_spectrum_get_current_amplitudes();
-			for (i = 0; i < 8; i++) {
+			for (i = 0; i < bands; i++) {
 				int16_t a = amplitudes[i] / 327 + 2;
 				dstrect.x += barwidth+1;
 				if (amplitudes_smoothed[i] < a) amplitudes_smoothed[i] = a;
@@ -231,7 +234,7 @@ void cover_viewer_show(CoverViewer *cv, SDL_Surface *target, int with_image)
 				dstrect.h = amplitudes_smoothed[i];
 				dstrect.y = ay + ah / 2 + 25 - amplitudes_smoothed[i];
 				SDL_FillRect(target, &dstrect, color);
-				amplitudes_smoothed[i] -= (15-i);
+				amplitudes_smoothed[i] -= (15 - i * 8 / bands);
 				if (amplitudes_smoothed[i] < 2) amplitudes_smoothed[i] = 2;
 			}
 			audio_spectrum_read_unlock();
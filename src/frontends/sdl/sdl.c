@@ -1293,8 +1293,8 @@ static void *start_player(void *arg)
 	gmu_core_config_release_lock();
 
 	if (start) {
-		char       *decoders_str = NULL;
-		GmuDecoder *gd = NULL;
+		char         *decoders_str = NULL;
+		GmuDecoderV2 *gd = NULL;
 
 		gmu_core_config_acquire_lock();
 		if (skin_name[0] == '\0') {
@@ -164,6 +164,9 @@ static int event_callback(GmuEvent event, int param)
 			if (r < MSG_MAX_LEN && r > 0) httpd_send_websocket_broadcast(msg);
 			break;
 		}
+		case GMU_BUFFER_EMPTY:
+			gmu_http_audio_stats(NULL);
+			break;
 		default:
 			break;
 	}
@@ -926,6 +926,31 @@ void gmu_http_playmode_get_info(Connection *c)
 	if (r < MSG_MAX_LEN && r > 0) httpd_send_websocket_broadcast(msg);
 }
 
+/* Sends the audio buffer statistics to c, or to all clients when c is NULL */
+void gmu_http_audio_stats(Connection *c)
+{
+	char       msg[MSG_MAX_LEN];
+	AudioStats st;
+	int        r;
+
+	audio_get_stats(&st);
+	r = snprintf(msg, MSG_MAX_LEN,
+	             "{ \"cmd\": \"audio_stats\", \"profile\" : \"%s\", \"adaptive\" : %d, " \
+	             "\"buffer_fill_ms\" : %d, \"buffer_target_ms\" : %d, \"callbacks\" : %lu, " \
+	             "\"underruns\" : %lu, \"partial_fills\" : %lu, \"late_callbacks\" : %lu, " \
+	             "\"max_callback_gap_ms\" : %d }",
+	             audio_buffer_profile_get_name(st.profile), st.adaptive,
+	             st.buffer_fill_ms, st.buffer_target_ms, st.callbacks,
+	             st.underruns, st.partial_fills, st.late_callbacks,
+	             st.max_callback_gap_ms);
+	if (r < MSG_MAX_LEN && r > 0) {
+		if (c)
+			websocket_send_string(c, msg);
+		else
+			httpd_send_websocket_broadcast(msg);
+	}
+}
+
 void gmu_http_send_initial_information(Connection *c)
 {
 	char msg[MSG_MAX_LEN];
@@ -1206,8 +1231,16 @@ static int gmu_http_handle_websocket_message(const char *message, Connection *c)
 				} else if (vol >= 0) {
 					gmu_core_set_volume(vol);
 				}
+			} else if (strcmp(cmd, "seek") == 0) {
+				/* Positions in seconds, fractions of a second are possible */
+				if (json_get_type_for_key(json, "position") == JSON_NUMBER)
+					gmu_core_seek_ms((long)(json_get_number_value_for_key(json, "position") * 1000), 0);
+				else if (json_get_type_for_key(json, "relative") == JSON_NUMBER)
+					gmu_core_seek_ms((long)(json_get_number_value_for_key(json, "relative") * 1000), 1);
 			} else if (strcmp(cmd, "ping") == 0) {
 				gmu_http_ping(c);
+			} else if (strcmp(cmd, "audio_stats") == 0) {
+				gmu_http_audio_stats(c);
 			} else if (strcmp(cmd, "medialib_refresh") == 0) {
 				gmu_core_medialib_start_refresh();
 			} else if (strcmp(cmd, "medialib_search") == 0) {
@@ -83,4 +83,5 @@ void gmu_http_playlist_get_item(int id, Connection *c);
 void gmu_http_send_initial_information(Connection *c);
 void gmu_http_get_current_trackinfo(Connection *c);
 void gmu_http_playmode_get_info(Connection *c);
+void gmu_http_audio_stats(Connection *c);
 #endif
@@ -21,7 +21,12 @@ typedef enum GmuMetaDataType {
 	GMU_META_TITLE, GMU_META_ARTIST, GMU_META_ALBUM,
 	GMU_META_TRACKNR, GMU_META_DATE, GMU_META_COMMENT, GMU_META_LYRICS,
 	GMU_META_IMAGE_DATA, GMU_META_IMAGE_DATA_SIZE, GMU_META_IMAGE_MIME_TYPE,
-	GMU_META_IS_UPDATED
+	GMU_META_IS_UPDATED,
+	/* Local file containing the image at GMU_META_IMAGE_OFFSET (int), for
+	 * images that are loaded only when needed. Requesting GMU_META_IMAGE_DATA
+	 * for such an image loads it. Decoders return no file for images whose
+	 * offset does not fit into an int, so the image data is used instead. */
+	GMU_META_IMAGE_FILE, GMU_META_IMAGE_OFFSET
 } GmuMetaDataType;
 
 typedef enum GmuCharset { 
@@ -110,7 +115,73 @@ typedef struct _GmuDecoder {
 	void         *handle;
 } GmuDecoder;
 
+#define GMU_DECODER_API_VERSION 2
+
+/* Decoder state of a single stream. Each v2 decoder defines its own
+ * struct _GmuDecoderInstance; Gmu only ever handles pointers to it. */
+typedef struct _GmuDecoderInstance GmuDecoderInstance;
+
+/*
+ * Version 2 of the decoder interface. Unlike GmuDecoder, all per-stream
+ * state lives in a GmuDecoderInstance, so any number of streams can be
+ * decoded at the same time, e.g. one for playback while the next track
+ * is being prepared or meta data is being scanned in another thread.
+ * Different instances may be used from different threads concurrently,
+ * a single instance must only be used by one thread at a time.
+ * Functions documented for GmuDecoder have the same semantics here, but
+ * refer to the given instance instead of the decoder's global state.
+ */
+typedef struct _GmuDecoderV2 {
+	/* Must be set to GMU_DECODER_API_VERSION */
+	int                   api_version;
+	const char           *identifier;
+	void                 (*init_decoder)(void);
+	void                 (*close_decoder)(void);
+	const char *         (*get_name)(void);
+	const char *         (*get_info)(void);
+	const char *         (*get_file_extensions)(void);
+	const char *         (*get_mime_types)(void);
+	int                  (*data_check_magic_bytes)(const char *data, size_t size);
+	/* Allocates a new decoder instance. Returns NULL on failure. */
+	GmuDecoderInstance * (*create_instance)(void);
+	/* Frees an instance, closing its file first if necessary. */
+	void                 (*destroy_instance)(GmuDecoderInstance *inst);
+	/* Supplies a Reader handle for the next open_file() call. Unlike with
+	 * v1 decoders, the handle stays owned by the caller. Can be NULL. */
+	void                 (*set_reader_handle)(GmuDecoderInstance *inst, Reader *r);
+	int                  (*open_file)(GmuDecoderInstance *inst, const char *filename);
+	/* Closes the file opened with open_file() or the meta data loaded with
+	 * meta_data_load(). The instance can be reused afterwards. */
+	int                  (*close_file)(GmuDecoderInstance *inst);
+	int                  (*decode_data)(GmuDecoderInstance *inst, char *target, size_t max_size);
+	int                  (*seek)(GmuDecoderInstance *inst, int second);
+	int                  (*get_current_bitrate)(GmuDecoderInstance *inst);
+	/* Returns meta data of the file opened or loaded with this instance */
+	const char *         (*get_meta_data)(GmuDecoderInstance *inst, GmuMetaDataType gmdt);
+	int                  (*get_meta_data_int)(GmuDecoderInstance *inst, GmuMetaDataType gmdt);
+	int                  (*get_samplerate)(GmuDecoderInstance *inst);
+	int                  (*get_channels)(GmuDecoderInstance *inst);
+	int                  (*get_length)(GmuDecoderInstance *inst);
+	int                  (*get_bitrate)(GmuDecoderInstance *inst);
+	const char *         (*get_file_type)(GmuDecoderInstance *inst);
+	int                  (*get_decoder_buffer_size)(GmuDecoderInstance *inst);
+	/* Loads the meta data of the given file into the instance without
+	 * preparing it for decoding. Release it with close_file(). */
+	int                  (*meta_data_load)(GmuDecoderInstance *inst, const char *filename);
+	GmuCharset           (*meta_data_get_charset)(GmuDecoderInstance *inst);
+	/* Seeks to the given sample (frame) from the beginning of the stream.
+	 * Returns TRUE on success. Can be NULL, seek() is used instead then. */
+	int                  (*seek_sample)(GmuDecoderInstance *inst, long sample);
+	/* internal handles, do not use */
+	void                 *handle;
+	void                 *legacy;
+} GmuDecoderV2;
+
 /* This function must be implemented by the decoder. It must return a valid
- * GmuDecoder object */
-GmuDecoder *GMU_REGISTER_DECODER(void);
+ * GmuDecoder object. Decoders implementing the v2 interface implement
+ * GMU_REGISTER_DECODER_V2() instead. */
+GmuDecoder   *GMU_REGISTER_DECODER(void);
+#ifdef GMU_REGISTER_DECODER_V2
+GmuDecoderV2 *GMU_REGISTER_DECODER_V2(void);
+#endif
 #endif
@@ -0,0 +1,60 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: gmuoutput.h  Created: 261016
+ *
+ * Description: Gmu audio output plugin interface
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+
+#ifndef _GMUOUTPUT_H
+#define _GMUOUTPUT_H
+
+/* Called by the output whenever it needs more audio data. Fills stream
+ * with len bytes of signed 16 bit native-endian interleaved PCM and returns
+ * the number of bytes taken from the audio buffer; the remainder of stream
+ * is filled with silence. */
+typedef int (*GmuOutputFillCallback)(char *stream, int len);
+
+typedef struct _GmuOutput {
+	/* Short identifier such as "sdl". Used to select the output in the
+	 * configuration (Gmu.AudioOutput) */
+	const char   *identifier;
+	/* Should return a human-readable name such as "SDL audio output v1.0" */
+	const char * (*get_name)(void);
+	/* Init function. Can be NULL if not neccessary. Will be called ONCE when
+	 * the output is loaded. Should return 1 on success, 0 otherwise. */
+	int          (*output_init)(void);
+	/* Function to be called on unload. Can be NULL. */
+	void         (*output_shutdown)(void);
+	/* Opens the output with the given sample rate and number of channels.
+	 * buffer_frames is a hint for the number of frames to request from
+	 * the fill callback at once. The output starts paused. Returns 1 on
+	 * success, 0 otherwise. */
+	int          (*open)(int samplerate, int channels, int buffer_frames, GmuOutputFillCallback fill);
+	void         (*close)(void);
+	/* Pauses (pause=1) or resumes (pause=0) calling the fill callback */
+	void         (*pause)(int pause);
+	/* Returns 1 when the output is open and not paused */
+	int          (*is_playing)(void);
+	/* Blocks calls to the fill callback until unlock is called */
+	void         (*lock)(void);
+	void         (*unlock)(void);
+	/* Returns the number of frames it takes until data returned by the
+	 * fill callback becomes audible. Can be NULL if negligible. */
+	int          (*get_latency)(void);
+	/* internal handle, do not use */
+	void         *handle;
+} GmuOutput;
+
+/* This function must be implemented by the output plugin. It must return
+ * a valid GmuOutput object */
+GmuOutput *GMU_REGISTER_OUTPUT(void);
+#endif
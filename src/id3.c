@@ -21,7 +21,28 @@
 #include "charset.h"
 #include "debug.h"
 #include "id3.h"
-#define ID3V2_MAX_SIZE 262144
+#define ID3V2_MAX_SIZE 16777216
+#define ID3V1_SIZE     128
+
+/* Tag data that has been read already, parsed like a file */
+typedef struct _ID3Data {
+	const unsigned char *data;
+	size_t               size, pos;
+	const char          *file; /* File starting with data, NULL if unknown */
+} ID3Data;
+
+static int data_read(ID3Data *d, void *target, size_t size)
+{
+	if (size > d->size - d->pos) return 0;
+	memcpy(target, d->data + d->pos, size);
+	d->pos += size;
+	return 1;
+}
+
+static int data_getc(ID3Data *d)
+{
+	return d->pos < d->size ? d->data[d->pos++] : EOF;
+}
 
 static int convert_copy_strip(char *target, const char *source, size_t size)
 {
@@ -36,50 +57,54 @@ static int convert_copy_strip(char *target, const char *source, size_t size)
 	return res;
 }
 
-int id3_read_id3v1(FILE *file, TrackInfo *ti, const char *file_type)
+/* Parses the last ID3V1_SIZE bytes of a file */
+static int parse_id3v1(const char *tag, TrackInfo *ti, const char *file_type)
 {
 	int result = 0;
 
-	if (fseek(file, -128, SEEK_END) == 0) {
-		char id[3];
-
-		/* Search for a ID3v1 tag: */
-		if (fread(id, 3, 1, file) && strncmp(id, "TAG", 3) == 0) {
-			char title[31], artist[31], album[31], year[5], comment[31];
-			int  tracknr = 0;
-
-			if (fread(title, 30, 1, file)  &&
-			    fread(artist, 30, 1, file) &&
-			    fread(album, 30, 1, file)  &&
-			    fread(year, 4, 1, file)    &&
-			    fread(comment, 30, 1, file)) {
-				title[30] = '\0';
-				artist[30] = '\0';
-				album[30] = '\0';
-				year[4] = '\0';
-				comment[30] = '\0';
-				wdprintf(V_INFO, "id3", "ID3v1.%d detected!\n", (comment[28] == '\0' ? 1 : 0));
-				if (comment[28] == '\0') {
-					snprintf(ti->file_type, SIZE_FILE_TYPE-1, "%s (ID3v1.1)", file_type);
-					tracknr = comment[29];
-				} else {
-					snprintf(ti->file_type, SIZE_FILE_TYPE-1, "%s (ID3v1)", file_type);
-				}
-				if (strlen(title) > 0) {
-					convert_copy_strip(ti->title, title, SIZE_TITLE-1);
-				}
-				convert_copy_strip(ti->artist, artist, SIZE_ARTIST-1);
-				convert_copy_strip(ti->album, album, SIZE_ALBUM-1);
-				convert_copy_strip(ti->comment, comment, SIZE_COMMENT-1);
-				convert_copy_strip(ti->date, year, SIZE_DATE-1);
-				snprintf(ti->tracknr, SIZE_TRACKNR-1, "%d", tracknr);
-				result = 1;
-			}
+	/* Search for a ID3v1 tag: */
+	if (strncmp(tag, "TAG", 3) == 0) {
+		char title[31], artist[31], album[31], year[5], comment[31];
+		int  tracknr = 0;
+
+		memcpy(title, tag + 3, 30);
+		memcpy(artist, tag + 33, 30);
+		memcpy(album, tag + 63, 30);
+		memcpy(year, tag + 93, 4);
+		memcpy(comment, tag + 97, 30);
+		title[30] = '\0';
+		artist[30] = '\0';
+		album[30] = '\0';
+		year[4] = '\0';
+		comment[30] = '\0';
+		wdprintf(V_INFO, "id3", "ID3v1.%d detected!\n", (comment[28] == '\0' ? 1 : 0));
+		if (comment[28] == '\0') {
+			snprintf(ti->file_type, SIZE_FILE_TYPE-1, "%s (ID3v1.1)", file_type);
+			tracknr = comment[29];
+		} else {
+			snprintf(ti->file_type, SIZE_FILE_TYPE-1, "%s (ID3v1)", file_type);
 		}
+		if (strlen(title) > 0) {
+			convert_copy_strip(ti->title, title, SIZE_TITLE-1);
+		}
+		convert_copy_strip(ti->artist, artist, SIZE_ARTIST-1);
+		convert_copy_strip(ti->album, album, SIZE_ALBUM-1);
+		convert_copy_strip(ti->comment, comment, SIZE_COMMENT-1);
+		convert_copy_strip(ti->date, year, SIZE_DATE-1);
+		snprintf(ti->tracknr, SIZE_TRACKNR-1, "%d", tracknr);
+		result = 1;
 	}
 	return result;
 }
 
+int id3_read_id3v1(FILE *file, TrackInfo *ti, const char *file_type)
+{
+	char tag[ID3V1_SIZE];
+
+	return fseek(file, -ID3V1_SIZE, SEEK_END) == 0 && fread(tag, ID3V1_SIZE, 1, file) &&
+	       parse_id3v1(tag, ti, file_type);
+}
+
 static int calc_size_unsync(const unsigned char *four_bytes)
 {
 	return (four_bytes[3])       + (four_bytes[2] << 7) + 
@@ -142,30 +167,33 @@ static int set_data(
 	return res;
 }
 
-static void set_cover_art(TrackInfo *ti, char *data, size_t data_size, Charset charset)
+/* Sets the image of an APIC frame. If the file is known, the frame's data
+ * (after the text encoding byte) is located at offset in that file and the
+ * image is only referenced. Otherwise, it is copied. */
+static void set_cover_art(TrackInfo *ti, const char *data, size_t data_size, Charset charset,
+                          const char *file, unsigned long offset)
 {
-	char  *mime_type = data, *descr = NULL;
-	size_t m;
+	char   mime_type[SIZE_MIME_TYPE];
+	size_t m, len;
 	int    pic_type;
+	if (data_size < 2) return;
 	/* skip over mime type: */
-	for (m = 0; data[m] != '\0' && m < data_size - 1; m++);
+	for (m = 0; m < data_size - 1 && data[m] != '\0'; m++);
+	len = m < SIZE_MIME_TYPE - 1 ? m : SIZE_MIME_TYPE - 1;
+	memcpy(mime_type, data, len);
+	mime_type[len] = '\0';
 	m++;
-	pic_type = *(data+m);
+	pic_type = (unsigned char)data[m];
 	m++; /* skip over picture type byte */
-	descr = data+m;
 	/* skip over description: */
-	for (; data[m] != '\0' && m < data_size - 1; m++);
+	for (; m < data_size - 1 && data[m] != '\0'; m++);
 	m++;
 	if (charset == UTF_16 || charset == UTF_16_BOM) m++;
-	wdprintf(
-		V_DEBUG,
-		"id3", "APIC: mime type: %s pic type: %d description: %s\n",
-		mime_type,
-		pic_type,
-		descr
-	);
+	if (m >= data_size) return;
+	wdprintf(V_DEBUG, "id3", "APIC: mime type: %s pic type: %d\n", mime_type, pic_type);
 	/*wdprintf(V_DEBUG, "id3", "APIC: size = %d (header: %d)\n", data_size-m, m);*/
-	trackinfo_set_image(ti, data+m, data_size-m, mime_type);
+	if (!file || !trackinfo_set_image_reference(ti, file, offset + m, data_size - m, mime_type))
+		trackinfo_set_image(ti, data+m, data_size-m, mime_type);
 }
 
 static void set_lyrics(TrackInfo *ti, const char *str, size_t str_size, Charset charset)
@@ -185,15 +213,15 @@ static void set_lyrics(TrackInfo *ti, const char *str, size_t str_size, Charset
 	}
 }
 
-static int fread_unsync(char *frame_data, size_t fsize, FILE *file)
+static int read_unsync(char *frame_data, size_t fsize, ID3Data *d)
 {
 	size_t j;
 
 	for (j = 0; j < fsize; j++) {
-		unsigned char uc = fgetc(file);
+		unsigned char uc = data_getc(d);
 		frame_data[j] = (char)uc;
 		if (uc == 0xFF) {
-			uc = fgetc(file);
+			uc = data_getc(d);
 			if (uc != 0) {
 				j++;
 				frame_data[j] = (char)uc;
@@ -203,19 +231,19 @@ static int fread_unsync(char *frame_data, size_t fsize, FILE *file)
 	return j;
 }
 
-int id3_read_id3v2(FILE *file, TrackInfo *ti, const char *file_type)
+/* Parses an ID3v2 tag from the beginning of d */
+static int parse_id3v2(ID3Data *d, TrackInfo *ti, const char *file_type)
 {
 	char id[3];
 	int  result = 0;
 
-	rewind(file);
-	if (fread(id, 3, 1, file) && strncmp(id, "ID3", 3) == 0) {
+	if (data_read(d, id, 3) && strncmp(id, "ID3", 3) == 0) {
 		unsigned char ver_major, ver_minor, flags, size[4];
 
-		ver_major = fgetc(file);
-		ver_minor = fgetc(file);
-		flags     = fgetc(file);
-		if (fread(size, 4, 1, file)) {
+		ver_major = data_getc(d);
+		ver_minor = data_getc(d);
+		flags     = data_getc(d);
+		if (data_read(d, size, 4)) {
 			wdprintf(V_INFO, "id3", "ID3v2.%d.%d detected!\n", ver_major, ver_minor);
 			snprintf(ti->file_type, SIZE_FILE_TYPE, "%s (ID3v2.%d.%d)",
 					 file_type, ver_major, ver_minor);
@@ -250,14 +278,14 @@ int id3_read_id3v2(FILE *file, TrackInfo *ti, const char *file_type)
 					size_t byte_counter = 0;
 					char   frame_id[5] = "X", frame_flags[3];
 
-					if (real_size - 10 > ID3V2_MAX_SIZE) frame_id[0] = 0;
+					if (real_size < 10 || real_size - 10 > ID3V2_MAX_SIZE) frame_id[0] = 0;
 					while (byte_counter < real_size - 10 && frame_id[0] != 0) {
 						size_t fsize;
 						int    frame_unsync = 0;
 
-						if (fread(frame_id,    4, 1, file) &&
-						    fread(frame_size,  4, 1, file) &&
-						    fread(frame_flags, 2, 1, file)) {
+						if (data_read(d, frame_id,    4) &&
+						    data_read(d, frame_size,  4) &&
+						    data_read(d, frame_flags, 2)) {
 							byte_counter += 10;
 							fsize = calc_size(frame_size);
 							/*wdprintf(V_DEBUG, "id3", "Frame ID: %s - Frame size: %d bytes\n", frame_id, fsize);*/
@@ -266,16 +294,26 @@ int id3_read_id3v2(FILE *file, TrackInfo *ti, const char *file_type)
 								frame_unsync = (frame_flags[1] & 2) ? 1 : 0;
 							/*wdprintf(V_DEBUG, "id3", "bytecounter=%d fsize=%d realsize=%d r-b=%d\n",
 									   byte_counter, fsize, real_size, real_size - byte_counter);*/
-							if (fsize > 0 && fsize <= real_size - byte_counter) {
+							if (fsize > 0 && fsize <= real_size - byte_counter && fsize <= d->size - d->pos &&
+							    strncmp(frame_id, "APIC", 4) == 0 && d->file &&
+							    !((global_unsync && ver_major == 3) || frame_unsync)) {
+								/* The image is used directly from the file, so the frame is not copied */
+								const char *frame_data = (const char *)d->data + d->pos;
+								Charset     charset    = frame_data[0] == 1 ? UTF_16_BOM :
+								                         (frame_data[0] == 2 ? UTF_16 : ISO_8859_1);
+								set_cover_art(ti, frame_data+1, fsize-1, charset, d->file, d->pos + 1);
+								d->pos += fsize;
+								byte_counter += fsize;
+							} else if (fsize > 0 && fsize <= real_size - byte_counter) {
 								char    *frame_data = malloc(fsize+1);
 								Charset  charset    = ISO_8859_1;
 								char    *tmp_charset;
 
 								if ((global_unsync && ver_major == 3 ) || frame_unsync) {
-									fread_unsync(frame_data, fsize, file);
+									read_unsync(frame_data, fsize, d);
 									/*wdprintf(V_DEBUG, "id3", "Decoded unsync scheme.\n");*/
 								} else {
-									if (!fread(frame_data, fsize, 1, file)) {
+									if (!data_read(d, frame_data, fsize)) {
 										wdprintf(V_ERROR, "id3", "ERROR: Incomplete data.\n");
 										break;
 									}
@@ -323,7 +361,7 @@ int id3_read_id3v2(FILE *file, TrackInfo *ti, const char *file_type)
 								} else if (strncmp(frame_id, "COMM", 4) == 0) {
 									set_data(ti, COMMENT, frame_data+1, fsize-1, charset);
 								} else if (strncmp(frame_id, "APIC", 4) == 0) {
-									set_cover_art(ti, frame_data+1, fsize-1, charset);
+									set_cover_art(ti, frame_data+1, fsize-1, charset, NULL, 0);
 								} else if (strncmp(frame_id, "USLT", 4) == 0) {
 									set_lyrics(ti, frame_data+4, fsize-4, charset);
 								}
@@ -342,31 +380,97 @@ int id3_read_id3v2(FILE *file, TrackInfo *ti, const char *file_type)
 	return result;
 }
 
-int id3_read_tag(const char *filename, TrackInfo *ti, const char *file_type)
+/* Returns the number of bytes of an ID3v2 tag that need to be read for
+ * parsing it, given its first 10 bytes, or 0 if there is no tag */
+static size_t id3v2_parse_size(const char *header, long file_size)
 {
-	int   result = 0;
-	FILE *file;
+	size_t size;
 
-	if ((file = fopen(filename, "r"))) {
-		const char *filename_without_path = strrchr(filename, '/');
+	if (strncmp(header, "ID3", 3) != 0) return 0;
+	size = calc_size_unsync((const unsigned char *)header + 6);
+	/* Frames of oversized (or broken) tags are skipped */
+	if (size < 10 || size - 10 > ID3V2_MAX_SIZE) return 10;
+	/* The tag cannot be larger than the file (if its size is known) */
+	if (file_size > 0 && size + 10 > (unsigned long)file_size) return file_size;
+	return size + 10;
+}
 
-		if (filename_without_path != NULL)
-			filename_without_path++;
-		else
-			filename_without_path = filename;
+int id3_read_id3v2(FILE *file, TrackInfo *ti, const char *file_type)
+{
+	char    header[10], *tag;
+	size_t  size;
+	long    file_size;
+	int     result = 0;
 
-		trackinfo_clear(ti);
-		if (charset_is_valid_utf8_string(filename_without_path)) {
-			strncpy(ti->title, filename_without_path, SIZE_TITLE-1);
-		} else {
-			if (!charset_iso8859_1_to_utf8(ti->title, filename_without_path, SIZE_TITLE-1)) {
-				wdprintf(V_WARNING, "id3", "ERROR: Failed to convert filename text to UTF-8.\n");
-			}
+	fseek(file, 0, SEEK_END);
+	file_size = ftell(file);
+	rewind(file);
+	if (fread(header, 10, 1, file) && (size = id3v2_parse_size(header, file_size)) > 0 && (tag = malloc(size))) {
+		ID3Data d;
+
+		memcpy(tag, header, 10);
+		d.data = (const unsigned char *)tag;
+		d.size = 10 + fread(tag + 10, 1, size - 10, file);
+		d.pos  = 0;
+		d.file = NULL;
+		result = parse_id3v2(&d, ti, file_type);
+		free(tag);
+	}
+	return result;
+}
+
+/* Uses the file name as title until a tag tells otherwise */
+static void id3_init_trackinfo(TrackInfo *ti, const char *filename)
+{
+	const char *filename_without_path = strrchr(filename, '/');
+
+	if (filename_without_path != NULL)
+		filename_without_path++;
+	else
+		filename_without_path = filename;
+
+	trackinfo_clear(ti);
+	if (charset_is_valid_utf8_string(filename_without_path)) {
+		strncpy(ti->title, filename_without_path, SIZE_TITLE-1);
+	} else {
+		if (!charset_iso8859_1_to_utf8(ti->title, filename_without_path, SIZE_TITLE-1)) {
+			wdprintf(V_WARNING, "id3", "ERROR: Failed to convert filename text to UTF-8.\n");
 		}
-		strncpy(ti->file_type, "MP3", SIZE_FILE_TYPE-1);
-		if (!(result = id3_read_id3v2(file, ti, file_type)))
-			result = id3_read_id3v1(file, ti, file_type);
-		fclose(file);
+	}
+	strncpy(ti->file_type, "MP3", SIZE_FILE_TYPE-1);
+}
+
+int id3_read_tag_from_reader(Reader *r, const char *filename, TrackInfo *ti, const char *file_type)
+{
+	const char *data;
+	long        file_size = reader_get_file_size(r);
+	size_t      size;
+	int         result = 0;
+
+	id3_init_trackinfo(ti, filename);
+	if ((data = reader_peek(r, 0, 10)) && (size = id3v2_parse_size(data, file_size)) > 0) {
+		ID3Data d;
+
+		if ((d.data = (const unsigned char *)reader_peek(r, 0, size))) {
+			d.size = size;
+			d.pos  = 0;
+			d.file = strstr(filename, "://") ? NULL : filename;
+			result = parse_id3v2(&d, ti, file_type);
+		}
+	}
+	if (!result && file_size >= ID3V1_SIZE && (data = reader_peek(r, file_size - ID3V1_SIZE, ID3V1_SIZE)))
+		result = parse_id3v1(data, ti, file_type);
+	return result;
+}
+
+int id3_read_tag(const char *filename, TrackInfo *ti, const char *file_type)
+{
+	int     result = 0;
+	Reader *r = strstr(filename, "://") ? NULL : reader_open(filename);
+
+	if (r) {
+		result = id3_read_tag_from_reader(r, filename, ti, file_type);
+		reader_close(r);
 	}
 	return result;
 }
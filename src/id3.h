@@ -17,8 +17,12 @@
 #define _ID3_H
 #include <stdio.h>
 #include "trackinfo.h"
+#include "reader.h"
 
 int id3_read_id3v1(FILE *file, TrackInfo *ti, const char *file_type);
 int id3_read_id3v2(FILE *file, TrackInfo *ti, const char *file_type);
 int id3_read_tag(const char *filename, TrackInfo *ti, const char *file_type);
+/* Like id3_read_tag(), but parses the tags from data the reader has
+ * already read or can provide without disturbing the stream */
+int id3_read_tag_from_reader(Reader *r, const char *filename, TrackInfo *ti, const char *file_type);
 #endif
@@ -0,0 +1,164 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: lfringbuffer.c  Created: 261016
+ *
+ * Description: Lock-free single-producer/single-consumer ring buffer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "lfringbuffer.h"
+
+int lfringbuffer_init_with_slack(LockFreeRingBuffer *rb, size_t size, size_t slack)
+{
+	size_t real_size = 1;
+
+	while (real_size < size) real_size <<= 1;
+	if (slack > real_size) slack = real_size;
+	rb->buffer    = (char *)malloc(real_size + slack);
+	rb->size      = rb->buffer ? real_size : 0;
+	rb->mask      = real_size - 1;
+	rb->slack     = slack;
+	rb->write_pos = 0;
+	rb->read_pos  = 0;
+	return rb->buffer ? 1 : 0;
+}
+
+int lfringbuffer_init(LockFreeRingBuffer *rb, size_t size)
+{
+	return lfringbuffer_init_with_slack(rb, size, 0);
+}
+
+void lfringbuffer_free(LockFreeRingBuffer *rb)
+{
+	if (rb->buffer != NULL) {
+		free(rb->buffer);
+		rb->buffer = NULL;
+	}
+	rb->size = 0;
+}
+
+int lfringbuffer_write(LockFreeRingBuffer *rb, const char *data, size_t size)
+{
+	int    result = 0;
+	size_t rp = ATOMIC_LOAD_ACQUIRE(&(rb->read_pos));
+	size_t wp = rb->write_pos;
+
+	if (size <= rb->size - (wp - rp)) {
+		size_t offset = wp & rb->mask;
+
+		if (rb->size - offset >= size) {
+			memcpy(rb->buffer + offset, data, size);
+		} else {
+			size_t size_chunk_1 = rb->size - offset;
+			memcpy(rb->buffer + offset, data, size_chunk_1);
+			memcpy(rb->buffer, data + size_chunk_1, size - size_chunk_1);
+		}
+		/* Publish the data only after it has been completely written */
+		ATOMIC_STORE_RELEASE(&(rb->write_pos), wp + size);
+		result = 1;
+	}
+	return result;
+}
+
+int lfringbuffer_read(LockFreeRingBuffer *rb, char *target, size_t size)
+{
+	int    result = 0;
+	size_t wp = ATOMIC_LOAD_ACQUIRE(&(rb->write_pos));
+	size_t rp = rb->read_pos;
+
+	if (size <= wp - rp) {
+		size_t offset = rp & rb->mask;
+
+		if (rb->size - offset >= size) {
+			memcpy(target, rb->buffer + offset, size);
+		} else {
+			size_t size_chunk_1 = rb->size - offset;
+			memcpy(target, rb->buffer + offset, size_chunk_1);
+			memcpy(target + size_chunk_1, rb->buffer, size - size_chunk_1);
+		}
+		/* Hand the space back to the producer only after we are done with it */
+		ATOMIC_STORE_RELEASE(&(rb->read_pos), rp + size);
+		result = 1;
+	}
+	return result;
+}
+
+char *lfringbuffer_write_reserve(LockFreeRingBuffer *rb, size_t *size)
+{
+	size_t rp = ATOMIC_LOAD_ACQUIRE(&(rb->read_pos));
+	size_t wp = rb->write_pos;
+	size_t offset = wp & rb->mask;
+	size_t contiguous = rb->size - offset + rb->slack;
+
+	*size = rb->size - (wp - rp);
+	if (*size > contiguous) *size = contiguous;
+	return rb->buffer + offset;
+}
+
+void lfringbuffer_write_commit(LockFreeRingBuffer *rb, size_t size)
+{
+	size_t wp = rb->write_pos;
+	size_t offset = wp & rb->mask;
+
+	/* Move data from the slack area to where it belongs */
+	if (offset + size > rb->size)
+		memcpy(rb->buffer, rb->buffer + rb->size, offset + size - rb->size);
+	ATOMIC_STORE_RELEASE(&(rb->write_pos), wp + size);
+}
+
+const char *lfringbuffer_read_peek(LockFreeRingBuffer *rb, size_t *size)
+{
+	size_t wp = ATOMIC_LOAD_ACQUIRE(&(rb->write_pos));
+	size_t rp = rb->read_pos;
+	size_t offset = rp & rb->mask;
+
+	*size = wp - rp;
+	if (*size > rb->size - offset) *size = rb->size - offset;
+	return rb->buffer + offset;
+}
+
+void lfringbuffer_read_consume(LockFreeRingBuffer *rb, size_t size)
+{
+	ATOMIC_STORE_RELEASE(&(rb->read_pos), rb->read_pos + size);
+}
+
+size_t lfringbuffer_get_fill(LockFreeRingBuffer *rb)
+{
+	size_t rp = ATOMIC_LOAD_ACQUIRE(&(rb->read_pos));
+	size_t wp = ATOMIC_LOAD_ACQUIRE(&(rb->write_pos));
+	return wp - rp;
+}
+
+size_t lfringbuffer_get_free(LockFreeRingBuffer *rb)
+{
+	return rb->size - lfringbuffer_get_fill(rb);
+}
+
+size_t lfringbuffer_get_size(LockFreeRingBuffer *rb)
+{
+	return rb->size;
+}
+
+size_t lfringbuffer_get_write_position(LockFreeRingBuffer *rb)
+{
+	return ATOMIC_LOAD_ACQUIRE(&(rb->write_pos));
+}
+
+size_t lfringbuffer_get_read_position(LockFreeRingBuffer *rb)
+{
+	return ATOMIC_LOAD_ACQUIRE(&(rb->read_pos));
+}
+
+void lfringbuffer_clear(LockFreeRingBuffer *rb)
+{
+	ATOMIC_STORE_RELEASE(&(rb->read_pos), ATOMIC_LOAD_ACQUIRE(&(rb->write_pos)));
+}
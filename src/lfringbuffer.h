@@ -0,0 +1,80 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: lfringbuffer.h  Created: 261016
+ *
+ * Description: Lock-free single-producer/single-consumer ring buffer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef WEJ_LFRINGBUFFER_H
+#define WEJ_LFRINGBUFFER_H
+#include <sys/types.h>
+#include "atomic_helper.h"
+
+/*
+ * Exactly one thread may write to the buffer (the producer) and exactly
+ * one thread may read from it (the consumer) at the same time. Neither
+ * side ever blocks. The read and write positions are free-running
+ * counters which live on separate cache lines, so that producer and
+ * consumer do not keep invalidating each other's cache line.
+ * The buffer size is always rounded up to the next power of two.
+ *
+ * Besides copying data in and out, both sides can access the buffer
+ * memory directly (reserve/commit and peek/consume). For writing, an
+ * optional slack area behind the end of the buffer guarantees contiguous
+ * regions of up to 'slack' bytes even when the write position is close
+ * to the end; data committed to the slack area is moved to the start of
+ * the buffer.
+ */
+struct _LockFreeRingBuffer {
+	char   *buffer;
+	size_t  size, mask, slack;
+	char    pad_w[CACHE_LINE_SIZE];
+	size_t  write_pos; /* Only ever modified by the producer */
+	char    pad_r[CACHE_LINE_SIZE - sizeof(size_t)];
+	size_t  read_pos;  /* Only ever modified by the consumer */
+	char    pad_e[CACHE_LINE_SIZE - sizeof(size_t)];
+};
+
+typedef struct _LockFreeRingBuffer LockFreeRingBuffer;
+
+int    lfringbuffer_init(LockFreeRingBuffer *rb, size_t size);
+int    lfringbuffer_init_with_slack(LockFreeRingBuffer *rb, size_t size, size_t slack);
+void   lfringbuffer_free(LockFreeRingBuffer *rb);
+/* Producer side; writes all or nothing. Returns 1 on success, 0 otherwise. */
+int    lfringbuffer_write(LockFreeRingBuffer *rb, const char *data, size_t size);
+/* Consumer side; reads all or nothing. Returns 1 on success, 0 otherwise. */
+int    lfringbuffer_read(LockFreeRingBuffer *rb, char *target, size_t size);
+/* Producer side; returns a pointer to the contiguous free region at the
+ * write position and stores its size in *size. The region is at least
+ * min(free space, slack) bytes large. Nothing becomes visible to the
+ * consumer before lfringbuffer_write_commit() is called. */
+char  *lfringbuffer_write_reserve(LockFreeRingBuffer *rb, size_t *size);
+/* Producer side; publishes size bytes written to the reserved region */
+void   lfringbuffer_write_commit(LockFreeRingBuffer *rb, size_t size);
+/* Consumer side; returns a pointer to the contiguous readable data at the
+ * read position and stores its size in *size. Data wrapping around the
+ * end of the buffer becomes available after consuming the first part. */
+const char *lfringbuffer_read_peek(LockFreeRingBuffer *rb, size_t *size);
+/* Consumer side; hands size bytes of peeked data back to the producer */
+void   lfringbuffer_read_consume(LockFreeRingBuffer *rb, size_t size);
+/* Fill/free queries can be called from any thread without locking. The
+ * result is a snapshot and may already be outdated when it is used. */
+size_t lfringbuffer_get_fill(LockFreeRingBuffer *rb);
+size_t lfringbuffer_get_free(LockFreeRingBuffer *rb);
+size_t lfringbuffer_get_size(LockFreeRingBuffer *rb);
+/* Total number of bytes written to/read from the buffer so far (wrapping
+ * around at SIZE_MAX). Useful for marking positions in the data stream. */
+size_t lfringbuffer_get_write_position(LockFreeRingBuffer *rb);
+size_t lfringbuffer_get_read_position(LockFreeRingBuffer *rb);
+/* Discards all unread data. Must be called from the consumer thread or
+ * while the consumer is known not to be running. */
+void   lfringbuffer_clear(LockFreeRingBuffer *rb);
+#endif
@@ -20,33 +20,41 @@
 #include "util.h"
 #include "decloader.h"
 #include "metadatareader.h"
+#include "tagscan.h"
 
 int metadatareader_read(const char *file, const char *file_type, TrackInfo *ti)
 {
-	int         result = 0;
-	GmuDecoder *gd = decloader_get_decoder_for_extension(file_type);
-	GmuCharset  charset = M_CHARSET_AUTODETECT;
+	int                 result = 0;
+	GmuDecoderV2       *gd = decloader_get_decoder_for_extension(file_type);
+	GmuDecoderInstance *di = NULL;
+	GmuCharset          charset = M_CHARSET_AUTODETECT;
 
-	if (gd && *gd->meta_data_get_charset)
-		charset = (*gd->meta_data_get_charset)();
+	/* Most files can be handled without setting up a decoder */
+	if (tagscan_read(file, ti)) return 1;
+	if (gd && *gd->meta_data_load) di = decloader_instance_create(gd);
+	if (di && *gd->meta_data_get_charset)
+		charset = (*gd->meta_data_get_charset)(di);
 
 	trackinfo_clear(ti);
-	if (gd && *gd->meta_data_load && (*gd->meta_data_load)(file)) {
+	if (di && (*gd->meta_data_load)(di, file)) {
 		if (*gd->get_meta_data) {
-			if ((*gd->get_meta_data)(GMU_META_ARTIST, 0))
-				strncpy_charset_conv(ti->artist,  (*gd->get_meta_data)(GMU_META_ARTIST, 0), SIZE_ARTIST-1, 0, charset);
-			if ((*gd->get_meta_data)(GMU_META_TITLE, 0))
-				strncpy_charset_conv(ti->title,   (*gd->get_meta_data)(GMU_META_TITLE, 0), SIZE_TITLE-1, 0, charset);
-			if ((*gd->get_meta_data)(GMU_META_ALBUM, 0))
-				strncpy_charset_conv(ti->album,   (*gd->get_meta_data)(GMU_META_ALBUM, 0), SIZE_ALBUM-1, 0, charset);
-			if ((*gd->get_meta_data)(GMU_META_TRACKNR, 0))
-				strncpy_charset_conv(ti->tracknr, (*gd->get_meta_data)(GMU_META_TRACKNR, 0), SIZE_TRACKNR-1, 0, charset);
-			if ((*gd->get_meta_data)(GMU_META_DATE, 0))
-				strncpy_charset_conv(ti->date,    (*gd->get_meta_data)(GMU_META_DATE, 0), SIZE_DATE-1, 0, charset);
+			if ((*gd->get_meta_data)(di, GMU_META_ARTIST))
+				strncpy_charset_conv(ti->artist,  (*gd->get_meta_data)(di, GMU_META_ARTIST), SIZE_ARTIST-1, 0, charset);
+			if ((*gd->get_meta_data)(di, GMU_META_TITLE))
+				strncpy_charset_conv(ti->title,   (*gd->get_meta_data)(di, GMU_META_TITLE), SIZE_TITLE-1, 0, charset);
+			if ((*gd->get_meta_data)(di, GMU_META_ALBUM))
+				strncpy_charset_conv(ti->album,   (*gd->get_meta_data)(di, GMU_META_ALBUM), SIZE_ALBUM-1, 0, charset);
+			if ((*gd->get_meta_data)(di, GMU_META_TRACKNR))
+				strncpy_charset_conv(ti->tracknr, (*gd->get_meta_data)(di, GMU_META_TRACKNR), SIZE_TRACKNR-1, 0, charset);
+			if ((*gd->get_meta_data)(di, GMU_META_DATE))
+				strncpy_charset_conv(ti->date,    (*gd->get_meta_data)(di, GMU_META_DATE), SIZE_DATE-1, 0, charset);
 			trackinfo_set_updated(ti);
 			result = 1;
 		}
-		if (*gd->meta_data_close) (*gd->meta_data_close)();
+	}
+	if (di) {
+		(*gd->close_file)(di);
+		decloader_instance_destroy(gd, di);
 	}
 	return result;
 }
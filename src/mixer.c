@@ -0,0 +1,268 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: mixer.c  Created: 261016
+ *
+ * Description: Fixed-point PCM mixing functions
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <string.h>
+#include "mixer.h"
+#include "fmath.h"
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIXER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MIXER_SSE2 1
+#endif
+
+/* The gain curve is evaluated every MIXER_RAMP_BLOCK samples, in between
+ * the gain changes linearly from sample to sample */
+#define MIXER_RAMP_BLOCK 256
+
+const char *mixer_get_kernel_name(void)
+{
+#if defined(MIXER_NEON)
+	return "NEON";
+#elif defined(MIXER_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+/* Q30 -> Q15, saturated to the int16_t range */
+static int32_t gain_q15(int32_t gain)
+{
+	int32_t g = gain >> 15;
+	return g > 32767 ? 32767 : (g < 0 ? 0 : g);
+}
+
+void mixer_mix_ramp_s16(
+	int16_t       *target,
+	const int16_t *fade_out,
+	const int16_t *fade_in,
+	size_t         samples,
+	int32_t        gain_out,
+	int32_t        gain_out_step,
+	int32_t        gain_in,
+	int32_t        gain_in_step
+)
+{
+	size_t i = 0;
+
+	/* Both gains are < 1.0 on an equal-power curve and their sum is <= sqrt(2),
+	 * so the sum of both products always fits into 32 bits. */
+#if defined(MIXER_NEON)
+	{
+		int32_t   go[4], gi[4];
+		int32x4_t vgo, vgi, vgo_step, vgi_step;
+		int       j;
+
+		for (j = 0; j < 4; j++) {
+			go[j] = gain_out + j * gain_out_step;
+			gi[j] = gain_in  + j * gain_in_step;
+		}
+		vgo      = vld1q_s32(go);
+		vgi      = vld1q_s32(gi);
+		vgo_step = vdupq_n_s32(4 * gain_out_step);
+		vgi_step = vdupq_n_s32(4 * gain_in_step);
+		for (; i + 4 <= samples; i += 4) {
+			int16x4_t x   = vld1_s16(fade_out + i);
+			int16x4_t y   = vld1_s16(fade_in + i);
+			int32x4_t acc = vmull_s16(x, vqshrn_n_s32(vmaxq_s32(vgo, vdupq_n_s32(0)), 15));
+			acc = vmlal_s16(acc, y, vqshrn_n_s32(vmaxq_s32(vgi, vdupq_n_s32(0)), 15));
+			vst1_s16(target + i, vqshrn_n_s32(acc, 15));
+			vgo = vaddq_s32(vgo, vgo_step);
+			vgi = vaddq_s32(vgi, vgi_step);
+		}
+	}
+#elif defined(MIXER_SSE2)
+	{
+		__m128i vgo = _mm_setr_epi32(gain_out, gain_out + gain_out_step,
+		                             gain_out + 2 * gain_out_step, gain_out + 3 * gain_out_step);
+		__m128i vgi = _mm_setr_epi32(gain_in, gain_in + gain_in_step,
+		                             gain_in + 2 * gain_in_step, gain_in + 3 * gain_in_step);
+		__m128i vgo_step = _mm_set1_epi32(4 * gain_out_step);
+		__m128i vgi_step = _mm_set1_epi32(4 * gain_in_step);
+
+		for (; i + 8 <= samples; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(fade_out + i));
+			__m128i y = _mm_loadu_si128((const __m128i *)(fade_in + i));
+			__m128i g, g0, g1, r0, r1;
+
+			/* Interleave the Q15 gains as (out, in) pairs, matching the
+			 * interleaved (fade_out, fade_in) samples for _mm_madd_epi16() */
+			g  = _mm_packs_epi32(_mm_srai_epi32(vgo, 15), _mm_srai_epi32(vgi, 15));
+			g0 = _mm_unpacklo_epi16(g, _mm_srli_si128(g, 8));
+			vgo = _mm_add_epi32(vgo, vgo_step);
+			vgi = _mm_add_epi32(vgi, vgi_step);
+			g  = _mm_packs_epi32(_mm_srai_epi32(vgo, 15), _mm_srai_epi32(vgi, 15));
+			g1 = _mm_unpacklo_epi16(g, _mm_srli_si128(g, 8));
+			vgo = _mm_add_epi32(vgo, vgo_step);
+			vgi = _mm_add_epi32(vgi, vgi_step);
+
+			r0 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x, y), g0), 15);
+			r1 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x, y), g1), 15);
+			_mm_storeu_si128((__m128i *)(target + i), _mm_packs_epi32(r0, r1));
+		}
+	}
+#endif
+	/* Scalar fallback and remaining samples */
+	for (; i < samples; i++) {
+		int32_t go = gain_q15(gain_out + (int32_t)i * gain_out_step);
+		int32_t gi = gain_q15(gain_in  + (int32_t)i * gain_in_step);
+		int32_t s  = (fade_out[i] * go + fade_in[i] * gi) >> 15;
+		target[i] = (int16_t)(s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+	}
+}
+
+/* Equal-power gains (cos/sin) for position pos of len as Q30 values */
+static void equal_power_gains(size_t pos, size_t len, int32_t *gain_out, int32_t *gain_in)
+{
+	int angle = len > 0 ? (int)((uint64_t)(pos < len ? pos : len) * (F_PI / 2) / len) : F_PI / 2;
+	int go = fcos(angle), gi = fsin(angle);
+
+	/* fsin()/fcos() return values multiplied by 10000; 107374 ~ 2^30 / 10000 */
+	*gain_out = (go > 0 ? go : 0) * 107374;
+	*gain_in  = (gi > 0 ? gi : 0) * 107374;
+}
+
+void mixer_crossfade_s16(
+	int16_t       *target,
+	const int16_t *fade_out,
+	const int16_t *fade_in,
+	size_t         samples,
+	size_t         pos,
+	size_t         len
+)
+{
+	size_t i;
+
+	for (i = 0; i < samples; i += MIXER_RAMP_BLOCK) {
+		size_t  n = samples - i < MIXER_RAMP_BLOCK ? samples - i : MIXER_RAMP_BLOCK;
+		int32_t go0, gi0, go1, gi1;
+
+		equal_power_gains(pos + i, len, &go0, &gi0);
+		equal_power_gains(pos + i + n, len, &go1, &gi1);
+		mixer_mix_ramp_s16(
+			target + i, fade_out + i, fade_in + i, n,
+			go0, (go1 - go0) / (int32_t)n,
+			gi0, (gi1 - gi0) / (int32_t)n
+		);
+	}
+}
+
+void mixer_scale_s16(
+	int16_t       *target,
+	const int16_t *source,
+	size_t         samples,
+	int32_t        gain
+)
+{
+	size_t  i = 0;
+	int32_t g = gain_q15(gain);
+
+#if defined(MIXER_NEON)
+	{
+		int16x8_t vg = vdupq_n_s16((int16_t)g);
+
+		for (; i + 8 <= samples; i += 8)
+			vst1q_s16(target + i, vqdmulhq_s16(vld1q_s16(source + i), vg));
+	}
+#elif defined(MIXER_SSE2)
+	{
+		__m128i vg = _mm_set1_epi16((int16_t)g);
+
+		for (; i + 8 <= samples; i += 8) {
+			__m128i x  = _mm_loadu_si128((const __m128i *)(source + i));
+			__m128i lo = _mm_mullo_epi16(x, vg);
+			__m128i hi = _mm_mulhi_epi16(x, vg);
+			__m128i r0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+			__m128i r1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+			_mm_storeu_si128((__m128i *)(target + i), _mm_packs_epi32(r0, r1));
+		}
+	}
+#endif
+	for (; i < samples; i++)
+		target[i] = (int16_t)((source[i] * g) >> 15);
+}
+
+void mixer_channel_map_s16(
+	int16_t       *target,
+	int            dst_channels,
+	const int16_t *source,
+	int            src_channels,
+	size_t         frames
+)
+{
+	size_t i = 0;
+
+	if (src_channels == dst_channels) {
+		memcpy(target, source, frames * src_channels * sizeof(int16_t));
+	} else if (src_channels == 1 && dst_channels == 2) {
+#if defined(MIXER_NEON)
+		for (; i + 8 <= frames; i += 8) {
+			int16x8x2_t d;
+			d.val[0] = vld1q_s16(source + i);
+			d.val[1] = d.val[0];
+			vst2q_s16(target + 2 * i, d);
+		}
+#elif defined(MIXER_SSE2)
+		for (; i + 8 <= frames; i += 8) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(source + i));
+			_mm_storeu_si128((__m128i *)(target + 2 * i), _mm_unpacklo_epi16(x, x));
+			_mm_storeu_si128((__m128i *)(target + 2 * i + 8), _mm_unpackhi_epi16(x, x));
+		}
+#endif
+		for (; i < frames; i++)
+			target[2 * i] = target[2 * i + 1] = source[i];
+	} else if (src_channels == 2 && dst_channels == 1) {
+#if defined(MIXER_NEON)
+		for (; i + 8 <= frames; i += 8) {
+			int16x8x2_t s = vld2q_s16(source + 2 * i);
+			vst1q_s16(target + i, vhaddq_s16(s.val[0], s.val[1]));
+		}
+#elif defined(MIXER_SSE2)
+		{
+			const __m128i half = _mm_set1_epi16(16384); /* 0.5 in Q15 */
+
+			for (; i + 8 <= frames; i += 8) {
+				__m128i a = _mm_loadu_si128((const __m128i *)(source + 2 * i));
+				__m128i b = _mm_loadu_si128((const __m128i *)(source + 2 * i + 8));
+				a = _mm_srai_epi32(_mm_madd_epi16(a, half), 15);
+				b = _mm_srai_epi32(_mm_madd_epi16(b, half), 15);
+				_mm_storeu_si128((__m128i *)(target + i), _mm_packs_epi32(a, b));
+			}
+		}
+#endif
+		for (; i < frames; i++)
+			target[i] = (int16_t)((source[2 * i] + source[2 * i + 1]) >> 1);
+	} else if (src_channels > 2 || dst_channels == 1) {
+		/* Generic matrix: left/right at 1/2, the remaining channels share the other 1/2 */
+		int others = src_channels > 2 ? src_channels - 2 : 0;
+
+		for (; i < frames; i++) {
+			const int16_t *f = source + i * src_channels;
+			int32_t        rest = 0, l = f[0], r = src_channels > 1 ? f[1] : f[0];
+			int            c;
+
+			for (c = 2; c < src_channels; c++) rest += f[c];
+			if (others > 0) rest = rest / others;
+			if (dst_channels == 1) {
+				target[i] = (int16_t)(others > 0 ? (l + r + 2 * rest) >> 2 : (l + r) >> 1);
+			} else {
+				target[2 * i]     = (int16_t)(others > 0 ? (l + rest) >> 1 : l);
+				target[2 * i + 1] = (int16_t)(others > 0 ? (r + rest) >> 1 : r);
+			}
+		}
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: mixer.h  Created: 261016
+ *
+ * Description: Fixed-point PCM mixing functions
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _MIXER_H
+#define _MIXER_H
+#include <sys/types.h>
+#include <stdint.h>
+
+/* Gains are Q30 fixed-point values */
+#define MIXER_GAIN_UNITY (1 << 30)
+
+/* Returns the name of the mixing kernel in use ("NEON", "SSE2" or "scalar") */
+const char *mixer_get_kernel_name(void);
+/* Mixes 'samples' 16 bit samples of the outgoing (fade_out) and incoming
+ * (fade_in) tracks into target, applying gains that change linearly on
+ * each sample from gain_out/gain_in by gain_out_step/gain_in_step.
+ * target may be identical to one of the source buffers. */
+void mixer_mix_ramp_s16(
+	int16_t       *target,
+	const int16_t *fade_out,
+	const int16_t *fade_in,
+	size_t         samples,
+	int32_t        gain_out,
+	int32_t        gain_out_step,
+	int32_t        gain_in,
+	int32_t        gain_in_step
+);
+/* Equal-power crossfade of 'samples' samples, starting at sample
+ * position 'pos' of a crossfade with a total length of 'len' samples */
+void mixer_crossfade_s16(
+	int16_t       *target,
+	const int16_t *fade_out,
+	const int16_t *fade_in,
+	size_t         samples,
+	size_t         pos,
+	size_t         len
+);
+/* Copies 'samples' samples from source to target, multiplying them by
+ * gain (0..MIXER_GAIN_UNITY). target and source must not overlap. */
+void mixer_scale_s16(
+	int16_t       *target,
+	const int16_t *source,
+	size_t         samples,
+	int32_t        gain
+);
+/* Converts interleaved frames from src_channels to dst_channels (1 or 2)
+ * channels: mono is copied to both channels, stereo is averaged to mono
+ * and any other layout is mixed down generically (first two channels are
+ * taken as left/right, all others are spread equally on both sides).
+ * target and source must not overlap. */
+void mixer_channel_map_s16(
+	int16_t       *target,
+	int            dst_channels,
+	const int16_t *source,
+	int            src_channels,
+	size_t         frames
+);
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: outloader.c  Created: 261016
+ *
+ * Description: Audio output plugin loader
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "dir.h"
+#include "outloader.h"
+#include "gmuoutput.h"
+#include "debug.h"
+#if STATIC
+#include "../tmp-outlist.h"
+#endif
+
+static union {
+	void *ptr;
+	GmuOutput * (*fptr) (void);
+} dlsymunion;
+
+static char               *dir_extensions[] = { ".so", NULL };
+static OutputChainElement *oc_root = NULL;
+
+static OutputChainElement *oc_init_element(void)
+{
+	OutputChainElement *oc = NULL;
+
+	if ((oc = malloc(sizeof(OutputChainElement)))) {
+		oc->next = NULL;
+		oc->go = NULL;
+		oc->initialized = 0;
+	}
+	return oc;
+}
+
+void outloader_free(void)
+{
+	OutputChainElement *tmp = oc_root;
+
+	while (tmp != NULL) {
+		OutputChainElement *oc = tmp;
+
+		tmp = tmp->next;
+		if (oc->go) {
+			if (oc->initialized && oc->go->output_shutdown) (*oc->go->output_shutdown)();
+			if (oc->go->handle) dlclose(oc->go->handle);
+		}
+		free(oc);
+	}
+	oc_root = NULL;
+}
+
+/* Loads an output plugin and returns an output object */
+GmuOutput *outloader_load_output(const char *so_file)
+{
+	GmuOutput *result = NULL;
+	void      *handle;
+
+	handle = dlopen(so_file, RTLD_LAZY);
+	if (!handle) {
+		wdprintf(V_ERROR, "outloader", "%s\n", dlerror());
+	} else {
+		char *error;
+
+		dlsymunion.ptr = dlsym(handle, "gmu_register_output");
+		error = dlerror();
+		if (error) {
+			wdprintf(V_ERROR, "outloader", "%s\n", error);
+		} else {
+			result = (*dlsymunion.fptr)();
+			if (result) result->handle = handle;
+		}
+		if (!result) dlclose(handle);
+	}
+	dlerror(); /* Clear any possibly existing error */
+
+	return result;
+}
+
+int outloader_load_all(const char *directory)
+{
+	Dir                *dir;
+	int                 res = 0;
+	OutputChainElement *oc;
+
+	oc = oc_init_element();
+	oc_root = oc;
+
+	dir = dir_init();
+	if (dir && oc) {
+		dir_set_ext_filter(dir, (char **)&dir_extensions, 0);
+		dir_set_base_dir(dir, "/");
+		if (dir_read(dir, directory, 0)) {
+			int i, num = dir_get_number_of_files(dir);
+
+			wdprintf(V_INFO, "outloader", "%d outputs found.\n", num-2);
+			for (i = 0; i < num; i++) {
+				GmuOutput *go;
+				char       fpath[256];
+
+				if (dir_get_flag(dir, i) == REG_FILE) {
+					snprintf(fpath, 255, "%s/%s", dir_get_path(dir), dir_get_filename(dir, i));
+					if ((go = outloader_load_output(fpath))) {
+						wdprintf(V_INFO, "outloader", "Loading %s was successful.\n", dir_get_filename(dir, i));
+						wdprintf(V_INFO, "outloader", "%s: Name: %s\n", go->identifier, (*go->get_name)());
+						oc->go = go;
+						oc->next = oc_init_element();
+						oc = oc->next;
+						res++;
+					} else {
+						wdprintf(V_WARNING, "outloader", "Loading %s was unsuccessful.\n", dir_get_filename(dir, i));
+					}
+				}
+			}
+			dir_free(dir);
+		}
+	}
+	return res;
+}
+
+int outloader_load_builtin_outputs(void)
+{
+	int res = 0;
+#if STATIC
+	int                 i;
+	OutputChainElement *oc;
+
+	oc = oc_init_element();
+	oc_root = oc;
+	for (i = 0; outload_funcs[i]; i++) {
+		wdprintf(V_INFO, "outloader", "Loading internal output %d...\n", i);
+		oc->go = (*outload_funcs[i])();
+		if (oc->go) {
+			wdprintf(V_INFO, "outloader", "%s: Name: %s\n", oc->go->identifier, (*oc->go->get_name)());
+			oc->next = oc_init_element();
+			oc = oc->next;
+			res++;
+		}
+	}
+#endif
+	return res;
+}
+
+GmuOutput *outloader_output_list_get_next_output(int getfirst)
+{
+	static OutputChainElement *oc = NULL;
+	GmuOutput                 *res = NULL;
+
+	if (getfirst) {
+		oc = oc_root;
+	} else if (oc) {
+		oc = oc->next;
+	}
+	if (oc) res = oc->go;
+	return res;
+}
+
+static int output_init(OutputChainElement *oc)
+{
+	if (!oc->initialized) {
+		if (!oc->go->output_init || (*oc->go->output_init)()) {
+			oc->initialized = 1;
+		} else {
+			wdprintf(V_WARNING, "outloader", "Unable to initialize output %s.\n", oc->go->identifier);
+		}
+	}
+	return oc->initialized;
+}
+
+GmuOutput *outloader_select_output(const char *identifier)
+{
+	OutputChainElement *oc;
+	GmuOutput          *res = NULL;
+
+	for (oc = oc_root; oc && oc->go && !res; oc = oc->next)
+		if (identifier && strcmp(oc->go->identifier, identifier) == 0 && output_init(oc))
+			res = oc->go;
+	if (!res) {
+		if (identifier) wdprintf(V_WARNING, "outloader", "Output %s not available.\n", identifier);
+		for (oc = oc_root; oc && oc->go && !res; oc = oc->next)
+			if (output_init(oc)) res = oc->go;
+	}
+	if (res) wdprintf(V_INFO, "outloader", "Using audio output: %s\n", (*res->get_name)());
+	return res;
+}
@@ -0,0 +1,37 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: outloader.h  Created: 261016
+ *
+ * Description: Audio output plugin loader
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _OUTLOADER_H
+#define _OUTLOADER_H
+#include "gmuoutput.h"
+
+typedef struct _OutputChainElement OutputChainElement;
+
+struct _OutputChainElement {
+	OutputChainElement *next;
+	GmuOutput          *go;
+	int                 initialized;
+};
+
+GmuOutput *outloader_load_output(const char *so_file);
+int        outloader_load_all(const char *directory);
+int        outloader_load_builtin_outputs(void);
+GmuOutput *outloader_output_list_get_next_output(int getfirst);
+/* Initializes and returns the output with the given identifier. If that
+ * output is not available or cannot be initialized, the first output that
+ * can be initialized is returned instead. Returns NULL if there is none. */
+GmuOutput *outloader_select_output(const char *identifier);
+void       outloader_free(void);
+#endif
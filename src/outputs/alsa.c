@@ -0,0 +1,231 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: alsa.c  Created: 261016
+ *
+ * Description: ALSA audio output plugin writing to the device buffer
+ *              directly via mmap
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <alsa/asoundlib.h>
+#include "../gmuoutput.h"
+#include "../outthread.h"
+#include "../core.h"
+#include "../debug.h"
+
+static OutThread          thread;
+static snd_pcm_t         *pcm;
+static char               device[128];
+static snd_pcm_uframes_t  cfg_period_frames;
+static unsigned int       cfg_periods;
+static snd_pcm_uframes_t  period_size, buffer_size;
+static int                frame_size, device_open;
+
+static const char *get_name(void)
+{
+	return "ALSA mmap audio output v1.0";
+}
+
+static int init(void)
+{
+	ConfigFile *cf = gmu_core_get_config();
+
+	gmu_core_config_acquire_lock();
+	cfg_add_key_if_not_present(cf, "AlsaOutput.Device", "default");
+	cfg_add_key_if_not_present(cf, "AlsaOutput.PeriodFrames", "1024");
+	cfg_key_add_presets(cf, "AlsaOutput.PeriodFrames", "256", "512", "1024", "2048", "4096", NULL);
+	cfg_add_key_if_not_present(cf, "AlsaOutput.Periods", "3");
+	cfg_key_add_presets(cf, "AlsaOutput.Periods", "2", "3", "4", "8", NULL);
+	strncpy(device, cfg_get_key_value(cf, "AlsaOutput.Device"), 127);
+	device[127] = '\0';
+	cfg_period_frames = cfg_get_int_value(cf, "AlsaOutput.PeriodFrames");
+	cfg_periods       = cfg_get_int_value(cf, "AlsaOutput.Periods");
+	gmu_core_config_release_lock();
+	if (cfg_period_frames < 64) cfg_period_frames = 1024;
+	if (cfg_periods < 2) cfg_periods = 2;
+	return 1;
+}
+
+/* Recovers from underruns and suspends. Returns 1 on success, 0 otherwise. */
+static int recover(int err)
+{
+	if (err == -EPIPE) wdprintf(V_DEBUG, "alsa_output", "Underrun.\n");
+	err = snd_pcm_recover(pcm, err, 1);
+	if (err < 0) wdprintf(V_ERROR, "alsa_output", "Cannot recover: %s\n", snd_strerror(err));
+	return err >= 0;
+}
+
+static int alsa_wait(void *udata)
+{
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+	int               res = 0;
+
+	if (avail < 0) {
+		res = recover(avail) ? 0 : -1;
+	} else if ((snd_pcm_uframes_t)avail >= period_size) {
+		res = avail * frame_size;
+	} else if (snd_pcm_state(pcm) == SND_PCM_STATE_RUNNING) {
+		int err = snd_pcm_wait(pcm, 1000);
+		if (err < 0 && !recover(err)) res = -1;
+	} else { /* The buffer is (almost) full, but playback has not started yet */
+		int err = snd_pcm_start(pcm);
+		if (err < 0 && !recover(err)) res = -1;
+	}
+	return res;
+}
+
+/* Lets the fill callback write directly into the device buffer */
+static int alsa_render(void *udata, GmuOutputFillCallback fill, int len)
+{
+	snd_pcm_uframes_t frames = len / frame_size;
+
+	while (frames > 0) {
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t             offset, n = frames;
+		snd_pcm_sframes_t             committed;
+		int                           err;
+
+		if ((err = snd_pcm_mmap_begin(pcm, &areas, &offset, &n)) < 0)
+			return recover(err);
+		(*fill)((char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8, n * frame_size);
+		committed = snd_pcm_mmap_commit(pcm, offset, n);
+		if (committed < 0 || (snd_pcm_uframes_t)committed != n)
+			return recover(committed >= 0 ? -EPIPE : committed);
+		frames -= n;
+	}
+	return 1;
+}
+
+static void alsa_set_paused(void *udata, int paused)
+{
+	if (paused)
+		snd_pcm_drop(pcm);
+	else if (snd_pcm_state(pcm) != SND_PCM_STATE_PREPARED)
+		snd_pcm_prepare(pcm);
+}
+
+static const OutThreadOps ops = { alsa_wait, alsa_render, NULL, alsa_set_paused };
+
+static int set_hw_params(int samplerate, int channels)
+{
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t    period = cfg_period_frames;
+	unsigned int         periods = cfg_periods;
+	int                  err;
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_sw_params_alloca(&sw);
+	if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0 ||
+	    (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels(pcm, hw, channels)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate_resample(pcm, hw, 1)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate(pcm, hw, samplerate, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, NULL)) < 0 ||
+	    (err = snd_pcm_hw_params_set_periods_near(pcm, hw, &periods, NULL)) < 0 ||
+	    (err = snd_pcm_hw_params(pcm, hw)) < 0) {
+		wdprintf(V_ERROR, "alsa_output", "Unable to set hardware parameters: %s\n", snd_strerror(err));
+		return 0;
+	}
+	snd_pcm_hw_params_get_period_size(hw, &period_size, NULL);
+	snd_pcm_hw_params_get_buffer_size(hw, &buffer_size);
+
+	/* Start once the buffer has been filled and wake up for every period */
+	if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0 ||
+	    (err = snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer_size - buffer_size % period_size)) < 0 ||
+	    (err = snd_pcm_sw_params_set_avail_min(pcm, sw, period_size)) < 0 ||
+	    (err = snd_pcm_sw_params(pcm, sw)) < 0) {
+		wdprintf(V_ERROR, "alsa_output", "Unable to set software parameters: %s\n", snd_strerror(err));
+		return 0;
+	}
+	return 1;
+}
+
+static int open_output(int samplerate, int channels, int buffer_frames, GmuOutputFillCallback fill)
+{
+	int err, res = 0;
+
+	frame_size = channels * 2;
+	if ((err = snd_pcm_open(&pcm, device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+		wdprintf(V_ERROR, "alsa_output", "Cannot open device %s: %s\n", device, snd_strerror(err));
+	} else {
+		if (set_hw_params(samplerate, channels))
+			res = outthread_start(&thread, &ops, NULL, fill);
+		if (res) {
+			wdprintf(V_INFO, "alsa_output", "Device %s opened with %d Hz, %d channels, period %lu frames, buffer %lu frames.\n",
+			         device, samplerate, channels, (unsigned long)period_size, (unsigned long)buffer_size);
+		} else {
+			snd_pcm_close(pcm);
+			pcm = NULL;
+		}
+	}
+	device_open = res;
+	return res;
+}
+
+static void close_output(void)
+{
+	if (device_open) {
+		outthread_stop(&thread);
+		snd_pcm_drop(pcm);
+		snd_pcm_close(pcm);
+		pcm = NULL;
+		device_open = 0;
+	}
+}
+
+static void pause_output(int pause)
+{
+	if (device_open) outthread_pause(&thread, pause);
+}
+
+static int is_playing(void)
+{
+	return device_open && outthread_is_playing(&thread);
+}
+
+static void lock(void)
+{
+	if (device_open) outthread_lock(&thread);
+}
+
+static void unlock(void)
+{
+	if (device_open) outthread_unlock(&thread);
+}
+
+/* The buffer is kept full, so new data is played after buffer_size frames */
+static int get_latency(void)
+{
+	return device_open ? (int)buffer_size : 0;
+}
+
+static GmuOutput go = {
+	"alsa",
+	get_name,
+	init,
+	NULL,
+	open_output,
+	close_output,
+	pause_output,
+	is_playing,
+	lock,
+	unlock,
+	get_latency,
+	NULL
+};
+
+GmuOutput *GMU_REGISTER_OUTPUT(void)
+{
+	return &go;
+}
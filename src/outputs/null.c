@@ -0,0 +1,129 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: null.c  Created: 261016
+ *
+ * Description: Null audio output plugin; discards all audio data either
+ *              in real time or as fast as possible
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include "../gmuoutput.h"
+#include "../outthread.h"
+#include "../core.h"
+#include "../debug.h"
+
+static OutThread thread;
+static int       realtime, device_open;
+static int       samplerate, frame_size, period_frames;
+static char     *buf;
+
+static const char *get_name(void)
+{
+	return "Null audio output v1.0";
+}
+
+static int init(void)
+{
+	ConfigFile *cf = gmu_core_get_config();
+
+	gmu_core_config_acquire_lock();
+	cfg_add_key_if_not_present(cf, "NullOutput.Pacing", "realtime");
+	cfg_key_add_presets(cf, "NullOutput.Pacing", "realtime", "fast", NULL);
+	realtime = !cfg_compare_value(cf, "NullOutput.Pacing", "fast", 1);
+	gmu_core_config_release_lock();
+	wdprintf(V_INFO, "null_output", "Pacing: %s\n", realtime ? "real time" : "as fast as possible");
+	return 1;
+}
+
+static int null_wait(void *udata)
+{
+	if (realtime) outthread_pace(&thread, period_frames, samplerate);
+	return period_frames * frame_size;
+}
+
+static int null_render(void *udata, GmuOutputFillCallback fill, int len)
+{
+	/* When not paced, only consume what is available and wait for more
+	 * data instead of spinning on silence */
+	if ((*fill)(buf, len) == 0 && !realtime) usleep(1000);
+	return 1;
+}
+
+static const OutThreadOps ops = { null_wait, null_render, NULL, NULL };
+
+static int open_output(int rate, int channels, int buffer_frames, GmuOutputFillCallback fill)
+{
+	int res = 0;
+
+	samplerate    = rate;
+	frame_size    = channels * 2;
+	period_frames = buffer_frames;
+	if ((buf = malloc(period_frames * frame_size))) {
+		res = outthread_start(&thread, &ops, NULL, fill);
+		if (!res) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	device_open = res;
+	return res;
+}
+
+static void close_output(void)
+{
+	if (device_open) {
+		outthread_stop(&thread);
+		free(buf);
+		buf = NULL;
+		device_open = 0;
+	}
+}
+
+static void pause_output(int pause)
+{
+	if (device_open) outthread_pause(&thread, pause);
+}
+
+static int is_playing(void)
+{
+	return device_open && outthread_is_playing(&thread);
+}
+
+static void lock(void)
+{
+	if (device_open) outthread_lock(&thread);
+}
+
+static void unlock(void)
+{
+	if (device_open) outthread_unlock(&thread);
+}
+
+static GmuOutput go = {
+	"null",
+	get_name,
+	init,
+	NULL,
+	open_output,
+	close_output,
+	pause_output,
+	is_playing,
+	lock,
+	unlock,
+	NULL,
+	NULL
+};
+
+GmuOutput *GMU_REGISTER_OUTPUT(void)
+{
+	return &go;
+}
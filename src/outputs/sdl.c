@@ -0,0 +1,121 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: sdl.c  Created: 261016
+ *
+ * Description: SDL audio output plugin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include "SDL.h"
+#include "../gmuoutput.h"
+#include "../debug.h"
+
+static GmuOutputFillCallback fill_cb;
+static int                   device_open;
+static int                   latency;
+
+static const char *get_name(void)
+{
+	return "SDL audio output v1.0";
+}
+
+static int init(void)
+{
+	int res = SDL_InitSubSystem(SDL_INIT_AUDIO) == 0;
+	if (!res) wdprintf(V_ERROR, "sdl_output", "Could not initialize SDL audio: %s\n", SDL_GetError());
+	return res;
+}
+
+static void quit(void)
+{
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+static void callback(void *udata, Uint8 *stream, int len)
+{
+	(*fill_cb)((char *)stream, len);
+}
+
+static int open_output(int samplerate, int channels, int buffer_frames, GmuOutputFillCallback fill)
+{
+	SDL_AudioSpec wanted, obtained;
+	int           res = 0;
+
+	fill_cb         = fill;
+	wanted.freq     = samplerate;
+	wanted.format   = AUDIO_S16SYS;
+	wanted.channels = channels; /* 1 = mono, 2 = stereo */
+	wanted.samples  = buffer_frames;
+	wanted.callback = callback;
+	wanted.userdata = NULL;
+	SDL_ClearError();
+	if (SDL_OpenAudio(&wanted, &obtained) < 0) {
+		wdprintf(V_ERROR, "sdl_output", "Could not open audio: %s\n", SDL_GetError());
+	} else {
+		device_open = 1;
+		latency = obtained.samples;
+		res = 1;
+		wdprintf(V_INFO, "sdl_output", "Device opened with %d Hz, %d channels and sample buffer w/ %d samples.\n",
+		         obtained.freq, obtained.channels, obtained.samples);
+	}
+	return res;
+}
+
+static void close_output(void)
+{
+	if (device_open) SDL_CloseAudio();
+	device_open = 0;
+}
+
+static void pause_output(int pause)
+{
+	SDL_PauseAudio(pause);
+}
+
+static int is_playing(void)
+{
+	return SDL_GetAudioStatus() == SDL_AUDIO_PLAYING;
+}
+
+static void lock(void)
+{
+	SDL_LockAudio();
+}
+
+static void unlock(void)
+{
+	SDL_UnlockAudio();
+}
+
+/* The buffer filled by the callback is played after the current one */
+static int get_latency(void)
+{
+	return latency;
+}
+
+static GmuOutput go = {
+	"sdl",
+	get_name,
+	init,
+	quit,
+	open_output,
+	close_output,
+	pause_output,
+	is_playing,
+	lock,
+	unlock,
+	get_latency,
+	NULL
+};
+
+GmuOutput *GMU_REGISTER_OUTPUT(void)
+{
+	return &go;
+}
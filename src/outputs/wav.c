@@ -0,0 +1,208 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: wav.c  Created: 261016
+ *
+ * Description: WAV file audio output plugin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../gmuoutput.h"
+#include "../outthread.h"
+#include "../core.h"
+#include "../debug.h"
+
+#define WAV_HEADER_SIZE 44
+
+static OutThread     thread;
+static int           realtime, device_open;
+static int           samplerate, channels, period_frames;
+static char          filename[256];
+static FILE         *file;
+static char         *buf;
+static int           buf_fill;
+static unsigned long data_size;
+
+static const char *get_name(void)
+{
+	return "WAV file audio output v1.0";
+}
+
+static int init(void)
+{
+	ConfigFile *cf = gmu_core_get_config();
+
+	gmu_core_config_acquire_lock();
+	cfg_add_key_if_not_present(cf, "WavOutput.File", "gmu-output.wav");
+	cfg_add_key_if_not_present(cf, "WavOutput.Pacing", "fast");
+	cfg_key_add_presets(cf, "WavOutput.Pacing", "realtime", "fast", NULL);
+	realtime = !cfg_compare_value(cf, "WavOutput.Pacing", "fast", 1);
+	strncpy(filename, cfg_get_key_value(cf, "WavOutput.File"), 255);
+	filename[255] = '\0';
+	gmu_core_config_release_lock();
+	return 1;
+}
+
+static void put_le(unsigned char *p, unsigned long value, int bytes)
+{
+	int i;
+	for (i = 0; i < bytes; i++, value >>= 8) p[i] = (unsigned char)(value & 0xff);
+}
+
+/* Writes the header for the data written so far, keeping the file position */
+static void write_header(void)
+{
+	unsigned char h[WAV_HEADER_SIZE];
+	long          pos = ftell(file);
+
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, data_size + WAV_HEADER_SIZE - 8, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4);                        /* fmt chunk size */
+	put_le(h + 20, 1, 2);                         /* PCM */
+	put_le(h + 22, channels, 2);
+	put_le(h + 24, samplerate, 4);
+	put_le(h + 28, samplerate * channels * 2, 4); /* Bytes per second */
+	put_le(h + 32, channels * 2, 2);              /* Block align */
+	put_le(h + 34, 16, 2);                        /* Bits per sample */
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, data_size, 4);
+	fseek(file, 0, SEEK_SET);
+	fwrite(h, 1, WAV_HEADER_SIZE, file);
+	if (pos > 0) fseek(file, pos, SEEK_SET);
+	fflush(file);
+}
+
+static int wav_wait(void *udata)
+{
+	if (realtime) outthread_pace(&thread, period_frames, samplerate);
+	return period_frames * channels * 2;
+}
+
+static int wav_render(void *udata, GmuOutputFillCallback fill, int len)
+{
+	buf_fill = (*fill)(buf, len);
+	/* In real time mode, underruns are recorded as silence like on a real device */
+	if (realtime) buf_fill = len;
+	return 1;
+}
+
+static void wav_commit(void *udata)
+{
+	if (buf_fill > 0) {
+		const unsigned short one = 1;
+
+		if (!*(const unsigned char *)&one) { /* WAV data is little-endian */
+			int i;
+			for (i = 0; i + 1 < buf_fill; i += 2) {
+				char t = buf[i];
+				buf[i] = buf[i+1];
+				buf[i+1] = t;
+			}
+		}
+		if (fwrite(buf, 1, buf_fill, file) == (size_t)buf_fill)
+			data_size += buf_fill;
+		else
+			wdprintf(V_WARNING, "wav_output", "Write error.\n");
+	} else if (!realtime) {
+		usleep(1000); /* Wait for more data instead of spinning */
+	}
+}
+
+static void wav_set_paused(void *udata, int paused)
+{
+	if (paused) write_header(); /* Keep the file valid while nothing is written */
+}
+
+static const OutThreadOps ops = { wav_wait, wav_render, wav_commit, wav_set_paused };
+
+static int open_output(int rate, int ch, int buffer_frames, GmuOutputFillCallback fill)
+{
+	int res = 0;
+
+	samplerate    = rate;
+	channels      = ch;
+	period_frames = buffer_frames;
+	data_size     = 0;
+	if (!(file = fopen(filename, "wb"))) {
+		wdprintf(V_ERROR, "wav_output", "Could not open %s for writing.\n", filename);
+	} else if ((buf = malloc(period_frames * channels * 2))) {
+		write_header();
+		fseek(file, WAV_HEADER_SIZE, SEEK_SET);
+		res = outthread_start(&thread, &ops, NULL, fill);
+	}
+	if (res) {
+		wdprintf(V_INFO, "wav_output", "Writing %d Hz, %d channels to %s\n", rate, ch, filename);
+	} else {
+		if (file) fclose(file);
+		file = NULL;
+		free(buf);
+		buf = NULL;
+	}
+	device_open = res;
+	return res;
+}
+
+static void close_output(void)
+{
+	if (device_open) {
+		outthread_stop(&thread);
+		write_header();
+		fclose(file);
+		file = NULL;
+		free(buf);
+		buf = NULL;
+		device_open = 0;
+		wdprintf(V_INFO, "wav_output", "%lu bytes written to %s\n", data_size, filename);
+	}
+}
+
+static void pause_output(int pause)
+{
+	if (device_open) outthread_pause(&thread, pause);
+}
+
+static int is_playing(void)
+{
+	return device_open && outthread_is_playing(&thread);
+}
+
+static void lock(void)
+{
+	if (device_open) outthread_lock(&thread);
+}
+
+static void unlock(void)
+{
+	if (device_open) outthread_unlock(&thread);
+}
+
+static GmuOutput go = {
+	"wav",
+	get_name,
+	init,
+	NULL,
+	open_output,
+	close_output,
+	pause_output,
+	is_playing,
+	lock,
+	unlock,
+	NULL,
+	NULL
+};
+
+GmuOutput *GMU_REGISTER_OUTPUT(void)
+{
+	return &go;
+}
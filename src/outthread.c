@@ -0,0 +1,155 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: outthread.c  Created: 261016
+ *
+ * Description: Playback thread for output plugins without a
+ *              callback-driven audio API of their own
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <errno.h>
+#include "outthread.h"
+#include "pthread_helper.h"
+#include "core.h"
+#include "debug.h"
+
+#define PACE_MAX_LAG_NS 200000000L /* Restart the clock when falling behind further */
+
+static void *outthread_run(void *udata)
+{
+	OutThread *ot = (OutThread *)udata;
+	int        was_paused = 1;
+
+	for (;;) {
+		int paused, quit, len;
+
+		pthread_mutex_lock(&(ot->state_mutex));
+		paused = ot->paused;
+		quit   = ot->quit;
+		pthread_mutex_unlock(&(ot->state_mutex));
+		if (quit) break;
+
+		if (paused != was_paused) {
+			if (ot->ops->set_paused) (*ot->ops->set_paused)(ot->udata, paused);
+			ot->deadline.tv_sec = ot->deadline.tv_nsec = 0;
+			was_paused = paused;
+		}
+		if (paused) {
+			pthread_mutex_lock(&(ot->state_mutex));
+			while (ot->paused && !ot->quit)
+				pthread_cond_wait(&(ot->state_cond), &(ot->state_mutex));
+			pthread_mutex_unlock(&(ot->state_mutex));
+			continue;
+		}
+
+		len = (*ot->ops->wait)(ot->udata);
+		if (len < 0) {
+			wdprintf(V_ERROR, "outthread", "Output device failed. Stopping playback thread.\n");
+			break;
+		} else if (len > 0) {
+			int ok;
+
+			pthread_mutex_lock(&(ot->mutex));
+			ok = (*ot->ops->render)(ot->udata, ot->fill, len);
+			pthread_mutex_unlock(&(ot->mutex));
+			if (!ok) {
+				wdprintf(V_ERROR, "outthread", "Writing to output device failed. Stopping playback thread.\n");
+				break;
+			}
+			if (ot->ops->commit) (*ot->ops->commit)(ot->udata);
+		}
+	}
+	pthread_mutex_lock(&(ot->state_mutex));
+	ot->running = 0;
+	pthread_mutex_unlock(&(ot->state_mutex));
+	return NULL;
+}
+
+int outthread_start(OutThread *ot, const OutThreadOps *ops, void *udata, GmuOutputFillCallback fill)
+{
+	int res = 0;
+
+	ot->ops     = ops;
+	ot->udata   = udata;
+	ot->fill    = fill;
+	ot->paused  = 1;
+	ot->quit    = 0;
+	ot->running = 1;
+	ot->deadline.tv_sec = ot->deadline.tv_nsec = 0;
+	pthread_mutex_init(&(ot->mutex), NULL);
+	pthread_mutex_init(&(ot->state_mutex), NULL);
+	pthread_cond_init(&(ot->state_cond), NULL);
+	if (pthread_create_with_stack_size(&(ot->thread), DEFAULT_THREAD_STACK_SIZE, outthread_run, ot) == 0) {
+		res = 1;
+	} else {
+		wdprintf(V_ERROR, "outthread", "Could not create playback thread.\n");
+		pthread_cond_destroy(&(ot->state_cond));
+		pthread_mutex_destroy(&(ot->state_mutex));
+		pthread_mutex_destroy(&(ot->mutex));
+	}
+	return res;
+}
+
+void outthread_stop(OutThread *ot)
+{
+	pthread_mutex_lock(&(ot->state_mutex));
+	ot->quit = 1;
+	pthread_cond_signal(&(ot->state_cond));
+	pthread_mutex_unlock(&(ot->state_mutex));
+	pthread_join(ot->thread, NULL);
+	pthread_cond_destroy(&(ot->state_cond));
+	pthread_mutex_destroy(&(ot->state_mutex));
+	pthread_mutex_destroy(&(ot->mutex));
+}
+
+void outthread_pause(OutThread *ot, int pause)
+{
+	pthread_mutex_lock(&(ot->state_mutex));
+	ot->paused = pause;
+	pthread_cond_signal(&(ot->state_cond));
+	pthread_mutex_unlock(&(ot->state_mutex));
+}
+
+int outthread_is_playing(OutThread *ot)
+{
+	int res;
+
+	pthread_mutex_lock(&(ot->state_mutex));
+	res = ot->running && !ot->paused;
+	pthread_mutex_unlock(&(ot->state_mutex));
+	return res;
+}
+
+void outthread_lock(OutThread *ot)
+{
+	pthread_mutex_lock(&(ot->mutex));
+}
+
+void outthread_unlock(OutThread *ot)
+{
+	pthread_mutex_unlock(&(ot->mutex));
+}
+
+void outthread_pace(OutThread *ot, int frames, int samplerate)
+{
+	struct timespec now;
+	long long       lag;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	lag = (long long)(now.tv_sec - ot->deadline.tv_sec) * 1000000000LL + (now.tv_nsec - ot->deadline.tv_nsec);
+	if ((ot->deadline.tv_sec == 0 && ot->deadline.tv_nsec == 0) || lag > PACE_MAX_LAG_NS)
+		ot->deadline = now;
+	ot->deadline.tv_nsec += (long)((long long)frames * 1000000000LL / samplerate);
+	while (ot->deadline.tv_nsec >= 1000000000L) {
+		ot->deadline.tv_nsec -= 1000000000L;
+		ot->deadline.tv_sec++;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &(ot->deadline), NULL) == EINTR);
+}
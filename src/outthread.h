@@ -0,0 +1,63 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: outthread.h  Created: 261016
+ *
+ * Description: Playback thread for output plugins without a
+ *              callback-driven audio API of their own
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _OUTTHREAD_H
+#define _OUTTHREAD_H
+#include <pthread.h>
+#include <time.h>
+#include "gmuoutput.h"
+
+typedef struct _OutThreadOps {
+	/* Called without the lock being held. Blocks until the device can take
+	 * more data and returns the number of bytes to render, 0 if there is
+	 * nothing to do right now or a negative value on fatal errors, which
+	 * stops the thread. */
+	int  (*wait)(void *udata);
+	/* Called with the lock being held. Renders len bytes using the fill
+	 * callback and hands them to the device. Returns 0 on fatal errors. */
+	int  (*render)(void *udata, GmuOutputFillCallback fill, int len);
+	/* Called without the lock being held after render. Can be NULL. */
+	void (*commit)(void *udata);
+	/* Called from the thread when it enters (paused=1) or leaves (paused=0)
+	 * the paused state. Can be NULL. */
+	void (*set_paused)(void *udata, int paused);
+} OutThreadOps;
+
+typedef struct _OutThread {
+	pthread_t             thread;
+	pthread_mutex_t       mutex; /* Held while the fill callback runs */
+	pthread_mutex_t       state_mutex;
+	pthread_cond_t        state_cond;
+	int                   paused, quit, running;
+	const OutThreadOps   *ops;
+	void                 *udata;
+	GmuOutputFillCallback fill;
+	struct timespec       deadline;
+} OutThread;
+
+/* Starts the thread in paused state. Returns 1 on success, 0 otherwise. */
+int  outthread_start(OutThread *ot, const OutThreadOps *ops, void *udata, GmuOutputFillCallback fill);
+/* Stops the thread and waits for it to finish */
+void outthread_stop(OutThread *ot);
+void outthread_pause(OutThread *ot, int pause);
+int  outthread_is_playing(OutThread *ot);
+void outthread_lock(OutThread *ot);
+void outthread_unlock(OutThread *ot);
+/* Sleeps until 'frames' frames at 'samplerate' have passed since the
+ * previous call, for outputs that have to be paced in real time. The
+ * clock is restarted after pauses and when the thread fell behind. */
+void outthread_pace(OutThread *ot, int frames, int samplerate);
+#endif
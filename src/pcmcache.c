@@ -0,0 +1,296 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: pcmcache.c  Created: 261016
+ *
+ * Description: Cache for the pre-decoded beginnings of upcoming tracks
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pcmcache.h"
+#include "gmudecoder.h"
+#include "decloader.h"
+#include "reader.h"
+#include "util.h"
+#include "core.h"
+#include "pthread_helper.h"
+#include "debug.h"
+
+#define PCM_CACHE_MAX_TRACKS 8
+#define DECODE_CHUNK_SIZE    65536
+/* Time to wait after the list of upcoming files changed, so the cache
+ * does not compete with the decoder starting the current track */
+#define START_DELAY_MS       1500
+
+static pthread_t       thread;
+static pthread_mutex_t mutex;
+static pthread_cond_t  cond;
+static int             running, quit, changed;
+static size_t          budget;
+static int             max_tracks, max_seconds;
+static char           *upcoming[PCM_CACHE_MAX_TRACKS];
+static int             upcoming_num;
+static PCMCacheEntry  *entries[PCM_CACHE_MAX_TRACKS];
+static int             entries_num;
+
+void pcm_cache_entry_free(PCMCacheEntry *entry)
+{
+	if (entry) {
+		free(entry->filename);
+		free(entry->data);
+		free(entry);
+	}
+}
+
+/* To be called with the mutex being locked */
+static int is_upcoming(const char *filename)
+{
+	int i;
+
+	for (i = 0; i < upcoming_num; i++)
+		if (strcmp(upcoming[i], filename) == 0) return 1;
+	return 0;
+}
+
+/* To be called with the mutex being locked */
+static PCMCacheEntry *find_entry(const char *filename, int *index)
+{
+	int i;
+
+	for (i = 0; i < entries_num; i++) {
+		if (strcmp(entries[i]->filename, filename) == 0) {
+			if (index) *index = i;
+			return entries[i];
+		}
+	}
+	return NULL;
+}
+
+/* Returns 1 when decoding the given file should be aborted */
+static int decode_aborted(const char *filename)
+{
+	int res;
+
+	pthread_mutex_lock(&mutex);
+	res = quit || !is_upcoming(filename);
+	pthread_mutex_unlock(&mutex);
+	return res;
+}
+
+/**
+ * Decodes the beginning of the given file. Only local files are decoded,
+ * and only with v2 decoders, since a legacy decoder can only decode the
+ * file that is being played. Returns an entry, which is marked as failed
+ * if the file cannot be decoded this way, or NULL when out of memory.
+ */
+static PCMCacheEntry *decode_entry(const char *filename, char *buf)
+{
+	PCMCacheEntry      *entry = calloc(1, sizeof(PCMCacheEntry));
+	GmuDecoderV2       *gd = NULL;
+	GmuDecoderInstance *di = NULL;
+	Reader             *r = NULL;
+	const char         *ext = get_file_extension(filename);
+
+	if (!entry || !(entry->filename = malloc(strlen(filename) + 1))) {
+		free(entry);
+		return NULL;
+	}
+	strcpy(entry->filename, filename);
+	entry->failed = 1;
+	if (ext && !strstr(filename, "://")) gd = decloader_get_decoder_for_extension(ext);
+	if (gd && !gd->legacy) di = decloader_instance_create(gd);
+	if (di) {
+		if (gd->set_reader_handle && (r = reader_open(filename)))
+			(*gd->set_reader_handle)(di, r);
+		if ((!gd->set_reader_handle || r) && (*gd->open_file)(di, filename)) {
+			int    rate = gd->get_samplerate ? (*gd->get_samplerate)(di) : 0;
+			int    channels = gd->get_channels ? (*gd->get_channels)(di) : 0;
+			size_t frame_size = 2 * channels, size = 0;
+			long   seconds = max_seconds;
+
+			if (rate > 0 && channels > 0) {
+				if ((size_t)seconds * rate * frame_size > budget / max_tracks)
+					seconds = budget / max_tracks / (rate * frame_size);
+				size = (size_t)seconds * rate * frame_size;
+			}
+			if (size > 0 && (entry->data = malloc(size))) {
+				int ret = 1;
+
+				entry->samplerate = rate;
+				entry->channels   = channels;
+				while (entry->size < size && !decode_aborted(filename)) {
+					size_t n;
+
+					/* Some decoders write whole blocks, so always offer a full chunk */
+					if ((ret = (*gd->decode_data)(di, buf, DECODE_CHUNK_SIZE)) <= 0) break;
+					n = (size_t)ret < size - entry->size ? (size_t)ret : size - entry->size;
+					memcpy(entry->data + entry->size, buf, n);
+					entry->size += n;
+				}
+				/* Complete when the requested amount or the end of the file has been reached */
+				if (entry->size == size || (ret == 0 && entry->size > 0)) {
+					entry->frames   = entry->size / frame_size;
+					entry->complete = 1;
+					entry->failed   = 0;
+				}
+			}
+			(*gd->close_file)(di);
+		}
+		decloader_instance_destroy(gd, di);
+		if (r) reader_close(r);
+	}
+	if (entry->failed) {
+		free(entry->data);
+		entry->data = NULL;
+		entry->size = 0;
+	}
+	return entry;
+}
+
+static void *pcm_cache_thread(void *udata)
+{
+	char *buf = malloc(DECODE_CHUNK_SIZE);
+
+	pthread_mutex_lock(&mutex);
+	while (!quit && buf) {
+		const char *next = NULL;
+		char       *filename;
+		int         i;
+
+		/* Wait until the list of upcoming files has not changed for a while */
+		while (!quit && changed) {
+			changed = 0;
+			pthread_cond_timedwait_ms(&cond, &mutex, START_DELAY_MS);
+		}
+		for (i = 0; i < upcoming_num && !next; i++)
+			if (!find_entry(upcoming[i], NULL)) next = upcoming[i];
+		if (!next) {
+			if (!quit && !changed) pthread_cond_wait(&cond, &mutex);
+		} else if ((filename = malloc(strlen(next) + 1))) {
+			PCMCacheEntry *entry;
+
+			strcpy(filename, next);
+			pthread_mutex_unlock(&mutex);
+			wdprintf(V_DEBUG, "pcmcache", "Pre-decoding %s...\n", filename);
+			entry = decode_entry(filename, buf);
+			pthread_mutex_lock(&mutex);
+			if (entry && !quit && is_upcoming(filename) && entries_num < PCM_CACHE_MAX_TRACKS) {
+				entries[entries_num++] = entry;
+				if (entry->complete)
+					wdprintf(V_DEBUG, "pcmcache", "Cached %ld frames of %s.\n", entry->frames, filename);
+			} else {
+				pcm_cache_entry_free(entry);
+			}
+			free(filename);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	free(buf);
+	return NULL;
+}
+
+int pcm_cache_init(size_t budget_kb, int tracks, int seconds)
+{
+	if (tracks > PCM_CACHE_MAX_TRACKS) tracks = PCM_CACHE_MAX_TRACKS;
+	budget      = budget_kb * 1024;
+	max_tracks  = tracks;
+	max_seconds = seconds;
+	running = quit = changed = 0;
+	upcoming_num = entries_num = 0;
+	if (budget > 0 && tracks > 0 && seconds > 0) {
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init_monotonic(&cond);
+		if (pthread_create_with_stack_size(&thread, DEFAULT_THREAD_STACK_SIZE, pcm_cache_thread, NULL) == 0) {
+			running = 1;
+			wdprintf(V_INFO, "pcmcache", "Pre-decoding %d s of up to %d tracks (%lu KB).\n",
+			         seconds, tracks, (unsigned long)budget_kb);
+		} else {
+			wdprintf(V_ERROR, "pcmcache", "Could not create pre-decoder thread.\n");
+			pthread_cond_destroy(&cond);
+			pthread_mutex_destroy(&mutex);
+		}
+	}
+	return running;
+}
+
+void pcm_cache_free(void)
+{
+	int i;
+
+	if (running) {
+		pthread_mutex_lock(&mutex);
+		quit = 1;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(thread, NULL);
+		for (i = 0; i < entries_num; i++) pcm_cache_entry_free(entries[i]);
+		for (i = 0; i < upcoming_num; i++) free(upcoming[i]);
+		entries_num = upcoming_num = 0;
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+		running = 0;
+	}
+}
+
+void pcm_cache_set_upcoming(const char **filenames, int num)
+{
+	int i, n = 0;
+
+	if (!running) return;
+	if (num > max_tracks) num = max_tracks;
+	pthread_mutex_lock(&mutex);
+	for (i = 0; i < upcoming_num; i++) free(upcoming[i]);
+	for (i = 0; i < num; i++) {
+		if ((upcoming[n] = malloc(strlen(filenames[i]) + 1))) {
+			strcpy(upcoming[n], filenames[i]);
+			n++;
+		}
+	}
+	upcoming_num = n;
+	/* Drop everything that is not going to be needed anymore */
+	for (i = 0; i < entries_num; ) {
+		if (!is_upcoming(entries[i]->filename)) {
+			pcm_cache_entry_free(entries[i]);
+			entries[i] = entries[--entries_num];
+		} else {
+			i++;
+		}
+	}
+	changed = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+PCMCacheEntry *pcm_cache_take(const char *filename)
+{
+	PCMCacheEntry *entry = NULL;
+	int            i;
+
+	if (!running) return NULL;
+	pthread_mutex_lock(&mutex);
+	if ((entry = find_entry(filename, &i)) && entry->complete) {
+		entries[i] = entries[--entries_num];
+	} else {
+		entry = NULL;
+	}
+	/* The file is being played now, so it must not be decoded again */
+	for (i = 0; i < upcoming_num; i++) {
+		if (strcmp(upcoming[i], filename) == 0) {
+			free(upcoming[i]);
+			upcoming_num--;
+			memmove(upcoming + i, upcoming + i + 1, (upcoming_num - i) * sizeof(char *));
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return entry;
+}
@@ -0,0 +1,43 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: pcmcache.h  Created: 261016
+ *
+ * Description: Cache for the pre-decoded beginnings of upcoming tracks
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _PCMCACHE_H
+#define _PCMCACHE_H
+#include <sys/types.h>
+
+typedef struct _PCMCacheEntry {
+	char  *filename;
+	char  *data;   /* Decoder output, i.e. before any format conversion */
+	size_t size;
+	int    samplerate, channels;
+	long   frames; /* Number of sample frames in data */
+	int    complete, failed;
+} PCMCacheEntry;
+
+/* Starts the background decoder thread. The cache keeps the first
+ * 'seconds' seconds (whole seconds only) of up to 'tracks' files, using
+ * up to budget_kb KB of memory. Returns 1 on success, 0 when the cache is
+ * disabled or could not be started. */
+int            pcm_cache_init(size_t budget_kb, int tracks, int seconds);
+void           pcm_cache_free(void);
+/* Sets the files that are going to be played next, most likely first.
+ * Cached data of other files is dropped. */
+void           pcm_cache_set_upcoming(const char **filenames, int num);
+/* Removes the completely decoded entry of the given file from the cache
+ * and returns it, or NULL if there is none. The caller owns the entry
+ * and has to release it with pcm_cache_entry_free(). */
+PCMCacheEntry *pcm_cache_take(const char *filename);
+void           pcm_cache_entry_free(PCMCacheEntry *entry);
+#endif
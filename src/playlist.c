@@ -44,6 +44,7 @@ void playlist_init(Playlist *pl)
 	pl->play_mode    = PM_CONTINUE;
 	pl->played_items = 0;
 	pl->queue_start  = NULL;
+	pl->random_ahead_len = 0;
 	srand(time(NULL));
 	pthread_mutex_init(&(pl->mutex), NULL);
 }
@@ -82,6 +83,7 @@ void playlist_clear(Playlist *pl)
 	pl->last    = NULL;
 	pl->played_items = 0;
 	pl->queue_start = NULL;
+	pl->random_ahead_len = 0;
 }
 
 int playlist_add_item(Playlist *pl, const char *file, const char *name)
@@ -332,7 +334,8 @@ void playlist_reset_random(Playlist *pl)
 
 int playlist_entry_delete(Playlist *pl, Entry *entry)
 {
-	int result = 1;
+	int    result = 1;
+	size_t i;
 	if (entry != NULL && pl->length > 0) {
 		if (pl->current == entry) { /* We try to remove the currently playing entry */
 			pl->current = entry->prev;
@@ -350,6 +353,13 @@ int playlist_entry_delete(Playlist *pl, Entry *entry)
 			entry->prev->next = entry->next;
 			entry->next->prev = entry->prev;
 		}
+		for (i = 0; i < pl->random_ahead_len; i++) {
+			if (pl->random_ahead[i] == entry) {
+				pl->random_ahead_len--;
+				memmove(pl->random_ahead + i, pl->random_ahead + i + 1, (pl->random_ahead_len - i) * sizeof(Entry *));
+				break;
+			}
+		}
 		pl->length--;
 		if (pl->length == 0) {
 			pl->first = NULL;
@@ -427,6 +437,82 @@ size_t playlist_get_length(Playlist *pl)
 	return pl->length;
 }
 
+/* Removes and returns the first entry picked in advance that has not been played meanwhile */
+static Entry *random_ahead_pop(Playlist *pl)
+{
+	Entry *entry = NULL;
+
+	while (!entry && pl->random_ahead_len > 0) {
+		entry = pl->random_ahead[0];
+		pl->random_ahead_len--;
+		memmove(pl->random_ahead, pl->random_ahead + 1, pl->random_ahead_len * sizeof(Entry *));
+		if (entry->played) entry = NULL;
+	}
+	return entry;
+}
+
+static int random_ahead_contains(Playlist *pl, Entry *entry)
+{
+	size_t i;
+
+	for (i = 0; i < pl->random_ahead_len; i++)
+		if (pl->random_ahead[i] == entry) return 1;
+	return 0;
+}
+
+/* Picks an unplayed entry that has not been picked before. Returns NULL if there is none. */
+static Entry *random_pick(Playlist *pl)
+{
+	Entry *entry = NULL;
+	size_t n = pl->length - pl->played_items;
+
+	if (pl->length > 0 && pl->played_items < pl->length && n > pl->random_ahead_len) {
+		size_t next_item = rand() / (RAND_MAX / (n - pl->random_ahead_len) + 1);
+
+		for (entry = pl->first; entry; entry = entry->next) {
+			if (entry->played || random_ahead_contains(pl, entry)) continue;
+			if (next_item == 0) break;
+			next_item--;
+		}
+	}
+	return entry;
+}
+
+size_t playlist_peek_next(Playlist *pl, Entry **entries, size_t max)
+{
+	size_t i, n = 0;
+	Entry *iter, *cur = pl->current;
+
+	if (max > PL_LOOKAHEAD_MAX) max = PL_LOOKAHEAD_MAX;
+	for (iter = pl->queue_start; iter != NULL && n < max; iter = iter->next_in_queue)
+		cur = entries[n++] = iter;
+	switch (pl->play_mode) {
+		case PM_CONTINUE:
+		case PM_REPEAT_ALL:
+			while (n < max) {
+				cur = cur ? cur->next : pl->first;
+				if (!cur && pl->play_mode == PM_REPEAT_ALL) cur = pl->first;
+				if (!cur || (n > 0 && cur == entries[0])) break;
+				entries[n++] = cur;
+			}
+			break;
+		case PM_REPEAT_1:
+			if (n < max && (cur || pl->first)) entries[n++] = cur ? cur : pl->first;
+			break;
+		case PM_RANDOM:
+		case PM_RANDOM_REPEAT:
+			while (pl->random_ahead_len < max - n) {
+				Entry *entry = random_pick(pl);
+				if (!entry) break;
+				pl->random_ahead[pl->random_ahead_len++] = entry;
+			}
+			for (i = 0; i < pl->random_ahead_len && n < max; i++)
+				entries[n++] = pl->random_ahead[i];
+			break;
+	}
+	return n;
+}
+
 int playlist_next(Playlist *pl)
 {
 	int    result = 0;
@@ -472,6 +558,13 @@ int playlist_next(Playlist *pl)
 				break;
 			case PM_RANDOM:
 			case PM_RANDOM_REPEAT:
+				if ((entry = random_ahead_pop(pl))) { /* Picked in advance by playlist_peek_next() */
+					playlist_set_current(pl, entry);
+					result = 1;
+					if (pl->play_mode == PM_RANDOM_REPEAT && pl->played_items >= pl->length)
+						playlist_reset_random(pl);
+					break;
+				}
 				entry = pl->first;
 				if (pl->length > 0) {
 					next_item = rand() / (RAND_MAX / pl->length);
@@ -25,6 +25,7 @@ typedef enum PlayMode {
 typedef struct _Entry Entry;
 
 #define PL_ENTRY_NAME_MAX_LENGTH 64
+#define PL_LOOKAHEAD_MAX         8
 
 struct _Entry
 {
@@ -44,6 +45,10 @@ struct _Playlist
 	Entry          *current;
 	Entry          *first, *last;
 	Entry          *queue_start;
+	/* Entries picked in advance for random play, so the upcoming
+	 * entries are known before playlist_next() is called */
+	Entry          *random_ahead[PL_LOOKAHEAD_MAX];
+	size_t          random_ahead_len;
 	pthread_mutex_t mutex;
 };
 
@@ -62,6 +67,10 @@ int      playlist_entry_set_name(Entry *entry, const char *name);
 char    *playlist_get_filename(Playlist *pl, size_t item);
 size_t   playlist_get_length(Playlist *pl);
 int      playlist_next(Playlist *pl);
+/* Stores the entries subsequent playlist_next() calls are going to
+ * select (up to max, at most PL_LOOKAHEAD_MAX) in entries and returns
+ * their number. Has to be called with the playlist being locked. */
+size_t   playlist_peek_next(Playlist *pl, Entry **entries, size_t max);
 int      playlist_prev(Playlist *pl);
 int      playlist_set_current(Playlist *pl, Entry *entry);
 Entry   *playlist_get_current(Playlist *pl);
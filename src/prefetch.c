@@ -0,0 +1,181 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: prefetch.c  Created: 261016
+ *
+ * Description: Prefetching of upcoming local files into the page cache
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "prefetch.h"
+#include "util.h"
+#include "core.h" /* for DEFAULT_THREAD_STACK_SIZE */
+#include "pthread_helper.h"
+#include "debug.h"
+
+/* Amount of an audio file to be read ahead */
+#define PREFETCH_MAX_BYTES  (32 * 1024 * 1024)
+/* Amount read right away, which makes sure the device has woken up */
+#define PREFETCH_READ_BYTES 65536
+/* Larger files in the track's directory are not considered sidecar files */
+#define SIDECAR_MAX_BYTES   (2 * 1024 * 1024)
+
+static pthread_t       thread;
+static pthread_mutex_t mutex;
+static pthread_cond_t  cond;
+static int             running, quit;
+static char           *pending;
+
+/* Reads the beginning of the file and asks for more to be read ahead */
+static void prefetch_data(const char *filename, off_t size)
+{
+	int fd = open(filename, O_RDONLY);
+
+	if (fd >= 0) {
+		char buf[4096];
+		int  i;
+
+#ifdef POSIX_FADV_WILLNEED
+		posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+#endif
+		for (i = 0; i < PREFETCH_READ_BYTES / (int)sizeof(buf) && size > 0; i++)
+			if (read(fd, buf, sizeof(buf)) <= 0) break;
+		close(fd);
+	}
+}
+
+static int is_sidecar_file(const char *filename)
+{
+	static const char *extensions[] = { "jpg", "jpeg", "png", "gif", "bmp", "txt", "lrc", NULL };
+	const char        *ext = get_file_extension(filename);
+	int                i;
+
+	for (i = 0; ext && extensions[i]; i++)
+		if (strcasecmp(ext, extensions[i]) == 0) return 1;
+	return 0;
+}
+
+/* Reads the directory of the file, like the cover and lyrics file lookups
+ * do, along with any small image and text files in there */
+static void prefetch_sidecar_files(const char *filename)
+{
+	const char *name = extract_filename_from_path(filename);
+	size_t      dir_len = name > filename ? (size_t)(name - filename) : 0;
+	char       *dir = malloc(dir_len + 2), *path;
+	DIR        *d = NULL;
+
+	if (dir) {
+		if (dir_len > 0) {
+			memcpy(dir, filename, dir_len);
+			dir[dir_len] = '\0';
+		} else {
+			strcpy(dir, "./");
+		}
+		d = opendir(dir);
+	}
+	while (d) {
+		struct dirent *de = readdir(d);
+		struct stat    st;
+		size_t         len;
+
+		if (!de) break;
+		if (!is_sidecar_file(de->d_name)) continue;
+		len = strlen(dir) + strlen(de->d_name) + 1;
+		if ((path = malloc(len))) {
+			snprintf(path, len, "%s%s", dir, de->d_name);
+			if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size <= SIDECAR_MAX_BYTES)
+				prefetch_data(path, st.st_size);
+			free(path);
+		}
+	}
+	if (d) closedir(d);
+	free(dir);
+}
+
+static void *prefetch_thread(void *udata)
+{
+	pthread_mutex_lock(&mutex);
+	while (!quit) {
+		char *filename = pending;
+
+		if (!filename) {
+			pthread_cond_wait(&cond, &mutex);
+		} else {
+			struct stat st;
+
+			pending = NULL;
+			pthread_mutex_unlock(&mutex);
+			wdprintf(V_DEBUG, "prefetch", "Prefetching %s...\n", filename);
+			if (stat(filename, &st) == 0 && S_ISREG(st.st_mode)) {
+				prefetch_data(filename, st.st_size < PREFETCH_MAX_BYTES ? st.st_size : PREFETCH_MAX_BYTES);
+				prefetch_sidecar_files(filename);
+			}
+			free(filename);
+			pthread_mutex_lock(&mutex);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+int prefetch_init(void)
+{
+	running = quit = 0;
+	pending = NULL;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+	if (pthread_create_with_stack_size(&thread, DEFAULT_THREAD_STACK_SIZE, prefetch_thread, NULL) == 0) {
+		running = 1;
+	} else {
+		wdprintf(V_ERROR, "prefetch", "Could not create prefetch thread.\n");
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+	return running;
+}
+
+void prefetch_free(void)
+{
+	if (running) {
+		pthread_mutex_lock(&mutex);
+		quit = 1;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(thread, NULL);
+		free(pending);
+		pending = NULL;
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+		running = 0;
+	}
+}
+
+void prefetch_file(const char *filename)
+{
+	char *fn;
+
+	if (!running || !filename || strstr(filename, "://")) return;
+	if ((fn = malloc(strlen(filename) + 1))) {
+		strcpy(fn, filename);
+		pthread_mutex_lock(&mutex);
+		free(pending);
+		pending = fn;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+}
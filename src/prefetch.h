@@ -0,0 +1,27 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: prefetch.h  Created: 261016
+ *
+ * Description: Prefetching of upcoming local files into the page cache
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+/* Starts the prefetch thread. Returns 1 on success, 0 otherwise. */
+int  prefetch_init(void);
+void prefetch_free(void);
+/* Asks the kernel to read the given local file into the page cache in
+ * the background and warms the lookups of cover and lyrics files in its
+ * directory. A file that is still waiting to be prefetched is replaced.
+ * URLs are ignored. */
+void prefetch_file(const char *filename);
+#endif
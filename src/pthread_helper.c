@@ -8,6 +8,7 @@
  * Description: pthread related functions
  */
 #include <pthread.h>
+#include <time.h>
 #include "pthread_helper.h"
 
 int pthread_create_with_stack_size(
@@ -26,3 +27,29 @@ int pthread_create_with_stack_size(
 	}
 	return res;
 }
+
+int pthread_cond_init_monotonic(pthread_cond_t *cond)
+{
+	int                res;
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	res = pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+	return res;
+}
+
+int pthread_cond_timedwait_ms(pthread_cond_t *cond, pthread_mutex_t *mutex, int timeout_ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec  += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(cond, mutex, &ts);
+}
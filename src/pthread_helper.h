@@ -15,4 +15,10 @@ int pthread_create_with_stack_size(
 	pthread_t *thread, const size_t stack_size,
 	void *(*start_routine) (void *), void *arg
 );
+/* Initializes a condition variable that uses the monotonic clock for
+ * timed waits. Returns 0 on success like pthread_cond_init(). */
+int pthread_cond_init_monotonic(pthread_cond_t *cond);
+/* Waits on a condition variable initialized with pthread_cond_init_monotonic()
+ * for at most timeout_ms milliseconds. Returns ETIMEDOUT on timeout. */
+int pthread_cond_timedwait_ms(pthread_cond_t *cond, pthread_mutex_t *mutex, int timeout_ms);
 #endif
@@ -25,9 +25,13 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <signal.h>
+#include <time.h>
+#include <poll.h>
 #include "util.h" /* for assign_signal_handler() */
 #include "reader.h"
+#include "diskcache.h"
 #include "ringbuffer.h"
 #include "debug.h"
 #include "core.h" /* for VERSION_NUMBER and DEFAULT_THREAD_STACK_SIZE */
@@ -36,6 +40,75 @@
 static size_t http_cache_size           = 512 * 1024;
 static size_t http_cache_prebuffer_size = 256 * 1024;
 
+#define CONNECT_TIMEOUT_MS  5000
+/* Delay before the next address is tried while connecting to the
+ * previous ones is still in progress, as recommended by RFC 8305 */
+#define CONNECT_ATTEMPT_DELAY_MS 250
+#define RESPONSE_TIMEOUT_MS 5000
+/* Time without any data from the server before a stream is given up,
+ * unless there is enough buffered data left to keep trying */
+#define STALL_TIMEOUT_MS    2000
+#define HTTP_HEADER_MAX     32768
+#define HTTP_READ_CHUNK     16384
+/* Reconnecting after the connection to a server that supports range
+ * requests has been lost */
+#define HTTP_RESUME_ATTEMPTS 3
+#define HTTP_RESUME_DELAY_MS 1000
+/* The receive rate is measured in windows of RATE_WINDOW_MS and is only
+ * used for prebuffering once RATE_MIN_SAMPLES windows have been seen */
+#define RATE_WINDOW_MS      250
+#define RATE_MIN_SAMPLES    4
+/* Gaps between arriving data counted as stalls */
+#define STALL_GAP_MS        500
+/* Data to be prebuffered: at least PREBUFFER_MIN_SECONDS of the stream,
+ * plus a second for each stall seen (up to PREBUFFER_MAX_STALL_SECONDS),
+ * plus what is missing for PREBUFFER_PLAN_SECONDS when the receive rate
+ * might not keep up with the stream */
+#define PREBUFFER_MIN_SECONDS       1
+#define PREBUFFER_MAX_STALL_SECONDS 4
+#define PREBUFFER_PLAN_SECONDS      30
+#define STATS_PUBLISH_INTERVAL_MS   1000
+/* Interval for checking whether a blocking operation has been cancelled */
+#define CANCEL_CHECK_MS 50
+
+/*
+ * getaddrinfo() cannot be interrupted, so it is run in a detached thread
+ * when the caller wants to be able to cancel it. The caller waits for the
+ * result, but gives up when cancelled. In that case the resolver thread
+ * cleans up after itself once getaddrinfo() returns.
+ */
+typedef struct _Resolver {
+	char            *hostname, port[6];
+	struct addrinfo *result;
+	int              status, done, refs;
+	pthread_mutex_t  mutex;
+	pthread_cond_t   cond;
+} Resolver;
+
+#define RESOLVER_MAX_ADDRS  8
+#define RESOLVER_CACHE_SIZE 8
+/* getaddrinfo() does not tell the DNS record's TTL, so resolved addresses
+ * are kept for a fixed time. They are dropped early when none of them can
+ * be connected to. */
+#define RESOLVER_CACHE_TTL_MS (5 * 60 * 1000)
+
+/* Resolved addresses of a host in the order they should be tried in */
+typedef struct _AddressList {
+	int                     num;
+	struct sockaddr_storage addr[RESOLVER_MAX_ADDRS];
+	socklen_t               addr_len[RESOLVER_MAX_ADDRS];
+} AddressList;
+
+typedef struct _ResolverCacheEntry {
+	char        *hostname;
+	char         port[6];
+	long         expires; /* Monotonic time in ms */
+	AddressList  addrs;
+} ResolverCacheEntry;
+
+static ResolverCacheEntry resolver_cache[RESOLVER_CACHE_SIZE];
+static pthread_mutex_t    resolver_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 int reader_set_cache_size_kb(size_t size, size_t prebuffer_size)
 {
 	size = size < HTTP_CACHE_SIZE_MIN_KB ? HTTP_CACHE_SIZE_MIN_KB : size;
@@ -97,65 +170,949 @@ static int http_url_split_alloc(const char *url, char **hostname, int *port, cha
 	return 0;
 }
 
-static void *http_reader_thread(void *arg)
+static int is_cancelled(ReaderCancelCallback cancelled, void *udata)
 {
-	Reader *r = (Reader *)arg;
-	int     numbytes = 1, err = 0;
-	char    buf[4096];
-
-	while (numbytes != -1 && numbytes > 0 && !r->eof) {
-		do {
-			numbytes = recv(r->sockfd, buf, 4096, 0);
-			err = errno;
-			if (numbytes > 0) { /* write to ringbuffer */
-				int write_okay = 0;
-				while (!write_okay && !r->eof) {
-					pthread_mutex_lock(&(r->mutex));
-					write_okay = ringbuffer_write(&(r->rb_http), buf, numbytes);
-					pthread_mutex_unlock(&(r->mutex));
-					usleep(1500);
+	return cancelled && (*cancelled)(udata);
+}
+
+static void resolver_release(Resolver *res)
+{
+	int refs;
+
+	pthread_mutex_lock(&(res->mutex));
+	refs = --res->refs;
+	pthread_mutex_unlock(&(res->mutex));
+	if (refs == 0) {
+		if (res->result) freeaddrinfo(res->result);
+		pthread_cond_destroy(&(res->cond));
+		pthread_mutex_destroy(&(res->mutex));
+		free(res->hostname);
+		free(res);
+	}
+}
+
+static void *resolver_thread(void *arg)
+{
+	Resolver        *res = (Resolver *)arg;
+	struct addrinfo  hints, *result = NULL;
+	int              status;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	status = getaddrinfo(res->hostname, res->port, &hints, &result);
+	pthread_mutex_lock(&(res->mutex));
+	res->status = status;
+	res->result = status == 0 ? result : NULL;
+	res->done   = 1;
+	pthread_cond_broadcast(&(res->cond));
+	pthread_mutex_unlock(&(res->mutex));
+	resolver_release(res);
+	return NULL;
+}
+
+/**
+ * Resolves hostname like getaddrinfo() does. Returns EAI_SYSTEM with errno
+ * set to ECANCELED when cancelled() returned non-zero before the name
+ * could be resolved.
+ */
+static int resolve_addrinfo(const char *hostname, const char *port, struct addrinfo **result,
+                            ReaderCancelCallback cancelled, void *udata)
+{
+	Resolver  *res;
+	pthread_t  thread;
+	int        status;
+
+	if (!cancelled || !(res = calloc(1, sizeof(Resolver))) || !(res->hostname = malloc(strlen(hostname) + 1))) {
+		struct addrinfo hints;
+
+		if (cancelled) free(res);
+		memset(&hints, 0, sizeof hints);
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		return getaddrinfo(hostname, port, &hints, result);
+	}
+	strcpy(res->hostname, hostname);
+	strncpy(res->port, port, 5);
+	res->refs = 2;
+	pthread_mutex_init(&(res->mutex), NULL);
+	pthread_cond_init_monotonic(&(res->cond));
+	if (pthread_create_with_stack_size(&thread, DEFAULT_THREAD_STACK_SIZE, resolver_thread, res) != 0) {
+		res->refs = 1;
+		resolver_release(res);
+		return EAI_AGAIN;
+	}
+	pthread_detach(thread);
+	pthread_mutex_lock(&(res->mutex));
+	while (!res->done && !is_cancelled(cancelled, udata))
+		pthread_cond_timedwait_ms(&(res->cond), &(res->mutex), CANCEL_CHECK_MS);
+	if (res->done) {
+		status = res->status;
+		*result = res->result;
+		res->result = NULL; /* Now owned by the caller */
+	} else {
+		status = EAI_SYSTEM;
+		errno = ECANCELED;
+	}
+	pthread_mutex_unlock(&(res->mutex));
+	resolver_release(res);
+	return status;
+}
+
+static long get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Returns the cache entry for hostname and port or NULL. To be called with
+ * the resolver cache mutex being locked. */
+static ResolverCacheEntry *resolver_cache_find(const char *hostname, const char *port)
+{
+	int i;
+
+	for (i = 0; i < RESOLVER_CACHE_SIZE; i++) {
+		ResolverCacheEntry *e = resolver_cache + i;
+		if (e->hostname && strcmp(e->hostname, hostname) == 0 && strcmp(e->port, port) == 0) return e;
+	}
+	return NULL;
+}
+
+static int resolver_cache_get(const char *hostname, const char *port, AddressList *addrs)
+{
+	ResolverCacheEntry *e;
+	int                 res = 0;
+
+	pthread_mutex_lock(&resolver_cache_mutex);
+	if ((e = resolver_cache_find(hostname, port)) && e->expires - get_time_ms() > 0) {
+		*addrs = e->addrs;
+		res = 1;
+	}
+	pthread_mutex_unlock(&resolver_cache_mutex);
+	return res;
+}
+
+static void resolver_cache_put(const char *hostname, const char *port, const AddressList *addrs)
+{
+	ResolverCacheEntry *e;
+	int                 i;
+
+	pthread_mutex_lock(&resolver_cache_mutex);
+	if (!(e = resolver_cache_find(hostname, port))) {
+		/* Use a free slot or replace the entry that expires first */
+		e = resolver_cache;
+		for (i = 0; i < RESOLVER_CACHE_SIZE && e->hostname; i++)
+			if (!resolver_cache[i].hostname || resolver_cache[i].expires - e->expires < 0) e = resolver_cache + i;
+		free(e->hostname);
+		if ((e->hostname = malloc(strlen(hostname) + 1))) strcpy(e->hostname, hostname);
+		strncpy(e->port, port, 5);
+		e->port[5] = '\0';
+	}
+	e->addrs = *addrs;
+	e->expires = get_time_ms() + RESOLVER_CACHE_TTL_MS;
+	pthread_mutex_unlock(&resolver_cache_mutex);
+}
+
+static void resolver_cache_remove(const char *hostname, const char *port)
+{
+	ResolverCacheEntry *e;
+
+	pthread_mutex_lock(&resolver_cache_mutex);
+	if ((e = resolver_cache_find(hostname, port))) {
+		free(e->hostname);
+		e->hostname = NULL;
+	}
+	pthread_mutex_unlock(&resolver_cache_mutex);
+}
+
+static void address_list_add(AddressList *addrs, const struct addrinfo *ai)
+{
+	memcpy(addrs->addr + addrs->num, ai->ai_addr, ai->ai_addrlen);
+	addrs->addr_len[addrs->num++] = ai->ai_addrlen;
+}
+
+/**
+ * Stores the addresses from getaddrinfo()'s result in addrs. Starting
+ * with the preferred (first) address, the address families alternate,
+ * so an unreachable family does not delay connecting through the other
+ * one (RFC 8305).
+ */
+static void address_list_from_addrinfo(AddressList *addrs, const struct addrinfo *result)
+{
+	const struct addrinfo *p, *preferred[RESOLVER_MAX_ADDRS], *other[RESOLVER_MAX_ADDRS];
+	int                    np = 0, no = 0, i;
+
+	addrs->num = 0;
+	for (p = result; p; p = p->ai_next) {
+		if (p->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+		if (p->ai_family == result->ai_family) {
+			if (np < RESOLVER_MAX_ADDRS) preferred[np++] = p;
+		} else if (no < RESOLVER_MAX_ADDRS) {
+			other[no++] = p;
+		}
+	}
+	for (i = 0; addrs->num < RESOLVER_MAX_ADDRS && (i < np || i < no); i++) {
+		if (i < np) address_list_add(addrs, preferred[i]);
+		if (i < no && addrs->num < RESOLVER_MAX_ADDRS) address_list_add(addrs, other[i]);
+	}
+}
+
+/**
+ * Resolves hostname into addrs, using the resolver cache when possible.
+ * Returns 0 on success or a getaddrinfo() error code (see
+ * resolve_addrinfo() for cancellation).
+ */
+static int resolve(const char *hostname, const char *port, AddressList *addrs,
+                   ReaderCancelCallback cancelled, void *udata)
+{
+	struct addrinfo *result = NULL;
+	int              status;
+
+	if (resolver_cache_get(hostname, port, addrs)) {
+		wdprintf(V_DEBUG, "reader", "Using cached addresses of %s.\n", hostname);
+		return 0;
+	}
+	if ((status = resolve_addrinfo(hostname, port, &result, cancelled, udata)) == 0) {
+		address_list_from_addrinfo(addrs, result);
+		freeaddrinfo(result);
+		if (addrs->num > 0)
+			resolver_cache_put(hostname, port, addrs);
+		else
+			status = EAI_NONAME;
+	}
+	return status;
+}
+
+/**
+ * Connects to one of the addresses. Following the "Happy Eyeballs"
+ * approach (RFC 8305), the next address is tried every
+ * CONNECT_ATTEMPT_DELAY_MS (or as soon as an attempt fails) while the
+ * earlier attempts continue, and the first connection to be established
+ * wins. Returns the socket and stores the address' index in index, or
+ * returns -1 on error, timeout or cancellation.
+ */
+static int connect_any(const AddressList *addrs, int *index, ReaderCancelCallback cancelled, void *udata)
+{
+	struct pollfd pfds[RESOLVER_MAX_ADDRS];
+	int           pending[RESOLVER_MAX_ADDRS];
+	int           active = 0, next = 0, sockfd = -1, i;
+	long          start = get_time_ms(), next_attempt = start;
+
+	while (sockfd < 0 && (next < addrs->num || active > 0)) {
+		long now = get_time_ms();
+		int  timeout = CANCEL_CHECK_MS, res;
+
+		if (is_cancelled(cancelled, udata)) {
+			wdprintf(V_DEBUG, "reader", "Connecting cancelled.\n");
+			break;
+		}
+		if (now - start >= CONNECT_TIMEOUT_MS) {
+			wdprintf(V_DEBUG, "reader", "Timeout while connecting.\n");
+			break;
+		}
+		if (next < addrs->num && now - next_attempt >= 0) {
+			int fd = socket(addrs->addr[next].ss_family, SOCK_STREAM, 0);
+
+			if (fd >= 0) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+				if (connect(fd, (const struct sockaddr *)(addrs->addr + next), addrs->addr_len[next]) == 0) {
+					sockfd = fd;
+					*index = next;
+				} else if (errno == EINPROGRESS) {
+					pfds[active].fd = fd;
+					pfds[active].events = POLLOUT;
+					pending[active++] = next;
+					next_attempt = now + CONNECT_ATTEMPT_DELAY_MS;
+				} else {
+					wdprintf(V_DEBUG, "reader", "connect: %s\n", strerror(errno));
+					close(fd);
 				}
 			} else {
-				usleep(300000);
-				if (err == 0) {
-					if (numbytes == 0) r->eof = 1;
+				wdprintf(V_INFO, "reader", "socket: %s\n", strerror(errno));
+			}
+			next++;
+			continue;
+		}
+		if (next < addrs->num && next_attempt - now < timeout) timeout = next_attempt - now;
+		for (i = 0; i < active; i++) pfds[i].revents = 0;
+		res = poll(pfds, active, timeout);
+		if (res < 0 && errno != EINTR) {
+			wdprintf(V_DEBUG, "reader", "Error while connecting: %s\n", strerror(errno));
+			break;
+		}
+		for (i = 0; res > 0 && i < active; ) {
+			if (pfds[i].revents) {
+				int       err = 0;
+				socklen_t len = sizeof(err);
+
+				if (sockfd < 0 && getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&err, &len) == 0 && !err) {
+					sockfd = pfds[i].fd;
+					*index = pending[i];
 				} else {
-					wdprintf(V_DEBUG, "reader", "Network problem: %s (%d)\n", strerror(err), err);
-					wdprintf(V_DEBUG, "reader", "Retrying...\n");
+					if (err) wdprintf(V_DEBUG, "reader", "connect: %s\n", strerror(err));
+					close(pfds[i].fd);
+					next_attempt = now; /* Go on with the next address right away */
 				}
+				active--;
+				pfds[i] = pfds[active];
+				pending[i] = pending[active];
+			} else {
+				i++;
+			}
+		}
+	}
+	for (i = 0; i < active; i++) close(pfds[i].fd);
+	return sockfd;
+}
+
+/* Returns the length of the HTTP header in buf including the empty line
+ * ending it ("\r\n\r\n" or "\n\n"), or 0 if it is incomplete */
+static size_t http_find_header_end(const char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < len; i++) {
+		if (buf[i] == '\n') {
+			if (buf[i+1] == '\n') return i + 2;
+			if (buf[i+1] == '\r' && i + 2 < len && buf[i+2] == '\n') return i + 3;
+		}
+	}
+	return 0;
+}
+
+/* Adds the "Key: value" lines of a complete, zero terminated HTTP header
+ * to info. Returns the status code from the status line, 0 if there is none. */
+static int http_parse_header(char *buf, ConfigFile *info)
+{
+	char *line = buf;
+	int   status = 0;
+
+	while (line && *line) {
+		char   *eol = strchr(line, '\n'), *colon;
+		size_t  len = eol ? (size_t)(eol - line) : strlen(line);
+
+		if (len > 0 && line[len-1] == '\r') len--;
+		line[len] = '\0';
+		if (line == buf && sscanf(line, "%*s %d", &status) == 1) { /* e.g. "HTTP/1.1 200 OK" or "ICY 200 OK" */
+			wdprintf(V_DEBUG, "reader", "status=[%s]\n", line);
+		} else if ((colon = strchr(line, ':'))) {
+			char *value = colon + 1;
+
+			*colon = '\0';
+			while (*value == ' ') value++;
+			wdprintf(V_DEBUG, "reader", "key=[%s] value=[%s]\n", line, value);
+			if (line[0] && value[0]) cfg_add_key(info, line, value);
+		}
+		line = eol ? eol + 1 : NULL;
+	}
+	return status;
+}
+
+/* Returns 1 when the response in info delivers the resource from offset on */
+static int http_response_matches(int status, ConfigFile *info, unsigned long offset)
+{
+	char          *range = cfg_get_key_value_ignore_case(info, "Content-Range");
+	unsigned long  start = 0;
+
+	if (offset == 0) return status != 206 || (range && sscanf(range, "bytes %lu-", &start) == 1 && start == 0);
+	return status == 206 && range && sscanf(range, "bytes %lu-", &start) == 1 && start == offset;
+}
+
+/**
+ * Receives the HTTP response header in one piece directly from the socket
+ * and parses it into info. When the response delivers the requested data
+ * starting at offset, data received beyond the header is passed on to the
+ * stream buffer. Returns 1 on success, 0 on error, timeout, cancellation
+ * or when the response does not match the request.
+ */
+static int http_receive_header(Reader *r, int sockfd, unsigned long offset, ConfigFile *info,
+                               ReaderCancelCallback cancelled, void *udata)
+{
+	char   *buf = malloc(HTTP_HEADER_MAX + 1);
+	size_t  len = 0, header_len = 0;
+	int     waited = 0, res = 0;
+
+	while (buf && !header_len && len < HTTP_HEADER_MAX && waited < RESPONSE_TIMEOUT_MS) {
+		struct pollfd pfd;
+		ssize_t       numbytes;
+		int           ready;
+
+		if (is_cancelled(cancelled, udata)) {
+			wdprintf(V_DEBUG, "reader", "Waiting for the response cancelled.\n");
+			break;
+		}
+		pfd.fd = sockfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ready = poll(&pfd, 1, CANCEL_CHECK_MS);
+		if (ready == 0) {
+			waited += CANCEL_CHECK_MS;
+			continue;
+		} else if (ready < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		numbytes = recv(sockfd, buf + len, HTTP_HEADER_MAX - len, 0);
+		if (numbytes <= 0) {
+			if (numbytes < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+			break;
+		}
+		len += numbytes;
+		header_len = http_find_header_end(buf, len);
+	}
+	if (header_len) {
+		char   *rest = buf + header_len;
+		size_t  rest_len = len - header_len;
+		int     status;
+
+		wdprintf(V_DEBUG, "reader", "HTTP header received (%d bytes).\n", header_len);
+		/* Keep the data, as parsing the header modifies it */
+		memmove(buf + header_len + 1, rest, rest_len);
+		rest = buf + header_len + 1;
+		buf[header_len] = '\0';
+		status = http_parse_header(buf, info);
+		if (offset == 0) r->http_status = status;
+		if (!http_response_matches(status, info, offset)) {
+			wdprintf(V_WARNING, "reader", "Unexpected response for byte offset %lu.\n", offset);
+		} else if (rest_len > 0) {
+			pthread_mutex_lock(&(r->mutex));
+			while (ringbuffer_get_free(&(r->rb_http)) < rest_len && !r->closing)
+				pthread_cond_wait(&(r->space_cond), &(r->mutex));
+			if (ringbuffer_write(&(r->rb_http), rest, rest_len)) {
+				disk_cache_writer_write(r->cache, rest, rest_len, r->recv_pos);
+				r->recv_pos += rest_len;
+				pthread_cond_broadcast(&(r->cond));
+				res = 1;
+			}
+			pthread_mutex_unlock(&(r->mutex));
+		} else {
+			res = 1;
+		}
+	} else {
+		wdprintf(V_WARNING, "reader", "No valid HTTP response received.\n");
+	}
+	free(buf);
+	return res;
+}
+
+/**
+ * Connects to the reader's HTTP server. Returns the socket, or -1 on
+ * error, timeout or cancellation.
+ */
+static int http_connect(Reader *r, ReaderCancelCallback cancelled, void *udata)
+{
+	AddressList addrs;
+	int         rv, sockfd, i = 0;
+	char        s[INET6_ADDRSTRLEN];
+	char        port_str[6];
+
+	snprintf(port_str, 6, "%d", r->http_port);
+	if ((rv = resolve(r->http_host, port_str, &addrs, cancelled, udata)) != 0) {
+		if (rv == EAI_SYSTEM && errno == ECANCELED)
+			wdprintf(V_DEBUG, "reader", "Name resolution cancelled.\n");
+		else
+			wdprintf(V_ERROR, "reader",  "getaddrinfo: %s\n", gai_strerror(rv));
+		return -1;
+	}
+	if ((sockfd = connect_any(&addrs, &i, cancelled, udata)) < 0) {
+		if (!is_cancelled(cancelled, udata)) {
+			wdprintf(V_ERROR, "reader", "Failed to connect.\n");
+			/* The host's addresses might have changed */
+			resolver_cache_remove(r->http_host, port_str);
+		}
+	} else {
+		struct timeval tv;
+
+		fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) & (~O_NONBLOCK));
+		/* Set socket timeout to 2 seconds */
+		tv.tv_sec = 2;
+		tv.tv_usec = 0;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv,  sizeof tv))
+			wdprintf(V_INFO, "reader", "setsockopt: %s\n", strerror(errno));
+		inet_ntop(addrs.addr[i].ss_family, get_in_addr((struct sockaddr *)(addrs.addr + i)), s, sizeof s);
+		wdprintf(V_INFO, "reader", "Connected to %s:%d.\n", s, r->http_port);
+	}
+	return sockfd;
+}
+
+/**
+ * Requests the reader's resource from the given byte offset on and
+ * receives the response header into info. Returns the socket to read the
+ * data from, or -1 on failure.
+ */
+static int http_request(Reader *r, unsigned long offset, ConfigFile *info,
+                        ReaderCancelCallback cancelled, void *udata)
+{
+	int  sockfd = http_connect(r, cancelled, udata);
+	char http_request[1024], range[48];
+
+	if (sockfd < 0) return -1;
+	range[0] = '\0';
+	if (offset > 0) snprintf(range, sizeof(range), "Range: bytes=%lu-\r\n", offset);
+	snprintf(http_request, sizeof(http_request),
+	         "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\nUser-Agent: Gmu/%s\r\nIcy-MetaData: 1\r\n%s\r\n",
+	         r->http_path, r->http_host, VERSION_NUMBER, range);
+	wdprintf(V_DEBUG, "reader", "Sending request: %s\n", http_request);
+	if (send(sockfd, http_request, strlen(http_request), 0) < 0 ||
+	    !http_receive_header(r, sockfd, offset, info, cancelled, udata)) {
+		close(sockfd);
+		sockfd = -1;
+	}
+	return sockfd;
+}
+
+/* Cancel callback for requests made while the reader is in use */
+static int reader_closing(void *udata)
+{
+	Reader *r = (Reader *)udata;
+	int     res;
+
+	pthread_mutex_lock(&(r->mutex));
+	res = r->closing;
+	pthread_mutex_unlock(&(r->mutex));
+	return res;
+}
+
+/**
+ * Cancel callback for seeking in an HTTP stream: The new request is given
+ * up when the reader is being closed or the cancel callback given on
+ * opening says so.
+ */
+static int seek_cancelled(void *udata)
+{
+	Reader *r = (Reader *)udata;
+
+	return reader_closing(r) || is_cancelled(r->cancelled, r->cancel_udata);
+}
+
+/**
+ * Reconnects after the connection has been lost and requests the rest of
+ * the data. To be called by the reader thread with the mutex being locked.
+ * Returns 1 on success, 0 otherwise.
+ */
+static int http_resume(Reader *r)
+{
+	unsigned long offset = r->recv_pos;
+	int           attempt, sockfd = -1;
+
+	for (attempt = 0; attempt < HTTP_RESUME_ATTEMPTS && sockfd < 0 && !r->closing; attempt++) {
+		ConfigFile *info;
+
+		if (attempt > 0) pthread_cond_timedwait_ms(&(r->space_cond), &(r->mutex), HTTP_RESUME_DELAY_MS);
+		if (r->closing) break;
+		wdprintf(V_INFO, "reader", "Connection lost. Resuming at byte %lu...\n", offset);
+		pthread_mutex_unlock(&(r->mutex));
+		if ((info = cfg_init())) {
+			sockfd = http_request(r, offset, info, reader_closing, r);
+			cfg_free(info);
+		}
+		pthread_mutex_lock(&(r->mutex));
+	}
+	if (sockfd >= 0 && r->closing) {
+		close(sockfd);
+		sockfd = -1;
+	}
+	if (sockfd >= 0) {
+		close(r->sockfd);
+		r->sockfd = sockfd;
+	}
+	return sockfd >= 0;
+}
+
+/* Stops the reader thread, so the reader's connection can be replaced */
+static void http_stop_thread(Reader *r)
+{
+	pthread_mutex_lock(&(r->mutex));
+	r->closing = 1;
+	r->eof = 1;
+	pthread_cond_broadcast(&(r->space_cond));
+	/* shutdown() wakes the thread up from poll() */
+	if (r->sockfd > 0) shutdown(r->sockfd, SHUT_RDWR);
+	pthread_mutex_unlock(&(r->mutex));
+	if (r->thread_running) {
+		wdprintf(V_DEBUG, "reader", "Waiting for reader thread to finish.\n");
+		pthread_join(r->thread, NULL);
+		wdprintf(V_DEBUG, "reader", "Reader thread joined.\n");
+		r->thread_running = 0;
+	}
+}
+
+/* Starts a new rate measurement with the next data that arrives. Time the
+ * reader thread spends waiting for room in the buffer does not count. */
+static void http_stats_restart(Reader *r)
+{
+	r->window_start = 0;
+	r->last_data = 0;
+}
+
+/**
+ * Updates the receive rate and its jitter, estimated the way TCP
+ * estimates round-trip times (RFC 6298), when numbytes have been
+ * received. To be called with the mutex being locked.
+ */
+static void http_stats_update(Reader *r, size_t numbytes)
+{
+	long now = get_time_ms();
+
+	if (r->last_data != 0 && now - r->last_data >= STALL_GAP_MS) r->stats.stalls++;
+	r->last_data = now;
+	if (r->window_start == 0) {
+		/* The first data might have been waiting in the socket buffer already */
+		r->window_start = now;
+		r->window_bytes = 0;
+	} else {
+		r->window_bytes += numbytes;
+		if (now - r->window_start >= RATE_WINDOW_MS) {
+			unsigned long sample = (unsigned long)((unsigned long long)r->window_bytes * 1000 / (now - r->window_start));
+
+			if (r->rate_samples++ == 0) {
+				r->stats.rate = sample;
+				r->stats.jitter = sample / 2;
+			} else {
+				unsigned long diff = sample > r->stats.rate ? sample - r->stats.rate : r->stats.rate - sample;
+
+				r->stats.jitter = (3 * r->stats.jitter + diff) / 4;
+				r->stats.rate = (7 * r->stats.rate + sample) / 8;
+			}
+			r->window_start = now;
+			r->window_bytes = 0;
+		}
+	}
+}
+
+/**
+ * Returns the amount of data to be buffered before playback starts. It
+ * depends on the stream's bitrate and the measured receive rate, which
+ * is assumed to drop by up to twice its jitter. Until both are known, the
+ * configured prebuffer size is used. To be called with the mutex being
+ * locked.
+ */
+static size_t http_prebuffer_target(Reader *r)
+{
+	unsigned long need = r->bitrate / 8, low, target;
+	int           stalls = r->stats.stalls;
+
+	if (need == 0 || r->rate_samples < RATE_MIN_SAMPLES) return http_cache_prebuffer_size;
+	if (stalls > PREBUFFER_MAX_STALL_SECONDS) stalls = PREBUFFER_MAX_STALL_SECONDS;
+	target = need * (PREBUFFER_MIN_SECONDS + stalls);
+	low = r->stats.rate > 2 * r->stats.jitter ? r->stats.rate - 2 * r->stats.jitter : 0;
+	if (low < need) target += (need - low) * PREBUFFER_PLAN_SECONDS;
+	return target;
+}
+
+/* Marks the stream as ready once enough data has been prebuffered. The
+ * stream buffer grows (up to HTTP_CACHE_SIZE_MAX_KB), when it is too small
+ * for the prebuffer. To be called with the mutex being locked. */
+static void http_check_ready(Reader *r)
+{
+	size_t target = http_prebuffer_target(r);
+	size_t size = ringbuffer_get_size(&(r->rb_http));
+
+	if (r->is_ready) return;
+	if (target > size / 4 * 3 && size < HTTP_CACHE_SIZE_MAX_KB * 1024) {
+		size_t new_size = target / 3 * 4 < HTTP_CACHE_SIZE_MAX_KB * 1024 ? target / 3 * 4 : HTTP_CACHE_SIZE_MAX_KB * 1024;
+
+		if (ringbuffer_resize(&(r->rb_http), new_size)) {
+			wdprintf(V_DEBUG, "reader", "Stream buffer enlarged to %lu KB.\n", (unsigned long)new_size / 1024);
+			size = new_size;
+		}
+	}
+	if (target > size / 4 * 3) target = size / 4 * 3;
+	r->stats.prebuffer_target = target;
+	r->stats.buffer_size = size;
+	if (ringbuffer_get_fill(&(r->rb_http)) >= target) {
+		wdprintf(V_DEBUG, "reader", "Prebuffered %lu KB.\n", (unsigned long)ringbuffer_get_fill(&(r->rb_http)) / 1024);
+		r->is_ready = 1;
+		pthread_cond_broadcast(&(r->cond));
+	}
+}
+
+/**
+ * Receives the stream data into the stream buffer. Waits for the server
+ * with poll() and for the consumer to make room with a condition variable,
+ * so there is no polling with sleeps involved. Consumers are woken up
+ * through r->cond when new data arrives.
+ */
+static void *http_reader_thread(void *arg)
+{
+	Reader *r = (Reader *)arg;
+	char    buf[HTTP_READ_CHUNK];
+
+	pthread_mutex_lock(&(r->mutex));
+	http_stats_restart(r);
+	while (!r->eof) {
+		struct pollfd pfd;
+		size_t        space;
+		ssize_t       numbytes = -1;
+		int           res, err;
+
+		if (!r->eof && ringbuffer_get_free(&(r->rb_http)) == 0) {
+			while (!r->eof && ringbuffer_get_free(&(r->rb_http)) == 0)
+				pthread_cond_wait(&(r->space_cond), &(r->mutex));
+			http_stats_restart(r);
+		}
+		if (r->eof) break;
+		space = ringbuffer_get_free(&(r->rb_http));
+		pthread_mutex_unlock(&(r->mutex));
+		pfd.fd = r->sockfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		res = poll(&pfd, 1, STALL_TIMEOUT_MS);
+		if (res > 0) numbytes = recv(r->sockfd, buf, space < sizeof(buf) ? space : sizeof(buf), 0);
+		err = res == 0 ? ETIMEDOUT : errno;
+		/* Only this thread changes recv_pos while it is running */
+		if (numbytes > 0) disk_cache_writer_write(r->cache, buf, numbytes, r->recv_pos);
+		pthread_mutex_lock(&(r->mutex));
+		if (numbytes > 0) {
+			ringbuffer_write(&(r->rb_http), buf, numbytes);
+			r->recv_pos += numbytes;
+			http_stats_update(r, numbytes);
+			http_check_ready(r);
+			pthread_cond_broadcast(&(r->cond));
+		} else if (r->closing) {
+			r->eof = 1;
+		} else if (r->seekable && r->recv_pos < (unsigned long)r->file_size &&
+		           (numbytes == 0 || (err != EINTR && err != EAGAIN))) {
+			/* The server supports range requests, so continue where the data ended */
+			if (!http_resume(r)) r->eof = 1;
+		} else if (numbytes == 0) {
+			r->eof = 1;
+		} else if (err != EINTR && err != EAGAIN) {
+			wdprintf(V_DEBUG, "reader", "Network problem: %s (%d)\n", strerror(err), err);
+			/* Keep trying as long as there is enough data left to be played */
+			if (ringbuffer_get_fill(&(r->rb_http)) > 4000) {
+				wdprintf(V_DEBUG, "reader", "Retrying...\n");
+				if (err != ETIMEDOUT) pthread_cond_timedwait_ms(&(r->space_cond), &(r->mutex), 300);
+			} else {
+				r->eof = 1;
 			}
-		} while (numbytes <= 0 && !r->eof && ringbuffer_get_fill(&(r->rb_http)) > 4000);
-		wdprintf(V_DEBUG, "reader", "buf fill: %d bytes\r", ringbuffer_get_fill(&(r->rb_http)));
-		if (!r->is_ready && ringbuffer_get_fill(&(r->rb_http)) >= http_cache_prebuffer_size)
-			r->is_ready = 1;
-		fflush(stdout);
+		}
 	}
 	wdprintf(V_DEBUG, "reader", "thread done.\n");
 	r->eof = 1;
+	pthread_cond_broadcast(&(r->cond));
+	pthread_mutex_unlock(&(r->mutex));
 	return NULL;
 }
 
+/* Adds the reception statistics to the stream info. Called from reading,
+ * since the stream info must only be modified by the reader's user. */
+static void http_publish_stats(Reader *r)
+{
+	long now = get_time_ms();
+
+	if (now - r->stats_published >= STATS_PUBLISH_INTERVAL_MS) {
+		ReaderStats stats;
+		char        tmp[24];
+
+		reader_get_stats(r, &stats);
+		snprintf(tmp, sizeof(tmp), "%lu", stats.rate);
+		cfg_add_key(r->streaminfo, "X-Gmu-Receive-Rate", tmp);
+		snprintf(tmp, sizeof(tmp), "%lu", stats.jitter);
+		cfg_add_key(r->streaminfo, "X-Gmu-Receive-Jitter", tmp);
+		snprintf(tmp, sizeof(tmp), "%d", stats.stalls);
+		cfg_add_key(r->streaminfo, "X-Gmu-Stalls", tmp);
+		snprintf(tmp, sizeof(tmp), "%d", stats.refills);
+		cfg_add_key(r->streaminfo, "X-Gmu-Refills", tmp);
+		snprintf(tmp, sizeof(tmp), "%lu", (unsigned long)stats.prebuffer_target);
+		cfg_add_key(r->streaminfo, "X-Gmu-Prebuffer", tmp);
+		r->stats_published = now;
+	}
+}
+
+/**
+ * Waits until size bytes (at most the stream buffer's size) are available
+ * or the stream has ended and reads them. At the end of the stream, the
+ * remaining data is returned. Returns the number of bytes read.
+ */
+static size_t http_read(Reader *r, char *target, size_t size)
+{
+	size_t want, n;
+
+	pthread_mutex_lock(&(r->mutex));
+	want = size < ringbuffer_get_size(&(r->rb_http)) ? size : ringbuffer_get_size(&(r->rb_http));
+	if (r->is_ready && ringbuffer_get_fill(&(r->rb_http)) < want && !r->eof) r->stats.refills++;
+	while (ringbuffer_get_fill(&(r->rb_http)) < want && !r->eof)
+		pthread_cond_wait(&(r->cond), &(r->mutex));
+	n = ringbuffer_get_fill(&(r->rb_http));
+	if (n > size) n = size;
+	if (n > 0) {
+		ringbuffer_read(&(r->rb_http), target, n);
+		r->stream_pos += n;
+		pthread_cond_signal(&(r->space_cond));
+	}
+	pthread_mutex_unlock(&(r->mutex));
+	http_publish_stats(r);
+	return n;
+}
+
 int reader_is_ready(Reader *r)
 {
 	return r->is_ready;
 }
 
+int reader_wait_prebuffer(Reader *r, int timeout_ms)
+{
+	int res, wakeups, timed_out = 0;
+
+	pthread_mutex_lock(&(r->mutex));
+	wakeups = r->wakeups;
+	while (!r->is_ready && !r->eof && !timed_out && wakeups == r->wakeups)
+		timed_out = pthread_cond_timedwait_ms(&(r->cond), &(r->mutex), timeout_ms) == ETIMEDOUT;
+	res = r->is_ready;
+	pthread_mutex_unlock(&(r->mutex));
+	return res;
+}
+
+void reader_set_bitrate(Reader *r, int bitrate)
+{
+	pthread_mutex_lock(&(r->mutex));
+	r->bitrate = bitrate > 0 ? bitrate : 0;
+	if (r->rb_http.buffer) http_check_ready(r);
+	pthread_mutex_unlock(&(r->mutex));
+}
+
+void reader_get_stats(Reader *r, ReaderStats *stats)
+{
+	pthread_mutex_lock(&(r->mutex));
+	*stats = r->stats;
+	pthread_mutex_unlock(&(r->mutex));
+}
+
+void reader_wake(Reader *r)
+{
+	pthread_mutex_lock(&(r->mutex));
+	r->wakeups++;
+	pthread_cond_broadcast(&(r->cond));
+	pthread_mutex_unlock(&(r->mutex));
+}
+
+/**
+ * Regular files are mapped into memory, so reading from them needs
+ * neither system calls nor copying. Pipes, special files and files that
+ * cannot be mapped (e.g. because they are too large for the address
+ * space) are read through stdio. Returns 1 on success, 0 otherwise.
+ */
+static int local_file_open(Reader *r, const char *filename)
+{
+	struct stat st;
+	int         fd = open(filename, O_RDONLY);
+
+	if (fd < 0) return 0;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		r->file_size = st.st_size;
+		r->seekable = 1;
+		wdprintf(V_DEBUG, "reader", "File size = %d bytes.\n", r->file_size);
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		if (st.st_size > 0 && (size_t)st.st_size == (unsigned long long)st.st_size) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (map != MAP_FAILED) {
+				r->map = map;
+#ifdef MADV_SEQUENTIAL
+				madvise(r->map, st.st_size, MADV_SEQUENTIAL);
+#endif
+			} else {
+				wdprintf(V_DEBUG, "reader", "mmap: %s\n", strerror(errno));
+			}
+		}
+	}
+	if (r->map) {
+		close(fd); /* The mapping stays valid */
+	} else if (!(r->file = fdopen(fd, "r"))) {
+		close(fd);
+		return 0;
+	}
+	r->is_ready = 1;
+	return 1;
+}
+
+/**
+ * Switches a freshly opened HTTP reader over to the disk cache's copy of
+ * the file, if there is an up-to-date one. Otherwise the file is written
+ * through to the cache while it is being received. To be called before
+ * the reader thread is started. Returns 1 when the cached copy is used.
+ */
+static int http_use_disk_cache(Reader *r, const char *url)
+{
+	char *etag = cfg_get_key_value_ignore_case(r->streaminfo, "ETag");
+	char *last_modified = cfg_get_key_value_ignore_case(r->streaminfo, "Last-Modified");
+	char *path;
+	int   res = 0;
+
+	/* Live streams, redirects and errors are not cached */
+	if (r->file_size <= 0 || (r->http_status != 200 && r->http_status != 206)) return 0;
+	if ((path = disk_cache_get_file_alloc(url, etag, last_modified, r->file_size))) {
+		wdprintf(V_INFO, "reader", "Reading %s from the disk cache.\n", url);
+		res = local_file_open(r, path);
+		free(path);
+	}
+	if (res) {
+		close(r->sockfd);
+		r->sockfd = 0;
+		ringbuffer_clear(&(r->rb_http));
+		r->recv_pos = 0;
+	} else if ((r->cache = disk_cache_writer_open(url, etag, last_modified, r->file_size))) {
+		size_t fill = ringbuffer_get_fill(&(r->rb_http));
+		char  *buf = fill > 0 ? malloc(fill) : NULL;
+
+		/* Pass on the data that arrived along with the header */
+		if (buf) {
+			ringbuffer_set_unread_pos(&(r->rb_http));
+			ringbuffer_read(&(r->rb_http), buf, fill);
+			ringbuffer_unread(&(r->rb_http));
+			disk_cache_writer_write(r->cache, buf, fill, 0);
+			free(buf);
+		}
+	}
+	return res;
+}
+
 /* Opens a local file or HTTP URL for reading */
-static Reader *_reader_open(const char *url, int max_redirects)
+static Reader *_reader_open(const char *url, int max_redirects, ReaderCancelCallback cancelled, void *udata)
 {
 	Reader *r = malloc(sizeof(Reader));
 	if (r) {
 		r->eof = 0;
 		r->file = NULL;
+		r->map = NULL;
+		r->map_data = NULL;
 		r->sockfd = 0;
 		r->seekable = 0;
 		r->buf = NULL;
 		r->buf_size = 0;
 		r->buf_data_size = 0;
+		r->peek_buf = NULL;
+		r->peek_buf_size = 0;
 		r->file_size = 0;
 		r->is_ready = 0;
+		r->wakeups = 0;
 		r->stream_pos = 0;
+		r->http_host = NULL;
+		r->http_path = NULL;
+		r->http_port = 0;
+		r->rb_http.buffer = NULL;
+		r->recv_pos = 0;
+		r->closing = 0;
+		r->cancelled = cancelled;
+		r->cancel_udata = udata;
+		r->thread_running = 0;
+		r->cache = NULL;
+		r->http_status = 0;
+		r->bitrate = 0;
+		memset(&(r->stats), 0, sizeof(ReaderStats));
+		r->window_start = 0;
+		r->last_data = 0;
+		r->window_bytes = 0;
+		r->rate_samples = 0;
+		r->stats_published = 0;
 		pthread_mutex_init(&(r->mutex), NULL);
+		pthread_cond_init_monotonic(&(r->cond));
+		pthread_cond_init_monotonic(&(r->space_cond));
 
 		r->streaminfo = cfg_init();
 
@@ -165,182 +1122,56 @@ static Reader *_reader_open(const char *url, int max_redirects)
 			/* open http stream... */
 			/* 1) Split URL into host, port and path */
 			http_url_split_alloc(url, &hostname, &port, &path);
-			/* 2) open connection to host on port */
+			r->http_host = hostname;
+			r->http_path = path;
+			r->http_port = port;
+			/* 2) open connection to host on port and request the resource */
 			assign_signal_handler(SIGPIPE, SIG_IGN);
 			wdprintf(V_INFO, "reader", "Opening connection to host %s on port %d. Reading from %s.\n", hostname, port, path);
-			if (hostname && path && port > 0) {
-				struct addrinfo hints, *servinfo, *p;
-				int    rv;
-				char   s[INET6_ADDRSTRLEN];
-				char   port_str[6];
-
-				snprintf(port_str, 5, "%d", port);
-				memset(&hints, 0, sizeof hints);
-				hints.ai_family = AF_UNSPEC;
-				hints.ai_socktype = SOCK_STREAM;
-
-				if ((rv = getaddrinfo(hostname, port_str, &hints, &servinfo)) != 0) {
-					wdprintf(V_ERROR, "reader",  "getaddrinfo: %s\n", gai_strerror(rv));
-					free(r);
-					r = NULL;
-				} else {
-					int err = 0;
-					int flags = 0;
-					/* loop through all the results and connect to the first we can */
-					for (p = servinfo; p != NULL; p = p->ai_next) {
-						if ((r->sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
-							wdprintf(V_INFO, "reader", "socket: %s\n", strerror(errno));
-							continue;
-						} else { /* Set socket timeout to 2 seconds */
-							struct timeval tv;
-							tv.tv_sec = 2;
-							tv.tv_usec = 0;
-							if (setsockopt(r->sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv,  sizeof tv)) {
-								wdprintf(V_INFO, "reader", "setsockopt: %s\n", strerror(errno));
-							}
-						}
-
-						flags = fcntl(r->sockfd, F_GETFL, 0);
-						fcntl(r->sockfd, F_SETFL, flags | O_NONBLOCK);
-						if (connect(r->sockfd, p->ai_addr, p->ai_addrlen) == -1) {
-							err = errno;
-							wdprintf(V_INFO, "reader", "connect: %s\n", strerror(err));
-							if (err == EINPROGRESS) {
-								wdprintf(V_DEBUG, "reader", "Connection okay; continuing...\n");
-								break;
-							} else {
-								wdprintf(V_DEBUG, "reader", "Connection unusable; closing.\n");
-								close(r->sockfd);
-							}
-							continue;
-						}
-						break;
-					}
+			if (!hostname || !path || port <= 0) {
+				reader_close(r);
+				r = NULL;
+			} else if (!ringbuffer_init(&(r->rb_http), http_cache_size)) {
+				wdprintf(V_ERROR, "reader", "Out of memory.\n");
+				reader_close(r);
+				r = NULL;
+			} else if ((r->sockfd = http_request(r, 0, r->streaminfo, cancelled, udata)) < 0) {
+				char *cached_path = is_cancelled(cancelled, udata) ? NULL : disk_cache_get_file_alloc(url, NULL, NULL, 0);
 
-					if (err == EINPROGRESS) {
-						fd_set myset;
-						struct timeval tv; 
-
-						wdprintf(V_DEBUG, "reader", "Connection in progress. select()ing...\n");
-						do {
-							int res;
-
-							tv.tv_sec = 5; 
-							tv.tv_usec = 0; 
-							FD_ZERO(&myset); 
-							FD_SET(r->sockfd, &myset); 
-							res = select((r->sockfd)+1, NULL, &myset, NULL, &tv); 
-							if (res < 0 && errno != EINTR) {
-								wdprintf(V_DEBUG, "reader", "Error while connecting: %d - %s\n", errno, strerror(errno));
-								break;
-							} else if (res > 0) {
-								int valopt = 0;
-								socklen_t lon = sizeof(int);
-								if (getsockopt(r->sockfd, SOL_SOCKET, SO_ERROR, (void*)(&valopt), &lon) < 0) {
-									wdprintf(V_DEBUG, "reader", "Error in getsockopt(): %d - %s\n", errno, strerror(errno));
-									p = NULL;
-									break;
-								}
-								if (valopt) {
-									wdprintf(V_DEBUG, "reader", "Error in delayed connection(): %d - %s\n", valopt, strerror(valopt));
-									p = NULL;
-								}
-								break;
-							} else {
-								wdprintf(V_DEBUG, "reader", "Timeout in select() - Cancelling!\n");
-								p = NULL;
-								break;
-							}
-						} while (1);
-						flags = fcntl(r->sockfd, F_GETFL, 0);
-						fcntl(r->sockfd, F_SETFL, flags & (~O_NONBLOCK));
-					}
+				r->sockfd = 0;
+				/* Fall back to the cached copy when the server cannot be reached */
+				if (cached_path && local_file_open(r, cached_path)) {
+					wdprintf(V_INFO, "reader", "Server unavailable. Reading %s from the disk cache.\n", url);
+				} else {
+					reader_close(r);
+					r = NULL;
+				}
+				free(cached_path);
+			} else {
+				char *val = cfg_get_key_value_ignore_case(r->streaminfo, "Content-Length");
 
-					if (p == NULL) {
-						wdprintf(V_ERROR, "reader", "Failed to connect.\n");
-						free(r);
-						r = NULL;
-					} else {
-						inet_ntop(p->ai_family, get_in_addr((struct sockaddr *)p->ai_addr), s, sizeof s);
-						wdprintf(V_INFO, "reader", "Connected to %s:%d.\n", s, port);
-						/* Send HTTP GET request */
-						{
-							char http_request[512];
-							snprintf(http_request, 511,
-							         "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\nUser-Agent: Gmu/%s\r\nIcy-MetaData: 1\r\n\r\n",
-							         path, hostname, VERSION_NUMBER);
-							wdprintf(V_DEBUG, "reader", "Sending request: %s\n", http_request);
-							send(r->sockfd, http_request, strlen(http_request), 0);
-						}
-
-						/* Start reader thread... */
-						if (ringbuffer_init(&(r->rb_http), http_cache_size)) {
-							pthread_create_with_stack_size(&(r->thread), DEFAULT_THREAD_STACK_SIZE, http_reader_thread, r);
-						} else {
-							wdprintf(V_ERROR, "reader", "Out of memory.\n");
-						}
-
-						/* Skip http response header */
-						{
-							int    header_end_found = 0;
-							size_t cnt = 0, i = 0;
-							char   ch, key[256], value[512];
-
-							key[0] = '\0'; value[0] = '\0';
-							/* Search for http header end sequence "\r\n\r\n" (or "\n\n"); I assume http headers to be no longer than 32 kB. */
-							while (!header_end_found && !reader_is_eof(r) && cnt < 32768) {
-								/* extract key */
-								ch = 0;
-								while (ch != '\r' && ch != '\n' && ch != ':' && !reader_is_eof(r)) {
-									ch = reader_read_byte(r);
-									if (i < 255 && ch != ':' && ch != '=' && ch != '\r' && ch != '\n') key[i++] = ch;
-									cnt++;
-								}
-								key[i] = '\0';
-								wdprintf(V_DEBUG, "reader", "key=[%s]\n", key);
-
-								/* extract value */
-								i = 0;
-								while ((ch = reader_read_byte(r)) == ' ' && !reader_is_eof(r)) cnt++; /* skip spaces after ":" */
-								if (ch != '\r' && ch != '\n') value[i++] = ch;
-								while (ch != '\r' && ch != '\n' && !reader_is_eof(r)) {
-									ch = reader_read_byte(r);
-									if (i < 511 && ch != '\r' && ch != '\n') value[i++] = ch;
-									cnt++;
-								}
-								value[i] = '\0';
-								wdprintf(V_DEBUG, "reader", "value=[%s]\n", value);
-								if (key[0] && value[0])
-									cfg_add_key(r->streaminfo, key, value);
-
-								i = 0;
-								if (ch == '\n' || (ch = reader_read_byte(r)) == '\n') {
-									ch = reader_read_byte(r);
-									if ((ch == '\r' && (ch = reader_read_byte(r)) == '\n') || ch == '\n')
-										header_end_found = 1;
-									else
-										key[i++] = ch;
-									cnt+=3;
-								} else {
-									key[i++] = ch;
-								}
-							}
-							wdprintf(V_DEBUG, "reader", "HTTP header skipped: %s (%d bytes)\n", header_end_found ? "yes" : "no", cnt);
-							/* Try to figure out stream length */
-							if (header_end_found) {
-								char *val = cfg_get_key_value_ignore_case(r->streaminfo, "Content-Length");
-								if (val) {
-									r->file_size = atol(val);
-									wdprintf(V_DEBUG, "reader", "Stream size = %d bytes.\n", r->file_size);
-								}
-							}
-						}
-					}
-					freeaddrinfo(servinfo);
+				/* Try to figure out stream length */
+				if (val) {
+					r->file_size = atol(val);
+					wdprintf(V_DEBUG, "reader", "Stream size = %d bytes.\n", r->file_size);
+				}
+				/* Shoutcast/Icecast servers announce the bitrate in kbit/s */
+				val = cfg_get_key_value_ignore_case(r->streaminfo, "icy-br");
+				if (val && atoi(val) > 0) r->bitrate = atoi(val) * 1000;
+				/* Seeking and resuming need range requests */
+				val = cfg_get_key_value_ignore_case(r->streaminfo, "Accept-Ranges");
+				if (r->file_size > 0 && val && strncasecmp(val, "bytes", 5) == 0) {
+					wdprintf(V_DEBUG, "reader", "Server supports range requests.\n");
+					r->seekable = 1;
+				}
+				/* 3) Start reader thread, unless the file is in the disk cache */
+				if (!http_use_disk_cache(r, url)) {
+					if (pthread_create_with_stack_size(&(r->thread), DEFAULT_THREAD_STACK_SIZE, http_reader_thread, r) == 0)
+						r->thread_running = 1;
+					else
+						r->eof = 1;
 				}
 			}
-			if (hostname) free(hostname);
-			if (path)     free(path);
 			/* Check for 302 redirect (Location) */
 			if (r) {
 				char *v = cfg_get_key_value_ignore_case(r->streaminfo, "Location");
@@ -356,7 +1187,7 @@ static Reader *_reader_open(const char *url, int max_redirects)
 					reader_close(r);
 					r = NULL;
 					if (max_redirects > 0 && vc) {
-						r = _reader_open(vc, max_redirects-1);
+						r = _reader_open(vc, max_redirects-1, cancelled, udata);
 					} else {
 						wdprintf(V_WARNING, "reader", "Too many HTTP redirects.\n");
 					}
@@ -365,18 +1196,9 @@ static Reader *_reader_open(const char *url, int max_redirects)
 			}
 		} else { /* Treat everything else as a local file (for now) */
 			wdprintf(V_INFO, "reader", "Opening file %s.\n", url);
-			r->file = fopen(url, "r");
-			if (r->file) {
-				struct stat st;
-				r->seekable = 1;
-				if (stat(url, &st) == 0) {
-					r->file_size = st.st_size;
-					wdprintf(V_DEBUG, "reader", "File size = %d bytes.\n", r->file_size);
-				}
-				r->is_ready = 1;
-			} else {
+			if (!local_file_open(r, url)) {
 				wdprintf(V_ERROR, "reader", "Unable to open file '%s'.\n", url);
-				free(r);
+				reader_close(r);
 				r = NULL;
 			}
 		}
@@ -386,25 +1208,37 @@ static Reader *_reader_open(const char *url, int max_redirects)
 
 Reader *reader_open(const char *url)
 {
-	return _reader_open(url, 3);
+	return _reader_open(url, 3, NULL, NULL);
+}
+
+Reader *reader_open_cancellable(const char *url, ReaderCancelCallback cancelled, void *udata)
+{
+	return _reader_open(url, 3, cancelled, udata);
 }
 
 int reader_close(Reader *r)
 {
 	if (r) {
-		if (r->file) { /* local file */
+		if (r->map) { /* mapped local file */
+			munmap(r->map, r->file_size);
+		} else if (r->file) { /* local file */
 			fclose(r->file);
-		} else if (r->sockfd > 0) { /* http stream */
-			/* close http stream */
-			close(r->sockfd);
-			r->eof = 1;
-			wdprintf(V_DEBUG, "reader", "Waiting for reader thread to finish.\n");
-			pthread_join(r->thread, NULL);
-			wdprintf(V_DEBUG, "reader", "Reader thread joined.\n");
-			ringbuffer_free(&(r->rb_http));
 		}
+		if (r->http_host) { /* http stream, possibly read from the disk cache */
+			http_stop_thread(r);
+			wdprintf(V_DEBUG, "reader", "Received %lu bytes/s (jitter: %lu), %d stalls, %d refills.\n",
+			         r->stats.rate, r->stats.jitter, r->stats.stalls, r->stats.refills);
+			if (r->sockfd > 0) close(r->sockfd);
+			disk_cache_writer_close(r->cache);
+		}
+		ringbuffer_free(&(r->rb_http));
+		if (r->http_host) free(r->http_host);
+		if (r->http_path) free(r->http_path);
+		pthread_cond_destroy(&(r->space_cond));
+		pthread_cond_destroy(&(r->cond));
 		pthread_mutex_destroy(&(r->mutex));
 		if (r->buf) free(r->buf);
+		free(r->peek_buf);
 		cfg_free(r->streaminfo);
 		free(r);
 		r = NULL;
@@ -414,27 +1248,23 @@ int reader_close(Reader *r)
 
 int reader_is_eof(Reader *r)
 {
-	return r->file ? r->eof : ringbuffer_get_fill(&(r->rb_http)) > 0 ? 0 : r->eof;
+	return r->file || r->map ? r->eof : ringbuffer_get_fill(&(r->rb_http)) > 0 ? 0 : r->eof;
 }
 
 char reader_read_byte(Reader *r)
 {
 	int ch = 0;
-	if (r->file) {
+	if (r->map) {
+		if (r->stream_pos < (unsigned long)r->file_size)
+			ch = r->map[r->stream_pos++];
+		else
+			r->eof = 1;
+	} else if (r->file) {
 		ch = fgetc(r->file);
 		if (ch == EOF) r->eof = 1;
 	} else {
-		int read_okay = 0;
-		while (!read_okay && !reader_is_eof(r)) {
-			char buf[1];
-			pthread_mutex_lock(&(r->mutex));
-			read_okay = ringbuffer_read(&(r->rb_http), buf, 1);
-			pthread_mutex_unlock(&(r->mutex));
-			if (!read_okay && r->eof) break;
-			if (!read_okay) usleep(150);
-			ch = buf[0];
-		}
-		if (read_okay) r->stream_pos++;
+		char c;
+		if (http_read(r, &c, 1) == 1) ch = c;
 	}
 	return (char)ch;
 }
@@ -448,7 +1278,16 @@ int reader_read_bytes(Reader *r, size_t size)
 {
 	int read_okay = 0;
 
-	if (size > 0) {
+	if (size > 0 && r->map) {
+		size_t avail = r->stream_pos < (unsigned long)r->file_size ? r->file_size - r->stream_pos : 0;
+
+		/* Like fread(): a short read returns the rest, the next read hits EOF */
+		if (size > avail) size = avail;
+		r->map_data = r->map + r->stream_pos;
+		r->buf_data_size = size;
+		r->stream_pos += size;
+		if (size > 0) read_okay = 1; else r->eof = 1;
+	} else if (size > 0) {
 		if (size > r->buf_size) r->buf = realloc(r->buf, size+1);
 		if (r->buf) r->buf_size = size;
 		if (r->file) {
@@ -474,16 +1313,10 @@ int reader_read_bytes(Reader *r, size_t size)
 					r->stream_pos += size;
 				}
 			}
-		} else {
-			while (!read_okay) {
-				pthread_mutex_lock(&(r->mutex));
-				read_okay = ringbuffer_read(&(r->rb_http), r->buf, size);
-				pthread_mutex_unlock(&(r->mutex));
-				if (read_okay) r->buf_data_size = size; else r->buf_data_size = 0;
-				if (!read_okay && r->eof) break;
-				r->buf[size] = '\0';
-				if (!read_okay) usleep(150);
-			}
+		} else if (r->buf) {
+			r->buf_data_size = http_read(r, r->buf, size);
+			r->buf[r->buf_data_size] = '\0';
+			read_okay = r->buf_data_size > 0;
 		}
 	}
 	return read_okay;
@@ -491,7 +1324,7 @@ int reader_read_bytes(Reader *r, size_t size)
 
 char *reader_get_buffer(Reader *r)
 {
-	return r->buf;
+	return r->map ? r->map_data : r->buf;
 }
 
 long reader_get_file_size(Reader *r)
@@ -504,14 +1337,123 @@ unsigned long reader_get_stream_position(Reader *r)
 	return r->stream_pos;
 }
 
+/* Makes sure the peek buffer holds at least size bytes */
+static char *peek_buffer(Reader *r, size_t size)
+{
+	if (size > r->peek_buf_size) {
+		char *buf = realloc(r->peek_buf, size);
+
+		if (!buf) return NULL;
+		r->peek_buf = buf;
+		r->peek_buf_size = size;
+	}
+	return r->peek_buf;
+}
+
+/* Copies data of an HTTP stream from the last read and the stream buffer */
+static const char *http_peek(Reader *r, unsigned long offset, size_t size)
+{
+	unsigned long  start = r->stream_pos - r->buf_data_size, end = offset + size;
+	char          *buf = NULL;
+
+	if (offset < start) return NULL;
+	/* Within the data of the last read, which is the common case */
+	if (end <= r->stream_pos) return r->buf + (offset - start);
+	pthread_mutex_lock(&(r->mutex));
+	if (end <= r->stream_pos + ringbuffer_get_fill(&(r->rb_http)) && (buf = peek_buffer(r, end - start))) {
+		size_t from_buf = r->stream_pos - start;
+
+		memcpy(buf, r->buf, from_buf);
+		ringbuffer_set_unread_pos(&(r->rb_http));
+		ringbuffer_read(&(r->rb_http), buf + from_buf, end - r->stream_pos);
+		ringbuffer_unread(&(r->rb_http));
+		buf += offset - start;
+	}
+	pthread_mutex_unlock(&(r->mutex));
+	return buf;
+}
+
+const char *reader_peek(Reader *r, unsigned long offset, size_t size)
+{
+	const char *data = NULL;
+
+	if (r->map) {
+		if (offset + size <= (unsigned long)r->file_size) data = r->map + offset;
+	} else if (r->file) {
+		char *buf = peek_buffer(r, size);
+
+		if (buf && pread(fileno(r->file), buf, size, offset) == (ssize_t)size) data = buf;
+	} else if (r->rb_http.buffer && r->buf) {
+		data = http_peek(r, offset, size);
+	}
+	return data;
+}
+
+/**
+ * Moves an HTTP stream to the byte offset pos. Data that has already been
+ * buffered is skipped, otherwise the data is requested anew from pos on.
+ * Returns 1 on success, 0 otherwise.
+ */
+static int http_seek(Reader *r, unsigned long pos)
+{
+	ConfigFile *info;
+	int         sockfd = -1;
+
+	pthread_mutex_lock(&(r->mutex));
+	if (pos >= r->stream_pos && pos - r->stream_pos <= ringbuffer_get_fill(&(r->rb_http))) {
+		char tmp[4096];
+
+		while (r->stream_pos < pos) {
+			size_t n = pos - r->stream_pos < sizeof(tmp) ? pos - r->stream_pos : sizeof(tmp);
+			ringbuffer_read(&(r->rb_http), tmp, n);
+			r->stream_pos += n;
+		}
+		r->buf_data_size = 0;
+		pthread_cond_signal(&(r->space_cond));
+		pthread_mutex_unlock(&(r->mutex));
+		return 1;
+	}
+	pthread_mutex_unlock(&(r->mutex));
+
+	http_stop_thread(r);
+	if (r->sockfd > 0) close(r->sockfd);
+	r->sockfd = 0;
+	ringbuffer_clear(&(r->rb_http));
+	r->buf_data_size = 0;
+	r->stream_pos = r->recv_pos = pos;
+	r->closing = 0;
+	if (pos >= (unsigned long)r->file_size) return 1; /* Nothing left to be read; eof is set */
+	r->eof = 0;
+	wdprintf(V_DEBUG, "reader", "Requesting data from byte %lu on.\n", pos);
+	if ((info = cfg_init())) {
+		sockfd = http_request(r, pos, info, seek_cancelled, r);
+		cfg_free(info);
+	}
+	if (sockfd >= 0) {
+		r->sockfd = sockfd;
+		if (pthread_create_with_stack_size(&(r->thread), DEFAULT_THREAD_STACK_SIZE, http_reader_thread, r) == 0) {
+			r->thread_running = 1;
+			return 1;
+		}
+	}
+	r->eof = 1;
+	return 0;
+}
+
 /* Resets the stream to the beginning (if possible), returns 1 on success, 0 otherwise */
 int reader_reset_stream(Reader *r)
 {
 	int res = 0;
-	if (r->file) { /* Only possible for local files */
+	if (r->map) {
+		r->stream_pos = 0;
+		r->eof = 0;
+		res = 1;
+	} else if (r->file) {
 		rewind(r->file);
 		r->stream_pos = 0;
 		res = 1;
+	} else if (r->seekable) { /* HTTP streams with range support */
+		res = http_seek(r, 0);
 	}
 	return res;
 }
@@ -524,7 +1466,19 @@ int reader_is_seekable(Reader *r)
 int reader_seek_whence(Reader *r, long byte_offset, int whence)
 {
 	int res = 0;
-	if (r->file) {
+	if (r->map) {
+		long pos = whence == SEEK_CUR ? (long)r->stream_pos + byte_offset :
+		           whence == SEEK_END ? r->file_size + byte_offset : byte_offset;
+
+		if (pos >= 0 && pos <= r->file_size) {
+			r->buf_data_size = 0;
+			r->stream_pos = pos;
+			r->eof = 0;
+			res = 1;
+		} else {
+			wdprintf(V_INFO, "reader", "Seeking failed. :(\n");
+		}
+	} else if (r->file) {
 		if (fseek(r->file, byte_offset, whence) == 0) {
 			r->buf_data_size = 0;
 			r->stream_pos = ftell(r->file);
@@ -532,9 +1486,11 @@ int reader_seek_whence(Reader *r, long byte_offset, int whence)
 		} else {
 			wdprintf(V_INFO, "reader", "Seeking failed. :(\n");
 		}
-	} else {
-		/* Seeking not possible in HTTP streams */
-		res = 0;
+	} else if (r->seekable) { /* HTTP streams with range support */
+		long pos = whence == SEEK_CUR ? (long)r->stream_pos + byte_offset :
+		           whence == SEEK_END ? r->file_size + byte_offset : byte_offset;
+
+		if (pos >= 0 && pos <= r->file_size) res = http_seek(r, pos);
 	}
 	return res;
 }
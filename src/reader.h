@@ -20,43 +20,100 @@
 #include <pthread.h>
 #include "ringbuffer.h"
 #include "wejconfig.h"
+#include "diskcache.h"
 
 #define HTTP_CACHE_SIZE_MIN_KB 256
 #define HTTP_CACHE_SIZE_MAX_KB 4096
 
+/* Statistics of an HTTP stream's reception */
+typedef struct _ReaderStats
+{
+	unsigned long rate;             /* Receive rate in bytes per second, 0 until measured */
+	unsigned long jitter;           /* Mean deviation of the receive rate in bytes per second */
+	int           stalls;           /* Number of times no data arrived for a while */
+	int           refills;          /* Number of reads that had to wait for data after prebuffering */
+	size_t        prebuffer_target; /* Amount of data buffered before the stream is ready */
+	size_t        buffer_size;
+} ReaderStats;
+
+/* Returns non-zero when a blocking reader_open_cancellable() should give up */
+typedef int (*ReaderCancelCallback)(void *udata);
+
 typedef struct
 {
 	FILE           *file;
+	char           *map;       /* Memory mapped local file, used instead of file when possible */
+	char           *map_data;  /* Data of the last read from the mapped file */
 	int             eof;
 	int             seekable;
 	long            file_size;
 
 	int             sockfd;
+	char           *http_host, *http_path;
+	int             http_port;
+	int             http_status;    /* Status code of the response for the beginning of the file */
+	unsigned long   recv_pos;       /* Stream offset of the next byte to be received */
+	int             closing;        /* Tells the reader thread to stop */
+	ReaderCancelCallback cancelled; /* Cancel callback given on opening, also used for seeking */
+	void           *cancel_udata;
+	int             thread_running;
+	DiskCacheWriter *cache;         /* Writes the received data to the disk cache, if enabled */
+	int             bitrate;        /* Stream bitrate in bits per second, 0 if unknown */
+	ReaderStats     stats;
+	long            window_start;   /* Start of the current rate measurement, 0 if none */
+	long            last_data;      /* Time data has been received last, 0 if none */
+	unsigned long   window_bytes;
+	int             rate_samples;
+	long            stats_published;
 
 	char           *buf; /* Dynamic read buffer */
 	size_t          buf_size;
 	size_t          buf_data_size;
+	char           *peek_buf; /* Buffer for reader_peek() */
+	size_t          peek_buf_size;
 
 	ConfigFile     *streaminfo;
 
 	RingBuffer      rb_http;
 	pthread_mutex_t mutex;
+	pthread_cond_t  cond;       /* Signalled when data arrives or the stream ends */
+	pthread_cond_t  space_cond; /* Signalled when data has been consumed or the reader is closed */
 	pthread_t       thread;
 
 	unsigned long   stream_pos;
 
 	int             is_ready;
+	int             wakeups;
 } Reader;
 
 /* Opens a local file or HTTP URL for reading */
 int     reader_set_cache_size_kb(size_t size, size_t prebuffer_size);
 int     reader_get_cache_fill(Reader *r);
 Reader *reader_open(const char *url);
+/* Like reader_open(), but name resolution, connecting and waiting for the
+ * server's response are given up as soon as cancelled() returns non-zero.
+ * Returns NULL in that case. The same applies to the new requests made
+ * when seeking in an HTTP stream, so cancelled() must remain valid until
+ * the reader is closed. */
+Reader *reader_open_cancellable(const char *url, ReaderCancelCallback cancelled, void *udata);
 int     reader_close(Reader *r);
 int     reader_is_ready(Reader *r);
+/* Waits until the prebuffer has been filled, the stream has ended, at most
+ * timeout_ms milliseconds or until reader_wake() is called. Returns
+ * reader_is_ready(). */
+int     reader_wait_prebuffer(Reader *r, int timeout_ms);
+void    reader_wake(Reader *r);
+/* Tells the reader the stream's bitrate (in bits per second), which
+ * determines how much data needs to be prebuffered */
+void    reader_set_bitrate(Reader *r, int bitrate);
+/* Gets the reception statistics of an HTTP stream. They are also
+ * published in r->streaminfo (X-Gmu-* keys) while the stream is read. */
+void    reader_get_stats(Reader *r, ReaderStats *stats);
 int     reader_is_eof(Reader *r);
 char    reader_read_byte(Reader *r);
 int     reader_read_bytes(Reader *r, size_t size);
+/* Returns the data of the last reader_read_bytes() call. For mapped local
+ * files this points into the mapping and must not be written to. */
 char   *reader_get_buffer(Reader *r);
 size_t  reader_get_number_of_bytes_in_buffer(Reader *r);
 /* Resets the stream to the beginning (if possible), returns 1 on success, 0 otherwise */
@@ -66,6 +123,13 @@ int     reader_seek_whence(Reader *r, long byte_offset, int whence);
 int     reader_seek(Reader *r, long byte_offset);
 long    reader_get_file_size(Reader *r);
 unsigned long reader_get_stream_position(Reader *r);
+/* Returns size bytes from the given offset without changing the stream
+ * position or the data of the last read, or NULL if they are not
+ * available. Local files can be peeked at anywhere, without copying when
+ * they are mapped. HTTP streams can only be peeked at from the start of
+ * the last read up to the end of the buffered data. The data is valid
+ * until the next read or peek. */
+const char *reader_peek(Reader *r, unsigned long offset, size_t size);
 /* Sets number of bytes in buffer to 0 */
 void    reader_clear_buffer(Reader *r);
 #endif
@@ -0,0 +1,255 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: resampler.c  Created: 261016
+ *
+ * Description: Polyphase windowed-sinc sample rate converter
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "resampler.h"
+#include "debug.h"
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLER_SSE2 1
+#endif
+
+#define RESAMPLER_MAX_PHASES 1024
+#define RESAMPLER_MAX_TAPS   128
+#define RESAMPLER_CHUNK      4096 /* Input frames processed at once */
+
+static unsigned long gcd(unsigned long a, unsigned long b)
+{
+	while (b) {
+		unsigned long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Dot product of taps (multiple of 8) samples and Q14 coefficients */
+static int32_t dot_s16(const int16_t *x, const int16_t *c, int taps)
+{
+	int32_t res = 0;
+	int     k;
+
+#if defined(RESAMPLER_SSE2)
+	__m128i acc = _mm_setzero_si128();
+
+	for (k = 0; k < taps; k += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(x + k)),
+		                                        _mm_loadu_si128((const __m128i *)(c + k))));
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+	res = _mm_cvtsi128_si32(acc);
+#elif defined(RESAMPLER_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+	int32x2_t sum;
+
+	for (k = 0; k < taps; k += 4)
+		acc = vmlal_s16(acc, vld1_s16(x + k), vld1_s16(c + k));
+	sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	res = vget_lane_s32(vpadd_s32(sum, sum), 0);
+#else
+	for (k = 0; k < taps; k++)
+		res += x[k] * c[k];
+#endif
+	return res;
+}
+
+/* Windowed sinc (Blackman window) with cutoff fc (relative to the input
+ * Nyquist frequency) at distance d from the center, half_width input samples wide */
+static double kernel(double d, double fc, double half_width)
+{
+	double x = fc * d, s, w;
+
+	s = (x > -1e-9 && x < 1e-9) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+	w = 0.42 + 0.5 * cos(M_PI * d / half_width) + 0.08 * cos(2.0 * M_PI * d / half_width);
+	return fc * s * w;
+}
+
+static int build_filter(Resampler *rs)
+{
+	static const int    base_taps[] = { 8, 16, 32 };
+	static const double rolloff[]   = { 0.80, 0.90, 0.95 };
+	double fc = rolloff[rs->quality];
+	int    taps = base_taps[rs->quality], p;
+
+	/* When downsampling, the cutoff has to be lowered and the filter has to
+	 * be longer (in input samples) to keep the same transition band */
+	if (rs->out_rate < rs->in_rate) {
+		fc   = fc * rs->out_rate / rs->in_rate;
+		taps = (int)((long)taps * rs->in_rate / rs->out_rate);
+	}
+	taps = (taps + 7) & ~7;
+	if (taps > RESAMPLER_MAX_TAPS) taps = RESAMPLER_MAX_TAPS;
+	rs->taps   = taps;
+	rs->phases = rs->phases_total <= RESAMPLER_MAX_PHASES ? (int)rs->phases_total : RESAMPLER_MAX_PHASES;
+	rs->coeffs = malloc(sizeof(int16_t) * rs->phases * taps);
+	if (rs->coeffs) {
+		for (p = 0; p < rs->phases; p++) {
+			double   c[RESAMPLER_MAX_TAPS], sum = 0.0, f = (double)p / rs->phases;
+			int      k;
+			int16_t *row = rs->coeffs + p * taps;
+
+			for (k = 0; k < taps; k++) {
+				c[k] = kernel(taps / 2 - 1 - k + f, fc, taps / 2);
+				sum += c[k];
+			}
+			for (k = 0; k < taps; k++) /* Normalize for unity gain */
+				row[k] = (int16_t)floor(c[k] / sum * 16384.0 + 0.5);
+		}
+	}
+	return rs->coeffs ? 1 : 0;
+}
+
+void resampler_reset(Resampler *rs)
+{
+	int c;
+
+	/* Prefill the history, so that the first output frame is centered on the first input frame */
+	rs->hist_frames = rs->taps / 2 - 1;
+	for (c = 0; c < rs->channels; c++)
+		if (rs->hist[c]) memset(rs->hist[c], 0, sizeof(int16_t) * rs->hist_frames);
+	rs->pos     = 0;
+	rs->frac    = 0;
+	rs->flushed = 0;
+}
+
+int resampler_init(Resampler *rs, int in_rate, int out_rate, int channels, ResamplerQuality quality)
+{
+	int res = 0;
+
+	if (in_rate > 0 && out_rate > 0 && channels > 0 && channels <= RESAMPLER_MAX_CHANNELS) {
+		if (!rs->coeffs || rs->in_rate != in_rate || rs->out_rate != out_rate ||
+		    rs->channels != channels || rs->quality != quality) {
+			unsigned long g = gcd(in_rate, out_rate);
+			int           c;
+
+			resampler_free(rs);
+			rs->in_rate      = in_rate;
+			rs->out_rate     = out_rate;
+			rs->channels     = channels;
+			rs->quality      = quality;
+			rs->step         = in_rate / g;
+			rs->phases_total = out_rate / g;
+			if (build_filter(rs)) {
+				rs->hist_size = rs->taps + RESAMPLER_CHUNK;
+				res = 1;
+				for (c = 0; c < channels; c++) {
+					rs->hist[c] = malloc(sizeof(int16_t) * rs->hist_size);
+					if (!rs->hist[c]) res = 0;
+				}
+			}
+			if (res)
+				wdprintf(V_DEBUG, "resampler", "%d Hz -> %d Hz: %d phases, %d taps\n",
+				         in_rate, out_rate, rs->phases, rs->taps);
+			else
+				resampler_free(rs);
+		} else {
+			res = 1;
+		}
+		if (res) resampler_reset(rs);
+	}
+	return res;
+}
+
+void resampler_free(Resampler *rs)
+{
+	int c;
+
+	if (rs->coeffs) free(rs->coeffs);
+	rs->coeffs = NULL;
+	for (c = 0; c < RESAMPLER_MAX_CHANNELS; c++) {
+		if (rs->hist[c]) free(rs->hist[c]);
+		rs->hist[c] = NULL;
+	}
+}
+
+size_t resampler_get_max_output_frames(Resampler *rs, size_t in_frames)
+{
+	return (size_t)((double)(in_frames + rs->hist_frames + rs->taps) * rs->phases_total / rs->step) + 2;
+}
+
+/* Computes all output frames possible with the current history and discards consumed input */
+static size_t run_filter(Resampler *rs, int16_t *out)
+{
+	size_t o = 0, discard;
+	int    c;
+
+	while (rs->pos + rs->taps <= rs->hist_frames) {
+		int            phase = rs->phases == (int)rs->phases_total ?
+		                       (int)rs->frac : (int)((double)rs->frac * rs->phases / rs->phases_total);
+		const int16_t *coeffs = rs->coeffs + phase * rs->taps;
+
+		for (c = 0; c < rs->channels; c++) {
+			int32_t v = (dot_s16(rs->hist[c] + rs->pos, coeffs, rs->taps) + 8192) >> 14;
+			out[o * rs->channels + c] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+		}
+		o++;
+		rs->frac += rs->step;
+		rs->pos  += rs->frac / rs->phases_total;
+		rs->frac %= rs->phases_total;
+	}
+	discard = rs->pos < rs->hist_frames ? rs->pos : rs->hist_frames;
+	if (discard > 0) {
+		for (c = 0; c < rs->channels; c++)
+			memmove(rs->hist[c], rs->hist[c] + discard, sizeof(int16_t) * (rs->hist_frames - discard));
+		rs->hist_frames -= discard;
+		rs->pos         -= discard;
+	}
+	return o;
+}
+
+size_t resampler_process(Resampler *rs, const int16_t *in, size_t in_frames, int16_t *out)
+{
+	size_t o = 0;
+
+	if (in_frames > 0) rs->flushed = 0;
+	while (in_frames > 0) {
+		size_t n = rs->hist_size - rs->hist_frames, i;
+		int    c;
+
+		if (n > in_frames) n = in_frames;
+		for (c = 0; c < rs->channels; c++) {
+			int16_t *h = rs->hist[c] + rs->hist_frames;
+			for (i = 0; i < n; i++)
+				h[i] = in[i * rs->channels + c];
+		}
+		rs->hist_frames += n;
+		in              += n * rs->channels;
+		in_frames       -= n;
+		o += run_filter(rs, out + o * rs->channels);
+	}
+	return o;
+}
+
+size_t resampler_flush(Resampler *rs, int16_t *out)
+{
+	size_t o = 0;
+
+	if (!rs->flushed && rs->coeffs) {
+		size_t n = rs->taps / 2 + 1;
+		int    c;
+
+		for (c = 0; c < rs->channels; c++)
+			memset(rs->hist[c] + rs->hist_frames, 0, sizeof(int16_t) * n);
+		rs->hist_frames += n;
+		o = run_filter(rs, out);
+		rs->flushed = 1;
+	}
+	return o;
+}
@@ -0,0 +1,54 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: resampler.h  Created: 261016
+ *
+ * Description: Polyphase windowed-sinc sample rate converter
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _RESAMPLER_H
+#define _RESAMPLER_H
+#include <sys/types.h>
+#include <stdint.h>
+
+#define RESAMPLER_MAX_CHANNELS 2
+
+typedef enum { RESAMPLER_QUALITY_LOW, RESAMPLER_QUALITY_MEDIUM, RESAMPLER_QUALITY_HIGH } ResamplerQuality;
+
+struct _Resampler
+{
+	int              in_rate, out_rate, channels;
+	ResamplerQuality quality;
+	/* Output sample n is located at input position n * step / phases_total,
+	 * i.e. step = in_rate / gcd, phases_total = out_rate / gcd */
+	unsigned long    step, phases_total, frac;
+	int              phases, taps;
+	int16_t         *coeffs;     /* phases * taps coefficients, Q14 */
+	int16_t         *hist[RESAMPLER_MAX_CHANNELS]; /* Planar input history */
+	size_t           hist_size, hist_frames, pos;
+	int              flushed;
+};
+
+typedef struct _Resampler Resampler;
+
+/* Returns 1 on success, 0 otherwise. The resampler object has to be zeroed
+ * before the first call. When called again with the same rates and
+ * quality, the filter is reused and only the stream state is reset. */
+int    resampler_init(Resampler *rs, int in_rate, int out_rate, int channels, ResamplerQuality quality);
+void   resampler_free(Resampler *rs);
+/* Discards all buffered input, e.g. after seeking */
+void   resampler_reset(Resampler *rs);
+/* Maximum number of output frames resampler_process() can produce for in_frames input frames */
+size_t resampler_get_max_output_frames(Resampler *rs, size_t in_frames);
+/* Converts interleaved 16 bit frames and returns the number of frames written to out */
+size_t resampler_process(Resampler *rs, const int16_t *in, size_t in_frames, int16_t *out);
+/* Outputs the frames still held back by the filter at the end of a stream */
+size_t resampler_flush(Resampler *rs, int16_t *out);
+#endif
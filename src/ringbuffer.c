@@ -38,6 +38,29 @@ void ringbuffer_free(RingBuffer *rb)
 	}
 }
 
+/* Changes the buffer's size, keeping its contents. Fails when the new
+ * size is too small for the contents or memory is short. */
+int ringbuffer_resize(RingBuffer *rb, size_t size)
+{
+	char *buffer = size >= rb->buffer_fill ? (char *)malloc(size) : NULL;
+	int   result = 0;
+
+	if (buffer) {
+		size_t fill = rb->buffer_fill;
+
+		ringbuffer_read(rb, buffer, fill);
+		free(rb->buffer);
+		rb->buffer      = buffer;
+		rb->size        = size;
+		rb->read_ptr    = 0;
+		rb->write_ptr   = fill == size ? 0 : fill;
+		rb->buffer_fill = fill;
+		rb->unread_ptr  = -1;
+		result = 1;
+	}
+	return result;
+}
+
 void ringbuffer_clear(RingBuffer *rb)
 {
 	rb->read_ptr    = 0;
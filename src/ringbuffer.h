@@ -28,6 +28,7 @@ typedef struct _RingBuffer RingBuffer;
 
 int    ringbuffer_init(RingBuffer *rb, size_t size);
 void   ringbuffer_free(RingBuffer *rb);
+int    ringbuffer_resize(RingBuffer *rb, size_t size);
 int    ringbuffer_write(RingBuffer *rb, const char *data, size_t size);
 int    ringbuffer_read(RingBuffer *rb, char *target, size_t size);
 size_t ringbuffer_get_fill(RingBuffer *rb);
@@ -0,0 +1,575 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: tagscan.c  Created: 261016
+ *
+ * Description: Built-in tag and stream header parsers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "tagscan.h"
+#include "reader.h"
+#include "id3.h"
+#include "charset.h"
+#include "debug.h"
+
+#define ID3V1_SIZE       128
+#define APE_FOOTER_SIZE  32
+#define OGG_PACKET_MAX   65536 /* Longer comment packets are only read partially */
+#define OGG_TAIL_SIZE    65536 /* Area at the end searched for the last page */
+#define MPEG_SYNC_RANGE  65536 /* Area searched for the first frame */
+
+static unsigned long get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static unsigned long get_be32(const unsigned char *p)
+{
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static unsigned long long get_le64(const unsigned char *p)
+{
+	return get_le32(p) | ((unsigned long long)get_le32(p + 4) << 32);
+}
+
+static unsigned long long get_be64(const unsigned char *p)
+{
+	return ((unsigned long long)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static const unsigned char *peek(Reader *r, unsigned long offset, size_t size)
+{
+	return (const unsigned char *)reader_peek(r, offset, size);
+}
+
+/* Cuts off an incomplete UTF-8 sequence at the end of str */
+static void utf8_trim(char *str)
+{
+	size_t len = strlen(str), i = len;
+
+	while (i > 0 && len - i < 3 && ((unsigned char)str[i-1] & 0xC0) == 0x80) i--;
+	if (i > 0 && ((unsigned char)str[i-1] & 0xC0) == 0xC0) {
+		unsigned char c = str[i-1];
+		size_t        need = c >= 0xF0 ? 4 : (c >= 0xE0 ? 3 : 2);
+
+		if (len - (i - 1) < need) str[i-1] = '\0';
+	}
+}
+
+/* Stores a tag value as UTF-8, unless target has been set before. Values
+ * that are not valid UTF-8 are taken as ISO-8859-1. */
+static void set_text(char *target, size_t target_size, const char *value, size_t len)
+{
+	char tmp[256];
+
+	if (target[0] || len == 0) return;
+	if (len > sizeof(tmp) - 1) {
+		len = sizeof(tmp) - 1;
+		memcpy(tmp, value, len);
+		tmp[len] = '\0';
+		utf8_trim(tmp);
+	} else {
+		memcpy(tmp, value, len);
+		tmp[len] = '\0';
+	}
+	if (charset_is_valid_utf8_string(tmp)) {
+		strncpy(target, tmp, target_size - 1);
+		target[target_size - 1] = '\0';
+	} else {
+		charset_iso8859_1_to_utf8(target, tmp, target_size - 1);
+	}
+	utf8_trim(target);
+}
+
+static int key_is(const char *key, size_t key_len, const char *name)
+{
+	return strlen(name) == key_len && strncasecmp(key, name, key_len) == 0;
+}
+
+/* Stores a Vorbis comment or APEv2 item by its (case-insensitive) name */
+static void set_field(TrackInfo *ti, const char *key, size_t key_len, const char *value, size_t len)
+{
+	if (key_is(key, key_len, "TITLE"))
+		set_text(ti->title, SIZE_TITLE, value, len);
+	else if (key_is(key, key_len, "ARTIST"))
+		set_text(ti->artist, SIZE_ARTIST, value, len);
+	else if (key_is(key, key_len, "ALBUM"))
+		set_text(ti->album, SIZE_ALBUM, value, len);
+	else if (key_is(key, key_len, "TRACKNUMBER") || key_is(key, key_len, "TRACK"))
+		set_text(ti->tracknr, SIZE_TRACKNR, value, len);
+	else if (key_is(key, key_len, "DATE") || key_is(key, key_len, "YEAR"))
+		set_text(ti->date, SIZE_DATE, value, len);
+	else if (key_is(key, key_len, "COMMENT") || key_is(key, key_len, "DESCRIPTION"))
+		set_text(ti->comment, SIZE_COMMENT, value, len);
+}
+
+/* Parses a Vorbis comment block, as used by Ogg Vorbis, Opus and FLAC */
+static void parse_vorbis_comment(const unsigned char *p, size_t size, TrackInfo *ti)
+{
+	unsigned long len, count;
+	size_t        pos;
+
+	if (size < 8 || (len = get_le32(p)) > size - 8) return;
+	pos   = 4 + len; /* Skip vendor string */
+	count = get_le32(p + pos);
+	pos  += 4;
+	while (count-- > 0 && size - pos >= 4 && (len = get_le32(p + pos)) <= size - pos - 4) {
+		const char *entry = (const char *)p + pos + 4, *eq = memchr(entry, '=', len);
+
+		if (eq) set_field(ti, entry, eq - entry, eq + 1, len - (eq - entry) - 1);
+		pos += 4 + len;
+	}
+}
+
+/* APEv2 tag at the end of the file, optionally followed by an ID3v1 tag.
+ * Returns 1 if a tag has been found. */
+static int scan_apev2(Reader *r, TrackInfo *ti)
+{
+	long                 file_size = reader_get_file_size(r);
+	unsigned long        end = file_size > 0 ? file_size : 0, size, count, pos;
+	const unsigned char *p;
+	int                  result = 0;
+
+	if (end >= ID3V1_SIZE + APE_FOOTER_SIZE && (p = peek(r, end - ID3V1_SIZE, 3)) && memcmp(p, "TAG", 3) == 0)
+		end -= ID3V1_SIZE;
+	if (end < APE_FOOTER_SIZE || !(p = peek(r, end - APE_FOOTER_SIZE, APE_FOOTER_SIZE)) ||
+	    memcmp(p, "APETAGEX", 8) != 0)
+		return 0;
+	size  = get_le32(p + 12); /* Items and footer */
+	count = get_le32(p + 16);
+	if (size <= APE_FOOTER_SIZE || size > end) return 0;
+	size -= APE_FOOTER_SIZE;
+	if (!(p = peek(r, end - APE_FOOTER_SIZE - size, size))) return 0;
+	for (pos = 0; count-- > 0 && size - pos >= 9; ) {
+		unsigned long len = get_le32(p + pos), flags = get_le32(p + pos + 4);
+		const char   *key = (const char *)p + pos + 8, *key_end = memchr(key, '\0', size - pos - 8);
+		unsigned long value_pos;
+
+		if (!key_end) break;
+		value_pos = key_end + 1 - (const char *)p;
+		if (len > size - value_pos) break;
+		if ((flags & 6) == 0) /* UTF-8 text */
+			set_field(ti, key, key_end - key, key_end + 1, len);
+		pos = value_pos + len;
+		result = 1;
+	}
+	return result;
+}
+
+typedef struct _OggScan {
+	Reader        *r;
+	unsigned long  page_offset, page_size, data_pos, serial, page_serial;
+	unsigned char  lacing[255];
+	int            segment, segments, have_serial;
+} OggScan;
+
+static int ogg_load_page(OggScan *s, unsigned long offset)
+{
+	const unsigned char *h = peek(s->r, offset, 27);
+	int                  i;
+
+	if (!h || memcmp(h, "OggS", 4) != 0) return 0;
+	s->page_serial = get_le32(h + 14);
+	s->segments    = h[26];
+	if (s->segments > 0) {
+		if (!(h = peek(s->r, offset + 27, s->segments))) return 0;
+		memcpy(s->lacing, h, s->segments);
+	}
+	s->page_offset = offset;
+	s->page_size   = 27 + s->segments;
+	for (i = 0; i < s->segments; i++) s->page_size += s->lacing[i];
+	s->data_pos = offset + 27 + s->segments;
+	s->segment  = 0;
+	return 1;
+}
+
+/* Reads the next packet of the first logical stream into buf. Packets
+ * longer than max are cut short, so they must be the last ones needed.
+ * Returns 0 when no further packet is available. */
+static int ogg_next_packet(OggScan *s, unsigned char *buf, size_t max, size_t *len)
+{
+	*len = 0;
+	for (;;) {
+		size_t seg, n;
+
+		while (s->segment >= s->segments || s->page_serial != s->serial) {
+			if (!ogg_load_page(s, s->page_offset + s->page_size)) return 0;
+			if (!s->have_serial) {
+				s->serial = s->page_serial;
+				s->have_serial = 1;
+			}
+		}
+		seg = s->lacing[s->segment++];
+		n = seg < max - *len ? seg : max - *len;
+		if (n > 0) {
+			const unsigned char *data = peek(s->r, s->data_pos, n);
+
+			if (!data) return 0;
+			memcpy(buf + *len, data, n);
+			*len += n;
+		}
+		s->data_pos += seg;
+		if (seg < 255 || *len >= max) return 1;
+	}
+}
+
+/* Returns the granule position of the stream's last page, or -1 */
+static long long ogg_last_granule(Reader *r, unsigned long serial, unsigned long file_size)
+{
+	unsigned long        size = file_size < OGG_TAIL_SIZE ? file_size : OGG_TAIL_SIZE;
+	const unsigned char *p = size >= 27 ? peek(r, file_size - size, size) : NULL;
+	long                 i;
+
+	for (i = p ? (long)size - 27 : -1; i >= 0; i--) {
+		if (memcmp(p + i, "OggS", 4) == 0 && get_le32(p + i + 14) == serial) {
+			long long granule = (long long)get_le64(p + i + 6);
+
+			if (granule >= 0) return granule;
+		}
+	}
+	return -1;
+}
+
+static int scan_ogg(Reader *r, TrackInfo *ti)
+{
+	OggScan        s;
+	unsigned char *buf = malloc(OGG_PACKET_MAX);
+	size_t         len;
+	long           rate = 0, preskip = 0, file_size = reader_get_file_size(r);
+	int            result = 0;
+
+	memset(&s, 0, sizeof(OggScan));
+	s.r = r;
+	if (buf && ogg_next_packet(&s, buf, OGG_PACKET_MAX, &len)) {
+		if (len >= 16 && memcmp(buf, "\001vorbis", 7) == 0) {
+			ti->channels = buf[11];
+			rate = get_le32(buf + 12);
+			strncpy(ti->file_type, "Ogg Vorbis", SIZE_FILE_TYPE-1);
+			if (ogg_next_packet(&s, buf, OGG_PACKET_MAX, &len) && len > 7 && memcmp(buf, "\003vorbis", 7) == 0)
+				parse_vorbis_comment(buf + 7, len - 7, ti);
+			result = 1;
+		} else if (len >= 19 && memcmp(buf, "OpusHead", 8) == 0) {
+			/* Opus is always decoded at 48 kHz, granule positions count 48 kHz samples */
+			ti->channels = buf[9];
+			preskip = buf[10] | (buf[11] << 8);
+			rate = 48000;
+			strncpy(ti->file_type, "Opus", SIZE_FILE_TYPE-1);
+			if (ogg_next_packet(&s, buf, OGG_PACKET_MAX, &len) && len > 8 && memcmp(buf, "OpusTags", 8) == 0)
+				parse_vorbis_comment(buf + 8, len - 8, ti);
+			result = 1;
+		}
+	}
+	if (result && rate > 0 && file_size > 0) {
+		long long granule = ogg_last_granule(r, s.serial, file_size);
+
+		ti->samplerate = rate;
+		if (granule > preskip) ti->length = (size_t)((granule - preskip) / rate);
+		if (ti->length > 0) ti->bitrate = (long)((unsigned long long)file_size * 8 / ti->length);
+		ti->vbr = 1;
+	}
+	free(buf);
+	return result;
+}
+
+/* FLAC stream starting at offset. Returns 1 if STREAMINFO has been found. */
+static int scan_flac(Reader *r, unsigned long offset, TrackInfo *ti)
+{
+	const unsigned char *h = peek(r, offset, 4);
+	long                 file_size = reader_get_file_size(r);
+	int                  last = 0, result = 0;
+
+	if (!h || memcmp(h, "fLaC", 4) != 0) return 0;
+	offset += 4;
+	while (!last && (h = peek(r, offset, 4))) {
+		int                  type = h[0] & 0x7F;
+		unsigned long        size = ((unsigned long)h[1] << 16) | (h[2] << 8) | h[3];
+		const unsigned char *b;
+
+		last = h[0] & 0x80;
+		offset += 4;
+		if (type == 0 && size >= 18 && (b = peek(r, offset, 18))) { /* STREAMINFO */
+			unsigned long long samples = ((unsigned long long)(b[13] & 0x0F) << 32) | get_be32(b + 14);
+
+			ti->samplerate = ((unsigned long)b[10] << 12) | (b[11] << 4) | (b[12] >> 4);
+			ti->channels   = ((b[12] >> 1) & 7) + 1;
+			if (ti->samplerate > 0) ti->length = (size_t)(samples / ti->samplerate);
+			result = 1;
+		} else if (type == 4 && size > 0 && (b = peek(r, offset, size))) { /* VORBIS_COMMENT */
+			parse_vorbis_comment(b, size, ti);
+		}
+		offset += size;
+	}
+	if (result) {
+		strncpy(ti->file_type, "FLAC", SIZE_FILE_TYPE-1);
+		if (ti->length > 0 && file_size > 0)
+			ti->bitrate = (long)((unsigned long long)file_size * 8 / ti->length);
+		ti->vbr = 1;
+	}
+	return result;
+}
+
+typedef struct _MPEGHeader {
+	int version; /* 0: MPEG 1, 1: MPEG 2, 2: MPEG 2.5 */
+	int layer, bitrate, samplerate, channels, samples, frame_size;
+} MPEGHeader;
+
+static const unsigned short mpeg_bitrates[5][15] = {
+	{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 }, /* MPEG 1, layer 1 */
+	{ 0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384 }, /* MPEG 1, layer 2 */
+	{ 0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320 }, /* MPEG 1, layer 3 */
+	{ 0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256 }, /* MPEG 2/2.5, layer 1 */
+	{ 0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160 }  /* MPEG 2/2.5, layer 2/3 */
+};
+
+static int mpeg_parse_header(const unsigned char *h, MPEGHeader *mh)
+{
+	static const int rates[3] = { 44100, 48000, 32000 };
+	int              version = (h[1] >> 3) & 3, layer = 4 - ((h[1] >> 1) & 3);
+	int              bitrate_index = h[2] >> 4, rate_index = (h[2] >> 2) & 3, padding = (h[2] >> 1) & 1;
+	int              table;
+
+	if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0 || version == 1 || layer == 4 ||
+	    bitrate_index == 0 || bitrate_index == 15 || rate_index == 3)
+		return 0;
+	mh->version    = version == 3 ? 0 : (version == 2 ? 1 : 2);
+	mh->layer      = layer;
+	mh->samplerate = rates[rate_index] >> mh->version;
+	mh->channels   = (h[3] >> 6) == 3 ? 1 : 2;
+	table = mh->version == 0 ? layer - 1 : (layer == 1 ? 3 : 4);
+	mh->bitrate = mpeg_bitrates[table][bitrate_index] * 1000;
+	if (layer == 1) {
+		mh->samples    = 384;
+		mh->frame_size = (12 * mh->bitrate / mh->samplerate + padding) * 4;
+	} else {
+		mh->samples    = (layer == 3 && mh->version > 0) ? 576 : 1152;
+		mh->frame_size = mh->samples / 8 * mh->bitrate / mh->samplerate + padding;
+	}
+	return 1;
+}
+
+/* MPEG audio file, optionally tagged. The length is taken from a Xing/Info
+ * or VBRI header, or estimated from the first frame's bitrate. Returns 1 if
+ * a tag or a frame has been found. */
+static int scan_mpeg(Reader *r, const char *filename, TrackInfo *ti)
+{
+	long                 file_size = reader_get_file_size(r);
+	unsigned long        start = 0, end = file_size > 0 ? file_size : 0, size, i;
+	const unsigned char *p;
+	MPEGHeader           mh;
+	int                  found = 0, tagged = id3_read_tag_from_reader(r, filename, ti, "MP3");
+
+	if (!tagged) { /* Look for an APEv2 tag instead, but keep the file name as fallback title */
+		char name[SIZE_TITLE];
+
+		strcpy(name, ti->title);
+		ti->title[0] = '\0';
+		tagged = scan_apev2(r, ti);
+		if (!ti->title[0]) strcpy(ti->title, name);
+	}
+	if ((p = peek(r, 0, 10)) && memcmp(p, "ID3", 3) == 0)
+		start = 10 + ((unsigned long)(p[6] & 0x7F) << 21 | (p[7] & 0x7F) << 14 | (p[8] & 0x7F) << 7 | (p[9] & 0x7F))
+		           + (p[5] & 0x10 ? 10 : 0);
+	if (end >= ID3V1_SIZE && (p = peek(r, end - ID3V1_SIZE, 3)) && memcmp(p, "TAG", 3) == 0)
+		end -= ID3V1_SIZE;
+	if (start + 4 > end) return tagged;
+	size = end - start < MPEG_SYNC_RANGE ? end - start : MPEG_SYNC_RANGE;
+	p = peek(r, start, size);
+	for (i = 0; p && i + 4 <= size; i++) {
+		MPEGHeader next;
+
+		/* Require the next frame to follow, unless it is out of range */
+		if (mpeg_parse_header(p + i, &mh) &&
+		    (i + mh.frame_size + 4 > size || mpeg_parse_header(p + i + mh.frame_size, &next))) {
+			found = 1;
+			break;
+		}
+	}
+	if (found) {
+		const unsigned char *f = p + i;
+		unsigned long        frames = 0, audio_size = end - start - i;
+		unsigned long        xing = 4 + (mh.version == 0 ? (mh.channels == 1 ? 17 : 32) : (mh.channels == 1 ? 9 : 17));
+
+		if (i + xing + 12 <= size && (memcmp(f + xing, "Xing", 4) == 0 || memcmp(f + xing, "Info", 4) == 0)) {
+			if (f[xing + 7] & 1) frames = get_be32(f + xing + 8);
+			ti->vbr = f[xing] == 'X';
+		} else if (i + 36 + 18 <= size && memcmp(f + 36, "VBRI", 4) == 0) {
+			frames = get_be32(f + 36 + 14);
+			ti->vbr = 1;
+		}
+		ti->samplerate = mh.samplerate;
+		ti->channels   = mh.channels;
+		if (frames > 0) {
+			ti->length  = (size_t)((unsigned long long)frames * mh.samples / mh.samplerate);
+			ti->bitrate = ti->length > 0 ? (long)((unsigned long long)audio_size * 8 / ti->length) : mh.bitrate;
+		} else {
+			ti->bitrate = mh.bitrate;
+			ti->length  = (size_t)((unsigned long long)audio_size * 8 / mh.bitrate);
+		}
+	}
+	return tagged || found;
+}
+
+/* Finds the atom of the given type within [offset, end) and returns the
+ * offset and size of its contents */
+static int mp4_find_atom(Reader *r, unsigned long offset, unsigned long end, const char *type,
+                         unsigned long *data_offset, unsigned long *data_size)
+{
+	while (offset + 8 <= end) {
+		const unsigned char *h = peek(r, offset, 8);
+		unsigned long long   size;
+		unsigned long        header = 8;
+		int                  match;
+
+		if (!h) break;
+		size  = get_be32(h);
+		match = memcmp(h + 4, type, 4) == 0;
+		if (size == 1) { /* 64 bit size */
+			if (!(h = peek(r, offset, 16))) break;
+			size   = get_be64(h + 8);
+			header = 16;
+		} else if (size == 0) { /* Extends to the end */
+			size = end - offset;
+		}
+		if (size < header || size > end - offset) break;
+		if (match) {
+			*data_offset = offset + header;
+			*data_size   = (unsigned long)size - header;
+			return 1;
+		}
+		offset += (unsigned long)size;
+	}
+	return 0;
+}
+
+/* Follows a path of nested atoms like "trak/mdia/minf" */
+static int mp4_find_path(Reader *r, unsigned long offset, unsigned long size, const char *path,
+                         unsigned long *data_offset, unsigned long *data_size)
+{
+	for (; *path; path += path[4] == '/' ? 5 : 4) {
+		if (strlen(path) < 4 || !mp4_find_atom(r, offset, offset + size, path, &offset, &size)) return 0;
+	}
+	*data_offset = offset;
+	*data_size   = size;
+	return 1;
+}
+
+static void mp4_parse_ilst(Reader *r, unsigned long offset, unsigned long end, TrackInfo *ti)
+{
+	const unsigned char *p;
+
+	while (offset + 8 <= end && (p = peek(r, offset, 8))) {
+		unsigned long size = get_be32(p), data, data_size;
+		char          type[4];
+
+		if (size < 8 || size > end - offset) break;
+		memcpy(type, p + 4, 4);
+		if (mp4_find_atom(r, offset + 8, offset + size, "data", &data, &data_size) &&
+		    data_size > 8 && (p = peek(r, data + 8, data_size - 8))) {
+			const char *value = (const char *)p;
+			size_t      len = data_size - 8;
+
+			if (memcmp(type, "\251nam", 4) == 0)
+				set_text(ti->title, SIZE_TITLE, value, len);
+			else if (memcmp(type, "\251ART", 4) == 0)
+				set_text(ti->artist, SIZE_ARTIST, value, len);
+			else if (memcmp(type, "\251alb", 4) == 0)
+				set_text(ti->album, SIZE_ALBUM, value, len);
+			else if (memcmp(type, "\251day", 4) == 0)
+				set_text(ti->date, SIZE_DATE, value, len);
+			else if (memcmp(type, "\251cmt", 4) == 0)
+				set_text(ti->comment, SIZE_COMMENT, value, len);
+			else if (memcmp(type, "trkn", 4) == 0 && len >= 4 && !ti->tracknr[0])
+				snprintf(ti->tracknr, SIZE_TRACKNR, "%d", (p[2] << 8) | p[3]);
+		}
+		offset += size;
+	}
+}
+
+static int scan_mp4(Reader *r, TrackInfo *ti)
+{
+	long                 file_size = reader_get_file_size(r);
+	unsigned long        moov, moov_size, offset, size;
+	const unsigned char *p;
+
+	if (file_size <= 0 || !mp4_find_atom(r, 0, file_size, "moov", &moov, &moov_size)) return 0;
+	strncpy(ti->file_type, "MP4", SIZE_FILE_TYPE-1);
+	if (mp4_find_atom(r, moov, moov + moov_size, "mvhd", &offset, &size) && size >= 20 &&
+	    (p = peek(r, offset, size < 32 ? size : 32))) {
+		unsigned long      timescale;
+		unsigned long long duration;
+
+		if (p[0] == 1 && size >= 32) {
+			timescale = get_be32(p + 20);
+			duration  = get_be64(p + 24);
+		} else {
+			timescale = get_be32(p + 12);
+			duration  = get_be32(p + 16);
+		}
+		if (timescale > 0) ti->length = (size_t)(duration / timescale);
+		if (ti->length > 0) ti->bitrate = (long)((unsigned long long)file_size * 8 / ti->length);
+	}
+	/* The first sample description of the first track, skipping the stsd
+	 * header (8 bytes) and the sample entry's atom header (8 bytes) */
+	if (mp4_find_path(r, moov, moov_size, "trak/mdia/minf/stbl/stsd", &offset, &size) &&
+	    size >= 8 + 8 + 28 && (p = peek(r, offset + 16, 28))) {
+		ti->channels   = (p[16] << 8) | p[17];
+		ti->samplerate = (p[24] << 8) | p[25];
+	}
+	if (mp4_find_path(r, moov, moov_size, "udta/meta", &offset, &size) && size >= 4 && (p = peek(r, offset, 4))) {
+		/* In contrast to QuickTime files, the meta atom has version and flags in MP4 files */
+		if (get_be32(p) == 0) {
+			offset += 4;
+			size   -= 4;
+		}
+		if (mp4_find_atom(r, offset, offset + size, "ilst", &offset, &size))
+			mp4_parse_ilst(r, offset, offset + size, ti);
+	}
+	return 1;
+}
+
+int tagscan_read(const char *filename, TrackInfo *ti)
+{
+	Reader              *r;
+	const unsigned char *h;
+	int                  result = 0;
+
+	if (strstr(filename, "://") || !(r = reader_open(filename))) return 0;
+	trackinfo_clear(ti);
+	if ((h = peek(r, 0, 10))) {
+		int           ogg = memcmp(h, "OggS", 4) == 0, flac = memcmp(h, "fLaC", 4) == 0;
+		int           mp4 = memcmp(h + 4, "ftyp", 4) == 0, id3 = memcmp(h, "ID3", 3) == 0;
+		int           sync = h[0] == 0xFF && (h[1] & 0xE0) == 0xE0;
+		unsigned long id3_size = 10 + ((unsigned long)(h[6] & 0x7F) << 21 | (h[7] & 0x7F) << 14 |
+		                               (h[8] & 0x7F) << 7 | (h[9] & 0x7F)) + (h[5] & 0x10 ? 10 : 0);
+
+		if (ogg)
+			result = scan_ogg(r, ti);
+		else if (flac || (id3 && scan_flac(r, id3_size, ti))) /* FLAC files might start with an ID3 tag */
+			result = flac ? scan_flac(r, 0, ti) : 1;
+		else if (mp4)
+			result = scan_mp4(r, ti);
+		else if (id3 || sync)
+			result = scan_mpeg(r, filename, ti);
+		else
+			result = scan_apev2(r, ti);
+	}
+	if (result) {
+		ti->file_size = reader_get_file_size(r);
+		trackinfo_set_updated(ti);
+		wdprintf(V_DEBUG, "tagscan", "%s: %s, %lu s\n", filename, ti->file_type, (unsigned long)ti->length);
+	}
+	reader_close(r);
+	return result;
+}
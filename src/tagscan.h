@@ -0,0 +1,28 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: tagscan.h  Created: 261016
+ *
+ * Description: Built-in tag and stream header parsers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#ifndef _TAGSCAN_H
+#define _TAGSCAN_H
+#include "trackinfo.h"
+
+/*
+ * Reads tags and stream properties (length, sample rate, channels) of
+ * local Ogg Vorbis/Opus, FLAC, MP3 and MP4 files, and APEv2 tags of other
+ * files, without involving a decoder. Only the headers and tags are read.
+ * Text is stored as UTF-8. Returns 1 if the file has been recognized,
+ * 0 otherwise, in which case the decoder has to be asked.
+ */
+int tagscan_read(const char *filename, TrackInfo *ti);
+#endif
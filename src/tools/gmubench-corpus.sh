@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Gmu Music Player
+#
+# Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+#
+# File: gmubench-corpus.sh  Created: 261016
+#
+# Description: Generates a synthetic benchmark corpus for gmu-bench.
+# The WAV files written by gmu-bench are encoded to every format an
+# encoder is available for locally, so the corpus can be rebuilt offline.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; version 2 of
+# the License. See the file COPYING in the Gmu's main directory
+# for details.
+#
+
+if [ "$1" = "" ]; then
+	echo "Usage: $0 <corpus dir> [seconds per file] [path to gmu-bench]"
+	exit 1
+fi
+
+corpus=$1
+seconds=${2:-30}
+bench=${3:-./gmu-bench}
+
+have()
+{
+	which "$1" >/dev/null 2>&1
+}
+
+if ! "$bench" -g "$corpus" -t "$seconds"; then
+	echo "Failed to generate WAV files."
+	exit 1
+fi
+
+for wav in "$corpus"/*.wav; do
+	base=${wav%.wav}
+	title=$(basename "$base")
+	echo "Encoding $title..."
+	have flac     && flac -s -f -8 -T "TITLE=$title" -T "ARTIST=gmu-bench" -o "$base.flac" "$wav"
+	have lame     && lame --quiet -V 2 --tt "$title" --ta "gmu-bench" "$wav" "$base.mp3"
+	have oggenc   && oggenc -Q -q 5 -t "$title" -a "gmu-bench" -o "$base.ogg" "$wav"
+	have opusenc  && opusenc --quiet --bitrate 128 --title "$title" --artist "gmu-bench" "$wav" "$base.opus"
+	have wavpack  && wavpack -q -y "$wav" -o "$base.wv"
+	have mpcenc   && mpcenc --silent --overwrite --standard --tag "Title=$title" "$wav" "$base.mpc"
+	have speexenc && speexenc --quiet --title "$title" "$wav" "$base.spx"
+done
+echo "Corpus ready in $corpus"
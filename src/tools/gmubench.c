@@ -0,0 +1,473 @@
+/*
+ * Gmu Music Player
+ *
+ * Copyright (c) 2006-2021 Johannes Heimansberg (wej.k.vu)
+ *
+ * File: gmubench.c  Created: 261016
+ *
+ * Description: Decoder throughput benchmark
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of
+ * the License. See the file COPYING in the Gmu's main directory
+ * for details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "../decloader.h"
+#include "../gmudecoder.h"
+#include "../reader.h"
+#include "../util.h"
+#include "../debug.h"
+
+#define BUF_SIZE       65536
+#define MAX_PATH_LEN   1024
+#define DEFAULT_SEEKS  5
+
+typedef struct _BenchResult {
+	char      decoder[64];
+	char      file[MAX_PATH_LEN];
+	int       ok;
+	int       samplerate, channels, length;
+	long      file_size;
+	long long pcm_bytes;
+	double    open_ms, meta_ms;
+	double    decode_s, cpu_s, audio_s;
+	double    seek_avg_ms, seek_max_ms;
+	int       seeks;
+	long      peak_rss_kb;
+} BenchResult;
+
+static BenchResult *results;
+static size_t       results_num, results_size;
+
+static double time_now(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Resets the peak RSS of the process (Linux >= 4.0), so it can be measured per file */
+static void peak_rss_reset(void)
+{
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+	if (f) {
+		fputs("5", f);
+		fclose(f);
+	}
+}
+
+static long peak_rss_get_kb(void)
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	long  res = -1;
+
+	if (f) {
+		char line[256];
+		while (res < 0 && fgets(line, 255, f))
+			if (strncmp(line, "VmHWM:", 6) == 0) res = atol(line + 6);
+		fclose(f);
+	}
+	if (res < 0) {
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF, &ru) == 0) res = ru.ru_maxrss;
+	}
+	return res;
+}
+
+static BenchResult *result_new(void)
+{
+	BenchResult *br = NULL;
+
+	if (results_num == results_size) {
+		size_t       size = results_size ? results_size * 2 : 64;
+		BenchResult *tmp = realloc(results, size * sizeof(BenchResult));
+		if (tmp) {
+			results = tmp;
+			results_size = size;
+		}
+	}
+	if (results_num < results_size) {
+		br = &results[results_num++];
+		memset(br, 0, sizeof(BenchResult));
+	}
+	return br;
+}
+
+static void set_reader(GmuDecoderV2 *gd, GmuDecoderInstance *di, const char *file)
+{
+	if (gd->set_reader_handle) {
+		Reader *r = reader_open(file);
+		if (r) reader_read_bytes(r, 4096);
+		(*gd->set_reader_handle)(di, r);
+	}
+}
+
+static void bench_meta_data(GmuDecoderV2 *gd, const char *file, BenchResult *br)
+{
+	GmuDecoderInstance *di;
+
+	br->meta_ms = -1.0;
+	if (gd->meta_data_load && (di = decloader_instance_create(gd))) {
+		double t = time_now(CLOCK_MONOTONIC);
+		if ((*gd->meta_data_load)(di, file))
+			br->meta_ms = (time_now(CLOCK_MONOTONIC) - t) * 1000.0;
+		(*gd->close_file)(di);
+		decloader_instance_destroy(gd, di);
+	}
+}
+
+/* Measures the time for seeking and decoding the first chunk after the seek */
+static void bench_seek(GmuDecoderV2 *gd, GmuDecoderInstance *di, int seeks, char *buf, BenchResult *br)
+{
+	int i;
+
+	for (i = 1; i <= seeks && gd->seek && br->length > 0; i++) {
+		double t = time_now(CLOCK_MONOTONIC), ms;
+
+		if ((*gd->seek)(di, br->length * i / (seeks + 1))) {
+			(*gd->decode_data)(di, buf, BUF_SIZE);
+			ms = (time_now(CLOCK_MONOTONIC) - t) * 1000.0;
+			br->seek_avg_ms += ms;
+			if (ms > br->seek_max_ms) br->seek_max_ms = ms;
+			br->seeks++;
+		}
+	}
+	if (br->seeks > 0) br->seek_avg_ms /= br->seeks;
+}
+
+static void bench_file(GmuDecoderV2 *gd, const char *file, double max_seconds, int seeks)
+{
+	static char         buf[BUF_SIZE];
+	BenchResult        *br = result_new();
+	GmuDecoderInstance *di;
+	struct stat         st;
+
+	if (!br) return;
+	snprintf(br->decoder, sizeof(br->decoder), "%s", gd->identifier);
+	snprintf(br->file, MAX_PATH_LEN, "%s", file);
+	br->file_size = stat(file, &st) == 0 ? (long)st.st_size : -1;
+	peak_rss_reset();
+
+	bench_meta_data(gd, file, br);
+
+	if ((di = decloader_instance_create(gd))) {
+		double t = time_now(CLOCK_MONOTONIC), c;
+
+		set_reader(gd, di, file);
+		if ((*gd->open_file)(di, file)) {
+			long long limit;
+			int       ret;
+
+			br->open_ms    = (time_now(CLOCK_MONOTONIC) - t) * 1000.0;
+			br->samplerate = gd->get_samplerate ? (*gd->get_samplerate)(di) : 44100;
+			br->channels   = gd->get_channels ? (*gd->get_channels)(di) : 2;
+			br->length     = gd->get_length ? (*gd->get_length)(di) : 0;
+			limit = max_seconds > 0.0 ? (long long)(max_seconds * br->samplerate * br->channels * 2) : -1;
+
+			t = time_now(CLOCK_MONOTONIC);
+			c = time_now(CLOCK_PROCESS_CPUTIME_ID);
+			while ((ret = (*gd->decode_data)(di, buf, BUF_SIZE)) > 0) {
+				br->pcm_bytes += ret;
+				if (limit >= 0 && br->pcm_bytes >= limit) break;
+			}
+			br->decode_s = time_now(CLOCK_MONOTONIC) - t;
+			br->cpu_s    = time_now(CLOCK_PROCESS_CPUTIME_ID) - c;
+			if (br->samplerate > 0 && br->channels > 0)
+				br->audio_s = (double)br->pcm_bytes / (br->samplerate * br->channels * 2);
+			br->ok = ret >= 0 && br->pcm_bytes > 0;
+
+			bench_seek(gd, di, seeks, buf, br);
+			(*gd->close_file)(di);
+		} else {
+			wdprintf(V_WARNING, "gmubench", "%s: Unable to open %s\n", gd->identifier, file);
+			(*gd->close_file)(di);
+		}
+		decloader_instance_destroy(gd, di);
+	}
+	br->peak_rss_kb = peak_rss_get_kb();
+}
+
+static void scan_directory(const char *path, double max_seconds, int seeks)
+{
+	DIR           *dir = opendir(path);
+	struct dirent *de;
+
+	if (!dir) {
+		wdprintf(V_ERROR, "gmubench", "Unable to open directory %s\n", path);
+		return;
+	}
+	while ((de = readdir(dir))) {
+		char        file[MAX_PATH_LEN];
+		struct stat st;
+
+		if (de->d_name[0] == '.') continue;
+		snprintf(file, MAX_PATH_LEN, "%s/%s", path, de->d_name);
+		if (stat(file, &st) != 0) continue;
+		if (S_ISDIR(st.st_mode)) {
+			scan_directory(file, max_seconds, seeks);
+		} else if (S_ISREG(st.st_mode)) {
+			const char   *ext = get_file_extension(file);
+			GmuDecoderV2 *gd = ext ? decloader_get_decoder_for_extension(ext) : NULL;
+
+			if (gd) {
+				wdprintf(V_INFO, "gmubench", "%s: %s\n", gd->identifier, file);
+				bench_file(gd, file, max_seconds, seeks);
+			} else {
+				wdprintf(V_DEBUG, "gmubench", "No decoder for %s\n", file);
+			}
+		}
+	}
+	closedir(dir);
+}
+
+static double rtf(BenchResult *br)
+{
+	return br->decode_s > 0.0 ? br->audio_s / br->decode_s : 0.0;
+}
+
+static void print_table(FILE *out)
+{
+	size_t i;
+
+	fprintf(out, "%-16s %-32s %8s %8s %10s %8s %8s %8s %8s %9s\n",
+	        "decoder", "file", "audio s", "RTF", "PCM KB/s", "CPU %", "open ms",
+	        "meta ms", "seek ms", "peak KB");
+	for (i = 0; i < results_num; i++) {
+		BenchResult *br = &results[i];
+		const char  *name = strrchr(br->file, '/');
+
+		name = name ? name + 1 : br->file;
+		if (!br->ok) {
+			fprintf(out, "%-16.16s %-32.32s %8s\n", br->decoder, name, "FAILED");
+			continue;
+		}
+		fprintf(out, "%-16.16s %-32.32s %8.1f %8.1f %10.0f %8.1f %8.2f %8.2f %8.2f %9ld\n",
+		        br->decoder, name, br->audio_s, rtf(br),
+		        br->decode_s > 0.0 ? br->pcm_bytes / br->decode_s / 1024.0 : 0.0,
+		        br->decode_s > 0.0 ? br->cpu_s / br->decode_s * 100.0 : 0.0,
+		        br->open_ms, br->meta_ms, br->seek_avg_ms, br->peak_rss_kb);
+	}
+}
+
+static void print_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+static void print_json(FILE *out)
+{
+	size_t i;
+
+	fprintf(out, "{\n  \"results\": [");
+	for (i = 0; i < results_num; i++) {
+		BenchResult *br = &results[i];
+
+		fprintf(out, "%s\n    { \"decoder\": ", i > 0 ? "," : "");
+		print_json_string(out, br->decoder);
+		fprintf(out, ", \"file\": ");
+		print_json_string(out, br->file);
+		fprintf(out, ", \"ok\": %s, \"file_size\": %ld, \"samplerate\": %d, \"channels\": %d, \"length_s\": %d, "
+		        "\"pcm_bytes\": %lld, \"audio_s\": %.3f, \"decode_s\": %.6f, \"cpu_s\": %.6f, "
+		        "\"realtime_factor\": %.2f, \"pcm_bytes_per_s\": %.0f, \"input_bytes_per_s\": %.0f, "
+		        "\"open_ms\": %.3f, \"meta_data_load_ms\": %.3f, \"seeks\": %d, "
+		        "\"seek_avg_ms\": %.3f, \"seek_max_ms\": %.3f, \"peak_rss_kb\": %ld }",
+		        br->ok ? "true" : "false", br->file_size, br->samplerate, br->channels, br->length,
+		        br->pcm_bytes, br->audio_s, br->decode_s, br->cpu_s, rtf(br),
+		        br->decode_s > 0.0 ? br->pcm_bytes / br->decode_s : 0.0,
+		        br->decode_s > 0.0 && br->length > 0 && br->audio_s > 0.0 ?
+		            br->file_size * (br->audio_s / br->length) / br->decode_s : 0.0,
+		        br->open_ms, br->meta_ms, br->seeks, br->seek_avg_ms, br->seek_max_ms, br->peak_rss_kb);
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
+
+static void put_le(unsigned char *p, unsigned long value, int bytes)
+{
+	int i;
+	for (i = 0; i < bytes; i++, value >>= 8) p[i] = (unsigned char)(value & 0xff);
+}
+
+static int write_wav(const char *file, int samplerate, int channels, int seconds, int type)
+{
+	FILE          *f = fopen(file, "wb");
+	unsigned char  h[44];
+	unsigned long  data_size = (unsigned long)samplerate * channels * 2 * seconds, i, frames;
+	unsigned long  seed = 12345;
+	int            res = 0;
+
+	if (f) {
+		memcpy(h, "RIFF", 4);
+		put_le(h + 4, data_size + 36, 4);
+		memcpy(h + 8, "WAVEfmt ", 8);
+		put_le(h + 16, 16, 4);                        /* fmt chunk size */
+		put_le(h + 20, 1, 2);                         /* PCM */
+		put_le(h + 22, channels, 2);
+		put_le(h + 24, samplerate, 4);
+		put_le(h + 28, samplerate * channels * 2, 4); /* Bytes per second */
+		put_le(h + 32, channels * 2, 2);              /* Block align */
+		put_le(h + 34, 16, 2);                        /* Bits per sample */
+		memcpy(h + 36, "data", 4);
+		put_le(h + 40, data_size, 4);
+		fwrite(h, 1, 44, f);
+
+		frames = (unsigned long)samplerate * seconds;
+		for (i = 0; i < frames; i++) {
+			double t = (double)i / samplerate, v;
+			int    c;
+
+			for (c = 0; c < channels; c++) {
+				unsigned char s[2];
+
+				switch (type) {
+					case 0: /* Sine tone, slightly detuned between channels */
+						v = 0.5 * sin(2.0 * M_PI * (440.0 + c * 2.0) * t);
+						break;
+					case 1: /* Logarithmic sweep from 20 Hz to 20 kHz */
+						v = 0.5 * sin(2.0 * M_PI * 20.0 * seconds / log(1000.0) * (pow(1000.0, t / seconds) - 1.0));
+						break;
+					default: /* White noise (deterministic) */
+						seed = seed * 1103515245UL + 12345UL;
+						v = ((double)((seed >> 16) & 0x7fff) / 16384.0 - 1.0) * 0.3;
+						break;
+				}
+				put_le(s, (unsigned long)(long)(v * 32767.0), 2);
+				fwrite(s, 1, 2, f);
+			}
+		}
+		res = !ferror(f);
+		fclose(f);
+	}
+	if (!res) wdprintf(V_ERROR, "gmubench", "Unable to write %s\n", file);
+	return res;
+}
+
+/* Writes a reproducible set of WAV files, which can be encoded to other formats */
+static int generate_corpus(const char *path, int seconds)
+{
+	static const struct { const char *name; int samplerate, channels, type; } files[] = {
+		{ "sine-44100-stereo",  44100, 2, 0 },
+		{ "sweep-48000-stereo", 48000, 2, 1 },
+		{ "noise-44100-stereo", 44100, 2, 2 },
+		{ "sine-22050-mono",    22050, 1, 0 },
+		{ NULL, 0, 0, 0 }
+	};
+	int i, res = 1;
+
+	mkdir(path, 0755);
+	for (i = 0; files[i].name && res; i++) {
+		char file[MAX_PATH_LEN];
+
+		snprintf(file, MAX_PATH_LEN, "%s/%s.wav", path, files[i].name);
+		wdprintf(V_INFO, "gmubench", "Writing %s\n", file);
+		res = write_wav(file, files[i].samplerate, files[i].channels, seconds, files[i].type);
+	}
+	return res;
+}
+
+static void print_cmd_help(const char *prog_name)
+{
+	printf("Gmu decoder benchmark\n");
+	printf("Usage: %s [-d decoder_dir] [-j file.json] [-t seconds] [-s seeks] [-v 0..5] corpus_dir\n", prog_name);
+	printf("       %s -g corpus_dir [-t seconds]\n", prog_name);
+	printf("-d dir  : Directory with decoder plugins (default: ./decoders)\n");
+	printf("-j file : Write results as JSON to file (\"-\" for stdout)\n");
+	printf("-t sec  : Decode at most sec seconds of each file (default: all);\n");
+	printf("          with -g: length of the generated files (default: 30)\n");
+	printf("-s n    : Number of seeks per file (default: %d)\n", DEFAULT_SEEKS);
+	printf("-q      : Do not print the result table\n");
+	printf("-g      : Generate a synthetic WAV corpus in corpus_dir\n");
+	printf("-v n    : Verbosity (default: 2)\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *decoder_dir = "./decoders", *json_file = NULL, *corpus_dir = NULL;
+	double      max_seconds = 0.0;
+	int         seeks = DEFAULT_SEEKS, quiet = 0, generate = 0, i;
+	Verbosity   v = V_ERROR;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			switch (argv[i][1]) {
+				case 'd':
+					if (i + 1 < argc) decoder_dir = argv[++i];
+					break;
+				case 'j':
+					if (i + 1 < argc) json_file = argv[++i];
+					break;
+				case 't':
+					if (i + 1 < argc) max_seconds = atof(argv[++i]);
+					break;
+				case 's':
+					if (i + 1 < argc) seeks = atoi(argv[++i]);
+					break;
+				case 'v':
+					if (i + 1 < argc) v = atoi(argv[++i]);
+					break;
+				case 'q':
+					quiet = 1;
+					break;
+				case 'g':
+					generate = 1;
+					break;
+				default:
+					print_cmd_help(argv[0]);
+					exit(argv[i][1] == 'h' ? 0 : 1);
+					break;
+			}
+		} else {
+			corpus_dir = argv[i];
+		}
+	}
+	if (!corpus_dir) {
+		print_cmd_help(argv[0]);
+		exit(1);
+	}
+	wdprintf_set_verbosity(v);
+
+	if (generate)
+		return generate_corpus(corpus_dir, max_seconds > 0.0 ? (int)max_seconds : 30) ? 0 : 1;
+
+#if STATIC
+	decloader_load_builtin_decoders();
+#else
+	if (decloader_load_all(decoder_dir) <= 0) {
+		wdprintf(V_ERROR, "gmubench", "No decoders found in %s\n", decoder_dir);
+		exit(1);
+	}
+#endif
+	scan_directory(corpus_dir, max_seconds, seeks);
+
+	if (!quiet) print_table(stdout);
+	if (json_file) {
+		FILE *out = strcmp(json_file, "-") == 0 ? stdout : fopen(json_file, "w");
+		if (out) {
+			print_json(out);
+			if (out != stdout) fclose(out);
+		} else {
+			wdprintf(V_ERROR, "gmubench", "Unable to write %s\n", json_file);
+		}
+	}
+	decloader_free();
+	free(results);
+	return 0;
+}
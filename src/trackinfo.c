@@ -16,11 +16,61 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "trackinfo.h"
 #include "charset.h"
 #include "debug.h"
 #include <pthread.h>
 
+static void image_free(Image *image)
+{
+	if (image->map)
+		munmap(image->map, image->map_size);
+	else if (image->data)
+		free(image->data);
+	image->data = NULL;
+	image->data_size = 0;
+	image->mime_type[0] = '\0';
+	image->file[0] = '\0';
+	image->offset = 0;
+	image->map = NULL;
+	image->map_size = 0;
+}
+
+/* Loads a referenced image by mapping its part of the file, or by reading
+ * it if the file cannot be mapped. Returns 1 on success, 0 otherwise. */
+static int image_load(Image *image)
+{
+	int         fd = open(image->file, O_RDONLY);
+	long        page_size = sysconf(_SC_PAGESIZE);
+	size_t      skip = page_size > 0 ? image->offset % page_size : 0;
+	struct stat st;
+
+	if (fd < 0) return 0;
+	/* The file might have changed since the image has been found */
+	if (image->data_size > 0 && fstat(fd, &st) == 0 &&
+	    (unsigned long long)image->offset + image->data_size <= (unsigned long long)st.st_size) {
+		void *map = mmap(NULL, skip + image->data_size, PROT_READ, MAP_PRIVATE, fd, image->offset - skip);
+
+		if (map != MAP_FAILED) {
+			image->map      = map;
+			image->map_size = skip + image->data_size;
+			image->data     = image->map + skip;
+		} else if ((image->data = malloc(image->data_size))) {
+			ssize_t n = pread(fd, image->data, image->data_size, image->offset);
+			if (n < 0 || n != (ssize_t)image->data_size) {
+				free(image->data);
+				image->data = NULL;
+			}
+		}
+	}
+	close(fd);
+	return image->data != NULL;
+}
+
 void trackinfo_set(
 	TrackInfo  *ti,
 	const char *artist,
@@ -87,6 +137,10 @@ void trackinfo_init(TrackInfo *ti, int with_locking)
 	ti->image.data = NULL;
 	ti->image.data_size = 0;
 	ti->image.mime_type[0] = '\0';
+	ti->image.file[0] = '\0';
+	ti->image.offset = 0;
+	ti->image.map = NULL;
+	ti->image.map_size = 0;
 	ti->updated = 0;
 	ti->with_locking = with_locking;
 	if (with_locking) {
@@ -121,10 +175,7 @@ void trackinfo_clear(TrackInfo *ti)
 	ti->length = 0;
 	ti->file_size = 0;
 	ti->has_lyrics = 0;
-	if (ti->image.data != NULL) free(ti->image.data);
-	ti->image.data = NULL;
-	ti->image.data_size = 0;
-	ti->image.mime_type[0] = '\0';
+	image_free(&(ti->image));
 	ti->updated = 0;
 }
 
@@ -135,6 +186,7 @@ void trackinfo_set_image(
 	const char *mime_type
 )
 {
+	image_free(&(ti->image));
 	if ((ti->image.data = malloc(image_data_size)) != NULL) {
 		strncpy(ti->image.mime_type, mime_type, SIZE_MIME_TYPE);
 		ti->image.mime_type[SIZE_MIME_TYPE-1] = '\0';
@@ -144,11 +196,49 @@ void trackinfo_set_image(
 	}
 }
 
+int trackinfo_set_image_reference(
+	TrackInfo    *ti,
+	const char   *file,
+	unsigned long offset,
+	size_t        image_data_size,
+	const char   *mime_type
+)
+{
+	if (strlen(file) >= SIZE_FILE_NAME) return 0;
+	image_free(&(ti->image));
+	strcpy(ti->image.file, file);
+	ti->image.offset = offset;
+	ti->image.data_size = image_data_size;
+	strncpy(ti->image.mime_type, mime_type, SIZE_MIME_TYPE);
+	ti->image.mime_type[SIZE_MIME_TYPE-1] = '\0';
+	ti->updated = 1;
+	return 1;
+}
+
+int trackinfo_has_image(TrackInfo *ti)
+{
+	return ti->image.data != NULL || ti->image.file[0] != '\0';
+}
+
 char *trackinfo_get_image_data(TrackInfo *ti)
 {
+	if (!ti->image.data && ti->image.file[0] && !image_load(&(ti->image))) {
+		wdprintf(V_WARNING, "trackinfo", "Unable to load image from %s.\n", ti->image.file);
+		image_free(&(ti->image));
+	}
 	return ti->image.data;
 }
 
+char *trackinfo_get_image_file(TrackInfo *ti)
+{
+	return ti->image.file[0] ? ti->image.file : NULL;
+}
+
+unsigned long trackinfo_get_image_offset(TrackInfo *ti)
+{
+	return ti->image.offset;
+}
+
 int trackinfo_get_image_data_size(TrackInfo *ti)
 {
 	return ti->image.data_size;
@@ -342,7 +432,7 @@ int trackinfo_release_lock(TrackInfo *ti)
 }
 
 /* Copies the content of a TrackInfo object */
-int trackinfo_copy(TrackInfo *dest, TrackInfo *src)
+int trackinfo_copy_text(TrackInfo *dest, TrackInfo *src)
 {
 	int res = 0;
 	strncpy(dest->artist, src->artist, SIZE_ARTIST);
@@ -354,7 +444,6 @@ int trackinfo_copy(TrackInfo *dest, TrackInfo *src)
 	strncpy(dest->file_name, src->file_name, SIZE_FILE_NAME);
 	strncpy(dest->tracknr, src->tracknr, SIZE_TRACKNR);
 	strncpy(dest->lyrics, src->lyrics, SIZE_LYRICS);
-	dest->image = src->image;
 	dest->bitrate = src->bitrate;
 	dest->recent_bitrate = src->recent_bitrate;
 	dest->samplerate = src->samplerate;
@@ -368,3 +457,24 @@ int trackinfo_copy(TrackInfo *dest, TrackInfo *src)
 	dest->id = src->id;
 	return res;
 }
+
+int trackinfo_copy(TrackInfo *dest, TrackInfo *src)
+{
+	int res = trackinfo_copy_text(dest, src);
+	/* The copy never shares the source's buffer or mapping; a referenced
+	 * image is loaded again by the copy when needed */
+	image_free(&(dest->image));
+	if (src->image.file[0]) {
+		strncpy(dest->image.file, src->image.file, SIZE_FILE_NAME);
+		dest->image.offset = src->image.offset;
+		dest->image.data_size = src->image.data_size;
+	} else if (src->image.data && src->image.data_size > 0) {
+		dest->image.data = malloc(src->image.data_size);
+		if (dest->image.data) {
+			memcpy(dest->image.data, src->image.data, src->image.data_size);
+			dest->image.data_size = src->image.data_size;
+		}
+	}
+	strncpy(dest->image.mime_type, src->image.mime_type, SIZE_MIME_TYPE);
+	return res;
+}
@@ -30,9 +30,15 @@
 
 typedef struct Image
 {
-	char *data;
-	int   data_size;
-	char  mime_type[SIZE_MIME_TYPE];
+	char          *data;
+	int            data_size;
+	char           mime_type[SIZE_MIME_TYPE];
+	/* Embedded images are only loaded when their data is requested. Until
+	 * then, data is NULL and the image is stored at offset in file. */
+	char           file[SIZE_FILE_NAME];
+	unsigned long  offset;
+	char          *map; /* Mapping containing data, if mapped */
+	size_t         map_size;
 } Image;
 
 struct _TrackInfo
@@ -104,6 +110,15 @@ void  trackinfo_set_image(
 	size_t      image_data_size,
 	const char *mime_type
 );
+/* Records the position of an image embedded in a local file without
+ * loading it. Returns 0 if the file name is too long to be stored. */
+int   trackinfo_set_image_reference(
+	TrackInfo    *ti,
+	const char   *file,
+	unsigned long offset,
+	size_t        image_data_size,
+	const char   *mime_type
+);
 int   trackinfo_is_vbr(TrackInfo *ti);
 int   trackinfo_has_cover_artwork(TrackInfo *ti);
 int   trackinfo_get_length_minutes(TrackInfo *ti);
@@ -111,15 +126,25 @@ int   trackinfo_get_length_seconds(TrackInfo *ti);
 int   trackinfo_load_lyrics_from_file(TrackInfo *ti, const char *file_name);
 int   trackinfo_is_updated(TrackInfo *ti);
 void  trackinfo_set_updated(TrackInfo *ti);
+int   trackinfo_has_image(TrackInfo *ti);
+/* Returns the image data, loading a referenced image first. Returns NULL
+ * if there is no image or it cannot be loaded. The data might be mapped
+ * read-only and must not be modified. */
 char *trackinfo_get_image_data(TrackInfo *ti);
 int   trackinfo_get_image_data_size(TrackInfo *ti);
 char *trackinfo_get_image_mime_type(TrackInfo *ti);
+/* Returns the file containing the image, or NULL if the image is not
+ * referenced, but has been stored in memory */
+char *trackinfo_get_image_file(TrackInfo *ti);
+unsigned long trackinfo_get_image_offset(TrackInfo *ti);
 /* The locking/unlocking functions return 1 on success and 0 otherwise.
  * The functions can fail either because of an error inside of the
  * pthread library or because the TrackInfo object has not been
  * initialized with locking enabled. */
 int   trackinfo_acquire_lock(TrackInfo *ti);
 int   trackinfo_release_lock(TrackInfo *ti);
-/* Copies the content of a TrackInfo object */
+/* Copies the content of a TrackInfo object. trackinfo_copy_text() copies
+ * everything but the image, so no image data gets duplicated. */
 int   trackinfo_copy(TrackInfo *dest, TrackInfo *src);
+int   trackinfo_copy_text(TrackInfo *dest, TrackInfo *src);
 #endif